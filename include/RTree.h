@@ -9,6 +9,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include <QAtomicInt>
+
 #define ASSERT assert // RTree uses ASSERT( condition )
 #ifndef Min
   #define Min qMin
@@ -47,6 +49,11 @@ class RTFileStream;  // File I/O helper class, look below for implementation and
 ///        Instead of using a callback function for returned results, I recommend and efficient pre-sized, grow-only memory
 ///        array similar to MFC CArray or STL Vector for returning search query result.
 ///
+/// Nodes are reference counted and copied on write: a Snapshot keeps the tree as it was when taken,
+/// and later edits copy the nodes they would change instead of modifying them in place.
+/// Snapshots can be searched from other threads while the tree is edited; the tree itself,
+/// and the taking of snapshots, must stay on one thread.
+///
 template<class DATATYPE, class ELEMTYPE, int NUMDIMS,
          class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8, int TMINNODES = TMAXNODES / 2>
 class RTree
@@ -95,6 +102,63 @@ public:
   /// Remove all entries from tree
   void RemoveAll();
 
+  /// Read only view of the tree as it was when taken
+  class Snapshot
+  {
+  public:
+    Snapshot() : m_root(NULL)                     { }
+    Snapshot(const Snapshot& a_other) : m_root(a_other.m_root) { if(m_root) m_root->m_ref.ref(); }
+    ~Snapshot()                                   { Release(); }
+
+    Snapshot& operator=(const Snapshot& a_other)
+    {
+      if(a_other.m_root)
+      {
+        a_other.m_root->m_ref.ref();
+      }
+      Release();
+      m_root = a_other.m_root;
+      return *this;
+    }
+
+    bool IsNull() const                           { return !m_root; }
+
+    /// Find all within search rectangle, as RTree::Search
+    int Search(const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], bool a_resultCallback(DATATYPE a_data, void* a_context), void* a_context) const
+    {
+      if(!m_root)
+      {
+        return 0;
+      }
+      Rect rect;
+      for(int axis=0; axis<NUMDIMS; ++axis)
+      {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+      }
+      int foundCount = 0;
+      RTree::Search(m_root, &rect, foundCount, a_resultCallback, a_context);
+      return foundCount;
+    }
+
+  private:
+    void Release()                                { if(m_root) RTree::ReleaseNode(m_root); m_root = NULL; }
+
+    Node* m_root;
+
+    friend class RTree;
+  };
+
+  /// Take a snapshot of the current content. This is O(1); the cost is paid by the edits
+  /// made while the snapshot is alive, which copy the nodes on their path.
+  Snapshot GetSnapshot()
+  {
+    Snapshot snapshot;
+    m_root->m_ref.ref();
+    snapshot.m_root = m_root;
+    return snapshot;
+  }
+
   /// Count the data elements in this container.  This is slow as no internal counter is maintained.
   int Count();
 
@@ -300,6 +364,7 @@ protected:
 
     int m_count;                                  ///< Count
     int m_level;                                  ///< Leaf is zero, others positive
+    QAtomicInt m_ref;                             ///< Parents, trees and snapshots pointing to this node
     Branch m_branch[MAXNODES];                    ///< Branch
   };
 
@@ -328,7 +393,9 @@ protected:
   };
 
   Node* AllocNode();
-  void FreeNode(Node* a_node);
+  static void FreeNode(Node* a_node);
+  static void ReleaseNode(Node* a_node);
+  void Detach(Node** a_node);
   void InitNode(Node* a_node);
   void InitRect(Rect* a_rect);
   bool InsertRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node, Node** a_newNode, int a_level);
@@ -350,12 +417,12 @@ protected:
   void Classify(int a_index, int a_group, PartitionVars* a_parVars);
   bool RemoveRect(Rect* a_rect, const DATATYPE& a_id, Node** a_root);
   bool RemoveRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node, ListNode** a_listNode);
+  bool FindRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node);
   ListNode* AllocListNode();
   void FreeListNode(ListNode* a_listNode);
-  bool Overlap(Rect* a_rectA, Rect* a_rectB);
+  static bool Overlap(Rect* a_rectA, Rect* a_rectB);
   void ReInsert(Node* a_node, ListNode** a_listNode);
-  bool Search(Node* a_node, Rect* a_rect, int& a_foundCount, bool a_resultCallback(DATATYPE a_data, void* a_context), void* a_context);
-  void RemoveAllRec(Node* a_node);
+  static bool Search(Node* a_node, Rect* a_rect, int& a_foundCount, bool a_resultCallback(DATATYPE a_data, void* a_context), void* a_context);
   void Reset();
   void CountRec(Node* a_node, int& a_count);
 
@@ -777,8 +844,8 @@ RTREE_TEMPLATE
 void RTREE_QUAL::Reset()
 {
 #ifdef RTREE_DONT_USE_MEMPOOLS
-  // Delete all existing nodes
-  RemoveAllRec(m_root);
+  // Delete all existing nodes, except those still held by a snapshot
+  ReleaseNode(m_root);
 #else // RTREE_DONT_USE_MEMPOOLS
   // Just reset memory pools.  We are not using complex types
   // EXAMPLE
@@ -786,23 +853,56 @@ void RTREE_QUAL::Reset()
 }
 
 
+// Drop one reference to a node, and free it with the subtree it alone holds when it was the last.
 RTREE_TEMPLATE
-void RTREE_QUAL::RemoveAllRec(Node* a_node)
+void RTREE_QUAL::ReleaseNode(Node* a_node)
 {
   ASSERT(a_node);
-  ASSERT(a_node->m_level >= 0);
 
+  if(a_node->m_ref.deref())
+  {
+    return;
+  }
   if(a_node->IsInternalNode()) // This is an internal node in the tree
   {
     for(int index=0; index < a_node->m_count; ++index)
     {
-      RemoveAllRec(a_node->m_branch[index].m_child);
+      ReleaseNode(a_node->m_branch[index].m_child);
     }
   }
   FreeNode(a_node);
 }
 
 
+// Make the node pointed to writable: if a snapshot shares it, replace it with a copy
+// that shares its children instead.
+RTREE_TEMPLATE
+void RTREE_QUAL::Detach(Node** a_node)
+{
+  ASSERT(a_node && *a_node);
+
+  Node* node = *a_node;
+  if(node->m_ref.testAndSetAcquire(1, 1))
+  {
+    return;
+  }
+
+  Node* copy = AllocNode();
+  copy->m_count = node->m_count;
+  copy->m_level = node->m_level;
+  for(int index=0; index < node->m_count; ++index)
+  {
+    copy->m_branch[index] = node->m_branch[index];
+    if(node->IsInternalNode())
+    {
+      copy->m_branch[index].m_child->m_ref.ref();
+    }
+  }
+  ReleaseNode(node);
+  *a_node = copy;
+}
+
+
 RTREE_TEMPLATE
 typename RTREE_QUAL::Node* RTREE_QUAL::AllocNode()
 {
@@ -812,6 +912,7 @@ typename RTREE_QUAL::Node* RTREE_QUAL::AllocNode()
 #else // RTREE_DONT_USE_MEMPOOLS
   // EXAMPLE
 #endif // RTREE_DONT_USE_MEMPOOLS
+  newNode->m_ref = 1;
   InitNode(newNode);
   return newNode;
 }
@@ -894,6 +995,7 @@ bool RTREE_QUAL::InsertRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node,
   if(a_node->m_level > a_level)
   {
     index = PickBranch(a_rect, a_node);
+    Detach(&a_node->m_branch[index].m_child);
     if (!InsertRectRec(a_rect, a_id, a_node->m_branch[index].m_child, &otherNode, a_level))
     {
       // Child was not split
@@ -947,6 +1049,7 @@ bool RTREE_QUAL::InsertRect(Rect* a_rect, const DATATYPE& a_id, Node** a_root, i
   Node* newNode;
   Branch branch;
 
+  Detach(a_root);
   if(InsertRectRec(a_rect, a_id, *a_root, &newNode, a_level))  // Root split
   {
     newRoot = AllocNode();  // Grow tree taller and new root
@@ -1425,6 +1528,13 @@ bool RTREE_QUAL::RemoveRect(Rect* a_rect, const DATATYPE& a_id, Node** a_root)
   Node* tempNode;
   ListNode* reInsertList = NULL;
 
+  // Nothing is copied for a snapshot unless the entry is actually there
+  if(!FindRectRec(a_rect, a_id, *a_root))
+  {
+    return true;
+  }
+
+  Detach(a_root);
   if(!RemoveRectRec(a_rect, a_id, *a_root, &reInsertList))
   {
     // Found and deleted a data item
@@ -1480,8 +1590,10 @@ bool RTREE_QUAL::RemoveRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node,
   {
     for(int index = 0; index < a_node->m_count; ++index)
     {
-      if(Overlap(a_rect, &(a_node->m_branch[index].m_rect)))
+      if(Overlap(a_rect, &(a_node->m_branch[index].m_rect)) && FindRectRec(a_rect, a_id, a_node->m_branch[index].m_child))
       {
+        // Only the path down to the entry is copied if a snapshot shares it
+        Detach(&a_node->m_branch[index].m_child);
         if(!RemoveRectRec(a_rect, a_id, a_node->m_branch[index].m_child, a_listNode))
         {
           if(a_node->m_branch[index].m_child->m_count >= MINNODES)
@@ -1516,6 +1628,38 @@ bool RTREE_QUAL::RemoveRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node,
 }
 
 
+// Look for a data rectangle without changing the tree.
+// Returns true if the record is found.
+RTREE_TEMPLATE
+bool RTREE_QUAL::FindRectRec(Rect* a_rect, const DATATYPE& a_id, Node* a_node)
+{
+  ASSERT(a_rect && a_node);
+  ASSERT(a_node->m_level >= 0);
+
+  if(a_node->IsInternalNode())  // not a leaf node
+  {
+    for(int index = 0; index < a_node->m_count; ++index)
+    {
+      if(Overlap(a_rect, &(a_node->m_branch[index].m_rect)) && FindRectRec(a_rect, a_id, a_node->m_branch[index].m_child))
+      {
+        return true;
+      }
+    }
+  }
+  else // A leaf node
+  {
+    for(int index = 0; index < a_node->m_count; ++index)
+    {
+      if(a_node->m_branch[index].m_child == (Node*)a_id)
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+
 // Decide whether two rectangles overlap.
 RTREE_TEMPLATE
 bool RTREE_QUAL::Overlap(Rect* a_rectA, Rect* a_rectB)
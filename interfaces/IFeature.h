@@ -4,6 +4,7 @@
 #include <QString>
 #include <QDateTime>
 #include <QPair>
+#include <QList>
 #include <QMetaType>
 
 #define TECHNICAL_TAGS "created_by#source"
@@ -95,6 +96,11 @@ public:
         */
     virtual QString tagKey(int i) const = 0;
 
+    /** return the keys and values of the tags as indexes
+         * in the tag lists of g_getTagKey and g_getTagValue.
+         * @return the pairs of key and value indexes
+        */
+    virtual const QList<QPair<quint32, quint32> >& tagIds() const = 0;
 
     /** check if the feature has been uploaded
      * @return true if uploaded
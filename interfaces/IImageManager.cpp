@@ -21,6 +21,53 @@
 #include "MerkaartorPreferences.h"
 
 #include <QDateTime>
+#include <QLocale>
+#include <QRegExp>
+
+#define TILE_DEFAULT_LIFETIME (7*24*3600) /* s; for tiles served without any freshness information */
+#define TILE_MAX_HEURISTIC_LIFETIME (30*24*3600) /* s; cap on the Last-Modified based heuristic */
+
+/* Response headers are kept as text fields of the cached PNG; their case is whatever the server sent */
+QString IImageManager::tileHeader(const QImage& img, const QString& key)
+{
+    foreach (QString k, img.textKeys())
+        if (k.compare(key, Qt::CaseInsensitive) == 0)
+            return img.text(k);
+    return QString();
+}
+
+static QDateTime parseHttpDate(const QString& s)
+{
+    // RFC 1123 only, which is what tile servers send in practice
+    QDateTime dt = QLocale::c().toDateTime(s.simplified().left(25), "ddd, dd MMM yyyy hh:mm:ss");
+    dt.setTimeSpec(Qt::UTC);
+    return dt;
+}
+
+/* Freshness lifetime of a cached tile in seconds, following RFC 2616 section 13.2 */
+static qint64 freshnessLifetime(const QImage& img, const QDateTime& fetched)
+{
+    QString cc = IImageManager::tileHeader(img, "Cache-Control");
+    if (cc.contains("no-cache", Qt::CaseInsensitive) || cc.contains("no-store", Qt::CaseInsensitive))
+        return 0;
+    QRegExp maxAge("max-age\\s*=\\s*(\\d+)", Qt::CaseInsensitive);
+    if (maxAge.indexIn(cc) != -1)
+        return maxAge.cap(1).toLongLong();
+
+    QDateTime expires = parseHttpDate(IImageManager::tileHeader(img, "Expires"));
+    if (expires.isValid()) {
+        QDateTime date = parseHttpDate(IImageManager::tileHeader(img, "Date"));
+        if (!date.isValid())
+            date = fetched.toUTC();
+        return qMax((qint64)0, (qint64)date.secsTo(expires));
+    }
+
+    QDateTime lastModified = parseHttpDate(IImageManager::tileHeader(img, "Last-Modified"));
+    if (lastModified.isValid())
+        return qMin((qint64)TILE_MAX_HEURISTIC_LIFETIME, (qint64)lastModified.secsTo(fetched.toUTC()) / 10);
+
+    return TILE_DEFAULT_LIFETIME;
+}
 
 IImageManager::IImageManager()
     : cacheSize(0), cacheMaxSize(0), cachePermanent(false)
@@ -39,27 +86,36 @@ QNetworkAccessManager* IImageManager::getNetworkManager() const
     return m_networkManager;
 }
 
-bool IImageManager::useDiskCache(QString filename)
+QImage IImageManager::getImage(IMapAdapter* anAdapter, const QString &url, qreal /* priority */)
 {
-    // qDebug() << cacheDir.absolutePath() << filename;
+    return getImage(anAdapter, url);
+}
+
+void IImageManager::startRequestBatch()
+{
+}
+
+void IImageManager::notModified(const QHash<QString, QString>& /* headers */, const QString& /* hash */)
+{
+}
 
+bool IImageManager::useDiskCache(const QString& filename, QImage& img)
+{
     if (!cacheMaxSize && !cachePermanent)
         return false;
 
     if (!cacheDir.exists(filename))
         return false;
 
-    if (M_PREFS->getOfflineMode())
-        return true;
+    QString fn = cacheDir.absolutePath() + "/" + filename;
+    if (!img.load(fn))
+        return false;
 
-    if (cachePermanent)
+    if (M_PREFS->getOfflineMode() || cachePermanent)
         return true;
 
-    int random = qrand() % 100;
-    QFileInfo info(cacheDir.absolutePath() + "/" + filename);
-    int days = info.lastModified().daysTo(QDateTime::currentDateTime());
-
-    return  random < (10 * days) ? false : true;
+    QDateTime fetched = QFileInfo(fn).lastModified();
+    return fetched.secsTo(QDateTime::currentDateTime()) < freshnessLifetime(img, fetched);
 }
 
 void IImageManager::adaptCache()
@@ -29,7 +29,7 @@ class IMapAdapter;
 class LoadingRequest
 {
     public:
-        LoadingRequest(QString h, QString H, QString U) : hash(h), host(H), url(U) {};
+        LoadingRequest(QString h, QString H, QString U, qreal P = 0.) : hash(h), host(H), url(U), priority(P), generation(0), timeoutSlot(-1), timeouts(0), persistent(false) {};
         bool operator==(const LoadingRequest& LR) const {
             if (hash != LR.hash)
                 return false;
@@ -42,6 +42,12 @@ class LoadingRequest
     QString hash;
     QString host;
     QString url;
+    qreal priority;     //!< lower is more urgent
+    int generation;     //!< request batch this request was last asked for in
+    int timeoutSlot;    //!< slot in the timeout wheel while the request is on the network
+    int timeouts;       //!< times the request timed out; it is given up after MAX_TIMEOUTS
+    bool persistent;    //!< survives request batches and aborts, e.g. for tile seeding
+    QHash<QByteArray, QByteArray> headers; //!< extra request headers, e.g. conditional GET validators
 };
 
 /**
@@ -53,6 +59,9 @@ class IImageManager
         IImageManager();
         virtual ~IImageManager();
 
+        //! a response header stored with a cached tile
+        static QString tileHeader(const QImage& img, const QString& key);
+
         virtual QNetworkAccessManager* getNetworkManager() const;
 
         //! returns a QPixmap of the asked image
@@ -63,12 +72,16 @@ class IImageManager
          * @return the pixmap of the asked image
          */
         virtual QImage getImage(IMapAdapter* anAdapter, const QString &url) = 0;
+        //! same as above, but lets the network scheduler serve lower priority values first
+        virtual QImage getImage(IMapAdapter* anAdapter, const QString &url, qreal priority);
         virtual QByteArray getData(IMapAdapter* anAdapter, const QString &url) = 0;
 
         //QPixmap prefetchImage(const QString& host, const QString& path);
         virtual QImage prefetchImage(IMapAdapter* anAdapter, int x, int y, int z) = 0;
 
         virtual void receivedData(const QByteArray& ba, const QHash<QString, QString>& headers, const QString& url) = 0;
+        //! called by MapNetwork when a conditional request was answered with 304 Not Modified
+        virtual void notModified(const QHash<QString, QString>& headers, const QString& hash);
 
         /*!
          * This method is called by MapNetwork, after all images in its queue were loaded.
@@ -84,6 +97,12 @@ class IImageManager
          */
         virtual void abortLoading() = 0;
 
+        /*!
+         * Starts a new batch of requests, e.g. for a redraw of the viewport.
+         * Requests still queued from earlier batches that are not asked for again are dropped.
+         */
+        virtual void startRequestBatch();
+
         virtual void setCacheDir(const QDir& path) = 0;
         virtual QDir getCacheDir() = 0;
         virtual void setCacheMaxSize(int max) = 0;
@@ -100,7 +119,13 @@ class IImageManager
         int	cacheMaxSize;
         bool cachePermanent;
 
-        bool useDiskCache(QString filename);
+        //! loads a tile from the disk cache
+        /*!
+         * @param img set to the cached tile, if there is one
+         * @return true if the tile is fresh enough to use without asking the server, from the
+         * response headers stored with it
+         */
+        bool useDiskCache(const QString& filename, QImage& img);
         void adaptCache();
 };
 
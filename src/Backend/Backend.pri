@@ -2,7 +2,17 @@ INCLUDEPATH += $$MERKAARTOR_SRC_DIR/Backend
 DEPENDPATH += $$MERKAARTOR_SRC_DIR/Backend
 
 HEADERS += \
-    MemoryBackend.h
+    FeatureArena.h \
+    FeatureIdSet.h \
+    MemoryBackend.h \
+    OsmStore.h \
+    StorePager.h \
+    TagIndex.h
 
 SOURCES += \
-    MemoryBackend.cpp
+    FeatureArena.cpp \
+    FeatureIdSet.cpp \
+    MemoryBackend.cpp \
+    OsmStore.cpp \
+    StorePager.cpp \
+    TagIndex.cpp
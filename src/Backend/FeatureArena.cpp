@@ -0,0 +1,127 @@
+#include "FeatureArena.h"
+#include "Features.h"
+
+#include <new>
+#include <stdlib.h>
+
+/* SLABPOOL */
+
+SlabPool::SlabPool()
+    : slotSize(0), used(0), freeList(NULL), live(0)
+{
+}
+
+SlabPool::~SlabPool()
+{
+    destroyFeatures();
+    for (int i=0; i<slabs.size(); ++i)
+        ::free(slabs[i]);
+}
+
+void SlabPool::setObjectSize(size_t size)
+{
+    Q_ASSERT(slabs.isEmpty());
+    slotSize = FEATURE_SLOT_HEADER + ((size + 15) & ~size_t(15));
+}
+
+FeatureSlot* SlabPool::alloc()
+{
+    FeatureSlot* s;
+    if (freeList) {
+        s = freeList;
+        freeList = *reinterpret_cast<FeatureSlot**>(s->feature());
+    } else {
+        if (slabs.isEmpty() || used == SlabSlots) {
+            char* slab = static_cast<char*>(::malloc(slotSize * SlabSlots));
+            if (!slab)
+                return NULL;
+            slabs.append(slab);
+            used = 0;
+        }
+        s = slotAt(slabs.size()-1, used++);
+    }
+    new (s) FeatureSlot;
+    ++live;
+    return s;
+}
+
+void SlabPool::release(FeatureSlot* s)
+{
+    s->state = FeatureSlot::Free;
+    *reinterpret_cast<FeatureSlot**>(s->feature()) = freeList;
+    freeList = s;
+    --live;
+}
+
+void SlabPool::destroyFeatures()
+{
+    for (int i=0; i<slabs.size(); ++i) {
+        int n = (i == slabs.size()-1) ? used : SlabSlots;
+        for (int j=0; j<n; ++j) {
+            FeatureSlot* s = slotAt(i, j);
+            if (s->state == FeatureSlot::Free)
+                continue;
+            // Mark it first: destructors may hand other features back to the backend
+            s->state = FeatureSlot::Free;
+            s->feature()->~Feature();
+        }
+    }
+    live = 0;
+}
+
+/* FEATUREARENA */
+
+FeatureArena::FeatureArena()
+{
+    pools[NodePool].setObjectSize(sizeof(Node));
+    pools[TrackNodePool].setObjectSize(sizeof(TrackNode));
+    pools[PhotoNodePool].setObjectSize(sizeof(PhotoNode));
+    pools[WayPool].setObjectSize(sizeof(Way));
+    pools[RelationPool].setObjectSize(sizeof(Relation));
+    pools[SegmentPool].setObjectSize(sizeof(TrackSegment));
+}
+
+FeatureArena::~FeatureArena()
+{
+    destroyFeatures();
+}
+
+void FeatureArena::destroyFeatures()
+{
+    for (int i=0; i<PoolCount; ++i)
+        pools[i].destroyFeatures();
+}
+
+void* FeatureArena::alloc(PoolType aType, FeatureSlot::State aState)
+{
+    FeatureSlot* s = pools[aType].alloc();
+    if (!s)
+        return NULL;
+    s->arena = this;
+    s->pool = aType;
+    s->state = aState;
+    s->pinned = 0;
+    s->tagId = 0;
+    return s->feature();
+}
+
+void FeatureArena::release(FeatureSlot* s)
+{
+    pools[s->pool].release(s);
+}
+
+int FeatureArena::count() const
+{
+    int n = 0;
+    for (int i=0; i<PoolCount; ++i)
+        n += pools[i].count();
+    return n;
+}
+
+qint64 FeatureArena::reserved() const
+{
+    qint64 n = 0;
+    for (int i=0; i<PoolCount; ++i)
+        n += pools[i].reserved();
+    return n;
+}
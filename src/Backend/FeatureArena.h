@@ -0,0 +1,96 @@
+#ifndef FEATUREARENA_H
+#define FEATUREARENA_H
+
+#include "Coord.h"
+
+#include <QList>
+
+class Feature;
+class FeatureArena;
+
+/* Bookkeeping stored in front of every feature allocated by the backend */
+struct FeatureSlot
+{
+    enum State { Free, Allocated, Released, Virtual };
+
+    FeatureArena* arena;
+    CoordBox indexed;   // box the feature is filed under in the R-tree; null if it is not
+    quint8 pool;
+    quint8 state;
+    quint16 pinned;     // commands referring to it, so it has to stay in memory; sticks when full
+    quint32 tagId;      // its id in the tag index plus one; 0 if it has none
+
+    inline Feature* feature();
+    static inline FeatureSlot* of(const Feature* f);
+};
+
+/* Keeps the features 16 bytes aligned */
+#define FEATURE_SLOT_HEADER ((sizeof(FeatureSlot) + 15) & ~size_t(15))
+
+/* The feature classes use single inheritance, so a Feature* is the start of the object */
+inline Feature* FeatureSlot::feature()
+{
+    return reinterpret_cast<Feature*>(reinterpret_cast<char*>(this) + FEATURE_SLOT_HEADER);
+}
+
+inline FeatureSlot* FeatureSlot::of(const Feature* f)
+{
+    return reinterpret_cast<FeatureSlot*>(const_cast<char*>(reinterpret_cast<const char*>(f)) - FEATURE_SLOT_HEADER);
+}
+
+/* Fixed size slots carved out of large blocks, with a free list threaded through the unused ones */
+class SlabPool
+{
+public:
+    SlabPool();
+    ~SlabPool();
+
+    void setObjectSize(size_t size);
+    FeatureSlot* alloc();
+    void release(FeatureSlot* s);
+    void destroyFeatures();
+
+    int count() const { return live; }
+    qint64 reserved() const { return (qint64)slabs.size() * slotSize * SlabSlots; }
+
+private:
+    static const int SlabSlots = 512;
+
+    FeatureSlot* slotAt(int slab, int i) const
+    {
+        return reinterpret_cast<FeatureSlot*>(slabs.at(slab) + (size_t)i * slotSize);
+    }
+
+    size_t slotSize;
+    QList<char*> slabs;
+    int used;           // slots handed out so far from the last slab
+    FeatureSlot* freeList;
+    int live;
+};
+
+/* All the features allocated for one layer, one pool per feature class */
+class FeatureArena
+{
+public:
+    enum PoolType { NodePool, TrackNodePool, PhotoNodePool, WayPool, RelationPool, SegmentPool, PoolCount };
+
+    FeatureArena();
+    /* Frees the memory slab by slab, after destroyFeatures() */
+    ~FeatureArena();
+
+    /* Runs the destructor of the features still allocated. Destructors may still look at other
+       features, so with several arenas this is done for all of them before any is deleted. */
+    void destroyFeatures();
+
+    void* alloc(PoolType aType, FeatureSlot::State aState);
+    /* The feature's destructor must already have run */
+    void release(FeatureSlot* s);
+
+    int count() const;
+    qint64 reserved() const;
+
+private:
+    SlabPool pools[PoolCount];
+};
+
+#endif // FEATUREARENA_H
@@ -0,0 +1,257 @@
+#include "FeatureIdSet.h"
+
+#include <algorithm>
+#include <iterator>
+
+static inline int bitCount(quint64 w)
+{
+    w = w - ((w >> 1) & Q_UINT64_C(0x5555555555555555));
+    w = (w & Q_UINT64_C(0x3333333333333333)) + ((w >> 2) & Q_UINT64_C(0x3333333333333333));
+    w = (w + (w >> 4)) & Q_UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return int((w * Q_UINT64_C(0x0101010101010101)) >> 56);
+}
+
+FeatureIdSet::FeatureIdSet()
+{
+}
+
+int FeatureIdSet::lowerBound(quint16 high) const
+{
+    int lo = 0, hi = chunks.size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (chunks.at(mid).high < high)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void FeatureIdSet::toBitmap(Chunk& c)
+{
+    c.bits.fill(0, BitmapWords);
+    for (int i=0; i<c.values.size(); ++i)
+        c.bits[c.values.at(i) >> 6] |= Q_UINT64_C(1) << (c.values.at(i) & 63);
+    c.values.clear();
+}
+
+void FeatureIdSet::toArray(Chunk& c)
+{
+    c.values.clear();
+    c.values.reserve(c.count);
+    for (int w=0; w<BitmapWords; ++w) {
+        quint64 word = c.bits.at(w);
+        for (int b=0; word; ++b, word >>= 1)
+            if (word & 1)
+                c.values.append(quint16((w << 6) + b));
+    }
+    c.bits.clear();
+}
+
+int FeatureIdSet::size() const
+{
+    int n = 0;
+    for (int i=0; i<chunks.size(); ++i)
+        n += chunks.at(i).count;
+    return n;
+}
+
+bool FeatureIdSet::contains(quint32 id) const
+{
+    quint16 high = id >> 16, low = id & 0xffff;
+    int i = lowerBound(high);
+    if (i == chunks.size() || chunks.at(i).high != high)
+        return false;
+    const Chunk& c = chunks.at(i);
+    if (c.isBitmap())
+        return c.bits.at(low >> 6) & (Q_UINT64_C(1) << (low & 63));
+    return std::binary_search(c.values.constBegin(), c.values.constEnd(), low);
+}
+
+void FeatureIdSet::insert(quint32 id)
+{
+    quint16 high = id >> 16, low = id & 0xffff;
+    int i = lowerBound(high);
+    if (i == chunks.size() || chunks.at(i).high != high) {
+        Chunk c;
+        c.high = high;
+        c.count = 0;
+        chunks.insert(i, c);
+    }
+    Chunk& c = chunks[i];
+    if (c.isBitmap()) {
+        quint64& word = c.bits[low >> 6];
+        quint64 mask = Q_UINT64_C(1) << (low & 63);
+        if (word & mask)
+            return;
+        word |= mask;
+    } else {
+        QVector<quint16>::iterator it = std::lower_bound(c.values.begin(), c.values.end(), low);
+        if (it != c.values.end() && *it == low)
+            return;
+        c.values.insert(it, low);
+        if (c.count + 1 > ArrayMax)
+            toBitmap(c);
+    }
+    ++c.count;
+}
+
+void FeatureIdSet::remove(quint32 id)
+{
+    quint16 high = id >> 16, low = id & 0xffff;
+    int i = lowerBound(high);
+    if (i == chunks.size() || chunks.at(i).high != high)
+        return;
+    Chunk& c = chunks[i];
+    if (c.isBitmap()) {
+        quint64& word = c.bits[low >> 6];
+        quint64 mask = Q_UINT64_C(1) << (low & 63);
+        if (!(word & mask))
+            return;
+        word &= ~mask;
+        // Not right at ArrayMax, so that a chunk on the edge does not keep switching
+        if (--c.count <= ArrayMax / 2)
+            toArray(c);
+    } else {
+        QVector<quint16>::iterator it = std::lower_bound(c.values.begin(), c.values.end(), low);
+        if (it == c.values.end() || *it != low)
+            return;
+        c.values.erase(it);
+        --c.count;
+    }
+    if (!c.count)
+        chunks.remove(i);
+}
+
+void FeatureIdSet::clear()
+{
+    chunks.clear();
+}
+
+void FeatureIdSet::unite(Chunk& c, const Chunk& other)
+{
+    if (!c.isBitmap() && !other.isBitmap()) {
+        QVector<quint16> merged;
+        merged.reserve(c.values.size() + other.values.size());
+        std::set_union(c.values.constBegin(), c.values.constEnd(), other.values.constBegin(), other.values.constEnd(),
+                       std::back_inserter(merged));
+        c.values = merged;
+        c.count = merged.size();
+        if (c.count > ArrayMax)
+            toBitmap(c);
+        return;
+    }
+
+    if (!c.isBitmap())
+        toBitmap(c);
+    if (other.isBitmap()) {
+        for (int w=0; w<BitmapWords; ++w)
+            c.bits[w] |= other.bits.at(w);
+    } else {
+        for (int i=0; i<other.values.size(); ++i)
+            c.bits[other.values.at(i) >> 6] |= Q_UINT64_C(1) << (other.values.at(i) & 63);
+    }
+    c.count = 0;
+    for (int w=0; w<BitmapWords; ++w)
+        c.count += bitCount(c.bits.at(w));
+}
+
+void FeatureIdSet::intersect(Chunk& c, const Chunk& other)
+{
+    if (!c.isBitmap()) {
+        QVector<quint16> kept;
+        if (other.isBitmap()) {
+            for (int i=0; i<c.values.size(); ++i)
+                if (other.bits.at(c.values.at(i) >> 6) & (Q_UINT64_C(1) << (c.values.at(i) & 63)))
+                    kept.append(c.values.at(i));
+        } else {
+            std::set_intersection(c.values.constBegin(), c.values.constEnd(), other.values.constBegin(), other.values.constEnd(),
+                                  std::back_inserter(kept));
+        }
+        c.values = kept;
+        c.count = kept.size();
+        return;
+    }
+
+    if (!other.isBitmap()) {
+        QVector<quint16> kept;
+        for (int i=0; i<other.values.size(); ++i)
+            if (c.bits.at(other.values.at(i) >> 6) & (Q_UINT64_C(1) << (other.values.at(i) & 63)))
+                kept.append(other.values.at(i));
+        c.bits.clear();
+        c.values = kept;
+        c.count = kept.size();
+        return;
+    }
+
+    c.count = 0;
+    for (int w=0; w<BitmapWords; ++w) {
+        c.bits[w] &= other.bits.at(w);
+        c.count += bitCount(c.bits.at(w));
+    }
+    if (c.count <= ArrayMax)
+        toArray(c);
+}
+
+FeatureIdSet& FeatureIdSet::operator|=(const FeatureIdSet& other)
+{
+    QVector<Chunk> result;
+    result.reserve(chunks.size() + other.chunks.size());
+    int i = 0, j = 0;
+    while (i < chunks.size() || j < other.chunks.size()) {
+        if (j == other.chunks.size() || (i < chunks.size() && chunks.at(i).high < other.chunks.at(j).high)) {
+            result.append(chunks.at(i++));
+        } else if (i == chunks.size() || other.chunks.at(j).high < chunks.at(i).high) {
+            result.append(other.chunks.at(j++));
+        } else {
+            Chunk c = chunks.at(i++);
+            unite(c, other.chunks.at(j++));
+            result.append(c);
+        }
+    }
+    chunks = result;
+    return *this;
+}
+
+FeatureIdSet& FeatureIdSet::operator&=(const FeatureIdSet& other)
+{
+    QVector<Chunk> result;
+    int i = 0, j = 0;
+    while (i < chunks.size() && j < other.chunks.size()) {
+        if (chunks.at(i).high < other.chunks.at(j).high) {
+            ++i;
+        } else if (other.chunks.at(j).high < chunks.at(i).high) {
+            ++j;
+        } else {
+            Chunk c = chunks.at(i++);
+            intersect(c, other.chunks.at(j++));
+            if (c.count)
+                result.append(c);
+        }
+    }
+    chunks = result;
+    return *this;
+}
+
+QVector<quint32> FeatureIdSet::toVector() const
+{
+    QVector<quint32> ids;
+    ids.reserve(size());
+    for (int i=0; i<chunks.size(); ++i) {
+        const Chunk& c = chunks.at(i);
+        quint32 base = quint32(c.high) << 16;
+        if (c.isBitmap()) {
+            for (int w=0; w<BitmapWords; ++w) {
+                quint64 word = c.bits.at(w);
+                for (int b=0; word; ++b, word >>= 1)
+                    if (word & 1)
+                        ids.append(base + (w << 6) + b);
+            }
+        } else {
+            for (int k=0; k<c.values.size(); ++k)
+                ids.append(base + c.values.at(k));
+        }
+    }
+    return ids;
+}
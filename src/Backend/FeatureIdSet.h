@@ -0,0 +1,51 @@
+#ifndef FEATUREIDSET_H
+#define FEATUREIDSET_H
+
+#include <QVector>
+
+/* A set of small integer ids, kept in chunks of 65536 ids. A chunk is a sorted array of the low
+   16 bits while it holds few ids and a bitmap once it holds many, so that both sparse and dense
+   sets stay compact and intersect quickly. */
+class FeatureIdSet
+{
+public:
+    FeatureIdSet();
+
+    bool isEmpty() const { return chunks.isEmpty(); }
+    int size() const;
+    bool contains(quint32 id) const;
+
+    void insert(quint32 id);
+    void remove(quint32 id);
+    void clear();
+
+    FeatureIdSet& operator|=(const FeatureIdSet& other);
+    FeatureIdSet& operator&=(const FeatureIdSet& other);
+
+    /* In increasing order */
+    QVector<quint32> toVector() const;
+
+private:
+    struct Chunk
+    {
+        quint16 high;
+        int count;
+        QVector<quint16> values;    // sorted, while it is an array
+        QVector<quint64> bits;      // BitmapWords words, once it is a bitmap
+
+        bool isBitmap() const { return !bits.isEmpty(); }
+    };
+
+    static const int ArrayMax = 4096;   /* past this a bitmap is smaller */
+    static const int BitmapWords = 1024;
+
+    int lowerBound(quint16 high) const;
+    static void toBitmap(Chunk& c);
+    static void toArray(Chunk& c);
+    static void unite(Chunk& c, const Chunk& other);
+    static void intersect(Chunk& c, const Chunk& other);
+
+    QVector<Chunk> chunks;
+};
+
+#endif // FEATUREIDSET_H
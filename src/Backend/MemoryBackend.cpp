@@ -1,13 +1,22 @@
 #include "MemoryBackend.h"
+#include "FeatureArena.h"
 #include "RTree.h"
 
 #include <QReadWriteLock>
 
+#include <new>
+
 RenderPriority NodePri(RenderPriority::IsSingular,0., 0);
 RenderPriority SegmentPri(RenderPriority::IsLinear,0.,99);
 
 typedef RTree<Feature*, qreal, 2, qreal, 32> CoordTree;
 
+class IndexSnapshotPrivate
+{
+public:
+    QList<CoordTree::Snapshot> theTrees;
+};
+
 class MemoryBackendPrivate
 {
 public:
@@ -19,9 +28,66 @@ public:
     QMutex toBeDeletedLock;
     QList<Feature*> toBeDeleted;
 
-    QHash<Feature*, CoordBox> AllocFeatures;
+    /* Features are allocated from per layer arenas; protects them and the pools */
+    QMutex arenaLock;
+    QHash<ILayer*, FeatureArena*> arenas;
+    /* Arenas of deleted layers that still hold features; freed once those are */
+    QSet<FeatureArena*> retired;
+    ILayer* lastLayer;
+    FeatureArena* lastArena;
+
     QHash<ILayer*, CoordTree*> theRTree;
     QList<Feature*> findResult;
+
+    TagIndex theTagIndex;
+
+    MemoryBackendPrivate()
+        : lastLayer(NULL), lastArena(NULL)
+    {
+    }
+
+    void* alloc(ILayer* l, FeatureArena::PoolType aType, FeatureSlot::State aState = FeatureSlot::Allocated)
+    {
+        QMutexLocker locker(&arenaLock);
+        if (!lastArena || l != lastLayer) {
+            FeatureArena*& A = arenas[l];
+            if (!A)
+                A = new (std::nothrow) FeatureArena();
+            if (!A)
+                return NULL;
+            lastLayer = l;
+            lastArena = A;
+        }
+        return lastArena->alloc(aType, aState);
+    }
+
+    void destroy(Feature* f)
+    {
+        FeatureSlot* s = FeatureSlot::of(f);
+        FeatureArena* A = s->arena;
+        f->~Feature();
+        QMutexLocker locker(&arenaLock);
+        A->release(s);
+        if (!A->count() && retired.remove(A))
+            delete A;
+    }
+
+    /* A new layer may get the same address, so it must not inherit the arena */
+    void retire(ILayer* l)
+    {
+        QMutexLocker locker(&arenaLock);
+        if (l == lastLayer) {
+            lastLayer = NULL;
+            lastArena = NULL;
+        }
+        FeatureArena* A = arenas.take(l);
+        if (!A)
+            return;
+        if (A->count())
+            retired.insert(A);
+        else
+            delete A;
+    }
 };
 
 bool indexFindCallbackList(Feature* F, void* ctxt)
@@ -42,7 +108,7 @@ bool indexFindCallback(Feature* F, void* ctxt)
         if (pCtxt->theFeatures->value(R->renderPriority()).contains(F))
             return true;
         R->buildPath(*(pCtxt->theProjection));
-        if (M_PREFS->getTrackPointsVisible()) {
+        if (pCtxt->theSettings->TrackPointsVisible) {
             for (int i=0; i<R->size(); ++i) {
                 if (pCtxt->bbox.contains(R->getNode(i)->boundingBox()))
                     if (!pCtxt->theFeatures->value(NodePri).contains(R->getNode(i)))
@@ -61,7 +127,7 @@ bool indexFindCallback(Feature* F, void* ctxt)
     if (CHECK_NODE(F)) {
         if (pCtxt->theFeatures->value(NodePri).contains(F))
             return true;
-        if (!(F->isVirtual() && !M_PREFS->getVirtualNodesVisible())) {
+        if (!(F->isVirtual() && !pCtxt->theSettings->VirtualNodesVisible)) {
             Node * N = STATIC_CAST_NODE(F);
             N->buildPath(*(pCtxt->theProjection));
             (*(pCtxt->theFeatures))[NodePri].insert(F);
@@ -75,6 +141,14 @@ bool indexFindCallback(Feature* F, void* ctxt)
     return true;
 }
 
+bool indexSnapshotCallback(Feature* F, void* ctxt)
+{
+    // Deleted since the snapshot was taken, but not yet freed
+    if (FeatureSlot::of(F)->state != FeatureSlot::Allocated)
+        return true;
+    return indexFindCallback(F, ctxt);
+}
+
 void MemoryBackend::indexAdd(ILayer* l, const QRectF& bb, Feature* aFeat)
 {
     if (!l)
@@ -82,7 +156,7 @@ void MemoryBackend::indexAdd(ILayer* l, const QRectF& bb, Feature* aFeat)
     if (!p->theRTree.contains(l))
         p->theRTree[l] = new CoordTree();
 
-    p->AllocFeatures[aFeat] = bb;
+    FeatureSlot::of(aFeat)->indexed = bb;
     qreal min[] = {bb.bottomLeft().x(), bb.bottomLeft().y()};
     qreal max[] = {bb.topRight().x(), bb.topRight().y()};
     p->theRTree[l]->Insert(min, max, aFeat);
@@ -128,15 +202,17 @@ void MemoryBackend::get(ILayer* l, const QRectF& bb, QList<Feature*>& theFeature
         return;
     qreal min[] = {bb.bottomLeft().x(), bb.bottomLeft().y()};
     qreal max[] = {bb.topRight().x(), bb.topRight().y()};
-    p->theRTree[l]->Search(min, max, &indexFindCallback, (void*)(&theFeatures));
+    p->theRTree[l]->Search(min, max, &indexFindCallbackList, (void*)(&theFeatures));
 }
 
 void MemoryBackend::getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
-                                  const QList<CoordBox>& invalidRects, Projection& theProjection)
+                                  const QList<CoordBox>& invalidRects, Projection& theProjection,
+                                  const RenderSettings& theSettings)
 {
     IndexFindContext ctxt;
     ctxt.theFeatures = &theFeatures;
     ctxt.theProjection = &theProjection;
+    ctxt.theSettings = &theSettings;
 
     for (int i=0; i < invalidRects.size(); ++i) {
         ctxt.bbox = invalidRects[i];
@@ -145,16 +221,46 @@ void MemoryBackend::getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*
 }
 
 void MemoryBackend::getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
-                                  const CoordBox& invalidRect, Projection& theProjection)
+                                  const CoordBox& invalidRect, Projection& theProjection,
+                                  const RenderSettings& theSettings)
 {
     IndexFindContext ctxt;
     ctxt.theFeatures = &theFeatures;
     ctxt.theProjection = &theProjection;
+    ctxt.theSettings = &theSettings;
 
     ctxt.bbox = invalidRect;
     indexFind(l, invalidRect, ctxt);
 }
 
+IndexSnapshot MemoryBackend::indexSnapshot(const QList<ILayer*>& layers)
+{
+    IndexSnapshot snapshot;
+    snapshot.p = QSharedPointer<IndexSnapshotPrivate>(new IndexSnapshotPrivate);
+    foreach (ILayer* l, layers)
+        if (p->theRTree.contains(l))
+            snapshot.p->theTrees << p->theRTree[l]->GetSnapshot();
+    return snapshot;
+}
+
+void MemoryBackend::getFeatureSet(const IndexSnapshot& snapshot, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
+                                  const CoordBox& invalidRect, Projection& theProjection,
+                                  const RenderSettings& theSettings)
+{
+    if (snapshot.isNull())
+        return;
+
+    IndexFindContext ctxt;
+    ctxt.theFeatures = &theFeatures;
+    ctxt.theProjection = &theProjection;
+    ctxt.theSettings = &theSettings;
+    ctxt.bbox = invalidRect;
+
+    qreal min[] = {invalidRect.bottomLeft().x(), invalidRect.bottomLeft().y()};
+    qreal max[] = {invalidRect.topRight().x(), invalidRect.topRight().y()};
+    foreach (const CoordTree::Snapshot& tree, snapshot.p->theTrees)
+        tree.Search(min, max, &indexSnapshotCallback, (void*)&ctxt);
+}
 
 /******************************/
 
@@ -172,23 +278,29 @@ MemoryBackend::~MemoryBackend()
 //        p->theRTree.GetNext(it);
 //    }
 
-    QHash<Feature *, CoordBox>::const_iterator i = p->AllocFeatures.constBegin();
-    while (i != p->AllocFeatures.constEnd()) {
-        delete i.key();
-        ++i;
-    }
+    // No point in taking the features out of the index one by one
+    p->theTagIndex.clear();
+
+    // Destructors first, as they may still look at features of other arenas; then the memory,
+    // which goes back slab by slab rather than feature by feature
+    foreach (FeatureArena* A, p->arenas)
+        A->destroyFeatures();
+    foreach (FeatureArena* A, p->retired)
+        A->destroyFeatures();
+    qDeleteAll(p->arenas);
+    qDeleteAll(p->retired);
+    qDeleteAll(p->theRTree);
 
     delete p;
 }
 
 Node * MemoryBackend::allocNode(ILayer* l, const Node& other)
 {
-    Node* f;
-    f = new (std::nothrow) Node(other);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::NodePool);
+    if (!mem)
         return NULL;
+    Node* f = new (mem) Node(other);
 
-    p->AllocFeatures[f] = f->BBox;
     if (!f->BBox.isNull()) {
         indexAdd(l, f->BBox, f);
     }
@@ -197,12 +309,11 @@ Node * MemoryBackend::allocNode(ILayer* l, const Node& other)
 
 Node * MemoryBackend::allocNode(ILayer* l, const QPointF& aCoord)
 {
-    Node* f;
-    f = new (std::nothrow) Node(aCoord);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::NodePool);
+    if (!mem)
         return NULL;
+    Node* f = new (mem) Node(aCoord);
 
-    p->AllocFeatures[f] = f->BBox;
     if (!f->BBox.isNull()) {
         indexAdd(l, f->BBox, f);
     }
@@ -211,12 +322,11 @@ Node * MemoryBackend::allocNode(ILayer* l, const QPointF& aCoord)
 
 TrackNode * MemoryBackend::allocTrackNode(ILayer* l, const QPointF& aCoord)
 {
-    TrackNode* f;
-    f = new (std::nothrow) TrackNode(aCoord);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::TrackNodePool);
+    if (!mem)
         return NULL;
+    TrackNode* f = new (mem) TrackNode(aCoord);
 
-    p->AllocFeatures[f] = f->BBox;
     if (!f->BBox.isNull()) {
         indexAdd(l, f->BBox, f);
     }
@@ -225,12 +335,11 @@ TrackNode * MemoryBackend::allocTrackNode(ILayer* l, const QPointF& aCoord)
 
 PhotoNode * MemoryBackend::allocPhotoNode(ILayer* l, const QPointF& aCoord)
 {
-    PhotoNode* f;
-    f = new (std::nothrow) PhotoNode(aCoord);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::PhotoNodePool);
+    if (!mem)
         return NULL;
+    PhotoNode* f = new (mem) PhotoNode(aCoord);
 
-    p->AllocFeatures[f] = f->BBox;
     if (!f->BBox.isNull()) {
         indexAdd(l, f->BBox, f);
     }
@@ -239,12 +348,11 @@ PhotoNode * MemoryBackend::allocPhotoNode(ILayer* l, const QPointF& aCoord)
 
 PhotoNode * MemoryBackend::allocPhotoNode(ILayer* l, const Node& other)
 {
-    PhotoNode* f;
-    f = new (std::nothrow) PhotoNode(other);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::PhotoNodePool);
+    if (!mem)
         return NULL;
+    PhotoNode* f = new (mem) PhotoNode(other);
 
-    p->AllocFeatures[f] = f->BBox;
     if (!f->BBox.isNull()) {
         indexAdd(l, f->BBox, f);
     }
@@ -253,12 +361,11 @@ PhotoNode * MemoryBackend::allocPhotoNode(ILayer* l, const Node& other)
 
 PhotoNode * MemoryBackend::allocPhotoNode(ILayer* l, const TrackNode& other)
 {
-    PhotoNode* f;
-    f = new (std::nothrow) PhotoNode(other);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::PhotoNodePool);
+    if (!mem)
         return NULL;
+    PhotoNode* f = new (mem) PhotoNode(other);
 
-    p->AllocFeatures[f] = f->BBox;
     if (!f->BBox.isNull()) {
         indexAdd(l, f->BBox, f);
     }
@@ -267,75 +374,63 @@ PhotoNode * MemoryBackend::allocPhotoNode(ILayer* l, const TrackNode& other)
 
 Node * MemoryBackend::allocVirtualNode(const QPointF& aCoord)
 {
-    return new (std::nothrow) Node(aCoord);
+    void* mem = p->alloc(NULL, FeatureArena::NodePool, FeatureSlot::Virtual);
+    if (!mem)
+        return NULL;
+    return new (mem) Node(aCoord);
 }
 
-Way * MemoryBackend::allocWay(ILayer* /*l*/)
+Way * MemoryBackend::allocWay(ILayer* l)
 {
-    Way* f;
-    f = new (std::nothrow) Way();
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::WayPool);
+    if (!mem)
         return NULL;
-
-    p->AllocFeatures[f] = CoordBox();
-    return f;
+    return new (mem) Way();
 }
 
-Way * MemoryBackend::allocWay(ILayer* /*l*/, const Way& other)
+Way * MemoryBackend::allocWay(ILayer* l, const Way& other)
 {
-    Way* f;
-    f = new (std::nothrow) Way(other);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::WayPool);
+    if (!mem)
         return NULL;
-
-    p->AllocFeatures[f] = CoordBox();
-    return f;
+    return new (mem) Way(other);
 }
 
-Relation * MemoryBackend::allocRelation(ILayer* /*l*/)
+Relation * MemoryBackend::allocRelation(ILayer* l)
 {
-    Relation* f;
-    f = new (std::nothrow) Relation();
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::RelationPool);
+    if (!mem)
         return NULL;
-
-    p->AllocFeatures[f] = CoordBox();
-    return f;
+    return new (mem) Relation();
 }
 
-Relation * MemoryBackend::allocRelation(ILayer* /*l*/, const Relation& other)
+Relation * MemoryBackend::allocRelation(ILayer* l, const Relation& other)
 {
-    Relation* f;
-    f = new (std::nothrow) Relation(other);
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::RelationPool);
+    if (!mem)
         return NULL;
-
-    p->AllocFeatures[f] = CoordBox();
-    return f;
+    return new (mem) Relation(other);
 }
 
-TrackSegment * MemoryBackend::allocSegment(ILayer* /*l*/)
+TrackSegment * MemoryBackend::allocSegment(ILayer* l)
 {
-    TrackSegment* f;
-    f = new (std::nothrow) TrackSegment();
-    if (!f)
+    void* mem = p->alloc(l, FeatureArena::SegmentPool);
+    if (!mem)
         return NULL;
-
-    p->AllocFeatures[f] = CoordBox();
-    return f;
+    return new (mem) TrackSegment();
 }
 
 void MemoryBackend::deallocFeature(ILayer* l, Feature *f)
 {
     p->delayedDeletesLock.lockForRead();
     p->toBeDeletedLock.lock();
-    if (p->AllocFeatures.contains(f)) {
-        indexRemove(l, p->AllocFeatures[f], f);
-        if (!p->AllocFeatures.remove(f)) {
-            qWarning() << "Feature, that is not in a list is being removed.";
-        } else {
-            p->toBeDeleted.append(f);
-        }
+    FeatureSlot* s = FeatureSlot::of(f);
+    if (s->state == FeatureSlot::Allocated) {
+        indexRemove(l, s->indexed, f);
+        s->state = FeatureSlot::Released;
+        p->toBeDeleted.append(f);
+    } else {
+        qWarning() << "Feature, that is not in a list is being removed.";
     }
     p->toBeDeletedLock.unlock();
     p->delayedDeletesLock.unlock();
@@ -346,12 +441,12 @@ void MemoryBackend::purge()
     if (p->toBeDeleted.empty()) return; /* Don't bother if there is nothing to delete */
     if (!p->delayedDeletesLock.tryLockForWrite()) return; /* If locked, deletes need to be delayed */
     p->toBeDeletedLock.lock();
-    QList<Feature*>::iterator it = p->toBeDeleted.begin();
-    while (it != p->toBeDeleted.end()) {
-        delete *(it++);
-    }
+    // Destructors may queue more (a way's virtual node proxy); those go on the next purge
+    QList<Feature*> doomed = p->toBeDeleted;
     p->toBeDeleted.clear();
     p->toBeDeletedLock.unlock();
+    foreach (Feature* f, doomed)
+        p->destroy(f);
     p->delayedDeletesLock.unlock();
 }
 
@@ -364,17 +459,58 @@ void MemoryBackend::resumeDeletes() {
     purge();
 }
 
+void MemoryBackend::releaseLayer(ILayer* l)
+{
+    if (!l)
+        return;
+    // Snapshots in use keep their own reference to the tree's nodes
+    delete p->theRTree.take(l);
+    p->retire(l);
+}
+
 void MemoryBackend::deallocVirtualNode(Feature *f)
 {
-    p->delayedDeletesLock.tryLockForRead();
+    QMutexLocker locker(&p->toBeDeletedLock);
+    FeatureSlot* s = FeatureSlot::of(f);
+    // Already gone when the backend is torn down
+    if (s->state != FeatureSlot::Virtual)
+        return;
+    s->state = FeatureSlot::Released;
     p->toBeDeleted.append(f);
-    p->delayedDeletesLock.unlock();
+}
+
+void MemoryBackend::pin(Feature* f)
+{
+    FeatureSlot* s = FeatureSlot::of(f);
+    if (s->pinned != 0xffff)
+        ++s->pinned;
+}
+
+void MemoryBackend::unpin(Feature* f)
+{
+    FeatureSlot* s = FeatureSlot::of(f);
+    // Once full it can no longer tell how many there are
+    if (s->pinned && s->pinned != 0xffff)
+        --s->pinned;
+}
+
+bool MemoryBackend::isPinned(const Feature* f) const
+{
+    return FeatureSlot::of(f)->pinned;
+}
+
+TagIndex& MemoryBackend::tagIndex()
+{
+    return p->theTagIndex;
 }
 
 void MemoryBackend::sync(Feature *f)
 {
-    if (p->AllocFeatures.contains(f) && !p->AllocFeatures[f].isNull())
-        indexRemove(f->layer(), p->AllocFeatures[f], f);
+    FeatureSlot* s = FeatureSlot::of(f);
+    if (s->state == FeatureSlot::Allocated && !s->indexed.isNull()) {
+        indexRemove(f->layer(), s->indexed, f);
+        s->indexed = CoordBox();
+    }
     if (CHECK_NODE(f)) {
         Node* N = STATIC_CAST_NODE(f);
         if (!N->tagSize())
@@ -2,15 +2,36 @@
 #define MEMORYBACKEND_H
 
 #include "Features.h"
+#include "TagIndex.h"
+#include "RenderSettings.h"
+
+#include <QSharedPointer>
 
 struct IndexFindContext {
     QMap<RenderPriority, QSet <Feature*> >* theFeatures;
     QRectF* clipRect;
     Projection* theProjection;
     QTransform* theTransform;
+    const RenderSettings* theSettings;
     CoordBox bbox;
 };
 
+class IndexSnapshotPrivate;
+
+/* The spatial index of some layers as it was when taken. Unlike the index itself it can be
+   searched from other threads while features are being edited. It does not keep the features
+   alive: deletes have to be delayed for as long as it is in use. */
+class IndexSnapshot
+{
+public:
+    bool isNull() const { return p.isNull(); }
+
+private:
+    QSharedPointer<IndexSnapshotPrivate> p;
+
+    friend class MemoryBackend;
+};
+
 class MemoryBackendPrivate;
 class MemoryBackend
 {
@@ -40,8 +61,18 @@ public:
 
     virtual void deallocFeature(ILayer* l, Feature* f);
     virtual void deallocVirtualNode(Feature* f);
+    /* The layer is deleted: its index goes, and its arena once the features left in it are.
+       Those may have moved to other layers, so they are not freed here. */
+    virtual void releaseLayer(ILayer* l);
 
     virtual void sync(Feature* f);
+    /* Features referred to by the undo stack; paged out features are never pinned ones */
+    virtual void pin(Feature* f);
+    /* Each pin() is matched by one unpin(); the feature is pinned until the last one */
+    virtual void unpin(Feature* f);
+    virtual bool isPinned(const Feature* f) const;
+
+    TagIndex& tagIndex();
     virtual void purge();
     virtual void delayDeletes();
     virtual void resumeDeletes();
@@ -50,9 +81,15 @@ public:
     virtual void indexFind(ILayer* l, const QRectF& bb, const IndexFindContext& findResult);
     virtual void get(ILayer* l, const QRectF& bb, QList<Feature*>& theFeatures);
     virtual void getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
-                               const QList<CoordBox>& invalidRects, Projection& theProjection);
+                               const QList<CoordBox>& invalidRects, Projection& theProjection,
+                               const RenderSettings& theSettings);
     virtual void getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
-                               const CoordBox& invalidRect, Projection& theProjection);
+                               const CoordBox& invalidRect, Projection& theProjection,
+                               const RenderSettings& theSettings);
+    virtual IndexSnapshot indexSnapshot(const QList<ILayer*>& layers);
+    virtual void getFeatureSet(const IndexSnapshot& snapshot, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
+                               const CoordBox& invalidRect, Projection& theProjection,
+                               const RenderSettings& theSettings);
     virtual void indexAdd(ILayer* l, const QRectF& bb, Feature* aFeat);
     virtual void indexRemove(ILayer* l, const QRectF& bb, Feature* aFeat);
 
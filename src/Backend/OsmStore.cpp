@@ -0,0 +1,779 @@
+#include "OsmStore.h"
+
+#include <QApplication>
+#include <QBitArray>
+#include <QFileInfo>
+#include <QHash>
+#include <QProgressDialog>
+#include <QTemporaryFile>
+#include <QXmlStreamReader>
+
+#include <limits.h>
+#include <string.h>
+
+#define STORE_MAGIC "MERKSTOR"
+#define STORE_VERSION 1
+#define STORE_LEVELS 11 /* index levels; the deepest one has 1024x1024 cells over the extract */
+#define STORE_NO_TAGS (~quint64(0))
+#define STORE_INTERN_MAX 262144 /* distinct short strings shared between records while building */
+#define STORE_INTERN_LENGTH 32 /* longer strings are seldom repeated */
+#define STORE_COPY_CHUNK (1024*1024)
+#define STORE_PROGRESS_STEP 10000 /* elements read between progress updates */
+
+struct StoreHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 levels;
+    qint32 box[4];
+    quint64 nodeCount, wayCount, relationCount, refCount, memberCount, textSize, cellCount, entryCount;
+    quint64 nodes, ways, relations, refs, members, text, cells, entries;
+};
+
+static inline quint64 align8(quint64 n)
+{
+    return (n + 7) & ~quint64(7);
+}
+
+static inline void boxInit(qint32* box)
+{
+    box[0] = box[1] = INT_MAX;
+    box[2] = box[3] = INT_MIN;
+}
+
+static inline bool boxValid(const qint32* box)
+{
+    return box[0] <= box[2] && box[1] <= box[3];
+}
+
+static inline void boxMerge(qint32* box, qint32 lon, qint32 lat)
+{
+    box[0] = qMin(box[0], lon);
+    box[1] = qMin(box[1], lat);
+    box[2] = qMax(box[2], lon);
+    box[3] = qMax(box[3], lat);
+}
+
+static inline void boxMerge(qint32* box, const qint32* other)
+{
+    if (!boxValid(other))
+        return;
+    boxMerge(box, other[0], other[1]);
+    boxMerge(box, other[2], other[3]);
+}
+
+static inline bool boxOverlap(const qint32* a, const qint32* b)
+{
+    return a[0] <= b[2] && b[0] <= a[2] && a[1] <= b[3] && b[1] <= a[3];
+}
+
+static inline qint32 toFixed(qreal deg, qreal limit)
+{
+    return qint32(qRound64(qBound(-limit, deg, limit) * 1e7));
+}
+
+template<class T>
+static qint64 searchId(const T* records, quint64 count, qint64 id)
+{
+    quint64 lo = 0, hi = count;
+    while (lo < hi) {
+        quint64 mid = lo + (hi - lo) / 2;
+        if (records[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < count && records[lo].id == id)
+        return lo;
+    return -1;
+}
+
+/* Levels of square grids over the extract. An entry goes to the deepest cell that holds its whole box,
+   so a query only has to look at the cells it overlaps on each level. */
+class StoreGrid
+{
+public:
+    StoreGrid(const qint32* aBox, int aLevels)
+        : levels(aLevels), cells(1 << (aLevels-1))
+    {
+        memcpy(box, aBox, sizeof(box));
+    }
+
+    quint64 cellCount() const
+    {
+        return levelOffset(levels);
+    }
+
+    quint64 cellOf(const qint32* b) const
+    {
+        int x0 = gx(b[0]), y0 = gy(b[1]), x1 = gx(b[2]), y1 = gy(b[3]);
+        for (int level = levels-1; level > 0; --level) {
+            int s = levels-1 - level;
+            if ((x0 >> s) == (x1 >> s) && (y0 >> s) == (y1 >> s))
+                return cell(level, x0 >> s, y0 >> s);
+        }
+        return 0;
+    }
+
+    void cellRange(int level, const qint32* b, int& x0, int& y0, int& x1, int& y1) const
+    {
+        int s = levels-1 - level;
+        x0 = gx(b[0]) >> s;
+        y0 = gy(b[1]) >> s;
+        x1 = gx(b[2]) >> s;
+        y1 = gy(b[3]) >> s;
+    }
+
+    quint64 cell(int level, int x, int y) const
+    {
+        return levelOffset(level) + (quint64)y * (1 << level) + x;
+    }
+
+    const int levels;
+
+private:
+    static quint64 levelOffset(int level)
+    {
+        // 1 + 4 + 16 + ... cells on the levels above
+        return ((Q_UINT64_C(1) << (2*level)) - 1) / 3;
+    }
+
+    int gx(qint32 lon) const
+    {
+        qint64 g = ((qint64)lon - box[0]) * cells / ((qint64)box[2] - box[0] + 1);
+        return (int)qBound((qint64)0, g, (qint64)cells-1);
+    }
+
+    int gy(qint32 lat) const
+    {
+        qint64 g = ((qint64)lat - box[1]) * cells / ((qint64)box[3] - box[1] + 1);
+        return (int)qBound((qint64)0, g, (qint64)cells-1);
+    }
+
+    qint32 box[4];
+    const int cells;
+};
+
+/* STOREBUILDER */
+
+class StoreBuilder
+{
+public:
+    StoreBuilder();
+
+    bool run(QIODevice& osm, const QString& fileName, QProgressDialog* progress);
+
+    QString error;
+
+private:
+    bool openTemp(QTemporaryFile& f, const QString& fileName);
+    bool write(QFile& f, const void* data, qint64 size);
+    bool copy(QFile& from, QFile& to, quint64 offset);
+    const uchar* map(QTemporaryFile& f, quint64 size);
+
+    bool advance(int aType);
+    bool startElement(OsmStore::EntryType aType, const QXmlStreamAttributes& atts);
+    bool endNode();
+    bool endWay();
+    bool endRelation();
+    bool addText(const QString& s, quint64& offset);
+    bool addTags(quint64& offset);
+    bool entry(int aType, quint64 i, StoreEntry& e) const;
+    bool finish(const QString& fileName, QProgressDialog* progress);
+
+    QTemporaryFile tmpNodes, tmpWays, tmpRelations, tmpRefs, tmpMembers, tmpText;
+    quint64 count[3];
+    quint64 refCount, memberCount, textSize;
+    qint64 lastId[3];
+    int section;
+    qint32 box[4];
+
+    /* The element being read */
+    int curType;
+    StoreNode curNode;
+    qint64 curId;
+    quint32 curVersion;
+    QList<QPair<QString, QString> > curTags;
+    QVector<qint64> curRefs;
+    QVector<StoreMember> curMembers;
+
+    QHash<QString, quint64> interned;
+
+    /* Mapped once complete, to look up the coordinates of the ways and relations */
+    const StoreNode* nodes;
+    const StoreWay* ways;
+    const StoreRelation* relations;
+    QBitArray nodeUsed;
+};
+
+StoreBuilder::StoreBuilder()
+    : refCount(0), memberCount(0), textSize(0), section(OsmStore::NodeEntry), curType(-1)
+    , curId(0), curVersion(0), nodes(NULL), ways(NULL), relations(NULL)
+{
+    for (int i=0; i<3; ++i) {
+        count[i] = 0;
+        lastId[i] = 0;
+    }
+    boxInit(box);
+}
+
+bool StoreBuilder::openTemp(QTemporaryFile& f, const QString& fileName)
+{
+    f.setFileTemplate(fileName + ".XXXXXX");
+    if (!f.open()) {
+        error = f.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool StoreBuilder::write(QFile& f, const void* data, qint64 size)
+{
+    if (f.write((const char*)data, size) != size) {
+        error = f.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool StoreBuilder::copy(QFile& from, QFile& to, quint64 offset)
+{
+    if (!from.flush() || !from.seek(0) || !to.seek(offset)) {
+        error = to.errorString();
+        return false;
+    }
+    QByteArray buf;
+    while (!(buf = from.read(STORE_COPY_CHUNK)).isEmpty())
+        if (!write(to, buf.constData(), buf.size()))
+            return false;
+    return true;
+}
+
+const uchar* StoreBuilder::map(QTemporaryFile& f, quint64 size)
+{
+    if (!size)
+        return NULL;
+    f.flush();
+    const uchar* data = f.map(0, size);
+    if (!data)
+        error = QApplication::translate("OsmStore", "The data could not be mapped in memory.");
+    return data;
+}
+
+bool StoreBuilder::advance(int aType)
+{
+    while (section < aType) {
+        ++section;
+        if (section == OsmStore::WayEntry) {
+            if (count[OsmStore::NodeEntry] > (quint64)INT_MAX) {
+                error = QApplication::translate("OsmStore", "The file has too many nodes.");
+                return false;
+            }
+            nodes = (const StoreNode*)map(tmpNodes, count[OsmStore::NodeEntry] * sizeof(StoreNode));
+            if (!nodes && count[OsmStore::NodeEntry])
+                return false;
+            nodeUsed.resize(count[OsmStore::NodeEntry]);
+        } else if (section == OsmStore::RelationEntry) {
+            ways = (const StoreWay*)map(tmpWays, count[OsmStore::WayEntry] * sizeof(StoreWay));
+            if (!ways && count[OsmStore::WayEntry])
+                return false;
+        } else {
+            relations = (const StoreRelation*)map(tmpRelations, count[OsmStore::RelationEntry] * sizeof(StoreRelation));
+            if (!relations && count[OsmStore::RelationEntry])
+                return false;
+        }
+    }
+    return true;
+}
+
+bool StoreBuilder::startElement(OsmStore::EntryType aType, const QXmlStreamAttributes& atts)
+{
+    if (aType < section) {
+        error = QApplication::translate("OsmStore", "The file must list the nodes, then the ways, then the relations.");
+        return false;
+    }
+    if (!advance(aType))
+        return false;
+
+    curId = atts.value("id").toString().toLongLong();
+    if (count[aType] && curId <= lastId[aType]) {
+        error = QApplication::translate("OsmStore", "The file must be sorted by id (%1 comes after %2).").arg(curId).arg(lastId[aType]);
+        return false;
+    }
+    lastId[aType] = curId;
+    curVersion = atts.value("version").toString().toUInt();
+    curType = aType;
+    curTags.clear();
+    curRefs.clear();
+    curMembers.clear();
+    return true;
+}
+
+bool StoreBuilder::addText(const QString& s, quint64& offset)
+{
+    bool internable = s.size() <= STORE_INTERN_LENGTH;
+    if (internable) {
+        QHash<QString, quint64>::const_iterator it = interned.constFind(s);
+        if (it != interned.constEnd()) {
+            offset = it.value();
+            return true;
+        }
+    }
+
+    QByteArray utf8 = s.toUtf8();
+    quint32 len = utf8.size();
+    offset = textSize;
+    if (!write(tmpText, &len, sizeof(len)) || !write(tmpText, utf8.constData(), len))
+        return false;
+    textSize += sizeof(len) + len;
+
+    if (internable && interned.size() < STORE_INTERN_MAX)
+        interned.insert(s, offset);
+    return true;
+}
+
+bool StoreBuilder::addTags(quint64& offset)
+{
+    offset = STORE_NO_TAGS;
+    if (curTags.isEmpty())
+        return true;
+
+    QVector<quint64> offsets(curTags.size()*2);
+    for (int i=0; i<curTags.size(); ++i)
+        if (!addText(curTags[i].first, offsets[i*2]) || !addText(curTags[i].second, offsets[i*2+1]))
+            return false;
+
+    quint32 n = curTags.size();
+    offset = textSize;
+    if (!write(tmpText, &n, sizeof(n)) || !write(tmpText, offsets.constData(), offsets.size()*sizeof(quint64)))
+        return false;
+    textSize += sizeof(n) + offsets.size()*sizeof(quint64);
+    return true;
+}
+
+bool StoreBuilder::endNode()
+{
+    curNode.id = curId;
+    curNode.version = curVersion;
+    curNode.reserved = 0;
+    if (!addTags(curNode.tags))
+        return false;
+    boxMerge(box, curNode.lon, curNode.lat);
+    ++count[OsmStore::NodeEntry];
+    return write(tmpNodes, &curNode, sizeof(curNode));
+}
+
+bool StoreBuilder::endWay()
+{
+    StoreWay W;
+    W.id = curId;
+    W.version = curVersion;
+    W.nodeCount = curRefs.size();
+    W.firstNode = refCount;
+    boxInit(W.box);
+    for (int i=0; i<curRefs.size(); ++i) {
+        qint64 n = searchId(nodes, count[OsmStore::NodeEntry], curRefs[i]);
+        if (n < 0)
+            continue;
+        boxMerge(W.box, nodes[n].lon, nodes[n].lat);
+        nodeUsed.setBit(n);
+    }
+    if (!write(tmpRefs, curRefs.constData(), curRefs.size()*sizeof(qint64)))
+        return false;
+    refCount += curRefs.size();
+    if (!addTags(W.tags))
+        return false;
+    ++count[OsmStore::WayEntry];
+    return write(tmpWays, &W, sizeof(W));
+}
+
+bool StoreBuilder::endRelation()
+{
+    StoreRelation R;
+    R.id = curId;
+    R.version = curVersion;
+    R.memberCount = curMembers.size();
+    R.firstMember = memberCount;
+    boxInit(R.box);
+    for (int i=0; i<curMembers.size(); ++i) {
+        const StoreMember& M = curMembers[i];
+        if (M.type == OsmStore::NodeEntry) {
+            qint64 n = searchId(nodes, count[OsmStore::NodeEntry], M.ref);
+            if (n >= 0)
+                boxMerge(R.box, nodes[n].lon, nodes[n].lat);
+        } else if (M.type == OsmStore::WayEntry) {
+            qint64 w = searchId(ways, count[OsmStore::WayEntry], M.ref);
+            if (w >= 0)
+                boxMerge(R.box, ways[w].box);
+        }
+        // Relation members would need the relations to be read twice; the box is only an index hint
+    }
+    if (!write(tmpMembers, curMembers.constData(), curMembers.size()*sizeof(StoreMember)))
+        return false;
+    memberCount += curMembers.size();
+    if (!addTags(R.tags))
+        return false;
+    ++count[OsmStore::RelationEntry];
+    return write(tmpRelations, &R, sizeof(R));
+}
+
+bool StoreBuilder::entry(int aType, quint64 i, StoreEntry& e) const
+{
+    e.type = aType;
+    e.reserved = 0;
+    e.index = i;
+    switch (aType) {
+    case OsmStore::NodeEntry:
+        // Nodes of ways come with their way
+        if (nodeUsed.size() > (int)i && nodeUsed.testBit(i) && nodes[i].tags == STORE_NO_TAGS)
+            return false;
+        e.box[0] = e.box[2] = nodes[i].lon;
+        e.box[1] = e.box[3] = nodes[i].lat;
+        return true;
+    case OsmStore::WayEntry:
+        memcpy(e.box, ways[i].box, sizeof(e.box));
+        return boxValid(e.box);
+    default:
+        memcpy(e.box, relations[i].box, sizeof(e.box));
+        return boxValid(e.box);
+    }
+}
+
+bool StoreBuilder::finish(const QString& fileName, QProgressDialog* progress)
+{
+    if (!count[OsmStore::NodeEntry]) {
+        error = QApplication::translate("OsmStore", "The file has no nodes.");
+        return false;
+    }
+    // Past the relations, to map them all
+    if (!advance(OsmStore::RelationEntry + 1))
+        return false;
+    if (progress) {
+        progress->setLabelText(QApplication::translate("OsmStore", "Indexing..."));
+        qApp->processEvents();
+    }
+
+    // Count the entries of each cell, then turn the counts into the first entry of each cell
+    StoreGrid grid(box, STORE_LEVELS);
+    QVector<quint64> first(grid.cellCount() + 1, 0);
+    quint64 entryCount = 0;
+    StoreEntry e;
+    for (int t=0; t<3; ++t)
+        for (quint64 i=0; i<count[t]; ++i)
+            if (entry(t, i, e)) {
+                ++first[grid.cellOf(e.box) + 1];
+                ++entryCount;
+            }
+    for (int c=1; c<first.size(); ++c)
+        first[c] += first[c-1];
+
+    StoreHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+    h.version = STORE_VERSION;
+    h.levels = STORE_LEVELS;
+    memcpy(h.box, box, sizeof(h.box));
+    h.nodeCount = count[OsmStore::NodeEntry];
+    h.wayCount = count[OsmStore::WayEntry];
+    h.relationCount = count[OsmStore::RelationEntry];
+    h.refCount = refCount;
+    h.memberCount = memberCount;
+    h.textSize = textSize;
+    h.cellCount = grid.cellCount();
+    h.entryCount = entryCount;
+
+    quint64 pos = align8(sizeof(h));
+    h.nodes = pos;      pos = align8(pos + h.nodeCount * sizeof(StoreNode));
+    h.ways = pos;       pos = align8(pos + h.wayCount * sizeof(StoreWay));
+    h.relations = pos;  pos = align8(pos + h.relationCount * sizeof(StoreRelation));
+    h.refs = pos;       pos = align8(pos + h.refCount * sizeof(qint64));
+    h.members = pos;    pos = align8(pos + h.memberCount * sizeof(StoreMember));
+    h.text = pos;       pos = align8(pos + h.textSize);
+    h.cells = pos;      pos = align8(pos + (h.cellCount + 1) * sizeof(quint64));
+    h.entries = pos;    pos = pos + h.entryCount * sizeof(StoreEntry);
+
+    // Built under a temporary name, so that a build cut short is never taken for a complete store
+    QTemporaryFile out;
+    if (!openTemp(out, fileName))
+        return false;
+    if (!out.resize(pos)) {
+        error = out.errorString();
+        return false;
+    }
+    if (!write(out, &h, sizeof(h))
+            || !copy(tmpNodes, out, h.nodes)
+            || !copy(tmpWays, out, h.ways)
+            || !copy(tmpRelations, out, h.relations)
+            || !copy(tmpRefs, out, h.refs)
+            || !copy(tmpMembers, out, h.members)
+            || !copy(tmpText, out, h.text))
+        return false;
+    if (!out.seek(h.cells) || !write(out, first.constData(), first.size() * sizeof(quint64)))
+        return false;
+
+    if (entryCount) {
+        out.flush();
+        uchar* entries = out.map(h.entries, entryCount * sizeof(StoreEntry));
+        if (!entries) {
+            error = QApplication::translate("OsmStore", "The data could not be mapped in memory.");
+            return false;
+        }
+        for (int t=0; t<3; ++t)
+            for (quint64 i=0; i<count[t]; ++i)
+                if (entry(t, i, e))
+                    memcpy(entries + (first[grid.cellOf(e.box)]++) * sizeof(StoreEntry), &e, sizeof(e));
+        out.unmap(entries);
+    }
+    if (!out.flush()) {
+        error = out.errorString();
+        return false;
+    }
+    QFile::remove(fileName);
+    if (!out.rename(fileName)) {
+        error = out.errorString();
+        return false;
+    }
+    out.setAutoRemove(false);
+    return true;
+}
+
+bool StoreBuilder::run(QIODevice& osm, const QString& fileName, QProgressDialog* progress)
+{
+    if (!openTemp(tmpNodes, fileName) || !openTemp(tmpWays, fileName) || !openTemp(tmpRelations, fileName)
+            || !openTemp(tmpRefs, fileName) || !openTemp(tmpMembers, fileName) || !openTemp(tmpText, fileName))
+        return false;
+
+    if (progress)
+        progress->setMaximum(100);
+    qint64 total = osm.size();
+    int elements = 0;
+
+    QXmlStreamReader xml(&osm);
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.isStartElement()) {
+            QStringRef name = xml.name();
+            if (name == "tag") {
+                if (curType >= 0)
+                    curTags << qMakePair(xml.attributes().value("k").toString(), xml.attributes().value("v").toString());
+            } else if (name == "nd") {
+                if (curType == OsmStore::WayEntry)
+                    curRefs << xml.attributes().value("ref").toString().toLongLong();
+            } else if (name == "member") {
+                if (curType == OsmStore::RelationEntry) {
+                    QXmlStreamAttributes atts = xml.attributes();
+                    QStringRef type = atts.value("type");
+                    StoreMember M;
+                    M.ref = atts.value("ref").toString().toLongLong();
+                    M.type = (type == "node") ? OsmStore::NodeEntry : (type == "way") ? OsmStore::WayEntry : OsmStore::RelationEntry;
+                    M.reserved = 0;
+                    if (!addText(atts.value("role").toString(), M.role))
+                        return false;
+                    curMembers << M;
+                }
+            } else if (name == "node") {
+                QXmlStreamAttributes atts = xml.attributes();
+                if (!startElement(OsmStore::NodeEntry, atts))
+                    return false;
+                curNode.lon = toFixed(atts.value("lon").toString().toDouble(), 180.);
+                curNode.lat = toFixed(atts.value("lat").toString().toDouble(), 90.);
+            } else if (name == "way") {
+                if (!startElement(OsmStore::WayEntry, xml.attributes()))
+                    return false;
+            } else if (name == "relation") {
+                if (!startElement(OsmStore::RelationEntry, xml.attributes()))
+                    return false;
+            }
+        } else if (xml.isEndElement()) {
+            QStringRef name = xml.name();
+            bool ok = true;
+            if (name == "node")
+                ok = endNode();
+            else if (name == "way")
+                ok = endWay();
+            else if (name == "relation")
+                ok = endRelation();
+            else
+                continue;
+            curType = -1;
+            if (!ok)
+                return false;
+
+            if (progress && !(++elements % STORE_PROGRESS_STEP)) {
+                if (total > 0)
+                    progress->setValue(int(osm.pos() * 100 / total));
+                qApp->processEvents();
+                if (progress->wasCanceled()) {
+                    error = QApplication::translate("OsmStore", "Cancelled.");
+                    return false;
+                }
+            }
+        }
+    }
+    if (xml.hasError()) {
+        error = QApplication::translate("OsmStore", "%1 at line %2").arg(xml.errorString()).arg(xml.lineNumber());
+        return false;
+    }
+
+    return finish(fileName, progress);
+}
+
+/* OSMSTORE */
+
+OsmStore::OsmStore()
+    : theData(NULL), theHeader(NULL)
+{
+}
+
+OsmStore::~OsmStore()
+{
+    close();
+}
+
+bool OsmStore::build(QIODevice& osm, const QString& fileName, QString& error, QProgressDialog* progress)
+{
+    StoreBuilder builder;
+    if (!builder.run(osm, fileName, progress)) {
+        error = builder.error;
+        QFile::remove(fileName);
+        return false;
+    }
+    return true;
+}
+
+bool OsmStore::open(const QString& fileName)
+{
+    close();
+    theError.clear();
+
+    theFile.setFileName(fileName);
+    if (!theFile.open(QIODevice::ReadOnly)) {
+        theError = theFile.errorString();
+        return false;
+    }
+    quint64 size = theFile.size();
+    if (size >= sizeof(StoreHeader))
+        theData = theFile.map(0, size);
+    if (!theData) {
+        theError = QApplication::translate("OsmStore", "The store could not be mapped in memory.");
+        close();
+        return false;
+    }
+
+    const StoreHeader* h = (const StoreHeader*)theData;
+    if (memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)) || h->version != STORE_VERSION
+            || h->levels < 1 || h->levels > 16
+            || h->entries + h->entryCount * sizeof(StoreEntry) > size) {
+        theError = QApplication::translate("OsmStore", "This is not a store of this version of Merkaartor.");
+        close();
+        return false;
+    }
+
+    theNodes = (const StoreNode*)(theData + h->nodes);
+    theWays = (const StoreWay*)(theData + h->ways);
+    theRelations = (const StoreRelation*)(theData + h->relations);
+    theRefs = (const qint64*)(theData + h->refs);
+    theMembers = (const StoreMember*)(theData + h->members);
+    theText = theData + h->text;
+    theCells = (const quint64*)(theData + h->cells);
+    theEntries = (const StoreEntry*)(theData + h->entries);
+    theHeader = h;
+    return true;
+}
+
+void OsmStore::close()
+{
+    if (theData)
+        theFile.unmap(theData);
+    theData = NULL;
+    theHeader = NULL;
+    theFile.close();
+}
+
+CoordBox OsmStore::boundingBox() const
+{
+    if (!theHeader)
+        return CoordBox();
+    return CoordBox(toCoord(theHeader->box[0], theHeader->box[1]), toCoord(theHeader->box[2], theHeader->box[3]));
+}
+
+bool OsmStore::find(const CoordBox& bb, QVector<const StoreEntry*>& result, int maxResults) const
+{
+    result.clear();
+    if (!theHeader)
+        return true;
+
+    qint32 q[4];
+    q[0] = toFixed(bb.bottomLeft().x(), 180.);
+    q[1] = toFixed(bb.bottomLeft().y(), 90.);
+    q[2] = toFixed(bb.topRight().x(), 180.);
+    q[3] = toFixed(bb.topRight().y(), 90.);
+    if (!boxOverlap(q, theHeader->box))
+        return true;
+
+    // Counted in features loaded: a way brings its nodes, a relation its members
+    qint64 loaded = 0;
+    StoreGrid grid(theHeader->box, theHeader->levels);
+    for (int level=0; level<grid.levels; ++level) {
+        int x0, y0, x1, y1;
+        grid.cellRange(level, q, x0, y0, x1, y1);
+        for (int y=y0; y<=y1; ++y)
+            for (int x=x0; x<=x1; ++x) {
+                quint64 c = grid.cell(level, x, y);
+                for (quint64 k=theCells[c]; k<theCells[c+1]; ++k) {
+                    const StoreEntry* e = theEntries + k;
+                    if (!boxOverlap(e->box, q))
+                        continue;
+                    loaded += 1;
+                    if (e->type == WayEntry)
+                        loaded += theWays[e->index].nodeCount;
+                    else if (e->type == RelationEntry)
+                        loaded += theRelations[e->index].memberCount;
+                    if (loaded > maxResults)
+                        return false;
+                    result << e;
+                }
+            }
+    }
+    return true;
+}
+
+qint64 OsmStore::findNode(qint64 id) const
+{
+    return theHeader ? searchId(theNodes, theHeader->nodeCount, id) : -1;
+}
+
+qint64 OsmStore::findWay(qint64 id) const
+{
+    return theHeader ? searchId(theWays, theHeader->wayCount, id) : -1;
+}
+
+qint64 OsmStore::findRelation(qint64 id) const
+{
+    return theHeader ? searchId(theRelations, theHeader->relationCount, id) : -1;
+}
+
+QString OsmStore::text(quint64 offset) const
+{
+    if (!theHeader || offset >= theHeader->textSize)
+        return QString();
+    quint32 len;
+    memcpy(&len, theText + offset, sizeof(len));
+    return QString::fromUtf8((const char*)theText + offset + sizeof(len), len);
+}
+
+void OsmStore::tags(quint64 offset, QList<QPair<QString, QString> >& theTags) const
+{
+    theTags.clear();
+    if (!theHeader || offset == STORE_NO_TAGS || offset >= theHeader->textSize)
+        return;
+    quint32 n;
+    memcpy(&n, theText + offset, sizeof(n));
+    const uchar* pairs = theText + offset + sizeof(n);
+    for (quint32 i=0; i<n; ++i) {
+        quint64 k, v;
+        memcpy(&k, pairs + (2*i) * sizeof(quint64), sizeof(k));
+        memcpy(&v, pairs + (2*i+1) * sizeof(quint64), sizeof(v));
+        theTags << qMakePair(text(k), text(v));
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef OSMSTORE_H
+#define OSMSTORE_H
+
+#include "Coord.h"
+
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+class QProgressDialog;
+
+/* Records of the store file; coordinates are in 1e-7 degrees, boxes are min lon, min lat, max lon, max lat */
+struct StoreNode
+{
+    qint64 id;
+    qint32 lon, lat;
+    quint32 version;
+    quint32 reserved;
+    quint64 tags;
+};
+
+struct StoreWay
+{
+    qint64 id;
+    quint32 version;
+    quint32 nodeCount;
+    quint64 firstNode;      // into the node references
+    quint64 tags;
+    qint32 box[4];
+};
+
+struct StoreRelation
+{
+    qint64 id;
+    quint32 version;
+    quint32 memberCount;
+    quint64 firstMember;
+    quint64 tags;
+    qint32 box[4];
+};
+
+struct StoreMember
+{
+    qint64 ref;
+    quint32 type;           // OsmStore::EntryType
+    quint32 reserved;
+    quint64 role;           // into the text
+};
+
+struct StoreEntry
+{
+    qint32 box[4];
+    quint32 type;
+    quint32 reserved;
+    quint64 index;
+};
+
+struct StoreHeader;
+
+/* A read only OSM extract kept on disk and memory mapped, with a spatial index, so that the features
+   around the view can be materialized one area at a time instead of loading the whole file.
+   It is built once from an .osm file sorted by type and id, as the planet and its extracts are;
+   building reads the file as a stream and needs memory for the node usage bits and the index cells only. */
+class OsmStore
+{
+public:
+    enum EntryType { NodeEntry, WayEntry, RelationEntry };
+
+    OsmStore();
+    ~OsmStore();
+
+    static bool build(QIODevice& osm, const QString& fileName, QString& error, QProgressDialog* progress = 0);
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const { return theHeader != 0; }
+    QString fileName() const { return theFile.fileName(); }
+    QString errorString() const { return theError; }
+
+    CoordBox boundingBox() const;
+
+    /* Standalone nodes, ways and relations whose box intersects bb.
+       Gives up and returns false once loading them would make more than maxResults features,
+       counting the nodes of the ways and the members of the relations. */
+    bool find(const CoordBox& bb, QVector<const StoreEntry*>& result, int maxResults) const;
+
+    /* Index of the record with that id, or -1 */
+    qint64 findNode(qint64 id) const;
+    qint64 findWay(qint64 id) const;
+    qint64 findRelation(qint64 id) const;
+
+    const StoreNode& node(quint64 i) const { return theNodes[i]; }
+    const StoreWay& way(quint64 i) const { return theWays[i]; }
+    const StoreRelation& relation(quint64 i) const { return theRelations[i]; }
+    qint64 wayNode(const StoreWay& W, int i) const { return theRefs[W.firstNode + i]; }
+    const StoreMember& member(const StoreRelation& R, int i) const { return theMembers[R.firstMember + i]; }
+
+    QString text(quint64 offset) const;
+    void tags(quint64 offset, QList<QPair<QString, QString> >& theTags) const;
+
+    static Coord toCoord(qint32 lon, qint32 lat) { return Coord(lon / 1e7, lat / 1e7); }
+
+private:
+    QFile theFile;
+    uchar* theData;
+    const StoreHeader* theHeader;
+    const StoreNode* theNodes;
+    const StoreWay* theWays;
+    const StoreRelation* theRelations;
+    const qint64* theRefs;
+    const StoreMember* theMembers;
+    const uchar* theText;
+    const quint64* theCells;
+    const StoreEntry* theEntries;
+    QString theError;
+};
+
+#endif // OSMSTORE_H
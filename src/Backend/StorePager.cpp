@@ -0,0 +1,284 @@
+#include "StorePager.h"
+#include "OsmStore.h"
+#include "Global.h"
+#include "Features.h"
+#include "Document.h"
+#include "Layer.h"
+#include "MapView.h"
+#include "MerkaartorPreferences.h"
+#ifndef _MOBILE
+#include "MainWindow.h"
+#include "PropertiesDock.h"
+#endif
+
+#include <QtAlgorithms>
+
+#define PAGER_DELAY 250 /* ms of a still view before paging, so that panning does not page every step */
+#define PAGER_MARGIN 1.5 /* the paged area, relative to the view */
+#define PAGER_RELATION_MEMBERS 256 /* larger relations get their members as they come in view */
+
+static const char FeatureTypes[3] = { IFeature::Point, IFeature::LineString, IFeature::OsmRelation };
+
+StorePager::StorePager(Document* aDoc, Layer* aLayer, OsmStore* aStore, MapView* aView)
+    : QObject(aLayer), theDocument(aDoc), theLayer(aLayer), theStore(aStore), theView(aView)
+    , theTick(0), changed(false)
+{
+    theTimer.setSingleShot(true);
+    theTimer.setInterval(PAGER_DELAY);
+    connect(&theTimer, SIGNAL(timeout()), this, SLOT(page()));
+    connect(theView, SIGNAL(viewportChanged()), this, SLOT(on_viewportChanged()));
+}
+
+StorePager::~StorePager()
+{
+    delete theStore;
+}
+
+void StorePager::on_viewportChanged()
+{
+    theTimer.start();
+}
+
+void StorePager::page()
+{
+    if (!theStore->isOpen() || !theLayer->isVisible() || !theLayer->isEnabled())
+        return;
+
+    CoordBox area = theView->viewport();
+    area.resize(PAGER_MARGIN);
+
+    // Zoomed too far out for the budget: keep what is there
+    int budget = qMax(1, M_PREFS->getStoreFeatureBudget());
+    QVector<const StoreEntry*> entries;
+    if (!theStore->find(area, entries, budget))
+        return;
+
+    ++theTick;
+    changed = false;
+    for (int i=0; i<entries.size(); ++i) {
+        const StoreEntry* e = entries[i];
+        switch (e->type) {
+        case OsmStore::NodeEntry:
+            pageNode(theStore->node(e->index).id);
+            break;
+        case OsmStore::WayEntry:
+            pageWay(theStore->way(e->index).id);
+            break;
+        case OsmStore::RelationEntry:
+            pageRelation(theStore->relation(e->index).id);
+            break;
+        }
+    }
+
+    if (theLayer->size() > budget)
+        evict(area);
+
+    if (changed)
+        theView->invalidate(true, true, false);
+}
+
+void StorePager::adopt(Feature* F)
+{
+    if (F->layer() != theLayer) {
+        if (F->layer())
+            F->layer()->remove(F);
+        theLayer->add(F);
+    }
+    F->clearTags();
+    F->setLastUpdated(Feature::OSMServer);
+}
+
+void StorePager::fill(Feature* F, quint32 version, quint64 tags)
+{
+    F->setVersionNumber(version);
+    QList<QPair<QString, QString> > theTags;
+    theStore->tags(tags, theTags);
+    for (int i=0; i<theTags.size(); ++i)
+        F->setTag(theTags[i].first, theTags[i].second);
+    changed = true;
+}
+
+void StorePager::touch(int aType, Feature* F)
+{
+    if (F->layer() == theLayer)
+        theTicks[aType].insert(F->id().numId, theTick);
+}
+
+Node* StorePager::pageNode(qint64 id)
+{
+    IFeature::FId fid(IFeature::Point, id);
+    Node* N = CAST_NODE(theDocument->getFeature(fid));
+    if (N && N->lastUpdated() != Feature::NotYetDownloaded) {
+        touch(OsmStore::NodeEntry, N);
+        return N;
+    }
+
+    qint64 i = theStore->findNode(id);
+    if (i < 0) {
+        N = Feature::getNodeOrCreatePlaceHolder(theDocument, theLayer, fid);
+        touch(OsmStore::NodeEntry, N);
+        return N;
+    }
+
+    const StoreNode& S = theStore->node(i);
+    Coord C = OsmStore::toCoord(S.lon, S.lat);
+    if (N) {
+        adopt(N);
+        N->setPosition(C);
+    } else {
+        N = g_backend.allocNode(theLayer, C);
+        N->setId(fid);
+        N->setLastUpdated(Feature::OSMServer);
+        theLayer->add(N);
+    }
+    fill(N, S.version, S.tags);
+    touch(OsmStore::NodeEntry, N);
+    return N;
+}
+
+Way* StorePager::pageWay(qint64 id, bool withNodes)
+{
+    IFeature::FId fid(IFeature::LineString, id);
+    Way* W = CAST_WAY(theDocument->getFeature(fid));
+    if (W && W->lastUpdated() != Feature::NotYetDownloaded) {
+        touch(OsmStore::WayEntry, W);
+        for (int j=0; j<W->size(); ++j)
+            touch(OsmStore::NodeEntry, W->getNode(j));
+        return W;
+    }
+
+    qint64 i = theStore->findWay(id);
+    if (i < 0 || !withNodes) {
+        W = Feature::getWayOrCreatePlaceHolder(theDocument, theLayer, fid);
+        touch(OsmStore::WayEntry, W);
+        return W;
+    }
+
+    const StoreWay& S = theStore->way(i);
+    if (W) {
+        adopt(W);
+        while (W->size())
+            W->remove((int)0);
+    } else {
+        W = g_backend.allocWay(theLayer);
+        W->setId(fid);
+        W->setLastUpdated(Feature::OSMServer);
+        theLayer->add(W);
+    }
+    for (quint32 j=0; j<S.nodeCount; ++j)
+        W->add(pageNode(theStore->wayNode(S, j)));
+    fill(W, S.version, S.tags);
+    touch(OsmStore::WayEntry, W);
+    return W;
+}
+
+Relation* StorePager::pageRelation(qint64 id)
+{
+    IFeature::FId fid(IFeature::OsmRelation, id);
+    Relation* R = CAST_RELATION(theDocument->getFeature(fid));
+    if (R && R->lastUpdated() != Feature::NotYetDownloaded) {
+        touch(OsmStore::RelationEntry, R);
+        return R;
+    }
+
+    qint64 i = theStore->findRelation(id);
+    if (i < 0) {
+        R = Feature::getRelationOrCreatePlaceHolder(theDocument, theLayer, fid);
+        touch(OsmStore::RelationEntry, R);
+        return R;
+    }
+
+    const StoreRelation& S = theStore->relation(i);
+    if (R) {
+        adopt(R);
+        while (R->size())
+            R->remove((int)0);
+    } else {
+        R = g_backend.allocRelation(theLayer);
+        R->setId(fid);
+        R->setLastUpdated(Feature::OSMServer);
+        theLayer->add(R);
+    }
+    bool withMembers = S.memberCount <= PAGER_RELATION_MEMBERS;
+    for (quint32 j=0; j<S.memberCount; ++j) {
+        const StoreMember& M = theStore->member(S, j);
+        Feature* F = NULL;
+        switch (M.type) {
+        case OsmStore::NodeEntry:
+            F = pageNode(M.ref);
+            break;
+        case OsmStore::WayEntry:
+            F = pageWay(M.ref, withMembers);
+            break;
+        default:
+            // Sub relations are filled when they come in view themselves
+            F = Feature::getRelationOrCreatePlaceHolder(theDocument, theLayer, IFeature::FId(IFeature::OsmRelation, M.ref));
+            touch(OsmStore::RelationEntry, F);
+            break;
+        }
+        if (F && F != R)
+            R->add(theStore->text(M.role), F);
+    }
+    fill(R, S.version, S.tags);
+    touch(OsmStore::RelationEntry, R);
+    return R;
+}
+
+bool StorePager::canEvict(Feature* F, const CoordBox& keep) const
+{
+    if (F->isDirty() || F->getDirtyLevel() || g_backend.isPinned(F) || F->sizeParents())
+        return false;
+    if (F->lastUpdated() != Feature::OSMServer && F->lastUpdated() != Feature::NotYetDownloaded)
+        return false;
+    if (!F->boundingBox().isNull() && F->boundingBox().intersects(keep))
+        return false;
+#ifndef _MOBILE
+    if (g_Merk_MainWindow && g_Merk_MainWindow->properties()->isSelected(F))
+        return false;
+#endif
+    return true;
+}
+
+void StorePager::evict(const CoordBox& keep)
+{
+    int excess = theLayer->size() - qMax(1, M_PREFS->getStoreFeatureBudget()) * 3 / 4;
+
+    // Oldest first; the relations and ways go before the nodes they hold
+    QSet<Feature*> doomed;
+    for (int t=OsmStore::RelationEntry; t>=OsmStore::NodeEntry && doomed.size() < excess; --t) {
+        QList<QPair<quint32, qint64> > candidates;
+        QMutableHashIterator<qint64, quint32> it(theTicks[t]);
+        while (it.hasNext()) {
+            it.next();
+            if (it.value() != theTick)
+                candidates << qMakePair(it.value(), it.key());
+        }
+        qSort(candidates);
+
+        for (int i=0; i<candidates.size() && doomed.size() < excess; ++i) {
+            Feature* F = theLayer->get(IFeature::FId(FeatureTypes[t], candidates[i].second));
+            if (!F) {
+                // Deleted or moved to another layer since
+                theTicks[t].remove(candidates[i].second);
+                continue;
+            }
+            if (!canEvict(F, keep))
+                continue;
+
+            if (Way* W = CAST_WAY(F)) {
+                while (W->size())
+                    W->remove((int)0);
+            } else if (Relation* R = CAST_RELATION(F)) {
+                while (R->size())
+                    R->remove((int)0);
+            }
+            doomed.insert(F);
+            theTicks[t].remove(candidates[i].second);
+        }
+    }
+
+    if (!doomed.isEmpty()) {
+        theLayer->deleteFeatures(doomed);
+        changed = true;
+    }
+}
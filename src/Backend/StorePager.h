@@ -0,0 +1,63 @@
+#ifndef STOREPAGER_H
+#define STOREPAGER_H
+
+#include "IFeature.h"
+#include "Coord.h"
+
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+
+class Document;
+class Layer;
+class MapView;
+class OsmStore;
+class Feature;
+class Node;
+class Way;
+class Relation;
+
+/* Keeps the features of an OsmStore around the view in a layer, and drops the ones that have not
+   been in view for the longest time once the layer holds more than the feature budget.
+   Edited, selected and referenced features stay; they are ordinary features of the layer. */
+class StorePager : public QObject
+{
+    Q_OBJECT
+
+public:
+    /* Takes ownership of the store; lives as long as the layer */
+    StorePager(Document* aDoc, Layer* aLayer, OsmStore* aStore, MapView* aView);
+    ~StorePager();
+
+    OsmStore* store() const { return theStore; }
+
+public slots:
+    void page();
+
+private slots:
+    void on_viewportChanged();
+
+private:
+    Node* pageNode(qint64 id);
+    Way* pageWay(qint64 id, bool withNodes = true);
+    Relation* pageRelation(qint64 id);
+
+    void adopt(Feature* F);
+    void fill(Feature* F, quint32 version, quint64 tags);
+    void touch(int aType, Feature* F);
+    bool canEvict(Feature* F, const CoordBox& keep) const;
+    void evict(const CoordBox& keep);
+
+    Document* theDocument;
+    Layer* theLayer;
+    OsmStore* theStore;
+    MapView* theView;
+    QTimer theTimer;
+
+    /* Last page() that needed each feature of the layer, by OsmStore::EntryType and id */
+    QHash<qint64, quint32> theTicks[3];
+    quint32 theTick;
+    bool changed;
+};
+
+#endif // STOREPAGER_H
@@ -0,0 +1,136 @@
+#include "TagIndex.h"
+#include "FeatureArena.h"
+#include "Global.h"
+
+static inline quint64 valueKey(quint32 key, quint32 fold)
+{
+    return (quint64(key) << 32) | fold;
+}
+
+TagIndex::TagIndex()
+{
+}
+
+int TagIndex::idOf(const Feature* F) const
+{
+    quint32 id = FeatureSlot::of(F)->tagId;
+    if (!id || int(id) > theFeatures.size() || theFeatures.at(id-1) != F)
+        return -1;
+    return id-1;
+}
+
+int TagIndex::idFor(const Feature* F)
+{
+    return int(FeatureSlot::of(F)->tagId) - 1;
+}
+
+quint32 TagIndex::foldOf(quint32 value)
+{
+    QHash<quint32, quint32>::const_iterator it = folds.constFind(value);
+    if (it != folds.constEnd())
+        return it.value();
+
+    QString folded = g_getTagValue(value).toCaseFolded();
+    QHash<QString, quint32>::const_iterator f = foldIds.constFind(folded);
+    quint32 fold;
+    if (f != foldIds.constEnd())
+        fold = f.value();
+    else {
+        fold = foldIds.size();
+        foldIds.insert(folded, fold);
+    }
+    folds.insert(value, fold);
+    return fold;
+}
+
+void TagIndex::insert(Feature* F, quint32 key, quint32 value)
+{
+    int id = idOf(F);
+    if (id < 0) {
+        if (!freeIds.isEmpty()) {
+            id = freeIds.last();
+            freeIds.pop_back();
+            theFeatures[id] = F;
+        } else {
+            id = theFeatures.size();
+            theFeatures.append(F);
+        }
+        FeatureSlot::of(F)->tagId = id+1;
+    }
+    byKey[key].insert(id);
+    byValue[valueKey(key, foldOf(value))].insert(id);
+}
+
+void TagIndex::remove(Feature* F, quint32 key, quint32 value)
+{
+    int id = idOf(F);
+    if (id < 0)
+        return;
+
+    QHash<quint32, FeatureIdSet>::iterator k = byKey.find(key);
+    if (k != byKey.end()) {
+        k.value().remove(id);
+        if (k.value().isEmpty())
+            byKey.erase(k);
+    }
+    QHash<quint64, FeatureIdSet>::iterator v = byValue.find(valueKey(key, foldOf(value)));
+    if (v != byValue.end()) {
+        v.value().remove(id);
+        if (v.value().isEmpty())
+            byValue.erase(v);
+    }
+}
+
+void TagIndex::release(Feature* F)
+{
+    int id = idOf(F);
+    if (id < 0)
+        return;
+    theFeatures[id] = NULL;
+    freeIds.append(id);
+    FeatureSlot::of(F)->tagId = 0;
+}
+
+void TagIndex::clear()
+{
+    byKey.clear();
+    byValue.clear();
+    folds.clear();
+    foldIds.clear();
+    theFeatures.clear();
+    freeIds.clear();
+}
+
+FeatureIdSet TagIndex::withKey(const QString& key) const
+{
+    return byKey.value(g_getTagKeyIndex(key));
+}
+
+FeatureIdSet TagIndex::withValue(const QString& key, const QString& value) const
+{
+    QHash<QString, quint32>::const_iterator f = foldIds.constFind(value.toCaseFolded());
+    if (f == foldIds.constEnd())
+        return FeatureIdSet();
+    return byValue.value(valueKey(g_getTagKeyIndex(key), f.value()));
+}
+
+FeatureIdSet TagIndex::withAnyKeyBut(const QStringList& keys) const
+{
+    FeatureIdSet result;
+    QHash<quint32, FeatureIdSet>::const_iterator it = byKey.constBegin();
+    for (; it != byKey.constEnd(); ++it)
+        if (!keys.contains(g_getTagKey(it.key())))
+            result |= it.value();
+    return result;
+}
+
+QList<Feature*> TagIndex::features(const FeatureIdSet& ids) const
+{
+    QList<Feature*> result;
+    QVector<quint32> v = ids.toVector();
+    result.reserve(v.size());
+    for (int i=0; i<v.size(); ++i)
+        if (int(v.at(i)) < theFeatures.size() && theFeatures.at(v.at(i)))
+            result << theFeatures.at(v.at(i));
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef TAGINDEX_H
+#define TAGINDEX_H
+
+#include "FeatureIdSet.h"
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+class Feature;
+
+/* The features having each tag key, and each key and value, as sets of small ids, so that tag
+   queries only look at the features that can match. Values are told apart ignoring case, as
+   TagSelector compares them. Kept up to date by Feature as its tags change. */
+class TagIndex
+{
+public:
+    TagIndex();
+
+    void insert(Feature* F, quint32 key, quint32 value);
+    void remove(Feature* F, quint32 key, quint32 value);
+    /* Gives the id of F back once its tags are removed */
+    void release(Feature* F);
+    /* Drops everything; features indexed so far are then ignored */
+    void clear();
+
+    FeatureIdSet withKey(const QString& key) const;
+    FeatureIdSet withValue(const QString& key, const QString& value) const;
+    FeatureIdSet withAnyKeyBut(const QStringList& keys) const;
+
+    QList<Feature*> features(const FeatureIdSet& ids) const;
+
+    /* The id of F, or -1 while it never had tags; only reads F, so any thread may ask */
+    static int idFor(const Feature* F);
+
+private:
+    int idOf(const Feature* F) const;
+    quint32 foldOf(quint32 value);
+
+    QHash<quint32, FeatureIdSet> byKey;
+    QHash<quint64, FeatureIdSet> byValue;   // key << 32 | folded value
+    QHash<quint32, quint32> folds;          // value index to folded value
+    QHash<QString, quint32> foldIds;
+    QVector<Feature*> theFeatures;
+    QVector<quint32> freeIds;
+};
+
+#endif // TAGINDEX_H
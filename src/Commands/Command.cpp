@@ -8,6 +8,8 @@
 #include "RelationCommands.h"
 #include "NodeCommands.h"
 #include "FeatureCommands.h"
+#include "HistoryLog.h"
+#include "Global.h"
 
 #include <QApplication>
 #include <QAction>
@@ -19,14 +21,36 @@
 #include <utility>
 #include <QList>
 
+#define COMMAND_MEMORY 128 /* bytes of a command besides its strings, on average */
+#define HISTORY_MERGE_INTERVAL 1000 /* ms within which moving the same nodes again merges the moves */
+#define HISTORY_RESIDENT 32 /* commands before the current one that are never written out */
+#define HISTORY_SEGMENTS 8 /* segments written out per memory budget */
+
 Command::Command(Feature* aF)
     : mainFeature(aF), commandDirtyLevel(0), isUndone(false)
 {
     description = QApplication::translate("Command", "No description");
+    pin(aF);
 }
 
 Command::~Command()
 {
+    unpinAll();
+}
+
+void Command::pin(Feature* F)
+{
+    if (F && !Pinned.contains(F)) {
+        g_backend.pin(F);
+        Pinned << F;
+    }
+}
+
+void Command::unpinAll()
+{
+    for (int i=0; i<Pinned.size(); ++i)
+        g_backend.unpin(Pinned[i]);
+    Pinned.clear();
 }
 
 void Command::setId(const QString& id)
@@ -59,6 +83,7 @@ Feature* Command::getFeature()
 void Command::setFeature(Feature* feat)
 {
     mainFeature = feat;
+    pin(feat);
 }
 
 bool Command::buildUndoList(QListWidget* theListWidget)
@@ -73,6 +98,7 @@ bool Command::buildUndoList(QListWidget* theListWidget)
 int Command::incDirtyLevel(Layer* aLayer, Feature* F)
 {
     F->incDirtyLevel();
+    pin(F);
     aLayer->incDirtyLevel();
     return ++commandDirtyLevel;
 }
@@ -89,6 +115,27 @@ int Command::getDirtyLevel()
     return commandDirtyLevel;
 }
 
+bool Command::mergeWith(Command* /*aCommand*/)
+{
+    return false;
+}
+
+qint64 Command::memoryUse() const
+{
+    return COMMAND_MEMORY + (description.capacity() + Id.capacity() + oldCreated.capacity()) * sizeof(QChar)
+        + Pinned.size() * sizeof(Feature*);
+}
+
+void Command::detach()
+{
+    commandDirtyLevel = 0;
+}
+
+void Command::collectPinned(QList<Feature*>& theFeatures) const
+{
+    theFeatures += Pinned;
+}
+
 void Command::undo()
 {
     if (mainFeature) {
@@ -116,6 +163,8 @@ bool Command::toXML(QXmlStreamWriter& stream) const
         stream.writeAttribute("oldCreated", oldCreated);
         if (isUndone)
             stream.writeAttribute("undone", "true");
+        if (commandDirtyLevel)
+            stream.writeAttribute("dirtylevel", QString::number(commandDirtyLevel));
 //        stream.writeAttribute("description", description);
         stream.writeEndElement();
     }
@@ -134,12 +183,17 @@ void Command::fromXML(Document* d, QXmlStreamReader& stream, Command* C)
         C->oldCreated = stream.attributes().value("oldCreated").toString();
     if (stream.attributes().hasAttribute("undone"))
         C->isUndone = (stream.attributes().value("undone") == "true" ? true : false);
+    if (stream.attributes().hasAttribute("dirtylevel"))
+        C->commandDirtyLevel = stream.attributes().value("dirtylevel").toString().toInt();
     if (stream.attributes().hasAttribute("description"))
         C->description = stream.attributes().value("description").toString();
     C->mainFeature = F;
+    C->pin(F);
     stream.readNext();
 }
 
+static Command* commandFromXML(Document* d, QXmlStreamReader& stream, bool& known, bool* complete = NULL);
+
 // COMMANDLIST
 
 CommandList::CommandList()
@@ -152,6 +206,7 @@ CommandList::CommandList(QString aDesc, Feature* aFeat)
 {
     description = aDesc;
     mainFeature = aFeat;
+    pin(aFeat);
 }
 
 CommandList::~CommandList(void)
@@ -165,6 +220,16 @@ void CommandList::setReversed(bool val)
 }
 
 void CommandList::add(Command* aCommand)
+{
+    // Moving a node twice in a row is one move
+    if (Size && Size == Subs.size() && Subs[Size-1]->mergeWith(aCommand)) {
+        delete aCommand;
+        return;
+    }
+    append(aCommand);
+}
+
+void CommandList::append(Command* aCommand)
 {
     Subs.push_back(aCommand);
     Size++;
@@ -220,6 +285,49 @@ bool CommandList::buildDirtyList(DirtyList& theList)
     return Size == 0;
 }
 
+bool CommandList::mergeWith(Command* aCommand)
+{
+    CommandList* L = dynamic_cast<CommandList*>(aCommand);
+    if (!L || !Size || L->Size != Size || Size != Subs.size() || L->Size != L->Subs.size())
+        return false;
+    if (isReversed || L->isReversed || L->description != description)
+        return false;
+
+    // Only lists of moves, of the same nodes in the same order
+    for (int i=0; i<Size; ++i) {
+        MoveNodeCommand* A = dynamic_cast<MoveNodeCommand*>(Subs[i]);
+        MoveNodeCommand* B = dynamic_cast<MoveNodeCommand*>(L->Subs[i]);
+        if (!A || !B || !A->canMergeWith(B))
+            return false;
+    }
+    for (int i=0; i<Size; ++i)
+        Subs[i]->mergeWith(L->Subs[i]);
+    return true;
+}
+
+qint64 CommandList::memoryUse() const
+{
+    qint64 m = Command::memoryUse() + Subs.size() * sizeof(Command*);
+    for (int i=0; i<Subs.size(); ++i)
+        m += Subs[i]->memoryUse();
+    return m;
+}
+
+void CommandList::detach()
+{
+    // Those past Size were uploaded and are not serialized
+    Command::detach();
+    for (int i=0; i<Size; ++i)
+        Subs[i]->detach();
+}
+
+void CommandList::collectPinned(QList<Feature*>& theFeatures) const
+{
+    Command::collectPinned(theFeatures);
+    for (int i=0; i<Size; ++i)
+        Subs[i]->collectPinned(theFeatures);
+}
+
 bool CommandList::toXML(QXmlStreamWriter& stream) const
 {
     bool OK = true;
@@ -242,7 +350,7 @@ bool CommandList::toXML(QXmlStreamWriter& stream) const
     return OK;
 }
 
-CommandList* CommandList::fromXML(Document* d, QXmlStreamReader& stream)
+CommandList* CommandList::fromXML(Document* d, QXmlStreamReader& stream, bool* complete)
 {
     CommandList* l = new CommandList();
     l->setId(stream.attributes().value("xml:id").toString());
@@ -260,59 +368,17 @@ CommandList* CommandList::fromXML(Document* d, QXmlStreamReader& stream)
             l->mainFeature = (Feature*) Feature::getRelationOrCreatePlaceHolder(d, (Layer *) d->getDirtyOrOriginLayer(), IFeature::FId(IFeature::OsmRelation, stream.attributes().value("feature").toString().toLongLong()));
         }
     }
+    l->pin(l->mainFeature);
 
     stream.readNext();
     while(!stream.atEnd() && !stream.isEndElement()) {
-        if (stream.name() == "AddFeatureCommand") {
-            AddFeatureCommand* C = AddFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "MoveTrackPointCommand") {
-            MoveNodeCommand* C = MoveNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RelationAddFeatureCommand") {
-            RelationAddFeatureCommand* C = RelationAddFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RelationRemoveFeatureCommand") {
-            RelationRemoveFeatureCommand* C = RelationRemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RemoveFeatureCommand") {
-            RemoveFeatureCommand* C = RemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RoadAddTrackPointCommand") {
-            WayAddNodeCommand* C = WayAddNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RoadRemoveTrackPointCommand") {
-            WayRemoveNodeCommand* C = WayRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "TrackSegmentAddTrackPointCommand") {
-            TrackSegmentAddNodeCommand* C = TrackSegmentAddNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "TrackSegmentRemoveTrackPointCommand") {
-            TrackSegmentRemoveNodeCommand* C = TrackSegmentRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "ClearTagCommand") {
-            ClearTagCommand* C = ClearTagCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "ClearTagsCommand") {
-            ClearTagsCommand* C = ClearTagsCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "SetTagCommand") {
-            SetTagCommand* C = SetTagCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "CommandList") {
-            l->add(CommandList::fromXML(d, stream));
+        bool known;
+        Command* C = commandFromXML(d, stream, known, complete);
+        if (C)
+            l->append(C);
+        else if (known) {
+            if (complete)
+                *complete = false;
         } else if (!stream.isWhitespace()) {
                 qDebug() << "CList: logic error: " << stream.name() << " : " << stream.tokenType() << " (" << stream.lineNumber() << ")";
                 QString el = stream.readElementText(QXmlStreamReader::IncludeChildElements);
@@ -332,14 +398,53 @@ CommandList* CommandList::fromXML(Document* d, QXmlStreamReader& stream)
 
 // COMMANDHISTORY
 
-CommandHistory::CommandHistory()
-: Index(0), Size(0), UndoAction(0), RedoAction(0), UploadAction(0)
+/* The command of the element the stream is at, or NULL if it does not load.
+   known is false when the element is not a command; complete, if given, is cleared when some
+   of the commands of a list do not load. */
+static Command* commandFromXML(Document* d, QXmlStreamReader& stream, bool& known, bool* complete)
+{
+    known = true;
+    if (stream.name() == "CommandList")
+        return CommandList::fromXML(d, stream, complete);
+    else if (stream.name() == "AddFeatureCommand")
+        return AddFeatureCommand::fromXML(d, stream);
+    else if (stream.name() == "MoveTrackPointCommand")
+        return MoveNodeCommand::fromXML(d, stream);
+    else if (stream.name() == "RelationAddFeatureCommand")
+        return RelationAddFeatureCommand::fromXML(d, stream);
+    else if (stream.name() == "RelationRemoveFeatureCommand")
+        return RelationRemoveFeatureCommand::fromXML(d, stream);
+    else if (stream.name() == "RemoveFeatureCommand")
+        return RemoveFeatureCommand::fromXML(d, stream, complete);
+    else if (stream.name() == "RoadAddTrackPointCommand")
+        return WayAddNodeCommand::fromXML(d, stream);
+    else if (stream.name() == "RoadRemoveTrackPointCommand")
+        return WayRemoveNodeCommand::fromXML(d, stream);
+    else if (stream.name() == "TrackSegmentAddTrackPointCommand")
+        return TrackSegmentAddNodeCommand::fromXML(d, stream);
+    else if (stream.name() == "TrackSegmentRemoveTrackPointCommand")
+        return TrackSegmentRemoveNodeCommand::fromXML(d, stream);
+    else if (stream.name() == "ClearTagCommand")
+        return ClearTagCommand::fromXML(d, stream);
+    else if (stream.name() == "ClearTagsCommand")
+        return ClearTagsCommand::fromXML(d, stream);
+    else if (stream.name() == "SetTagCommand")
+        return SetTagCommand::fromXML(d, stream);
+
+    known = false;
+    return NULL;
+}
+
+CommandHistory::CommandHistory(Document* aDocument)
+: theDocument(aDocument), Index(0), Size(0), UndoAction(0), RedoAction(0), UploadAction(0)
+, Log(0), Spilled(0), Memory(0), Merged(0)
 {
 }
 
 CommandHistory::~CommandHistory()
 {
     cleanup();
+    delete Log;
 }
 
 void CommandHistory::cleanup()
@@ -347,17 +452,40 @@ void CommandHistory::cleanup()
     //FIXME Is there a point to this?
     //for (int i=Index; i<Subs.size(); ++i)
     //	Subs[i]->redo();
+    // What was written out is read back, so that deleting the commands gives back what they hold
+    restoreAll();
     qDeleteAll(Subs);
     Subs.clear();
     Index = 0;
     Size = 0;
+    Memory = 0;
+}
+
+void CommandHistory::cleanupUploaded(DirtyList& theUploaded)
+{
+    restoreAll();
+    for (int i=0; i<Subs.size();) {
+        if (Subs[i]->buildDirtyList(theUploaded)) {
+            Memory -= Subs[i]->memoryUse();
+            delete Subs[i];
+            Subs.removeAt(i);
+            if (i + Spilled < Index)
+                --Index;
+            --Size;
+        } else
+            ++i;
+    }
+    updateActions();
 }
 
 void CommandHistory::undo()
 {
+    // Reading a segment back may drop it, with all the older ones
+    while (Index && Index == Spilled)
+        restore();
     if (Index)
     {
-        Subs[--Index]->undo();
+        Subs[--Index - Spilled]->undo();
         updateActions();
     }
 }
@@ -366,7 +494,7 @@ void CommandHistory::redo()
 {
     if (Index < Size)
     {
-        Subs[Index++]->redo();
+        Subs[Index++ - Spilled]->redo();
         updateActions();
     }
 }
@@ -378,10 +506,141 @@ void CommandHistory::add(Command* aCommand)
     //Subs.erase(Subs.begin()+Index,Subs.end());
     //Subs.push_back(aCommand);
     //Index = Subs.size();
-    Subs.insert(Subs.begin()+Index, aCommand);
+
+    // Moving the same nodes again right away is undone as one move
+    if (Index > Spilled && LastAdded.isValid() && LastAdded.elapsed() < HISTORY_MERGE_INTERVAL
+            && Subs[Index-1 - Spilled]->mergeWith(aCommand)) {
+        delete aCommand;
+        Size = Index;
+        ++Merged;
+    } else {
+        append(aCommand);
+        trim();
+    }
+    LastAdded.start();
+    updateActions();
+}
+
+void CommandHistory::append(Command* aCommand)
+{
+    Subs.insert(Subs.begin()+Index-Spilled, aCommand);
     Index++;
     Size = Index;
-    updateActions();
+    Memory += aCommand->memoryUse();
+}
+
+void CommandHistory::trim()
+{
+    qint64 Budget = qint64(M_PREFS->getHistoryMemoryLimit()) * 1024 * 1024;
+    if (!Budget || !theDocument || Memory <= Budget)
+        return;
+
+    // Write out the oldest commands, a segment at a time, until well under the budget,
+    // so that the next commands do not each write out another one
+    while (Memory > Budget / 2) {
+        int spillable = Index - HISTORY_RESIDENT - Spilled;
+        int count = 0;
+        qint64 bytes = 0;
+        while (count < spillable && bytes < Budget / HISTORY_SEGMENTS)
+            bytes += Subs[count++]->memoryUse();
+        if (!count || !spill(count))
+            break;
+    }
+}
+
+bool CommandHistory::spill(int count)
+{
+    QByteArray xml;
+    QXmlStreamWriter stream(&xml);
+    stream.writeStartElement("CommandHistory");
+    QList<HistoryLog::Entry> entries;
+    QList<Feature*> pinned;
+    qint64 freed = 0;
+    for (int i=0; i<count; ++i) {
+        Subs[i]->toXML(stream);
+        entries << qMakePair(Subs[i]->getDescription(), Subs[i]->getFeature() ? Subs[i]->getFeature()->id() : IFeature::FId());
+        Subs[i]->collectPinned(pinned);
+        freed += Subs[i]->memoryUse();
+    }
+    stream.writeEndElement();
+
+    if (!Log)
+        Log = new HistoryLog;
+    if (!Log->push(qCompress(xml), entries))
+        return false;
+
+    // The features stay in memory, for the commands to be read back
+    foreach (Feature* F, pinned)
+        g_backend.pin(F);
+    SegmentPins << pinned;
+    for (int i=0; i<count; ++i) {
+        Subs[i]->detach();
+        delete Subs[i];
+    }
+    Subs.erase(Subs.begin(), Subs.begin()+count);
+    Spilled += count;
+    Memory -= freed;
+    return true;
+}
+
+void CommandHistory::restore()
+{
+    int count = Log->entries(Log->segments()-1).size();
+    QByteArray xml = qUncompress(Log->pop());
+
+    bool OK = !xml.isEmpty();
+    QList<Command*> restored;
+    QXmlStreamReader stream(xml);
+    if (OK && stream.readNextStartElement() && stream.name() == "CommandHistory") {
+        stream.readNext();
+        while(!stream.atEnd() && !stream.isEndElement()) {
+            bool known;
+            Command* C = commandFromXML(theDocument, stream, known, &OK);
+            if (C)
+                restored << C;
+            else if (known)
+                OK = false;
+            stream.readNext();
+        }
+    }
+
+    // The commands pin their features again as they are read back
+    foreach (Feature* F, SegmentPins.takeLast())
+        g_backend.unpin(F);
+
+    if (!OK || restored.size() != count) {
+        // Undoing past the commands lost would apply the older ones to a state they were not
+        // recorded against: the older history cannot be undone anymore
+        foreach (Command* C, restored) {
+            C->detach();
+            delete C;
+        }
+        dropSpilled();
+        return;
+    }
+
+    Subs = restored + Subs;
+    Spilled -= count;
+    foreach (Command* C, restored)
+        Memory += C->memoryUse();
+}
+
+/* Forgets the history written out. It is all before the current command, as only that is written out */
+void CommandHistory::dropSpilled()
+{
+    Index -= Spilled;
+    Size -= Spilled;
+    Spilled = 0;
+    Log->clear();
+    while (!SegmentPins.isEmpty())
+        foreach (Feature* F, SegmentPins.takeLast())
+            g_backend.unpin(F);
+}
+
+void CommandHistory::restoreAll()
+{
+    while (Spilled)
+        restore();
 }
 
 void CommandHistory::setActions(QAction* anUndo, QAction* aRedo, QAction* anUploadAction)
@@ -399,7 +658,7 @@ void CommandHistory::updateActions()
     if (RedoAction)
         RedoAction->setEnabled(Index<Size);
     if (UploadAction && !M_PREFS->getOfflineMode())
-        UploadAction->setEnabled(Subs.size());
+        UploadAction->setEnabled(Subs.size() + Spilled);
 }
 
 int CommandHistory::index() const
@@ -412,8 +671,23 @@ int CommandHistory::size() const
     return Size;
 }
 
+CommandHistoryStatistics CommandHistory::statistics() const
+{
+    CommandHistoryStatistics S;
+    S.Resident = Subs.size();
+    S.Spilled = Spilled;
+    S.Segments = Log ? Log->segments() : 0;
+    S.Merged = Merged;
+    S.Memory = Memory;
+    S.Disk = Log ? Log->size() : 0;
+    S.Budget = qint64(M_PREFS->getHistoryMemoryLimit()) * 1024 * 1024;
+    return S;
+}
+
 int CommandHistory::buildDirtyList(DirtyList& theList)
 {
+    restoreAll();
+
     for (int i=0; i<Subs.size();)
         if (Subs[i]->buildDirtyList(theList))
         {
@@ -433,11 +707,18 @@ int CommandHistory::buildDirtyList(DirtyList& theList)
 
 int CommandHistory::buildUndoList(QListWidget* theList)
 {
-    for (int i=0; i<Index; ++i)
-        if (!(i < Subs.size()))
+    for (int s=0; Log && s<Log->segments(); ++s)
+        foreach (const HistoryLog::Entry& E, Log->entries(s)) {
+            QListWidgetItem* it = new QListWidgetItem(E.first, theList);
+            if (E.second.type != IFeature::Uninitialized)
+                it->setData(Qt::UserRole, QVariant::fromValue(E.second));
+        }
+
+    for (int i=Spilled; i<Index; ++i)
+        if (!(i-Spilled < Subs.size()))
             qDebug() << "!!! Error: Undo Index > list size";
         else
-            Subs[i]->buildUndoList(theList);
+            Subs[i-Spilled]->buildUndoList(theList);
 
     return Index;
 }
@@ -450,8 +731,25 @@ bool CommandHistory::toXML(QXmlStreamWriter& stream, QProgressDialog * /*progres
 
     stream.writeAttribute("index", QString::number(Index));
 
-    for (int i=0; i<Size; ++i) {
-        OK = Subs[i]->toXML(stream);
+    // The commands written out are copied from the log, without the root of their segment
+    for (int s=0; Log && s<Log->segments(); ++s) {
+        QByteArray xml = qUncompress(Log->segment(s));
+        if (xml.isEmpty())
+            OK = false;
+        QXmlStreamReader reader(xml);
+        int depth = 0;
+        while (!reader.atEnd()) {
+            reader.readNext();
+            if (reader.isEndElement())
+                --depth;
+            if (depth > 0)
+                stream.writeCurrentToken(reader);
+            if (reader.isStartElement())
+                ++depth;
+        }
+    }
+    for (int i=Spilled; i<Size; ++i) {
+        OK = Subs[i-Spilled]->toXML(stream);
     }
     stream.writeEndElement();
 
@@ -461,97 +759,27 @@ bool CommandHistory::toXML(QXmlStreamWriter& stream, QProgressDialog * /*progres
 CommandHistory* CommandHistory::fromXML(Document* d, QXmlStreamReader& stream, QProgressDialog * progress)
 {
     bool OK = true;
-    CommandHistory* h = new CommandHistory();
+    CommandHistory* h = new CommandHistory(d);
     int index = stream.attributes().value("index").toString().toUInt();
 
     stream.readNext();
     while(!stream.atEnd() && !stream.isEndElement()) {
-        if (stream.name() == "CommandList") {
-            CommandList* l = CommandList::fromXML(d, stream);
-            if (l)
-                h->add(l);
-            else
-                OK = false;
-        } else if (stream.name() == "AddFeatureCommand") {
-            AddFeatureCommand* C = AddFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "MoveTrackPointCommand") {
-            MoveNodeCommand* C = MoveNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RelationAddFeatureCommand") {
-            RelationAddFeatureCommand* C = RelationAddFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RelationRemoveFeatureCommand") {
-            RelationRemoveFeatureCommand* C = RelationRemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RemoveFeatureCommand") {
-            RemoveFeatureCommand* C = RemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RoadAddTrackPointCommand") {
-            WayAddNodeCommand* C = WayAddNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RoadRemoveTrackPointCommand") {
-            WayRemoveNodeCommand* C = WayRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "TrackSegmentAddTrackPointCommand") {
-            TrackSegmentAddNodeCommand* C = TrackSegmentAddNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "TrackSegmentRemoveTrackPointCommand") {
-            TrackSegmentRemoveNodeCommand* C = TrackSegmentRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "ClearTagCommand") {
-            ClearTagCommand* C = ClearTagCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "ClearTagsCommand") {
-            ClearTagsCommand* C = ClearTagsCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "SetTagCommand") {
-            SetTagCommand* C = SetTagCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (!stream.isWhitespace()) {
+        bool known;
+        Command* C = commandFromXML(d, stream, known);
+        if (C)
+            h->append(C);
+        else if (known)
+            OK = false;
+        else if (!stream.isWhitespace()) {
             qDebug() << "CHist: logic error: " << stream.name() << " : " << stream.tokenType() << " (" << stream.lineNumber() << ")";
             QString el = stream.readElementText(QXmlStreamReader::IncludeChildElements);
         }
 
-        progress->setValue(stream.characterOffset());
-        if (progress && progress->wasCanceled())
-            break;
+        if (progress) {
+            progress->setValue(stream.characterOffset());
+            if (progress->wasCanceled())
+                break;
+        }
 
         stream.readNext();
     }
@@ -561,11 +789,10 @@ CommandHistory* CommandHistory::fromXML(Document* d, QXmlStreamReader& stream, Q
         qDebug() << "-- Size: " << h->Size;
         qDebug() << "-- Index: " << h->Index;
         delete h;
-        h = new CommandHistory();
+        h = new CommandHistory(d);
     } else
         h->Index = index;
 
     return h;
 }
 
-
@@ -2,6 +2,7 @@
 #define MERKATOR_COMMAND_H_
 
 #include <QList>
+#include <QElapsedTimer>
 #include <QtXml>
 
 #define KEY_UNDEF_VALUE "%%%%%"
@@ -12,6 +13,7 @@ class Layer;
 class Feature;
 class DirtyList;
 class CommandList;
+class HistoryLog;
 
 class QAction;
 class QListWidget;
@@ -42,7 +44,21 @@ class Command
         int decDirtyLevel(Layer* aLayer, Feature* F);
         int getDirtyLevel();
 
+        /* Takes over aCommand, done right after this one, so that aCommand can be deleted.
+           Returns false, changing nothing, if the two are not one change to the same features. */
+        virtual bool mergeWith(Command* aCommand);
+        /* An estimate of the memory held by the command, in bytes */
+        virtual qint64 memoryUse() const;
+        /* Drops what deleting the command would give back (dirty levels, removed features),
+           as the command lives on serialized */
+        virtual void detach();
+        /* Appends the features the command keeps in memory */
+        virtual void collectPinned(QList<Feature*>& theFeatures) const;
+
     protected:
+        /* Keeps the feature in memory for as long as the command refers to it */
+        void pin(Feature* F);
+
         mutable QString Id;
         QString description;
         Feature* mainFeature;
@@ -50,6 +66,11 @@ class Command
         QString oldCreated;
         bool isUndone;
         bool wasUploaded;
+
+    private:
+        void unpinAll();
+
+        QList<Feature*> Pinned;
 };
 
 class CommandList : public Command
@@ -67,22 +88,47 @@ class CommandList : public Command
         virtual bool buildDirtyList(DirtyList& theList);
         void setReversed(bool val);
 
+        virtual bool mergeWith(Command* aCommand);
+        virtual qint64 memoryUse() const;
+        virtual void detach();
+        virtual void collectPinned(QList<Feature*>& theFeatures) const;
+
         virtual bool toXML(QXmlStreamWriter& stream) const;
-        static CommandList* fromXML(Document* d, QXmlStreamReader& stream);
+        /* complete, if given, is cleared when some of the commands of the list do not load */
+        static CommandList* fromXML(Document* d, QXmlStreamReader& stream, bool* complete = NULL);
 
     private:
+        void append(Command* aCommand);
+
         QList<Command*> Subs;
         int Size;
         bool isReversed;
 };
 
+/* Where the history is kept */
+struct CommandHistoryStatistics
+{
+    int Resident;           // commands in memory
+    int Spilled;            // commands in the log
+    int Segments;
+    int Merged;             // commands merged into the one before
+    qint64 Memory;          // estimated, of the commands in memory
+    qint64 Disk;            // used by the log
+    qint64 Budget;          // 0 when unbounded
+};
+
+/* The undo history. Consecutive moves of the same nodes are merged; once the commands use more
+   memory than the budget of the preferences, the oldest are written out to a temporary log and
+   read back when undo reaches them. */
 class CommandHistory
 {
     public:
-        CommandHistory();
+        CommandHistory(Document* aDocument = NULL);
         virtual ~CommandHistory();
 
         void cleanup();
+        /* Deletes the commands theUploaded reports done, keeping the others in order */
+        void cleanupUploaded(DirtyList& theUploaded);
         void undo();
         void redo();
         void add(Command* aCommand);
@@ -92,17 +138,34 @@ class CommandHistory
         int buildUndoList(QListWidget* theList);
         int index() const;
         int size() const;
+        CommandHistoryStatistics statistics() const;
 
         virtual bool toXML(QXmlStreamWriter& stream, QProgressDialog * progress) const;
         static CommandHistory* fromXML(Document* d, QXmlStreamReader& stream, QProgressDialog * progress);
 
     private:
-        QList<Command*> Subs;
+        void append(Command* aCommand);
+        void trim();
+        bool spill(int count);
+        /* Reads back the newest segment; if some of its commands cannot be read back, it is dropped
+           with all older history */
+        void restore();
+        void dropSpilled();
+        void restoreAll();
+
+        Document* theDocument;
+        QList<Command*> Subs;       // from index Spilled on
         int Index;
         int Size;
         QAction* UndoAction;
         QAction* RedoAction;
         QAction* UploadAction;
+        HistoryLog* Log;
+        QList<QList<Feature*> > SegmentPins;    // kept in memory for each segment written out
+        int Spilled;
+        qint64 Memory;
+        int Merged;
+        QElapsedTimer LastAdded;
 };
 
 #endif
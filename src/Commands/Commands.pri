@@ -3,6 +3,7 @@ DEPENDPATH += $$MERKAARTOR_SRC_DIR/Commands
 
 HEADERS += \
     Command.h \
+    HistoryLog.h \
     DocumentCommands.h \
     FeatureCommands.h \
     RelationCommands.h \
@@ -12,6 +13,7 @@ HEADERS += \
 
 SOURCES += \
     Command.cpp \
+    HistoryLog.cpp \
     DocumentCommands.cpp \
     FeatureCommands.cpp \
     NodeCommands.cpp \
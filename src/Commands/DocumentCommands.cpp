@@ -99,6 +99,7 @@ AddFeatureCommand * AddFeatureCommand::fromXML(Document* d, QXmlStreamReader& st
         return NULL;
 
     a->theFeature = F;
+    a->pin(F);
     a->UserAdded = (stream.attributes().value("useradded") == "true" ? true : false);
 
     stream.readNext();
@@ -129,6 +130,8 @@ RemoveFeatureCommand::RemoveFeatureCommand(Document *theDocument, Feature *aFeat
 RemoveFeatureCommand::RemoveFeatureCommand(Document *theDocument, Feature *aFeature, const QList<Feature*>& Alternatives)
 : Command(aFeature), theLayer(0), theFeature(aFeature), CascadedCleanUp(0), RemoveExecuted(false), theAlternatives(Alternatives)
 {
+    for (int i=0; i<theAlternatives.size(); ++i)
+        pin(theAlternatives[i]);
     CascadedCleanUp  = new CommandList(QApplication::tr("Cascaded cleanup"), NULL);
     while (aFeature->sizeParents()) {
         Feature* f = CAST_FEATURE(aFeature->getParent(0));
@@ -150,11 +153,35 @@ RemoveFeatureCommand::~RemoveFeatureCommand()
     if (oldLayer)
         oldLayer->decDirtyLevel(commandDirtyLevel);
     SAFE_DELETE(CascadedCleanUp);
-    if (theLayer->getDocument()->exists(theFeature) && theFeature->isDeleted()) {
+    if (theFeature && theLayer->getDocument()->exists(theFeature) && theFeature->isDeleted()) {
         theLayer->getDocument()->deleteFeature(theFeature);
     }
 }
 
+qint64 RemoveFeatureCommand::memoryUse() const
+{
+    qint64 m = Command::memoryUse() + theAlternatives.size() * sizeof(Feature*);
+    if (CascadedCleanUp)
+        m += CascadedCleanUp->memoryUse();
+    return m;
+}
+
+void RemoveFeatureCommand::detach()
+{
+    // The removed feature is kept for the command to be read back
+    Command::detach();
+    if (CascadedCleanUp)
+        CascadedCleanUp->detach();
+    theFeature = NULL;
+}
+
+void RemoveFeatureCommand::collectPinned(QList<Feature*>& theFeatures) const
+{
+    Command::collectPinned(theFeatures);
+    if (CascadedCleanUp)
+        CascadedCleanUp->collectPinned(theFeatures);
+}
+
 void RemoveFeatureCommand::redo()
 {
     if (!theFeature)
@@ -246,7 +273,7 @@ bool RemoveFeatureCommand::toXML(QXmlStreamWriter& stream) const
     return OK;
 }
 
-RemoveFeatureCommand * RemoveFeatureCommand::fromXML(Document* d, QXmlStreamReader& stream)
+RemoveFeatureCommand * RemoveFeatureCommand::fromXML(Document* d, QXmlStreamReader& stream, bool* complete)
 {
     RemoveFeatureCommand* a = new RemoveFeatureCommand();
 
@@ -263,11 +290,12 @@ RemoveFeatureCommand * RemoveFeatureCommand::fromXML(Document* d, QXmlStreamRead
     if (!(F = d->getFeature(IFeature::FId(IFeature::All, stream.attributes().value("feature").toString().toLongLong()))))
         return NULL;
     a->theFeature = F;
+    a->pin(F);
 
     stream.readNext();
     while(!stream.atEnd() && !stream.isEndElement()) {
         if (stream.name() == "Cascaded") {
-            a->CascadedCleanUp = CommandList::fromXML(d, stream);
+            a->CascadedCleanUp = CommandList::fromXML(d, stream, complete);
         } else if (stream.name() == "Command") {
             Command::fromXML(d, stream, a);
         }
@@ -41,9 +41,12 @@ class RemoveFeatureCommand : public Command
         void undo();
         void redo();
         bool buildDirtyList(DirtyList& theList);
+        qint64 memoryUse() const;
+        void detach();
+        void collectPinned(QList<Feature*>& theFeatures) const;
 
         virtual bool toXML(QXmlStreamWriter& stream) const;
-        static RemoveFeatureCommand* fromXML(Document* d, QXmlStreamReader& stream);
+        static RemoveFeatureCommand* fromXML(Document* d, QXmlStreamReader& stream, bool* complete = NULL);
 
     private:
         Layer* theLayer;
@@ -54,6 +54,16 @@ bool TagCommand::buildDirtyList(DirtyList& theList)
     return theList.noop(theFeature);
 }
 
+qint64 TagCommand::memoryUse() const
+{
+    qint64 m = Command::memoryUse();
+    for (int i=0; i<Before.size(); ++i)
+        m += sizeof(Before[i]) + (Before[i].first.capacity() + Before[i].second.capacity()) * sizeof(QChar);
+    for (int i=0; i<After.size(); ++i)
+        m += sizeof(After[i]) + (After[i].first.capacity() + After[i].second.capacity()) * sizeof(QChar);
+    return m;
+}
+
 SetTagCommand::SetTagCommand(Feature* aF)
 : TagCommand(aF, 0), theIdx(0), theK(""), theV("")
 {
@@ -171,6 +181,7 @@ SetTagCommand * SetTagCommand::fromXML(Document * d, QXmlStreamReader& stream)
     if (stream.attributes().hasAttribute("oldkey"))
         a->oldK = stream.attributes().value("oldkey").toString();
     a->theFeature = F;
+    a->pin(F);
     a->theIdx = stream.attributes().value("idx").toString().toInt();
     a->theK = stream.attributes().value("key").toString();
     a->theV = stream.attributes().value("value").toString();
@@ -276,6 +287,7 @@ ClearTagsCommand * ClearTagsCommand::fromXML(Document * d, QXmlStreamReader& str
     ClearTagsCommand* a = new ClearTagsCommand(F);
     a->setId(stream.attributes().value("xml:id").toString());
     a->theFeature = F;
+    a->pin(F);
     if (stream.attributes().hasAttribute("layer"))
         a->theLayer = d->getLayer(stream.attributes().value("layer").toString());
     else
@@ -385,6 +397,7 @@ ClearTagCommand * ClearTagCommand::fromXML(Document * d, QXmlStreamReader& strea
     ClearTagCommand* a = new ClearTagCommand(F);
     a->setId(stream.attributes().value("xml:id").toString());
     a->theFeature = F;
+    a->pin(F);
     a->theIdx = stream.attributes().value("idx").toString().toInt();
     a->theK = stream.attributes().value("key").toString();
     a->theV = stream.attributes().value("value").toString();
@@ -22,6 +22,7 @@ class TagCommand : public Command
         virtual void undo() = 0;
         virtual void redo() = 0;
         virtual bool buildDirtyList(DirtyList& theList);
+        virtual qint64 memoryUse() const;
 
     protected:
         Feature* theFeature;
@@ -0,0 +1,76 @@
+#include "HistoryLog.h"
+
+#include <QDir>
+#include <QTemporaryFile>
+#include <QDebug>
+
+HistoryLog::HistoryLog()
+    : theFile(0)
+{
+}
+
+HistoryLog::~HistoryLog()
+{
+    delete theFile;
+}
+
+bool HistoryLog::push(const QByteArray& data, const QList<Entry>& someEntries)
+{
+    if (!theFile) {
+        theFile = new QTemporaryFile(QDir::tempPath() + "/merkaartor-history-XXXXXX");
+        if (!theFile->open()) {
+            qDebug() << "HistoryLog: cannot create" << theFile->fileName();
+            delete theFile;
+            theFile = 0;
+            return false;
+        }
+    }
+
+    Segment S;
+    S.offset = size();
+    S.length = data.size();
+    S.entries = someEntries;
+    if (!theFile->seek(S.offset) || theFile->write(data) != S.length || !theFile->flush()) {
+        qDebug() << "HistoryLog: cannot write to" << theFile->fileName();
+        theFile->resize(S.offset);
+        return false;
+    }
+    theSegments << S;
+    return true;
+}
+
+QByteArray HistoryLog::pop()
+{
+    if (theSegments.isEmpty())
+        return QByteArray();
+
+    QByteArray data = segment(theSegments.size()-1);
+    theFile->resize(theSegments.last().offset);
+    theSegments.removeLast();
+    return data;
+}
+
+QByteArray HistoryLog::segment(int i) const
+{
+    const Segment& S = theSegments.at(i);
+    if (!theFile->seek(S.offset))
+        return QByteArray();
+    QByteArray data = theFile->read(S.length);
+    if (data.size() != S.length)
+        return QByteArray();
+    return data;
+}
+
+void HistoryLog::clear()
+{
+    theSegments.clear();
+    if (theFile)
+        theFile->resize(0);
+}
+
+qint64 HistoryLog::size() const
+{
+    if (theSegments.isEmpty())
+        return 0;
+    return theSegments.last().offset + theSegments.last().length;
+}
@@ -0,0 +1,51 @@
+#ifndef MERKAARTOR_HISTORYLOG_H_
+#define MERKAARTOR_HISTORYLOG_H_
+
+#include "IFeature.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+class QTemporaryFile;
+
+/* The oldest part of an undo history, written out to a temporary file a segment of commands at a
+   time. Segments are taken back newest first, as undo reaches them, so the file is a stack.
+   Each segment keeps the description and feature of its commands for the list of changes. */
+class HistoryLog
+{
+public:
+    typedef QPair<QString, IFeature::FId> Entry;
+
+    HistoryLog();
+    ~HistoryLog();
+
+    /* Appends the serialized commands; returns false if the file could not be written */
+    bool push(const QByteArray& data, const QList<Entry>& someEntries);
+    /* Removes the newest segment and returns its data, or an empty array if it cannot be read */
+    QByteArray pop();
+    void clear();
+
+    int segments() const { return theSegments.size(); }
+    bool isEmpty() const { return theSegments.isEmpty(); }
+    /* The data of segment i, oldest first, without removing it */
+    QByteArray segment(int i) const;
+    const QList<Entry>& entries(int i) const { return theSegments.at(i).entries; }
+
+    /* Bytes used in the file */
+    qint64 size() const;
+
+private:
+    struct Segment
+    {
+        qint64 offset;
+        qint64 length;
+        QList<Entry> entries;
+    };
+
+    QTemporaryFile* theFile;
+    QList<Segment> theSegments;
+};
+
+#endif
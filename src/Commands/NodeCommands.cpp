@@ -70,6 +70,28 @@ bool MoveNodeCommand::buildDirtyList(DirtyList &theList)
     return theList.noop(thePoint);
 }
 
+bool MoveNodeCommand::canMergeWith(const MoveNodeCommand* aCommand) const
+{
+    // The second move starts where the first ended, without changing layer
+    return aCommand->thePoint == thePoint && !isUndone && !aCommand->isUndone
+            && aCommand->theLayer == aCommand->oldLayer && aCommand->OldPos == NewPos;
+}
+
+bool MoveNodeCommand::mergeWith(Command* aCommand)
+{
+    MoveNodeCommand* C = dynamic_cast<MoveNodeCommand*>(aCommand);
+    if (!C || !canMergeWith(C))
+        return false;
+
+    // Undone, the second move gives back the dirty level it took; detached, it does not give it
+    // back a second time when deleted
+    C->undo();
+    C->detach();
+    NewPos = C->NewPos;
+    thePoint->setPosition(NewPos);
+    return true;
+}
+
 bool MoveNodeCommand::toXML(QXmlStreamWriter& stream) const
 {
     bool OK = true;
@@ -108,6 +130,7 @@ MoveNodeCommand * MoveNodeCommand::fromXML(Document * d, QXmlStreamReader& strea
         return NULL;
 
     a->thePoint = Feature::getNodeOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong()));
+    a->pin(a->thePoint);
     a->description = QApplication::tr("Move node %1").arg(a->thePoint->description());
 
     stream.readNext();
@@ -18,6 +18,8 @@ class MoveNodeCommand : public Command
         void undo();
         void redo();
         bool buildDirtyList(DirtyList& theList);
+        bool canMergeWith(const MoveNodeCommand* aCommand) const;
+        bool mergeWith(Command* aCommand);
 
         virtual bool toXML(QXmlStreamWriter& stream) const;
         static MoveNodeCommand* fromXML(Document* d,QXmlStreamReader& stream);
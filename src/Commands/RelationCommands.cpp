@@ -15,6 +15,7 @@ RelationAddFeatureCommand::RelationAddFeatureCommand(Relation* R, const QString&
 {
     if (!theLayer)
         theLayer = theRelation->layer();
+    pin(theMapFeature);
     redo();
 }
 
@@ -23,6 +24,7 @@ RelationAddFeatureCommand::RelationAddFeatureCommand(Relation* R, const QString&
 {
     if (!theLayer)
         theLayer = theRelation->layer();
+    pin(theMapFeature);
     redo();
 }
 
@@ -122,6 +124,8 @@ RelationAddFeatureCommand * RelationAddFeatureCommand::fromXML(Document * d, QXm
     }
     a->Role = stream.attributes().value("role").toString();
     a->theMapFeature = F;
+    a->pin(a->theRelation);
+    a->pin(a->theMapFeature);
     a->Position = stream.attributes().value("pos").toString().toUInt();
 
     stream.readNext();
@@ -148,6 +152,7 @@ RelationRemoveFeatureCommand::RelationRemoveFeatureCommand(Relation* R, Feature*
     if (!theLayer)
         theLayer = theRelation->layer();
     Role = R->getRole(Idx);
+    pin(theMapFeature);
     redo();
 }
 
@@ -156,6 +161,7 @@ RelationRemoveFeatureCommand::RelationRemoveFeatureCommand(Relation* R, int anId
 {
     if (!theLayer)
         theLayer = theRelation->layer();
+    pin(theMapFeature);
     redo();
 }
 
@@ -256,6 +262,8 @@ RelationRemoveFeatureCommand * RelationRemoveFeatureCommand::fromXML(Document *
             return NULL;
     }
     a->theMapFeature = F;
+    a->pin(a->theRelation);
+    a->pin(a->theMapFeature);
     a->Idx = stream.attributes().value("index").toString().toInt();
     a->Role = stream.attributes().value("role").toString();
 
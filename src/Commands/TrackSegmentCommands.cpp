@@ -13,12 +13,14 @@ TrackSegmentAddNodeCommand::TrackSegmentAddNodeCommand(TrackSegment* R)
 TrackSegmentAddNodeCommand::TrackSegmentAddNodeCommand(TrackSegment* R, TrackNode* W, Layer* aLayer)
 : Command(R), theLayer(aLayer), oldLayer(0), theTrackSegment(R), theNode(W), Position(theTrackSegment->size())
 {
+    pin(theNode);
     redo();
 }
 
 TrackSegmentAddNodeCommand::TrackSegmentAddNodeCommand(TrackSegment* R, TrackNode* W, int aPos, Layer* aLayer)
 : Command(R), theLayer(aLayer), oldLayer(0), theTrackSegment(R), theNode(W), Position(aPos)
 {
+    pin(theNode);
     redo();
 }
 
@@ -92,6 +94,8 @@ TrackSegmentAddNodeCommand * TrackSegmentAddNodeCommand::fromXML(Document * d, Q
 
     a->theTrackSegment = dynamic_cast<TrackSegment*>(d->getFeature(IFeature::FId(IFeature::GpxSegment, stream.attributes().value("tracksegment").toString().toLongLong())));
     a->theNode = Feature::getTrackNodeOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong()));
+    a->pin(a->theTrackSegment);
+    a->pin(a->theNode);
     a->Position = stream.attributes().value("pos").toString().toUInt();
 
     return a;
@@ -107,12 +111,14 @@ TrackSegmentRemoveNodeCommand::TrackSegmentRemoveNodeCommand(TrackSegment* R)
 TrackSegmentRemoveNodeCommand::TrackSegmentRemoveNodeCommand(TrackSegment* R, TrackNode* W, Layer* aLayer)
 : Command(R), theLayer(aLayer), oldLayer(0), Idx(R->find(W)), theTrackSegment(R), theTrackPoint(W)
 {
+    pin(theTrackPoint);
     redo();
 }
 
 TrackSegmentRemoveNodeCommand::TrackSegmentRemoveNodeCommand(TrackSegment* R, int anIdx, Layer* aLayer)
 : Command(R), theLayer(aLayer), oldLayer(0), Idx(anIdx), theTrackSegment(R), theTrackPoint(CAST_TRACKNODE(R->get(anIdx)))
 {
+    pin(theTrackPoint);
     redo();
 }
 
@@ -186,6 +192,8 @@ TrackSegmentRemoveNodeCommand * TrackSegmentRemoveNodeCommand::fromXML(Document
 
     a->theTrackSegment = dynamic_cast<TrackSegment*>(d->getFeature(IFeature::FId(IFeature::GpxSegment, stream.attributes().value("tracksegment").toString().toLongLong())));
     a->theTrackPoint = Feature::getTrackNodeOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong()));
+    a->pin(a->theTrackSegment);
+    a->pin(a->theTrackPoint);
     a->Idx = stream.attributes().value("index").toString().toUInt();
 
     return a;
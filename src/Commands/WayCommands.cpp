@@ -15,6 +15,7 @@ WayAddNodeCommand::WayAddNodeCommand(Way* R, Node* W, Layer* aLayer)
 {
     if (!theLayer)
         theLayer = theRoad->layer();
+    pin(theTrackPoint);
     redo();
 }
 
@@ -23,6 +24,7 @@ WayAddNodeCommand::WayAddNodeCommand(Way* R, Node* W, int aPos, Layer* aLayer)
 {
     if (!theLayer)
         theLayer = theRoad->layer();
+    pin(theTrackPoint);
     redo();
 }
 
@@ -107,6 +109,8 @@ WayAddNodeCommand * WayAddNodeCommand::fromXML(Document * d, QXmlStreamReader& s
 
     a->theRoad = Feature::getWayOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::LineString, stream.attributes().value("road").toString().toLongLong()));
     a->theTrackPoint = Feature::getNodeOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong()));
+    a->pin(a->theRoad);
+    a->pin(a->theTrackPoint);
     a->Position = stream.attributes().value("pos").toString().toUInt();
 
     stream.readNext();
@@ -132,6 +136,7 @@ WayRemoveNodeCommand::WayRemoveNodeCommand(Way* R, Node* W, Layer* aLayer)
 {
     if (!theLayer)
         theLayer = theRoad->layer();
+    pin(theNode);
     redo();
 }
 
@@ -140,6 +145,7 @@ WayRemoveNodeCommand::WayRemoveNodeCommand(Way* R, int anIdx, Layer* aLayer)
 {
     if (!theLayer)
         theLayer = theRoad->layer();
+    pin(theNode);
     redo();
 }
 
@@ -237,6 +243,8 @@ WayRemoveNodeCommand * WayRemoveNodeCommand::fromXML(Document * d, QXmlStreamRea
     a->wasClosed = (stream.attributes().hasAttribute("closed") && stream.attributes().value("closed") == "true");
     a->theRoad = Feature::getWayOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::LineString, stream.attributes().value("road").toString().toLongLong()));
     a->theNode = Feature::getNodeOrCreatePlaceHolder(d, a->theLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong()));
+    a->pin(a->theRoad);
+    a->pin(a->theNode);
     a->Idx = stream.attributes().value("index").toString().toUInt();
 
     stream.readNext();
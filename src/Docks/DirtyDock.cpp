@@ -77,6 +77,12 @@ void DirtyDock::updateList()
 
     Main->document()->history().buildUndoList(ui.ChangesList);
 
+    CommandHistoryStatistics stats = Main->document()->history().statistics();
+    ui.ChangesList->setToolTip(tr("History: %1 changes in memory (%2 KB), %3 written out (%4 KB), %5 merged")
+                               .arg(stats.Resident).arg(stats.Memory / 1024)
+                               .arg(stats.Spilled).arg(stats.Disk / 1024)
+                               .arg(stats.Merged));
+
     if (!M_PREFS->getAutoHistoryCleanup()) {
         if (!dirtyObjects)
             ui.pbCleanupHistory->setEnabled(true);
@@ -275,13 +275,7 @@ void FeaturesDock::on_btFind_clicked(bool)
     if (!tsel)
         return;
 
-    Found.clear();
-    int added = 0;
-    for (VisibleFeatureIterator i(Main->document()); !i.isEnd() && (!dlg->sbMaxResult->value() || added < dlg->sbMaxResult->value()); ++i) {
-        if (tsel->matches(i.get(), Main->view()->pixelPerM())) {
-            Found << i.get();
-        }
-    }
+    Found = Main->document()->findFeatures(tsel, Main->view()->pixelPerM(), dlg->sbMaxResult->value());
 
     findMode = true;
     ui.tabBar->blockSignals(true);
@@ -10,7 +10,9 @@
 #include "NodeCommands.h"
 #include "Document.h"
 #include "Layer.h"
+#include "FilterEngine.h"
 #include "MasPaintStyle.h"
+#include "MapCSSPaintstyle.h"
 #include "TagSelector.h"
 #include "MapView.h"
 #include "PropertiesDock.h"
@@ -90,7 +92,7 @@ public:
     FeaturePrivate(Feature* aFeature)
         :  LastActor(Feature::User)
         , PossiblePaintersUpToDate(false)
-        , PixelPerMForPainter(-1), CurrentPainter(0), HasPainter(false)
+        , PixelPerMForPainter(-1), CurrentPainter(0), HasPainter(false), StyleClass(-1)
         , theFeature(aFeature), LastPartNotification(0)
         , Deleted(false), Visible(true), Uploaded(false), FilterRevision(-1)
         , Virtual(false), Special(false), DirtyLevel(0)
@@ -107,7 +109,7 @@ public:
     FeaturePrivate(const FeaturePrivate& other)
         : Tags(other.Tags), LastActor(other.LastActor)
         , PossiblePaintersUpToDate(false)
-        , PixelPerMForPainter(-1), CurrentPainter(0), HasPainter(false)
+        , PixelPerMForPainter(-1), CurrentPainter(0), HasPainter(false), StyleClass(-1)
         , theFeature(NULL), LastPartNotification(0)
         , Deleted(false), Visible(true), Uploaded(false), FilterRevision(-1)
         , Virtual(other.Virtual), Special(other.Special), DirtyLevel(0)
@@ -124,6 +126,8 @@ public:
     void updatePossiblePainters();
     void blankPainters();
     void updatePainters(qreal PixelPerM);
+    void invalidateStyle();
+    static void invalidateChildPainters(Feature* F, int depth);
 #ifndef FRISIUS_BUILD
     void initVersionNumber()
     {
@@ -141,6 +145,7 @@ public:
     qreal PixelPerMForPainter; // 8
     const FeaturePainter* CurrentPainter; // 4
     bool HasPainter; // 1
+    int StyleClass; // 4
     Feature* theFeature; // 4
     QList<Feature*> Parents; // 4
     int LastPartNotification; // 4
@@ -176,6 +181,8 @@ Feature::Feature(const Feature& other)
     p = new FeaturePrivate(*other.p);
     p->Id = IFeature::FId(IFeature::Uninitialized, 0);
     p->theFeature = this;
+    for (int i=0; i<p->Tags.size(); ++i)
+        g_backend.tagIndex().insert(this, p->Tags[i].first, p->Tags[i].second);
 }
 
 Feature::~Feature(void)
@@ -184,6 +191,9 @@ Feature::~Feature(void)
     //      Check for side effect of supressing them.
 //    while (sizeParents())
 //        getParent(0)->remove(this);
+    for (int i=0; i<p->Tags.size(); ++i)
+        g_backend.tagIndex().remove(this, p->Tags[i].first, p->Tags[i].second);
+    g_backend.tagIndex().release(this);
     delete p;
 }
 
@@ -445,13 +455,17 @@ void Feature::setTag(int index, const QString& key, const QString& value)
             if (p->Tags[i].second == pi.second)
                 return;
             g_removeFromTagList(p->Tags[i].first, p->Tags[i].second);
+            g_backend.tagIndex().remove(this, p->Tags[i].first, p->Tags[i].second);
             p->Tags[i].second = pi.second;
+            g_backend.tagIndex().insert(this, pi.first, pi.second);
             break;
         }
     if (i == p->Tags.size()) {
         p->Tags.insert(p->Tags.begin() + index, pi);
+        g_backend.tagIndex().insert(this, pi.first, pi.second);
     }
-    invalidatePainter();
+    p->FilterRevision = -1;
+    p->invalidateStyle();
     invalidateMeta();
 }
 
@@ -469,24 +483,30 @@ void Feature::setTag(const QString& key, const QString& value)
             if (p->Tags[i].second == pi.second)
                 return;
             g_removeFromTagList(p->Tags[i].first, p->Tags[i].second);
+            g_backend.tagIndex().remove(this, p->Tags[i].first, p->Tags[i].second);
             p->Tags[i].second = pi.second;
+            g_backend.tagIndex().insert(this, pi.first, pi.second);
             break;
         }
     if (i == p->Tags.size()) {
         p->Tags.push_back(pi);
+        g_backend.tagIndex().insert(this, pi.first, pi.second);
     }
+    p->FilterRevision = -1;
     invalidateMeta();
-    invalidatePainter();
+    p->invalidateStyle();
 }
 
 void Feature::clearTags()
 {
     while (p->Tags.size()) {
         g_removeFromTagList(p->Tags[0].first, p->Tags[0].second);
+        g_backend.tagIndex().remove(this, p->Tags[0].first, p->Tags[0].second);
         p->Tags.erase(p->Tags.begin());
     }
+    p->FilterRevision = -1;
     invalidateMeta();
-    invalidatePainter();
+    p->invalidateStyle();
 }
 
 void Feature::clearTag(const QString& k)
@@ -497,19 +517,23 @@ void Feature::clearTag(const QString& k)
         if (p->Tags[i].first == ik)
         {
             g_removeFromTagList(p->Tags[i].first, p->Tags[i].second);
+            g_backend.tagIndex().remove(this, p->Tags[i].first, p->Tags[i].second);
             p->Tags.erase(p->Tags.begin()+i);
             break;
         }
+    p->FilterRevision = -1;
     invalidateMeta();
-    invalidatePainter();
+    p->invalidateStyle();
 }
 
 void Feature::removeTag(int idx)
 {
     g_removeFromTagList(p->Tags[idx].first, p->Tags[idx].second);
+    g_backend.tagIndex().remove(this, p->Tags[idx].first, p->Tags[idx].second);
     p->Tags.erase(p->Tags.begin()+idx);
+    p->FilterRevision = -1;
     invalidateMeta();
-    invalidatePainter();
+    p->invalidateStyle();
 }
 
 int Feature::tagSize() const
@@ -527,6 +551,11 @@ QString Feature::tagKey(int i) const
     return g_getTagKey(p->Tags[i].first);
 }
 
+const QList<QPair<quint32, quint32> >& Feature::tagIds() const
+{
+    return p->Tags;
+}
+
 int Feature::findKey(const QString &k) const
 {
     for (int i=0; i<p->Tags.size(); ++i)
@@ -554,6 +583,35 @@ void Feature::invalidatePainter()
     p->PixelPerMForPainter = -1;
 }
 
+/* With parent selectors, the style of the children depends on the tags of this one */
+void FeaturePrivate::invalidateChildPainters(Feature* F, int depth)
+{
+    for (int i=0; i<F->size(); ++i) {
+        Feature* C = F->get(i);
+        if (!C)
+            continue;
+        C->invalidatePainter();
+        if (depth > 1)
+            invalidateChildPainters(C, depth-1);
+    }
+}
+
+void FeaturePrivate::invalidateStyle()
+{
+    theFeature->invalidatePainter();
+    Layer* L = theFeature->layer();
+    if (!L || !L->getDocument())
+        return;
+    if (MapCSSPaintstyle* theSheet = L->getDocument()->getStyleSheet())
+        if (int depth = theSheet->parentDepth())
+            invalidateChildPainters(theFeature, depth);
+}
+
+void Feature::invalidateStyle()
+{
+    p->invalidateStyle();
+}
+
 static QPainterPath painterPath;
 
 const QPainterPath& Feature::getPath() const
@@ -566,7 +624,7 @@ void FeaturePrivate::updatePossiblePainters()
     QMutexLocker mutlock(&theFeature->featMutex);
 
     //still match features with no tags and no parent, i.e. "lost" trackpoints
-    if ( (theFeature->layer()->isTrack()) && M_PREFS->getDisableStyleForTracks() ) return blankPainters();
+    if ( (theFeature->layer()->isTrack()) && theFeature->layer()->getDocument()->getDisableStyleForTracks() ) return blankPainters();
 
     if ( (theFeature->layer()->isTrack()) || theFeature->sizeParents() ) {
         if (CHECK_NODE(theFeature) && !STATIC_CAST_NODE(theFeature)->isPOI()) return blankPainters();
@@ -574,6 +632,14 @@ void FeaturePrivate::updatePossiblePainters()
     }
 
     PossiblePainters.clear();
+    if (MapCSSPaintstyle* theSheet = theFeature->layer()->getDocument()->getStyleSheet()) {
+        // Whether it is drawn at some zoom is only worked out when asked
+        StyleClass = theSheet->styleClass(theFeature);
+        PossiblePaintersUpToDate = true;
+        HasPainter = false;
+        return;
+    }
+    StyleClass = -1;
     QList<const FeaturePainter*> DefaultPainters;
     for (int i=0; i<theFeature->layer()->getDocument()->getPaintersSize(); ++i)
     {
@@ -603,6 +669,11 @@ void FeaturePrivate::updatePainters(qreal PixelPerM)
     QMutexLocker mutlock(&theFeature->featMutex);
     CurrentPainter = NULL;
     PixelPerMForPainter = PixelPerM;
+    if (StyleClass != -1) {
+        if (MapCSSPaintstyle* theSheet = theFeature->layer()->getDocument()->getStyleSheet())
+            CurrentPainter = theSheet->painterFor(StyleClass, PixelPerM);
+        return;
+    }
     for (int i=0; i<PossiblePainters.size(); ++i)
         if (PossiblePainters[i]->matchesZoom(PixelPerM))
         {
@@ -615,6 +686,7 @@ void FeaturePrivate::blankPainters()
 {
     CurrentPainter = NULL;
     PossiblePainters.clear();
+    StyleClass = -1;
     PossiblePaintersUpToDate = true;
     HasPainter = false;
 }
@@ -642,6 +714,9 @@ bool Feature::hasPainter() const
     if (!p->PossiblePaintersUpToDate)
         p->updatePossiblePainters();
 
+    if (p->StyleClass != -1)
+        if (MapCSSPaintstyle* theSheet = layer()->getDocument()->getStyleSheet())
+            return theSheet->hasPainter(p->StyleClass);
     return p->HasPainter;
 }
 
@@ -656,8 +731,11 @@ bool Feature::hasPainter(qreal PixelPerM) const
 
 void Feature::setParentFeature(Feature* F)
 {
-    if (std::find(p->Parents.begin(),p->Parents.end(),F) == p->Parents.end())
+    if (std::find(p->Parents.begin(),p->Parents.end(),F) == p->Parents.end()) {
         p->Parents.push_back(F);
+        // Whether it is styled depends on its parents
+        invalidatePainter();
+    }
 }
 
 void Feature::unsetParentFeature(Feature* F)
@@ -666,6 +744,7 @@ void Feature::unsetParentFeature(Feature* F)
         if (p->Parents[i] == F)
         {
             p->Parents.erase(p->Parents.begin()+i);
+            invalidatePainter();
             return;
         }
 }
@@ -682,15 +761,25 @@ void Feature::updateFilters()
     if (!D)
         return;
 
+    // The filters only need trying again once the tags changed
+    FilterEngine* E = D->filterEngine();
+    bool retest = p->FilterRevision < 0;
     for (int i=0; i<D->layerSize(); ++i) {
         if (D->getLayer(i)->classType() == Layer::FilterLayerType) {
             FilterLayer* Fl = dynamic_cast<FilterLayer*>(D->getLayer(i));
-            if (!Fl->isEnabled() || !Fl->selector())
+            if (!Fl->selector())
                 continue;
-            if (Fl->selector()->matches(this, 0) != TagSelect_NoMatch)
+            if (!Fl->isEnabled()) {
+                // Keeps its result right for when it is enabled again
+                if (retest)
+                    E->passes(Fl, this, true);
+                continue;
+            }
+            if (E->passes(Fl, this, retest))
                 p->FilterLayers << Fl;
         }
     }
+    p->FilterRevision = E->revision();
     invalidateMeta();
 }
 
@@ -211,6 +211,12 @@ public:
         */
     virtual QString tagKey(int i) const;
 
+    /** return the keys and values of the tags as indexes
+         * in the tag lists of g_getTagKey and g_getTagValue.
+         * @return the pairs of key and value indexes
+        */
+    virtual const QList<QPair<quint32, quint32> >& tagIds() const;
+
     /** remove the tag at the position "i".
          * position start at 0.
          * Be carefull: no verification is made on i.
@@ -287,6 +293,8 @@ public:
     bool hasPainter() const;
     bool hasPainter(qreal PixelPerM) const;
     void invalidatePainter();
+    /* Restyles the feature, and its children if the style sheet has parent selectors */
+    void invalidateStyle();
     QVector<qreal> getParentDashes() const;
 
     virtual qreal getAlpha();
@@ -0,0 +1,138 @@
+#include "Global.h"
+
+#include "FeatureClosure.h"
+
+#include "Features.h"
+
+#include <QProgressDialog>
+#if QT_VERSION >= 0x050000
+#include <QtConcurrent>
+#endif
+
+#define CLOSURE_CHUNK 4096 /* features per parallel task */
+
+/* A run of the features to add, with what walking them reaches: a node as itself, a way as its
+   nodes then itself, a relation as itself, its members being left to the merge */
+struct ClosureChunk
+{
+    int begin, end;
+    QVector<Feature*> reached;
+};
+
+class WalkClosureChunk
+{
+public:
+    WalkClosureChunk(const QList<Feature*>& aFeatures)
+        : theFeatures(aFeatures) { }
+
+    typedef void result_type;
+
+    void operator()(ClosureChunk& C)
+    {
+        for (int i=C.begin; i<C.end; ++i) {
+            Feature* F = theFeatures.at(i);
+            if (CHECK_WAY(F)) {
+                foreach (Node* N, STATIC_CAST_WAY(F)->getNodes())
+                    C.reached << N;
+                C.reached << F;
+            } else if (CHECK_NODE(F) || CHECK_RELATION(F))
+                C.reached << F;
+        }
+    }
+
+    const QList<Feature*>& theFeatures;
+};
+
+FeatureClosure::FeatureClosure(Options someOptions)
+    : theOptions(someOptions)
+{
+}
+
+bool FeatureClosure::visit(Feature* F)
+{
+    int before = theVisited.size();
+    theVisited.insert(F);
+    return theVisited.size() != before;
+}
+
+void FeatureClosure::add(Feature* F)
+{
+    if (CHECK_NODE(F)) {
+        if (visit(F))
+            theNodes << F;
+    } else if (CHECK_WAY(F)) {
+        if (!visit(F))
+            return;
+        foreach (Node* N, STATIC_CAST_WAY(F)->getNodes())
+            if (visit(N))
+                theNodes << N;
+        theWays << F;
+    } else if (CHECK_RELATION(F))
+        addRelation(STATIC_CAST_RELATION(F));
+}
+
+void FeatureClosure::addRelation(Relation* R)
+{
+    if (!visit(R))
+        return;
+
+    if (theOptions & (RelationMembers | RecursiveRelations)) {
+        for (int i=0; i<R->size(); ++i) {
+            Feature* F = R->get(i);
+            if (CHECK_RELATION(F)) {
+                if (theOptions & RecursiveRelations)
+                    addRelation(STATIC_CAST_RELATION(F));
+            } else
+                add(F);
+        }
+    }
+    theRelations << R;
+}
+
+bool FeatureClosure::add(const QList<Feature*>& aFeatures, QProgressDialog* progress)
+{
+    theVisited.reserve(theVisited.size() + aFeatures.size());
+
+    QVector<ClosureChunk> chunks;
+    for (int i=0; i<aFeatures.size(); i+=CLOSURE_CHUNK) {
+        ClosureChunk C;
+        C.begin = i;
+        C.end = qMin(i + CLOSURE_CHUNK, aFeatures.size());
+        chunks << C;
+    }
+    if (chunks.size() > 1)
+        QtConcurrent::blockingMap(chunks, WalkClosureChunk(aFeatures));
+    else if (chunks.size())
+        WalkClosureChunk(aFeatures)(chunks[0]);
+
+    // Marking stays on this thread, in the order of the features, so the result does not
+    // depend on how the chunks were scheduled
+    for (int c=0; c<chunks.size(); ++c) {
+        foreach (Feature* F, chunks.at(c).reached) {
+            if (CHECK_RELATION(F))
+                addRelation(STATIC_CAST_RELATION(F));
+            else if (visit(F)) {
+                if (CHECK_WAY(F))
+                    theWays << F;
+                else
+                    theNodes << F;
+            }
+        }
+        chunks[c].reached.clear();
+
+        if (progress) {
+            if (progress->wasCanceled())
+                return false;
+            progress->setValue(progress->value() + chunks.at(c).end - chunks.at(c).begin);
+        }
+    }
+    return true;
+}
+
+QList<Feature*> FeatureClosure::features() const
+{
+    QList<Feature*> theFeatures;
+    theFeatures.reserve(theVisited.size());
+    theFeatures << theNodes << theWays << theRelations;
+    return theFeatures;
+}
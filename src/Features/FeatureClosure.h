@@ -0,0 +1,47 @@
+#ifndef FEATURECLOSURE_H
+#define FEATURECLOSURE_H
+
+#include <QList>
+#include <QSet>
+
+class Feature;
+class Relation;
+class QProgressDialog;
+
+/* The features a set of features needs to stand on its own: the nodes of its ways and, if asked,
+   the members of its relations. Every feature comes out once; nodes first, then ways, then
+   relations, each in the order they were reached, a member relation before those holding it. */
+class FeatureClosure
+{
+public:
+    enum Option {
+        RelationMembers = 0x1,      /* the nodes and ways of relations, with the nodes of those ways */
+        RecursiveRelations = 0x2    /* the members of member relations too, all the way down */
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    FeatureClosure(Options someOptions = RelationMembers);
+
+    void add(Feature* F);
+    /* Adds the features in order; the ways are walked in parallel when there are many.
+       Returns false if the progress dialog was canceled. */
+    bool add(const QList<Feature*>& aFeatures, QProgressDialog* progress = NULL);
+
+    bool contains(Feature* F) const { return theVisited.contains(F); }
+    int size() const { return theVisited.size(); }
+    QList<Feature*> features() const;
+
+private:
+    bool visit(Feature* F);
+    void addRelation(Relation* R);
+
+    Options theOptions;
+    QSet<Feature*> theVisited;
+    QList<Feature*> theNodes;
+    QList<Feature*> theWays;
+    QList<Feature*> theRelations;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FeatureClosure::Options)
+
+#endif // FEATURECLOSURE_H
@@ -7,6 +7,7 @@ HEADERS += \
     Way.h \
     Node.h \
     TrackSegment.h \
+    FeatureClosure.h \
     IFeature.h
 
 SOURCES += \
@@ -15,3 +16,4 @@ SOURCES += \
     Way.cpp \
     Node.cpp \
     TrackSegment.cpp \
+    FeatureClosure.cpp \
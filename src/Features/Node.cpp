@@ -128,7 +128,7 @@ bool Node::isWaypoint()
     return IsWaypoint;
 }
 
-bool Node::isSelectable(qreal PixelPerM, RendererOptions options)
+bool Node::isSelectable(qreal PixelPerM, RendererOptions options, const RenderSettings& theSettings)
 {
     // If Node has non-default tags -> POI -> always selectable
     if (isPOI())
@@ -136,9 +136,9 @@ bool Node::isSelectable(qreal PixelPerM, RendererOptions options)
 
     bool Draw = false;
     if (options.options.testFlag(RendererOptions::NodesVisible) || (lastUpdated() == Feature::Log && !options.options.testFlag(RendererOptions::TrackSegmentVisible))) {
-        Draw = (PixelPerM * M_PREFS->getNodeSize() >= 1);
+        Draw = (PixelPerM * theSettings.NodeSize >= 1);
         // Do not draw GPX nodes when simple GPX track appearance is enabled
-        if (M_PREFS->getSimpleGpxTrack() && layer()->isTrack())
+        if (theSettings.SimpleGpxTrack && layer()->isTrack())
             Draw = false;
         if (!Draw) {
             if (!sizeParents())
@@ -166,7 +166,7 @@ void Node::drawSimple(QPainter &P, MapView *theView)
 //    if (!M_PREFS->getWireframeView() && !TEST_RFLAGS(RendererOptions::Interacting))
 //        return;
 
-    if (! ((isReadonly() || !isSelectable(theView->pixelPerM(), theView->renderOptions())) && (!isPOI() && !isWaypoint())))
+    if (! ((isReadonly() || !isSelectable(theView->pixelPerM(), theView->renderOptions(), theView->renderSettings())) && (!isPOI() && !isWaypoint())))
         //        if (!Pt->isReadonly() && Pt->isSelectable(r))
     {
         if (!layer()) {
@@ -12,6 +12,7 @@
 #include <QtXml>
 
 class QProgressDialog;
+class RenderSettings;
 
 class Node : public Feature
 {
@@ -64,7 +65,7 @@ public:
     /** check if the feature is drawable
          * @return true if to be drawn
          */
-    virtual bool isSelectable(qreal PixelPerM, RendererOptions options);
+    virtual bool isSelectable(qreal PixelPerM, RendererOptions options, const RenderSettings& theSettings);
 
     virtual void partChanged(Feature* F, int ChangeId);
 
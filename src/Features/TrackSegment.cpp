@@ -85,6 +85,16 @@ void TrackSegment::add(TrackNode* Pt, int Idx)
     g_backend.sync(this);
 }
 
+void TrackSegment::add(const QList<TrackNode*>& Points)
+{
+    p->Nodes.reserve(p->Nodes.size() + Points.size());
+    for (int i=0; i<Points.size(); ++i) {
+        p->Nodes.push_back(Points[i]);
+        Points[i]->setParentFeature(this);
+    }
+    g_backend.sync(this);
+}
+
 int TrackSegment::find(Feature* Pt) const
 {
     for (int i=0; i<p->Nodes.size(); ++i)
@@ -133,13 +143,13 @@ bool TrackSegment::isNull() const
     return (p->Nodes.size() == 0);
 }
 
-void TrackSegment::drawDirectionMarkers(QPainter &P, QPen &pen, const QPointF & FromF, const QPointF & ToF)
+void TrackSegment::drawDirectionMarkers(const RenderSettings& theSettings, QPainter &P, QPen &pen, const QPointF & FromF, const QPointF & ToF)
 {
     if (::distance(FromF,ToF) <= 30.0)
         return;
 
     const qreal DistFromCenter=10.0;
-    const qreal theWidth = !M_PREFS->getSimpleGpxTrack() ? 5.0 : 8.0;
+    const qreal theWidth = !theSettings.SimpleGpxTrack ? 5.0 : 8.0;
     const qreal A = angle(FromF-ToF);
 
     QPointF T(DistFromCenter*cos(A), DistFromCenter*sin(A));
@@ -168,6 +178,8 @@ void TrackSegment::drawTouchup(QPainter &P, MapView* theView)
     if (!TEST_RFLAGS(RendererOptions::TrackSegmentVisible))
         return;
 
+    const RenderSettings& theSettings = theView->renderSettings();
+
     for (int i=1; i<p->Nodes.size(); ++i)
     {
         if (!theView->viewport().contains(p->Nodes[i-1]->position()) && !theView->viewport().contains(p->Nodes[i]->position()))
@@ -176,13 +188,13 @@ void TrackSegment::drawTouchup(QPainter &P, MapView* theView)
         QPointF FromF = theView->toView(p->Nodes[i-1]);
         QPointF ToF = theView->toView(p->Nodes[i]);
 
-        if (!M_PREFS->getSimpleGpxTrack())
+        if (!theSettings.SimpleGpxTrack)
         {
             qreal distance = p->Nodes[i-1]->position().distanceFrom(p->Nodes[i]->position());
             qreal slope = (p->Nodes[i]->elevation() - p->Nodes[i-1]->elevation()) / (distance * 10.0);
             qreal speed = p->Nodes[i]->speed();
 
-            int width = M_PREFS->getGpxTrackWidth();
+            int width = theSettings.GpxTrackWidth;
             // Dynamic track line width adaption to zoom level
             if (theView->pixelPerM() > 2)
                 width++;
@@ -218,19 +230,19 @@ void TrackSegment::drawTouchup(QPainter &P, MapView* theView)
         }
         else
         {
-            int width = M_PREFS->getGpxTrackWidth();
+            int width = theSettings.GpxTrackWidth;
             // Dynamic track line width adaption to zoom level
             if (theView->pixelPerM() > 2)
                 width++;
             else if (theView->pixelPerM() < 1)
                 width--;
             pen.setWidthF(width);
-            pen.setColor(M_PREFS->getGpxTrackColor());
+            pen.setColor(theSettings.GpxTrackColor);
         }
         P.setPen(pen);
 
         P.drawLine(FromF,ToF);
-        drawDirectionMarkers(P, pen, FromF, ToF);
+        drawDirectionMarkers(theSettings, P, pen, FromF, ToF);
     }
 }
 
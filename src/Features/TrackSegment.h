@@ -18,7 +18,7 @@ protected:
     TrackSegment(const TrackSegment& other);
 
 private:
-    void drawDirectionMarkers(QPainter & P, QPen & pen, const QPointF & FromF, const QPointF & ToF);
+    void drawDirectionMarkers(const RenderSettings& theSettings, QPainter & P, QPen & pen, const QPointF & FromF, const QPointF & ToF);
 
 public:
     virtual QString getClass() const {return "TrackSegment";}
@@ -39,6 +39,8 @@ public:
 
     void add(TrackNode* aPoint);
     void add(TrackNode* Pt, int Idx);
+    /* Appends the points at once, with a single index update */
+    void add(const QList<TrackNode*>& Points);
     virtual int find(Feature* Pt) const;
     virtual void remove(int idx);
     virtual void remove(Feature* F);
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <QList>
+#include <QHash>
 
 #define TEST_RFLAGS(x) theView->renderOptions().options.testFlag(x)
 
@@ -29,16 +30,16 @@ class WayPrivate
         WayPrivate(Way* aWay)
         : theWay(aWay), BBoxUpToDate(false)
             , Area(0), Distance(0)
-            , PathUpToDate(false), VirtualsUptodate(false)
+            , PathUpToDate(false)
             , ProjectionRevision(0)
             , BestSegment(-1)
             , SimpleWidth(0)
         {
+            invalidateLods();
         }
         Way* theWay;
 
         QList<Node*> Nodes;
-        QList<Node*> virtualNodes;
 
         bool BBoxUpToDate;
 
@@ -46,8 +47,11 @@ class WayPrivate
         qreal Distance;
         bool NotEverythingDownloaded;
         bool PathUpToDate;
-        bool VirtualsUptodate;
+        QHash<int, Node*> VirtualProxies;   // segment midpoints snapped to, kept until the geometry changes
         QPainterPath thePath;
+        QPainterPath theLodPaths[LOD_LEVELS];
+        bool LodUpToDate[LOD_LEVELS];
+        qreal LodTolerance[LOD_LEVELS];
         int ProjectionRevision;
         int BestSegment;
         qreal SimpleWidth;
@@ -56,9 +60,11 @@ class WayPrivate
         RenderPriority theRenderPriority; // 10 (24)
 
         void CalculateWidth();
-        void doUpdateVirtuals();
-        void removeVirtuals();
-        void addVirtuals();
+        void invalidateLods();
+        void buildLod(int lod, qreal tolerance);
+        Coord virtualPosition(int segment) const;
+        Node* virtualProxy(int segment);
+        void dropVirtualProxies();
 };
 
 #define DEFAULTWIDTH 6
@@ -100,43 +106,111 @@ void WayPrivate::CalculateWidth()
         SimpleWidth = s.toDouble();
 }
 
-void WayPrivate::removeVirtuals()
+void WayPrivate::invalidateLods()
 {
-    while (virtualNodes.size()) {
-        virtualNodes[0]->unsetParentFeature(theWay);
-        g_backend.deallocVirtualNode(virtualNodes[0]);
-//        if (virtualNodes[0]->layer())
-//            virtualNodes[0]->layer()->deleteFeature(virtualNodes[0]);
-//		delete p->virtualNodes[0];
-        virtualNodes.erase(virtualNodes.begin());
+    for (int i=0; i<LOD_LEVELS; ++i) {
+        LodUpToDate[i] = false;
+        theLodPaths[i] = QPainterPath();
     }
 }
 
-void WayPrivate::addVirtuals()
+/* Douglas-Peucker on one projected sub-path, iterative to cope with long ways */
+static void simplifyPolyline(const QPolygonF& in, qreal tolerance, QPainterPath& out)
 {
-    for (int i=1; i<Nodes.size(); ++i) {
-        QLineF l(Nodes[i-1]->position(), Nodes[i]->position());
-        l.setLength(l.length()/2);
-        Node* v = g_backend.allocVirtualNode(l.p2());
-        v->setVirtual(true);
-        v->setParentFeature(theWay);
-//        theWay->layer()->add(v);
-        virtualNodes.push_back(v);
+    int n = in.size();
+    QVector<bool> keep(n, false);
+    keep[0] = keep[n-1] = true;
+
+    QVector<QPair<int, int> > stack;
+    stack.push_back(qMakePair(0, n-1));
+    while (!stack.isEmpty()) {
+        QPair<int, int> r = stack.takeLast();
+        if (r.second - r.first < 2)
+            continue;
+
+        LineF L(in[r.first], in[r.second]);
+        qreal best = -1;
+        int bestIdx = -1;
+        for (int i=r.first+1; i<r.second; ++i) {
+            qreal d = L.capDistance(in[i]);
+            if (d > best) {
+                best = d;
+                bestIdx = i;
+            }
+        }
+        if (best > tolerance) {
+            keep[bestIdx] = true;
+            stack.push_back(qMakePair(r.first, bestIdx));
+            stack.push_back(qMakePair(bestIdx, r.second));
+        }
     }
+
+    out.moveTo(in[0]);
+    for (int i=1; i<n; ++i)
+        if (keep[i])
+            out.lineTo(in[i]);
 }
 
-void WayPrivate::doUpdateVirtuals()
+void WayPrivate::buildLod(int lod, qreal tolerance)
 {
-//    Q_ASSERT(!(theWay->layer()->isIndexingBlocked()));
+    QPainterPath& lodPath = theLodPaths[lod];
+    lodPath = QPainterPath();
+
+    QPolygonF sub;
+    for (int i=0; i<thePath.elementCount(); ++i) {
+        const QPainterPath::Element& e = thePath.elementAt(i);
+        if (e.isCurveTo()) {
+            /* Only straight segments are simplified */
+            lodPath = thePath;
+            LodUpToDate[lod] = true;
+            LodTolerance[lod] = tolerance;
+            return;
+        }
+        if (e.isMoveTo() && sub.size()) {
+            simplifyPolyline(sub, tolerance, lodPath);
+            sub.clear();
+        }
+        sub << QPointF(e.x, e.y);
+    }
+    if (sub.size())
+        simplifyPolyline(sub, tolerance, lodPath);
 
-    if (VirtualsUptodate)
-        return;
+    LodUpToDate[lod] = true;
+    LodTolerance[lod] = tolerance;
+}
+
+/* Virtual nodes are the segment midpoints; they are computed when drawn or hit tested and only
+   materialized as a Node when one is snapped to, so that it can be selected and dragged */
+Coord WayPrivate::virtualPosition(int segment) const
+{
+    const Coord& a = Nodes.at(segment)->position();
+    const Coord& b = Nodes.at(segment+1)->position();
+    return Coord((a.x() + b.x()) / 2, (a.y() + b.y()) / 2);
+}
 
-    removeVirtuals();
-    if (theWay->canAddVirtualNodes())
-        addVirtuals();
+Node* WayPrivate::virtualProxy(int segment)
+{
+    Node* v = VirtualProxies.value(segment);
+    if (v)
+        return v;
+
+    v = g_backend.allocVirtualNode(virtualPosition(segment));
+    if (!v)
+        return NULL;
+    v->setVirtual(true);
+    v->setParentFeature(theWay);
+    VirtualProxies.insert(segment, v);
+    return v;
+}
 
-    VirtualsUptodate = true;
+/* The proxies may be selected or dragged, so they only go when the segments they stand for do */
+void WayPrivate::dropVirtualProxies()
+{
+    foreach (Node* v, VirtualProxies) {
+        v->unsetParentFeature(theWay);
+        g_backend.deallocVirtualNode(v);
+    }
+    VirtualProxies.clear();
 }
 
 /**************************/
@@ -155,13 +229,12 @@ Way::Way(const Way& other)
 
 Way::~Way(void)
 {
+    // The proxies may already be gone when the backend is torn down, so leave their parents alone
+    foreach (Node* v, p->VirtualProxies)
+        g_backend.deallocVirtualNode(v);
+
     // TODO Those cleanup shouldn't be necessary and lead to crashes
     //      Check for side effect of supressing them.
-//    while (p->virtualNodes.size()) {
-//        p->virtualNodes[0]->unsetParentFeature(this);
-//        delete p->virtualNodes[0];
-//        p->virtualNodes.erase(p->virtualNodes.begin());
-//    }
 //    for (unsigned int i=0; i<p->Nodes.size(); ++i)
 //        if (p->Nodes[i])
 //            p->Nodes[i]->unsetParentFeature(this);
@@ -181,9 +254,7 @@ char Way::getType() const
 void Way::setDeleted(bool delState)
 {
     Feature::setDeleted(delState);
-    p->VirtualsUptodate = false;
-    if (p->Nodes.size())
-        p->doUpdateVirtuals();
+    p->dropVirtualProxies();
 }
 
 void Way::setLayer(Layer* L)
@@ -200,7 +271,7 @@ void Way::setLayer(Layer* L)
         }
     }
     Feature::setLayer(L);
-    p->VirtualsUptodate = false;
+    p->dropVirtualProxies();
 }
 
 void Way::partChanged(Feature* /*F*/, int ChangeId)
@@ -211,7 +282,7 @@ void Way::partChanged(Feature* /*F*/, int ChangeId)
     p->BBoxUpToDate = false;
     p->PathUpToDate = false;
     MetaUpToDate = false;
-    p->VirtualsUptodate = false;
+    p->dropVirtualProxies();
     g_backend.sync(this);
 
     notifyParents(ChangeId);
@@ -233,6 +304,7 @@ void Way::add(Node* Pt)
 void Way::add(Node* Pt, int Idx)
 {
     QMutexLocker mutlock(&featMutex);
+    bool wasClosed = isClosed();
     p->Nodes.insert(p->Nodes.begin() + Idx, Pt);
 //	p->Nodes.push_back(Pt);
 //	std::rotate(p->Nodes.begin()+Idx,p->Nodes.end()-1,p->Nodes.end());
@@ -241,8 +313,11 @@ void Way::add(Node* Pt, int Idx)
     p->BBoxUpToDate = false;
     p->PathUpToDate = false;
     MetaUpToDate = false;
-    p->VirtualsUptodate = false;
+    p->dropVirtualProxies();
     g_backend.sync(this);
+    // Closed ways are styled as areas
+    if (isClosed() != wasClosed)
+        invalidateStyle();
 
     notifyChanges();
 }
@@ -257,15 +332,19 @@ int Way::find(Feature* Pt) const
 
 int Way::findVirtual(Feature* Pt) const
 {
-    for (int i=0; i<p->virtualNodes.size(); ++i)
-        if (p->virtualNodes[i] == Pt)
-            return i;
-    return p->virtualNodes.size();
+    QHashIterator<int, Node*> it(p->VirtualProxies);
+    while (it.hasNext()) {
+        it.next();
+        if (it.value() == Pt)
+            return it.key();
+    }
+    return qMax(0, p->Nodes.size()-1);
 }
 
 void Way::remove(int idx)
 {
     QMutexLocker mutlock(&featMutex);
+    bool wasClosed = isClosed();
     Node* Pt = p->Nodes[idx];
     // only remove as parent if the node is only included once
     p->Nodes.erase(p->Nodes.begin()+idx);
@@ -275,8 +354,10 @@ void Way::remove(int idx)
     p->BBoxUpToDate = false;
     p->PathUpToDate = false;
     MetaUpToDate = false;
-    p->VirtualsUptodate = false;
+    p->dropVirtualProxies();
     g_backend.sync(this);
+    if (isClosed() != wasClosed)
+        invalidateStyle();
 
     notifyChanges();
 }
@@ -308,11 +389,6 @@ const QList<NodePtr>& Way::getNodes() const
     return p->Nodes;
 }
 
-const QList<NodePtr>& Way::getVirtuals() const
-{
-    return p->virtualNodes;
-}
-
 
 Feature* Way::get(int idx)
 {
@@ -442,8 +518,6 @@ void Way::updateMeta()
         Priority += p->Distance / INT_MAX;
         p->theRenderPriority = RenderPriority(RenderPriority::IsLinear,Priority, layer);
     }
-
-    p->doUpdateVirtuals();
 }
 
 qreal Way::distance()
@@ -489,14 +563,17 @@ void Way::drawTouchup(QPainter& P, MapView* theView)
     bool Draw = (theWidth >= 1);
     if (!Draw || !theView->renderOptions().options.testFlag(RendererOptions::VirtualNodesVisible) || !theView->renderOptions().options.testFlag(RendererOptions::NodesVisible) || isReadonly())
         return;
+    if (!canAddVirtualNodes())
+        return;
 
     theWidth /= 2;
     P.setPen(QColor(0,0,0));
-    foreach (NodePtr N, p->virtualNodes) {
-        if (theView->viewport().contains(N->position())) {
-            QPoint p =  theView->toView(N);
-            P.drawLine(p+QPoint(-theWidth, -theWidth), p+QPoint(theWidth, theWidth));
-            P.drawLine(p+QPoint(theWidth, -theWidth), p+QPoint(-theWidth, theWidth));
+    for (int i=0; i+1<p->Nodes.size(); ++i) {
+        Coord v = p->virtualPosition(i);
+        if (theView->viewport().contains(v)) {
+            QPoint pt = theView->toView(v);
+            P.drawLine(pt+QPoint(-theWidth, -theWidth), pt+QPoint(theWidth, theWidth));
+            P.drawLine(pt+QPoint(theWidth, -theWidth), pt+QPoint(-theWidth, theWidth));
         }
     }
 }
@@ -592,15 +669,16 @@ Node* Way::pixelDistanceNode(const QPointF& Target, qreal ClearEndDistance, MapV
             }
         }
     }
-    if (!NoSelectVirtuals && M_PREFS->getVirtualNodesVisible()) {
-        for (int i=0; i<p->virtualNodes.size(); ++i)
+    if (!NoSelectVirtuals && M_PREFS->getVirtualNodesVisible() && canAddVirtualNodes()) {
+        for (int i=0; i+1<p->Nodes.size(); ++i)
         {
-            if (p->virtualNodes.at(i)) {
-                p->virtualNodes.at(i)->buildPath(theView->projection());
-                qreal D = ::distance(Target,theView->toView(p->virtualNodes.at(i)));
+            if (p->Nodes.at(i) && p->Nodes.at(i+1)) {
+                qreal D = ::distance(Target,theView->toView(p->virtualPosition(i)));
                 if (D < ClearEndDistance && D < Best) {
-                    Best = D;
-                    return p->virtualNodes.at(i);
+                    Node* v = p->virtualProxy(i);
+                    if (v)
+                        v->buildPath(theView->projection());
+                    return v;
                 }
             }
         }
@@ -648,12 +726,24 @@ const QPainterPath& Way::getPath() const
     return p->thePath;
 }
 
+QPainterPath Way::getPath(int lod, qreal tolerance)
+{
+    QMutexLocker mutlock(&featMutex);
+    if (lod <= 0 || lod >= LOD_LEVELS || p->thePath.elementCount() < 3)
+        return p->thePath;
+
+    if (!p->LodUpToDate[lod] || p->LodTolerance[lod] != tolerance)
+        p->buildLod(lod, tolerance);
+    return p->theLodPaths[lod];
+}
+
 void Way::addPathHole(const QPainterPath& pth)
 {
     if (!p->PathUpToDate)
         return;
 
     p->thePath = p->thePath.subtracted(pth);
+    p->invalidateLods();
 }
 
 void Way::rebuildPath(const Projection &theProjection)
@@ -669,6 +759,7 @@ void Way::buildPath(const Projection &theProjection)
         return;
     else {
         p->thePath = QPainterPath();
+        p->invalidateLods();
         if (p->Nodes.size() < 2) {
             p->PathUpToDate = true;
             return;
@@ -678,9 +769,8 @@ void Way::buildPath(const Projection &theProjection)
         for (int i=1; i<p->Nodes.size(); ++i) {
             p->thePath.lineTo((p->Nodes.at(i)->projected(theProjection)));
         }
-        for (int i=0; i<p->virtualNodes.size(); ++i) {
-            p->virtualNodes[i]->buildPath(theProjection);
-        }
+        foreach (Node* v, p->VirtualProxies)
+            v->buildPath(theProjection);
         p->ProjectionRevision = theProjection.projectionRevision();
         p->PathUpToDate = true;
     }
@@ -1003,7 +1093,7 @@ int Way::createJunction(Document* theDocument, CommandList* theList, Way* R1, Wa
     return numInter;
 }
 
-bool Way::canAddVirtualNodes()
+bool Way::canAddVirtualNodes() const
 {
     if (M_PREFS->getUseVirtualNodes() && layer() && !ReadOnly && !isDeleted())
         return true;
@@ -12,6 +12,9 @@ class Node;
 class QProgressDialog;
 class MapRenderer;
 
+/* Number of level-of-detail paths kept per way; level 0 is the full path */
+#define LOD_LEVELS 5
+
 class Way : public Feature
 {
     friend class WayPrivate;
@@ -56,7 +59,6 @@ public:
     Node* getNode(int idx);
     const Node* getNode(int idx) const;
     const QList<NodePtr>& getNodes() const;
-    const QList<NodePtr>& getVirtuals() const;
 
     int segmentCount();
     QLineF getSegment(int i);
@@ -77,6 +79,7 @@ public:
     virtual bool deleteChildren(Document* theDocument, CommandList* theList);
 
     const QPainterPath& getPath() const;
+    QPainterPath getPath(int lod, qreal tolerance);
     void addPathHole(const QPainterPath &pth);
     void rebuildPath(const Projection &theProjection);
     void buildPath(Projection const &theProjection);
@@ -94,7 +97,7 @@ public:
     static int createJunction(Document* theDocument, CommandList* theList, Way* R1, Way* R2, bool doIt);
 
 protected:
-    bool canAddVirtualNodes();
+    bool canAddVirtualNodes() const;
     WayPrivate* p;
 };
 
@@ -0,0 +1,359 @@
+#include "Global.h"
+
+#include "BinaryClipboard.h"
+
+#include "Document.h"
+#include "DocumentCommands.h"
+#include "Features.h"
+#include "Layer.h"
+
+#include <QDataStream>
+#include <QHash>
+#include <QVector>
+
+#define CLIPBOARD_MAGIC 0x4d4b4346 /* "MKCF" */
+#define CLIPBOARD_VERSION 1 /* of the records, not of Merkaartor */
+#define CLIPBOARD_STREAM_VERSION QDataStream::Qt_4_6 /* the same on both ends of the clipboard */
+
+const QString BinaryClipboard::MimeType = "application/x-merkaartor-features";
+
+namespace {
+
+enum RecordType { EndRecord, NodeRecord, WayRecord, RelationRecord };
+enum { DeletedFlag = 0x01, UploadedFlag = 0x02, SpecialFlag = 0x04 };
+
+inline qint32 toFixed(qreal deg, qreal limit)
+{
+    return qint32(qRound64(qBound(-limit, deg, limit) * 1e7));
+}
+
+typedef QPair<quint8, qint64> ClipboardId;
+
+class ClipboardWriter
+{
+public:
+    ClipboardWriter()
+        : theStream(&theRecords, QIODevice::WriteOnly)
+    {
+        theStream.setVersion(CLIPBOARD_STREAM_VERSION);
+    }
+
+    void node(Node* N)
+    {
+        header(NodeRecord, N);
+        theStream << toFixed(N->position().x(), 180.) << toFixed(N->position().y(), 90.);
+    }
+
+    void way(Way* W)
+    {
+        header(WayRecord, W);
+        theStream << quint32(W->size());
+        for (int i=0; i<W->size(); ++i)
+            theStream << qint64(W->getNode(i)->id().numId);
+    }
+
+    void relation(Relation* R)
+    {
+        header(RelationRecord, R);
+        theStream << quint32(R->size());
+        for (int i=0; i<R->size(); ++i) {
+            const IFeature::FId& id = R->get(i)->id();
+            theStream << quint8(id.type) << qint64(id.numId) << string(R->getRole(i));
+        }
+    }
+
+    QByteArray finish()
+    {
+        theStream << quint8(EndRecord);
+
+        QByteArray bytes;
+        QDataStream out(&bytes, QIODevice::WriteOnly);
+        out.setVersion(CLIPBOARD_STREAM_VERSION);
+        out << quint32(CLIPBOARD_MAGIC) << quint32(CLIPBOARD_VERSION) << quint32(theStrings.size());
+        foreach (const QString& s, theStrings)
+            out << s.toUtf8();
+        bytes.append(theRecords);
+        return bytes;
+    }
+
+private:
+    quint32 string(const QString& s)
+    {
+        QHash<QString, quint32>::const_iterator it = theIndex.constFind(s);
+        if (it != theIndex.constEnd())
+            return it.value();
+        quint32 i = theStrings.size();
+        theIndex.insert(s, i);
+        theStrings << s;
+        return i;
+    }
+
+    void header(RecordType aType, Feature* F)
+    {
+        quint8 flags = 0;
+        if (F->isDeleted())
+            flags |= DeletedFlag;
+        if (F->isUploaded())
+            flags |= UploadedFlag;
+        if (F->isSpecial())
+            flags |= SpecialFlag;
+
+        theStream << quint8(aType) << qint64(F->id().numId) << flags << qint32(F->getDirtyLevel()) << quint8(F->lastUpdated());
+#ifndef FRISIUS_BUILD
+        theStream << qint32(F->versionNumber()) << quint32(F->time().isValid() ? F->time().toTime_t() : 0) << string(F->user());
+#else
+        theStream << qint32(0) << quint32(0) << string(QString());
+#endif
+        theStream << quint32(F->tagSize());
+        for (int i=0; i<F->tagSize(); ++i)
+            theStream << string(F->tagKey(i)) << string(F->tagValue(i));
+    }
+
+    QByteArray theRecords;
+    QDataStream theStream;
+    QHash<QString, quint32> theIndex;
+    QList<QString> theStrings;
+};
+
+/* What a record holds besides its geometry */
+struct ClipboardHeader
+{
+    qint64 id;
+    quint8 flags;
+    qint32 dirtyLevel;
+    quint8 actor;
+    qint32 version;
+    quint32 time;
+    quint32 user;
+    QVector<QPair<quint32, quint32> > tags;
+};
+
+struct ClipboardMember
+{
+    quint8 type;
+    qint64 id;
+    quint32 role;
+};
+
+class ClipboardReader
+{
+public:
+    ClipboardReader(const QByteArray& data, Document* aDocument, Layer* aLayer, CommandList* aList, QList<Feature*>& someFeats)
+        : theStream(data), theDocument(aDocument), theLayer(aLayer), theList(aList), theFeats(someFeats)
+    {
+        theStream.setVersion(CLIPBOARD_STREAM_VERSION);
+    }
+
+    bool read()
+    {
+        quint32 magic, version, count;
+        theStream >> magic >> version >> count;
+        if (theStream.status() != QDataStream::Ok || magic != CLIPBOARD_MAGIC || version != CLIPBOARD_VERSION)
+            return false;
+
+        theStrings.reserve(count);
+        for (quint32 i=0; i<count; ++i) {
+            QByteArray s;
+            theStream >> s;
+            if (theStream.status() != QDataStream::Ok)
+                return false;
+            theStrings << QString::fromUtf8(s.constData(), s.size());
+        }
+
+        // Relations may refer to one another in any order; their members are linked once all are read
+        QList<QPair<Relation*, QVector<ClipboardMember> > > relations;
+        bool ok = false;
+        forever {
+            quint8 type;
+            theStream >> type;
+            if (theStream.status() != QDataStream::Ok)
+                break;
+            if (type == EndRecord) {
+                ok = true;
+                break;
+            }
+
+            ClipboardHeader H;
+            if (!readHeader(H))
+                break;
+
+            if (type == NodeRecord) {
+                qint32 lon, lat;
+                theStream >> lon >> lat;
+                if (theStream.status() != QDataStream::Ok)
+                    break;
+                Node* N = g_backend.allocNode(theLayer, Coord(lon / 1e7, lat / 1e7));
+                apply(N, IFeature::Point, H);
+                add(N);
+            } else if (type == WayRecord) {
+                quint32 size;
+                theStream >> size;
+                QVector<qint64> refs(theStream.status() == QDataStream::Ok ? qMin(size, quint32(theStream.device()->bytesAvailable() / 8)) : 0);
+                if (quint32(refs.size()) != size)
+                    break;
+                for (int i=0; i<refs.size(); ++i)
+                    theStream >> refs[i];
+                if (theStream.status() != QDataStream::Ok)
+                    break;
+
+                Way* W = g_backend.allocWay(theLayer);
+                apply(W, IFeature::LineString, H);
+                foreach (qint64 ref, refs)
+                    if (Node* N = CAST_NODE(member(IFeature::Point, ref)))
+                        W->add(N);
+                add(W);
+            } else if (type == RelationRecord) {
+                quint32 size;
+                theStream >> size;
+                QVector<ClipboardMember> members(theStream.status() == QDataStream::Ok ? qMin(size, quint32(theStream.device()->bytesAvailable() / 13)) : 0);
+                if (quint32(members.size()) != size)
+                    break;
+                for (int i=0; i<members.size(); ++i)
+                    theStream >> members[i].type >> members[i].id >> members[i].role;
+                if (theStream.status() != QDataStream::Ok || !checkRoles(members))
+                    break;
+
+                Relation* R = g_backend.allocRelation(theLayer);
+                apply(R, IFeature::OsmRelation, H);
+                relations << qMakePair(R, members);
+            } else
+                break;
+        }
+
+        for (int i=0; i<relations.size(); ++i) {
+            Relation* R = relations.at(i).first;
+            foreach (const ClipboardMember& M, relations.at(i).second)
+                if (Feature* F = member(M.type, M.id))
+                    R->add(theStrings.at(M.role), F);
+            add(R);
+        }
+        return ok;
+    }
+
+private:
+    bool readHeader(ClipboardHeader& H)
+    {
+        quint32 size;
+        theStream >> H.id >> H.flags >> H.dirtyLevel >> H.actor >> H.version >> H.time >> H.user >> size;
+        if (theStream.status() != QDataStream::Ok || H.user >= quint32(theStrings.size()))
+            return false;
+        if (size > quint32(theStream.device()->bytesAvailable() / 8))
+            return false;
+
+        H.tags.resize(size);
+        for (int i=0; i<H.tags.size(); ++i) {
+            theStream >> H.tags[i].first >> H.tags[i].second;
+            if (H.tags[i].first >= quint32(theStrings.size()) || H.tags[i].second >= quint32(theStrings.size()))
+                return false;
+        }
+        return theStream.status() == QDataStream::Ok;
+    }
+
+    bool checkRoles(const QVector<ClipboardMember>& members) const
+    {
+        foreach (const ClipboardMember& M, members)
+            if (M.role >= quint32(theStrings.size()))
+                return false;
+        return true;
+    }
+
+    void apply(Feature* F, IFeature::FeatureType aType, const ClipboardHeader& H)
+    {
+        IFeature::FId id(aType, H.id);
+        theRemap.insert(ClipboardId(aType, H.id), F);
+        if (theDocument->getFeature(id))
+            F->resetId();
+        else
+            F->setId(id);
+
+        F->setLastUpdated((Feature::ActorType)H.actor);
+        F->setDeleted(H.flags & DeletedFlag);
+        F->setDirtyLevel(H.dirtyLevel);
+        F->setUploaded(H.flags & UploadedFlag);
+        F->setSpecial(H.flags & SpecialFlag);
+#ifndef FRISIUS_BUILD
+        if (H.time)
+            F->setTime(H.time);
+        F->setUser(theStrings.at(H.user));
+        F->setVersionNumber(H.version);
+#endif
+        for (int i=0; i<H.tags.size(); ++i)
+            F->setTag(theStrings.at(H.tags.at(i).first), theStrings.at(H.tags.at(i).second));
+    }
+
+    /* The feature a member refers to: the one pasted, else the one of the document,
+       else a placeholder to be downloaded */
+    Feature* member(quint8 aType, qint64 aNumId)
+    {
+        ClipboardId key(aType, aNumId);
+        if (Feature* F = theRemap.value(key))
+            return F;
+
+        IFeature::FId id(aType, aNumId);
+        Feature* F = theDocument->getFeature(id);
+        if (!F) {
+            if (aType == IFeature::Point)
+                F = g_backend.allocNode(theLayer, Coord(0,0));
+            else if (aType == IFeature::LineString)
+                F = g_backend.allocWay(theLayer);
+            else if (aType == IFeature::OsmRelation)
+                F = g_backend.allocRelation(theLayer);
+            else
+                return NULL;
+            F->setId(id);
+            F->setLastUpdated(Feature::NotYetDownloaded);
+            add(F);
+        }
+        theRemap.insert(key, F);
+        return F;
+    }
+
+    void add(Feature* F)
+    {
+        if (theList)
+            theList->add(new AddFeatureCommand(theLayer, F, true));
+        else
+            theLayer->add(F);
+        theFeats << F;
+    }
+
+    QDataStream theStream;
+    Document* theDocument;
+    Layer* theLayer;
+    CommandList* theList;
+    QList<Feature*>& theFeats;
+    QList<QString> theStrings;
+    QHash<ClipboardId, Feature*> theRemap;
+};
+
+}  // namespace
+
+QByteArray BinaryClipboard::encode(const QList<Feature*>& aFeatures)
+{
+    ClipboardWriter writer;
+    foreach (Feature* F, aFeatures)
+        if (CHECK_NODE(F) && !F->isNull())
+            writer.node(STATIC_CAST_NODE(F));
+    foreach (Feature* F, aFeatures)
+        if (CHECK_WAY(F) && !F->isNull())
+            writer.way(STATIC_CAST_WAY(F));
+    foreach (Feature* F, aFeatures)
+        if (CHECK_RELATION(F) && !F->isNull())
+            writer.relation(STATIC_CAST_RELATION(F));
+    return writer.finish();
+}
+
+bool BinaryClipboard::isValid(const QByteArray& data)
+{
+    QDataStream in(data);
+    in.setVersion(CLIPBOARD_STREAM_VERSION);
+    quint32 magic, version;
+    in >> magic >> version;
+    return in.status() == QDataStream::Ok && magic == CLIPBOARD_MAGIC && version == CLIPBOARD_VERSION;
+}
+
+bool BinaryClipboard::paste(const QByteArray& data, Document* theDocument, Layer* aLayer, CommandList* theList, QList<Feature*>& theFeats)
+{
+    ClipboardReader reader(data, theDocument, aLayer, theList, theFeats);
+    return reader.read();
+}
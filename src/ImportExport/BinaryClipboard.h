@@ -0,0 +1,37 @@
+#ifndef BINARYCLIPBOARD_H
+#define BINARYCLIPBOARD_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+class Feature;
+class Document;
+class Layer;
+class CommandList;
+
+/* Merkaartor's own clipboard format, put next to the OSM XML so that a paste between two documents
+   or two instances does not go through a DOM. Tags, users and roles are interned once in a string
+   table, coordinates are packed in 1e-7 degrees and members are referred to by id.
+   The nodes come first, then the ways, then the relations. */
+class BinaryClipboard
+{
+public:
+    static const QString MimeType;
+
+    /* The features as copied, with the nodes of their ways; Document::exportCoreOSM gives them */
+    static QByteArray encode(const QList<Feature*>& aFeatures);
+
+    /* Whether the data starts as this format of this version does */
+    static bool isValid(const QByteArray& data);
+
+    /* Builds the features straight into aLayer, adding them through theList when given.
+       A feature whose id is taken in theDocument gets a new one; a member that was not copied is
+       linked to the feature of that id in theDocument, or to a placeholder to be downloaded.
+       theFeats receives the features added, placeholders included.
+       Returns false if the data is not valid; the features read until then are in theList,
+       which the caller undoes. */
+    static bool paste(const QByteArray& data, Document* theDocument, Layer* aLayer, CommandList* theList, QList<Feature*>& theFeats);
+};
+
+#endif // BINARYCLIPBOARD_H
@@ -256,7 +256,7 @@ void ImportCSVDialog::generatePreview(int /*sel*/)
         Feature* F = generateOSM(NULL, line);
         if (F) {
             previewText += F->toXML(2);
-            delete F;
+            g_backend.deallocFeature(NULL, F);
         }
         ++l;
     }
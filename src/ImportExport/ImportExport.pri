@@ -4,12 +4,15 @@ DEPENDPATH += $$MERKAARTOR_SRC_DIR/ImportExport
 #Header files
 HEADERS += \
     ExportOSM.h \
+    OsmWriter.h \
+    BinaryClipboard.h \
     ImportGPX.h \
     ImportNGT.h \
     ImportOSM.h \
     ImportNGT.h \
     IImportExport.h \
     ImportNMEA.h \
+    TrackParser.h \
     ExportGPX.h \
     ImportExportKML.h \
     ImportExportCSV.h \
@@ -18,11 +21,14 @@ HEADERS += \
 #Source files
 SOURCES += \
     ExportOSM.cpp \
+    OsmWriter.cpp \
+    BinaryClipboard.cpp \
     ImportGPX.cpp \
     ImportOSM.cpp \
     ImportNGT.cpp \
     IImportExport.cpp \
     ImportNMEA.cpp \
+    TrackParser.cpp \
     ExportGPX.cpp \
     ImportExportKML.cpp \
     ImportExportCSV.cpp \
@@ -5,15 +5,23 @@
 #include "Document.h"
 #include "Node.h"
 #include "TrackSegment.h"
+#include "TrackParser.h"
 #include "Global.h"
+#ifndef _MOBILE
+#include "MainWindow.h"
+#endif
 
+#include <QApplication>
 #include <QBuffer>
 #include <QDateTime>
 #include <QFile>
 #include <QMessageBox>
 #include <QDomDocument>
+#include <QElapsedTimer>
 #include <QProgressDialog>
+#include <QStatusBar>
 
+#define GPX_PROGRESS_STEP 1000 /* points made between progress updates */
 
 static TrackNode* importTrkPt(const QDomElement& Root, Document* /* theDocument */, Layer* theLayer)
 {
@@ -248,8 +256,170 @@ static void importGPX(const QDomElement& Root, Document* theDocument, QList<Trac
     }
 }
 
+static TrackNode* importFix(const GpxParser& parser, const TrackFix& fix, Layer* theLayer, bool waypoint)
+{
+    TrackNode* Pt = g_backend.allocTrackNode(theLayer, Coord(fix.lon, fix.lat));
+    Pt->setLastUpdated(Feature::Log);
+    if (fix.id)
+        Pt->setId(IFeature::FId(IFeature::Point, fix.id));
+
+    theLayer->add(Pt);
+
+    if (waypoint)
+        Pt->setTag("_waypoint_", "yes");
+    if (fix.time)
+        Pt->setTime(fix.time);
+    Pt->setElevation(fix.elevation);
+    Pt->setSpeed(fix.speed);
+
+    if (fix.text >= 0) {
+        const GpxParser::Text& T = parser.texts().at(fix.text);
+        if (!T.name.isNull())
+            Pt->setTag("name", T.name);
+        if (!T.desc.isNull())
+            Pt->setTag("_description_", T.desc);
+        if (!T.cmt.isNull())
+            Pt->setTag("_comment_", T.cmt);
+        if (T.special) {
+            Pt->setId(IFeature::FId(IFeature::Point | IFeature::Special, T.special));
+            Pt->setTag("_special_", "yes"); // OpenStreetBugs, as above
+            Pt->setSpecial(true);
+        }
+    }
+    return Pt;
+}
+
+static void addSegment(QList<TrackNode*>& points, Layer* theLayer, qint64 id)
+{
+    if (points.isEmpty())
+        return;
+    TrackSegment* S = g_backend.allocSegment(theLayer);
+    if (id)
+        S->setId(IFeature::FId(IFeature::GpxSegment, id));
+    theLayer->add(S);
+    S->add(points);
+    points.clear();
+}
+
+static bool stepProgress(QProgressDialog& progress, int& done)
+{
+    if (++done % GPX_PROGRESS_STEP)
+        return true;
+    progress.setValue(done);
+    return !progress.wasCanceled();
+}
+
+static bool importSegment(const GpxParser& parser, const GpxParser::Segment& Seg, Layer* theLayer, bool MakeSegment, QProgressDialog& progress, int& done)
+{
+    QList<TrackNode*> points;
+    qint64 id = Seg.id;
+    TrackNode* lastPoint = NULL;
+    for (int i=0; i<Seg.fixes.size(); ++i) {
+        TrackNode* Pt = importFix(parser, Seg.fixes.at(i), theLayer, false);
+        if (!stepProgress(progress, done))
+            break;
+
+        if (MakeSegment == false)
+            continue;
+
+        if (lastPoint)
+        {
+            qreal kilometer = Pt->position().distanceFrom( lastPoint->position() );
+
+            if (M_PREFS->getMaxDistNodes() != 0.0 && kilometer > M_PREFS->getMaxDistNodes())
+            {
+                addSegment(points, theLayer, id);
+                id = 0;
+            }
+        }
+        points << Pt;
+        lastPoint = Pt;
+    }
+    addSegment(points, theLayer, id);
+    return !progress.wasCanceled();
+}
+
+/* Makes the features of what GpxParser read, in bulk */
+static void importGPX(const GpxParser& parser, Document* theDocument, QList<TrackLayer*>& theTracklayers, bool MakeSegment, QProgressDialog & progress)
+{
+    int done = 0;
+    for (int i=0; i<parser.tracks().size(); ++i) {
+        const GpxParser::Track& T = parser.tracks().at(i);
+
+        TrackLayer* newLayer = new TrackLayer();
+        theDocument->add(newLayer);
+        if (!T.name.isNull())
+            newLayer->setName(T.name);
+        if (!T.desc.isNull())
+            newLayer->setDescription(T.desc);
+
+        bool ok = true;
+        for (int j=0; j<T.segments.size() && ok; ++j)
+            ok = importSegment(parser, T.segments.at(j), newLayer, MakeSegment, progress, done);
+
+        if (!newLayer->size()) {
+            theDocument->remove(newLayer);
+            delete newLayer;
+        } else {
+            theTracklayers.append(newLayer);
+        }
+        if (!ok)
+            return;
+    }
+
+    for (int i=0; i<parser.waypoints().size(); ++i) {
+        importFix(parser, parser.waypoints().at(i), theTracklayers[0], true);
+        if (!stepProgress(progress, done))
+            return;
+    }
+}
+
 bool importGPX(QWidget* aParent, QIODevice& File, Document* theDocument, QList<TrackLayer*>& theTracklayers, bool MakeSegment)
 {
+    QElapsedTimer timer;
+    timer.start();
+
+    // Most files are read straight from their bytes; the DOM reader is left with the rest
+    QByteArray bytes;
+    const char* data = NULL;
+    qint64 size = File.size();
+    QFile* file = qobject_cast<QFile*>(&File);
+    uchar* mapped = (file && size) ? file->map(0, size) : NULL;
+    if (mapped)
+        data = (const char*)mapped;
+    else {
+        bytes = File.readAll();
+        data = bytes.constData();
+        size = bytes.size();
+    }
+
+    GpxParser parser;
+    bool parsed = parser.parse(data, size);
+    if (mapped)
+        file->unmap(mapped);
+
+    if (parsed) {
+        QProgressDialog progress("Importing GPX...", "Cancel", 0, 0);
+        progress.setWindowModality(Qt::WindowModal);
+        progress.setMaximum(parser.fixCount());
+
+        importGPX(parser, theDocument, theTracklayers, MakeSegment, progress);
+
+        progress.setValue(progress.maximum());
+        if (progress.wasCanceled())
+            return false;
+
+#ifndef _MOBILE
+        if (g_Merk_MainWindow) {
+            qint64 elapsed = qMax(qint64(1), timer.elapsed());
+            g_Merk_MainWindow->statusBar()->showMessage(QApplication::translate("ImportGPX", "Imported %1 fixes in %2 ms, %3 fixes/s")
+                    .arg(parser.fixCount()).arg(elapsed).arg(qint64(parser.fixCount()) * 1000 / elapsed), 15000);
+        }
+#endif
+        return true;
+    }
+    File.seek(0);
+
     // TODO remove debug messageboxes
     QDomDocument DomDoc;
     QString ErrorStr;
@@ -32,14 +32,6 @@ public:
 private:
     TrackLayer* theLayer;
 
-    bool importGSA (QString line);
-    bool importGSV (QString line);
-    bool importGGA (QString line);
-    bool importGLL (QString line);
-    TrackNode* importRMC (QString line);
-
-    qreal curAltitude;
-
 };
 
 #endif
@@ -21,10 +21,11 @@
 #include <QProgressDialog>
 #include <QDomDocument>
 #include <QXmlAttributes>
+#include <QLabel>
 
 
 OSMHandler::OSMHandler(Document* aDoc, Layer* aLayer, Layer* aConflict)
-: theDocument(aDoc), theLayer(aLayer), conflictLayer(aConflict), Current(0)
+: theDocument(aDoc), theLayer(aLayer), conflictLayer(aConflict), Current(0), featureCount(0)
 {
 }
 
@@ -310,26 +311,75 @@ bool OSMHandler::startElement ( const QString &, const QString & /* localName */
 {
     if (qName == "tag")
         parseTag(atts);
-    else if (qName == "node")
+    else if (qName == "node") {
         parseNode(atts);
-    else if (qName == "nd")
+        ++featureCount;
+    } else if (qName == "nd")
         parseNd(atts);
-    else if (qName == "way")
+    else if (qName == "way") {
         parseWay(atts);
-    else if (qName == "member")
+        ++featureCount;
+    } else if (qName == "member")
         parseMember(atts);
-    else if (qName == "relation")
+    else if (qName == "relation") {
         parseRelation(atts);
+        ++featureCount;
+    }
     return true;
 }
 
 bool OSMHandler::endElement ( const QString &, const QString & /* localName */, const QString & qName )
 {
-    if (qName == "node")
+    if (qName == "node" || qName == "way" || qName == "relation")
         Current = 0;
     return true;
 }
 
+/* The input was cut short: the feature being parsed may lack some of its nodes, members or
+   tags, so leave it to be completed by a later download */
+void OSMHandler::abort()
+{
+    if (Current && NewFeature && Current->layer() == theLayer)
+        Current->setLastUpdated(Feature::NotYetDownloaded);
+    Current = 0;
+}
+
+/* OSMStreamParser */
+
+OSMStreamParser::OSMStreamParser(Document* aDoc, Layer* aLayer, Layer* aConflict)
+    : theHandler(aDoc, aLayer, aConflict), started(false)
+{
+    xmlReader.setContentHandler(&theHandler);
+}
+
+bool OSMStreamParser::feed(const QByteArray& buf)
+{
+    if (buf.isEmpty())
+        return true;
+
+    source.setData(buf);
+    if (!started) {
+        started = true;
+        return xmlReader.parse(&source, true);
+    }
+    return xmlReader.parseContinue();
+}
+
+void OSMStreamParser::abort()
+{
+    theHandler.abort();
+}
+
+int OSMStreamParser::featureCount() const
+{
+    return theHandler.featureCount;
+}
+
+OSMHandler& OSMStreamParser::handler()
+{
+    return theHandler;
+}
+
 static bool downloadToResolve(const QList<Feature*>& Resolution, QWidget* aParent, Document* theDocument, Layer* theLayer, Downloader* theDownloader)
 {
     IProgressWindow* aProgressWindow = dynamic_cast<IProgressWindow*>(aParent);
@@ -348,8 +398,7 @@ static bool downloadToResolve(const QList<Feature*>& Resolution, QWidget* aParen
         if (theDownloader->go(URL))
         {
             if (theDownloader->resultCode() == 410) {
-                theLayer->remove(Resolution[i]);
-                delete Resolution[i];
+                theLayer->deleteFeature(Resolution[i]);
             }
             else
             {
@@ -359,19 +408,10 @@ static bool downloadToResolve(const QList<Feature*>& Resolution, QWidget* aParen
                 QBuffer  File(&ba);
                 File.open(QIODevice::ReadOnly);
 
-                OSMHandler theHandler(theDocument,theLayer,NULL);
-
-                QXmlSimpleReader xmlReader;
-                xmlReader.setContentHandler(&theHandler);
-                QXmlInputSource source;
-                QByteArray buf(File.read(10240));
-                source.setData(buf);
-                xmlReader.parse(&source,true);
+                OSMStreamParser theParser(theDocument,theLayer,NULL);
                 while (!File.atEnd())
                 {
-                    QByteArray buf(File.read(20480));
-                    source.setData(buf);
-                    xmlReader.parseContinue();
+                    theParser.feed(File.read(20480));
                     qApp->processEvents();
                     if (dlg && dlg->wasCanceled())
                         break;
@@ -395,7 +435,48 @@ static void recurseDelete (Feature* F, QList<Feature*>& MustDelete)
         MustDelete.push_back(F);
 }
 
-static bool resolveNotYetDownloaded(QWidget* aParent, Document* theDocument, Layer* theLayer, Downloader* theDownloader)
+#define MULTIFETCH_URL_LENGTH 1800 /* keep multi-fetch queries well below common URL length limits */
+
+/* Build /nodes?nodes=..., /ways?ways=... and /relations?relations=... requests, chunked on URL length */
+static void addMultiFetchUrls(QList<QUrl>& theUrls, const QString& What, const QList<qint64>& Ids, Downloader* theDownloader)
+{
+    QString Base = M_PREFS->getOsmApiUrl()+theDownloader->getURLToFetch(What);
+    QString IdList;
+    foreach (qint64 id, Ids) {
+        if (!IdList.isEmpty() && Base.length()+IdList.length() > MULTIFETCH_URL_LENGTH) {
+            theUrls << QUrl(Base+IdList);
+            IdList.clear();
+        }
+        if (!IdList.isEmpty())
+            IdList += ",";
+        IdList += QString::number(id);
+    }
+    if (!IdList.isEmpty())
+        theUrls << QUrl(Base+IdList);
+}
+
+static void collectMissing(Feature* F, QSet<Feature*>& Requested, QList<qint64>& Nodes, QList<qint64>& Ways, QList<qint64>& Relations)
+{
+    if (!F)
+        return;
+    if (F->lastUpdated() == Feature::NotYetDownloaded) {
+        if (Requested.contains(F))
+            return;
+        Requested.insert(F);
+        if (CHECK_NODE(F))
+            Nodes << F->id().numId;
+        else if (CHECK_WAY(F))
+            Ways << F->id().numId;
+        else if (CHECK_RELATION(F))
+            Relations << F->id().numId;
+    } else if (CHECK_WAY(F)) {
+        Way* W = STATIC_CAST_WAY(F);
+        for (int i=0; i<W->size(); ++i)
+            collectMissing(W->getNode(i), Requested, Nodes, Ways, Relations);
+    }
+}
+
+static bool resolveNotYetDownloaded(QWidget* aParent, Document* theDocument, Layer* theLayer, const QSet<Relation*>& touchedRelations, Downloader* theDownloader)
 {
     // resolving nodes and roads makes no sense since the OSM api guarantees that they will be all downloaded,
     //  so only resolve for relations if the ResolveRelations pref is set
@@ -405,24 +486,73 @@ static bool resolveNotYetDownloaded(QWidget* aParent, Document* theDocument, Lay
         if (!aProgressWindow)
             return false;
 
+        QProgressDialog* dlg = aProgressWindow->getProgressDialog();
         QProgressBar* Bar = aProgressWindow->getProgressBar();
-        //QLabel* Lbl = aProgressWindow->getProgressLabel();
-
-        QList<Feature*> MustResolve;
-        MustResolve.clear();
-        for (FeatureIterator it(theDocument); !it.isEnd(); ++it)
-        {
-            Relation* RR = CAST_RELATION(it.get());
-            if (RR && RR->notEverythingDownloaded())
-                MustResolve.push_back(RR);
+        QLabel* Lbl = aProgressWindow->getProgressLabel();
+
+        // Only the relations read by this import can have become incomplete, no need to scan the document.
+        // Placeholder sub-relations are fetched too, as a /full request on them would have done.
+        QList<Relation*> MustResolve;
+        foreach (Relation* RR, touchedRelations) {
+            if (!RR->notEverythingDownloaded())
+                continue;
+            MustResolve << RR;
+            for (int i=0; i<RR->size(); ++i) {
+                Relation* Sub = CAST_RELATION(RR->get(i));
+                if (Sub && Sub->lastUpdated() == Feature::NotYetDownloaded && !MustResolve.contains(Sub))
+                    MustResolve << Sub;
+            }
         }
-        if (MustResolve.size())
-        {
-            Bar->setMaximum(MustResolve.size());
-            Bar->setValue(0);
-            if (!downloadToResolve(MustResolve,aParent,theDocument,theLayer, theDownloader))
-                return false;
+        if (MustResolve.isEmpty())
+            return true;
+
+        if (dlg)
+            dlg->setWindowTitle(QApplication::translate("Downloader", "Downloading unresolved..."));
+
+        // Each round fetches every missing member by type in a few concurrent multi-fetch requests;
+        //  ways arriving in one round bring placeholder nodes that are picked up by the next.
+        QSet<Feature*> Requested;
+        forever {
+            QList<qint64> Nodes, Ways, Relations;
+            foreach (Relation* RR, MustResolve) {
+                if (RR->lastUpdated() == Feature::NotYetDownloaded)
+                    collectMissing(RR, Requested, Nodes, Ways, Relations);
+                else
+                    for (int i=0; i<RR->size(); ++i)
+                        if (!CAST_RELATION(RR->get(i)))
+                            collectMissing(RR->get(i), Requested, Nodes, Ways, Relations);
+            }
+            if (Nodes.isEmpty() && Ways.isEmpty() && Relations.isEmpty())
+                break;
+
+            QList<QUrl> theUrls;
+            addMultiFetchUrls(theUrls, "relations", Relations, theDownloader);
+            addMultiFetchUrls(theUrls, "ways", Ways, theDownloader);
+            addMultiFetchUrls(theUrls, "nodes", Nodes, theDownloader);
+
+            if (Lbl)
+                Lbl->setText(QApplication::translate("Downloader","Downloading %1 nodes, %2 ways and %3 relations").arg(Nodes.size()).arg(Ways.size()).arg(Relations.size()));
+
+            StreamingDownloader Rcv(theDownloader->user(), theDownloader->password(), theDocument, theLayer, NULL);
+            Rcv.setAnimator(dlg, Lbl, Bar);
+            if (!Rcv.go(theUrls)) {
+                if (Rcv.wasCanceled())
+                    return false;
+                // A multi-fetch fails as a whole if one member is gone (404/410);
+                //  fall back to one full request per relation, which handles deleted members.
+                QList<Feature*> Remaining;
+                foreach (Relation* RR, MustResolve)
+                    if (RR->notEverythingDownloaded())
+                        Remaining << RR;
+                if (Bar) {
+                    Bar->setMaximum(Remaining.size());
+                    Bar->setValue(0);
+                }
+                return downloadToResolve(Remaining,aParent,theDocument,theLayer, theDownloader);
+            }
         }
+        foreach (Relation* RR, MustResolve)
+            RR->setLastUpdated(Feature::OSMServer);
     }
     return true;
 }
@@ -437,8 +567,7 @@ static bool deleteIncompleteRelations(QWidget* /*aParent*/, Document* /*theDocum
         }
     }
     for (int i=0; i<MustDelete.size(); i++) {
-        MustDelete[i]->layer()->remove(MustDelete[i]);
-        delete MustDelete[i];
+        MustDelete[i]->layer()->deleteFeature(MustDelete[i]);
     }
     return true;
 }
@@ -474,24 +603,16 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
     Layer* conflictLayer = new DrawingLayer(QApplication::translate("Downloader","Conflicts from %1").arg(theLayer->name()));
     theDocument->add(conflictLayer);
 
-    OSMHandler theHandler(theDocument,theLayer,conflictLayer);
-
-    QXmlSimpleReader xmlReader;
-    xmlReader.setContentHandler(&theHandler);
-    QXmlInputSource source;
-    QByteArray buf(File.read(10240));
-    source.setData(buf);
-    xmlReader.parse(&source,true);
+    OSMStreamParser theParser(theDocument,theLayer,conflictLayer);
     if (Bar) {
         Bar->setMaximum(File.size());
-        Bar->setValue(Bar->value()+buf.size());
+        Bar->setValue(0);
     }
 
     while (!File.atEnd())
     {
         QByteArray buf(File.read(20480));
-        source.setData(buf);
-        xmlReader.parseContinue();
+        theParser.feed(buf);
         if (Bar)
             Bar->setValue(Bar->value()+buf.size());
         qApp->processEvents();
@@ -502,15 +623,38 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
     bool WasCanceled = false;
     if (dlg)
         WasCanceled = dlg->wasCanceled();
+    return finishImportOSM(aParent, theDocument, theLayer, conflictLayer,
+                           theParser.handler().touchedWays, theParser.handler().touchedRelations, theDownloader, WasCanceled);
+}
+
+static void warnConflicts(QWidget* aParent)
+{
+    QMessageBox::warning(aParent,QApplication::translate("Downloader","Conflicts have been detected"),
+        QApplication::translate("Downloader",
+        "This means that some of the feature you modified"
+        " since your last download have since been modified by someone else on the server.\n"
+        "The features have been duplicated as \"conflict_...\" on the \"Conflicts...\" layer.\n"
+        "Before being able to upload your changes, you will have to manually merge the two versions"
+        " and remove the one from the \"Conflicts...\" layer."
+        ));
+}
+
+bool finishImportOSM(QWidget* aParent, Document* theDocument, Layer* theLayer, Layer* conflictLayer,
+                     const QSet<Way*>& touchedWays, const QSet<Relation*>& touchedRelations, Downloader* theDownloader, bool WasCanceled)
+{
     if (!WasCanceled && M_PREFS->getResolveRelations())
-        WasCanceled = !resolveNotYetDownloaded(aParent,theDocument,theLayer,theDownloader);
+        WasCanceled = !resolveNotYetDownloaded(aParent,theDocument,theLayer,touchedRelations,theDownloader);
     if (!WasCanceled && M_PREFS->getDeleteIncompleteRelations())
         WasCanceled = !deleteIncompleteRelations(aParent,theDocument,theLayer,theDownloader);
 
     if (WasCanceled)
     {
-        theDocument->remove(conflictLayer);
-        delete conflictLayer;
+        /* Conflicts already raised have updated the user's features: keep them to be merged */
+        if (!conflictLayer->size()) {
+            theDocument->remove(conflictLayer);
+            delete conflictLayer;
+        } else
+            warnConflicts(aParent);
         return false;
     }
     else
@@ -521,7 +665,7 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
 //                Bar->setMaximum(theHandler.touchedWays.size());
 //                Bar->setValue(0);
 //            }
-//            foreach (Way* w, theHandler.touchedWays) {
+//            foreach (Way* w, touchedWays) {
 //                w->updateVirtuals();
 //                if (Bar)
 //                    Bar->setValue(Bar->value()+1);
@@ -531,11 +675,11 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
 
         // Check for empty Roads/Relations and update virtual nodes
         QList<Feature*> EmptyFeature;
-        foreach (Way* w, theHandler.touchedWays) {
+        foreach (Way* w, touchedWays) {
             if (!w->size())
                 EmptyFeature.push_back(w);
         }
-        foreach (Relation* r, theHandler.touchedRelations) {
+        foreach (Relation* r, touchedRelations) {
             if (!r->size())
                 EmptyFeature.push_back(r);
         }
@@ -561,16 +705,8 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
         if (!conflictLayer->size()) {
             theDocument->remove(conflictLayer);
             delete conflictLayer;
-        } else {
-            QMessageBox::warning(aParent,QApplication::translate("Downloader","Conflicts have been detected"),
-                QApplication::translate("Downloader",
-                "This means that some of the feature you modified"
-                " since your last download have since been modified by someone else on the server.\n"
-                "The features have been duplicated as \"conflict_...\" on the \"Conflicts...\" layer.\n"
-                "Before being able to upload your changes, you will have to manually merge the two versions"
-                " and remove the one from the \"Conflicts...\" layer."
-                ));
-        }
+        } else
+            warnConflicts(aParent);
 
     }
     return true;
@@ -10,10 +10,13 @@ class Way;
 class Relation;
 
 class QByteArray;
+class QIODevice;
 class QString;
 class QWidget;
 
 #include <QXmlDefaultHandler>
+#include <QXmlSimpleReader>
+#include <QXmlInputSource>
 #include <QSet>
 
 class OSMHandler : public QXmlDefaultHandler
@@ -23,6 +26,7 @@ public:
 
     virtual bool startElement ( const QString & namespaceURI, const QString & localName, const QString & qName, const QXmlAttributes & atts );
     virtual bool endElement ( const QString & namespaceURI, const QString & localName, const QString & qName );
+    void abort();
 
 private:
     void parseNode(const QXmlAttributes & atts);
@@ -41,9 +45,30 @@ private:
 public:
         QSet<Way*> touchedWays;
         QSet<Relation*> touchedRelations;
+        int featureCount;
+};
+
+/// Incremental OSM XML parser, fed with chunks as they become available
+class OSMStreamParser
+{
+public:
+    OSMStreamParser(Document* aDoc, Layer* aLayer, Layer* aConflict);
+
+    bool feed(const QByteArray& buf);
+    void abort();
+    int featureCount() const;
+    OSMHandler& handler();
+
+private:
+    OSMHandler theHandler;
+    QXmlSimpleReader xmlReader;
+    QXmlInputSource source;
+    bool started;
 };
 
 bool importOSM(QWidget* aParent, const QString& aFilename, Document* theDocument, Layer* theLayer);
 bool importOSM(QWidget* aParent, QByteArray& Content, Document* theDocument, Layer* theLayer, Downloader* theDownloader);
+bool finishImportOSM(QWidget* aParent, Document* theDocument, Layer* theLayer, Layer* conflictLayer,
+                     const QSet<Way*>& touchedWays, const QSet<Relation*>& touchedRelations, Downloader* theDownloader, bool WasCanceled);
 
 #endif
@@ -0,0 +1,613 @@
+#include "Global.h"
+
+#include "OsmWriter.h"
+
+#include "Features.h"
+#include "MerkaartorPreferences.h"
+
+#include <QCoreApplication>
+#include <QProgressDialog>
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include "zlib.h"
+
+#define OSM_WRITE_CHUNK 1024 /* features per parallel task */
+#define OSM_WRITE_BATCH 4 /* chunks per thread kept in memory before they are written */
+
+/* The little of QXmlStreamWriter the OSM elements need, formatting into a byte array.
+   Elements are closed with "/>" when nothing was written inside them. */
+class XmlBytes
+{
+public:
+    XmlBytes(QByteArray& anOut, bool anIndent)
+        : out(anOut), indent(anIndent), pending(false) { }
+
+    void start(const char* name, int depth)
+    {
+        flush();
+        newLine(depth);
+        out += '<';
+        out += name;
+        pending = true;
+    }
+
+    void end(const char* name, int depth)
+    {
+        if (pending) {
+            out += "/>";
+            pending = false;
+            return;
+        }
+        newLine(depth);
+        out += "</";
+        out += name;
+        out += '>';
+    }
+
+    void flush()
+    {
+        if (pending) {
+            out += '>';
+            pending = false;
+        }
+    }
+
+    void attribute(const char* name, const char* value)
+    {
+        begin(name);
+        out += value;
+        out += '"';
+    }
+
+    void attribute(const char* name, const QString& value)
+    {
+        begin(name);
+        escape(value);
+        out += '"';
+    }
+
+    void attribute(const char* name, qint64 value)
+    {
+        begin(name);
+        number(value);
+        out += '"';
+    }
+
+    /* As COORD2STRING, 7 decimals unless told otherwise (at most 9) */
+    void coordinate(const char* name, qreal value, int places = 7)
+    {
+        begin(name);
+        qint64 scale = 1;
+        for (int i=0; i<places; ++i)
+            scale *= 10;
+        qint64 fixed = qRound64(value * scale);
+        if (fixed < 0) {
+            out += '-';
+            fixed = -fixed;
+        }
+        number(fixed / scale);
+
+        char decimals[10];
+        decimals[0] = '.';
+        qint64 rest = fixed % scale;
+        for (int i=places; i>0; --i) {
+            decimals[i] = char('0' + rest % 10);
+            rest /= 10;
+        }
+        out.append(decimals, places + 1);
+        out += '"';
+    }
+
+    /* As QDateTime::toString(Qt::ISODate) + "Z", which is what Feature::toXML writes */
+    void timestamp(const char* name, const QDateTime& time)
+    {
+        begin(name);
+        if (time.isValid()) {
+            QDate d = time.date();
+            QTime t = time.time();
+            char buf[19];
+            digits(buf, d.year(), 4);
+            buf[4] = '-';
+            digits(buf+5, d.month(), 2);
+            buf[7] = '-';
+            digits(buf+8, d.day(), 2);
+            buf[10] = 'T';
+            digits(buf+11, t.hour(), 2);
+            buf[13] = ':';
+            digits(buf+14, t.minute(), 2);
+            buf[16] = ':';
+            digits(buf+17, t.second(), 2);
+            out.append(buf, 19);
+        }
+        out += "Z\"";
+    }
+
+private:
+    void newLine(int depth)
+    {
+        if (!indent)
+            return;
+        out += '\n';
+        for (int i=0; i<depth; ++i)
+            out += "  ";
+    }
+
+    void begin(const char* name)
+    {
+        out += ' ';
+        out += name;
+        out += "=\"";
+    }
+
+    void number(qint64 value)
+    {
+        char buf[24];
+        char* e = buf + sizeof(buf);
+        char* p = e;
+        quint64 u = value < 0 ? 0 - quint64(value) : quint64(value);
+        do {
+            *--p = char('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (value < 0)
+            *--p = '-';
+        out.append(p, int(e - p));
+    }
+
+    static void digits(char* buf, int value, int width)
+    {
+        for (int i=width-1; i>=0; --i) {
+            buf[i] = char('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+    /* UTF-16 to UTF-8, escaped as QXmlStreamWriter escapes attribute values */
+    void escape(const QString& s)
+    {
+        const ushort* u = s.utf16();
+        int n = s.size();
+        for (int i=0; i<n; ++i) {
+            uint c = u[i];
+            if (c < 0x80) {
+                switch (c) {
+                case '&': out += "&amp;"; break;
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '"': out += "&quot;"; break;
+                case '\n': out += "&#10;"; break;
+                case '\r': out += "&#13;"; break;
+                case '\t': out += "&#9;"; break;
+                default: out += char(c);
+                }
+                continue;
+            }
+            if (c < 0x800) {
+                out += char(0xc0 | (c >> 6));
+                out += char(0x80 | (c & 0x3f));
+                continue;
+            }
+            if (QChar::isSurrogate(c)) {
+                if (QChar::isHighSurrogate(c) && i+1 < n && QChar::isLowSurrogate(u[i+1])) {
+                    c = QChar::surrogateToUcs4(ushort(c), u[++i]);
+                    out += char(0xf0 | (c >> 18));
+                    out += char(0x80 | ((c >> 12) & 0x3f));
+                    out += char(0x80 | ((c >> 6) & 0x3f));
+                    out += char(0x80 | (c & 0x3f));
+                    continue;
+                }
+                c = QChar::ReplacementCharacter;
+            }
+            out += char(0xe0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3f));
+            out += char(0x80 | (c & 0x3f));
+        }
+    }
+
+    QByteArray& out;
+    bool indent;
+    bool pending;
+};
+
+static const char* actionName(OsmWriter::ChangeAction anAction)
+{
+    switch (anAction) {
+    case OsmWriter::CreateAction:
+        return "create";
+    case OsmWriter::ModifyAction:
+        return "modify";
+    case OsmWriter::DeleteAction:
+        return "delete";
+    }
+    return "";
+}
+
+/* A whole gzip stream of its own; concatenated, they read back as one file */
+static QByteArray gzip(const QByteArray& data)
+{
+    z_stream z;
+    z.zalloc = Z_NULL;
+    z.zfree = Z_NULL;
+    z.opaque = Z_NULL;
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return QByteArray();
+
+    QByteArray packed;
+    packed.resize(int(deflateBound(&z, data.size())) + 32);
+    z.next_in = (Bytef*)data.constData();
+    z.avail_in = data.size();
+    z.next_out = (Bytef*)packed.data();
+    z.avail_out = packed.size();
+    int ret = deflate(&z, Z_FINISH);
+    packed.resize(int(z.total_out));
+    deflateEnd(&z);
+
+    return (ret == Z_STREAM_END) ? packed : QByteArray();
+}
+
+/* Formats one chunk of the features, gzipped if asked */
+class FormatOsmChunk
+{
+public:
+    FormatOsmChunk(const OsmWriter& aWriter, const QList<Feature*>& aFeatures, const QList<OsmWriter::ChangeAction>* someActions)
+        : theWriter(aWriter), theFeatures(aFeatures), theActions(someActions) { }
+
+    typedef void result_type;
+
+    void operator()(OsmWriter::Chunk& C)
+    {
+        C.bytes.reserve((C.end - C.begin) * 256);
+        XmlBytes xml(C.bytes, theWriter.theIndent);
+
+        for (int i=C.begin; i<C.end; ++i) {
+            if (!theActions) {
+                feature(xml, theFeatures.at(i), 1);
+                continue;
+            }
+            // The action elements span the chunks; each chunk closes what the previous one left open
+            OsmWriter::ChangeAction A = theActions->at(i);
+            if (i == 0 || A != theActions->at(i-1)) {
+                if (i)
+                    xml.end(actionName(theActions->at(i-1)), 1);
+                xml.start(actionName(A), 1);
+            }
+            feature(xml, theFeatures.at(i), 2);
+        }
+
+        C.size = C.bytes.size();
+        if (theWriter.theCompressed)
+            C.bytes = gzip(C.bytes);
+    }
+
+    void feature(XmlBytes& xml, const Feature* F, int depth)
+    {
+        if (CHECK_NODE(F)) {
+            const Node* N = static_cast<const Node*>(F);
+            if (N->isVirtual())
+                return;
+            xml.start("node", depth);
+            attributes(xml, F);
+            xml.coordinate("lon", N->position().x());
+            xml.coordinate("lat", N->position().y());
+            tags(xml, F, depth+1);
+            xml.end("node", depth);
+        } else if (CHECK_WAY(F)) {
+            const Way* W = static_cast<const Way*>(F);
+            xml.start("way", depth);
+            attributes(xml, F);
+            if (!theWriter.theStrict)
+                boundingBox(xml, F, depth+1);
+            if (W->size()) {
+                nd(xml, W->get(0), depth+1);
+                for (int i=1; i<W->size(); ++i)
+                    if (!W->getNode(i)->isVirtual())
+                        if (W->get(i)->id().numId != W->get(i-1)->id().numId)
+                            nd(xml, W->get(i), depth+1);
+            }
+            tags(xml, F, depth+1);
+            xml.end("way", depth);
+        } else if (CHECK_RELATION(F)) {
+            const Relation* R = static_cast<const Relation*>(F);
+            xml.start("relation", depth);
+            attributes(xml, F);
+            if (!theWriter.theStrict)
+                boundingBox(xml, F, depth+1);
+            for (int i=0; i<R->size(); ++i) {
+                const char* type = "node";
+                if (CHECK_WAY(R->get(i)))
+                    type = "way";
+                else if (CHECK_RELATION(R->get(i)))
+                    type = "relation";
+
+                xml.start("member", depth+1);
+                xml.attribute("type", type);
+                xml.attribute("ref", R->get(i)->id().numId);
+                xml.attribute("role", R->getRole(i));
+                xml.end("member", depth+1);
+            }
+            tags(xml, F, depth+1);
+            xml.end("relation", depth);
+        }
+    }
+
+private:
+    void attributes(XmlBytes& xml, const Feature* F)
+    {
+        xml.attribute("id", F->id().numId);
+#ifndef FRISIUS_BUILD
+        xml.timestamp("timestamp", F->time());
+        xml.attribute("version", qint64(F->versionNumber()));
+        xml.attribute("user", F->user());
+#endif
+        if (!theWriter.theChangesetId.isEmpty())
+            xml.attribute("changeset", theWriter.theChangesetId);
+        if (theWriter.theStrict)
+            return;
+
+        xml.attribute("actor", qint64(F->lastUpdated()));
+        if (F->isDeleted())
+            xml.attribute("deleted", "true");
+        if (F->getDirtyLevel())
+            xml.attribute("dirtylevel", qint64(F->getDirtyLevel()));
+        if (F->isUploaded())
+            xml.attribute("uploaded", "true");
+        if (F->isSpecial())
+            xml.attribute("special", "true");
+        if (theWriter.theSelection.contains(F))
+            xml.attribute("selected", "true");
+    }
+
+    void tags(XmlBytes& xml, const Feature* F, int depth)
+    {
+        for (int i=0; i<F->tagSize(); ++i) {
+            const QString& k = F->tagKey(i);
+            if (theWriter.theStrict && k.startsWith('_') && k.endsWith('_'))
+                continue;
+
+            xml.start("tag", depth);
+            xml.attribute("k", k);
+            xml.attribute("v", F->tagValue(i));
+            xml.end("tag", depth);
+        }
+    }
+
+    void nd(XmlBytes& xml, const Feature* F, int depth)
+    {
+        xml.start("nd", depth);
+        xml.attribute("ref", F->id().numId);
+        xml.end("nd", depth);
+    }
+
+    /* Brought up to date by the writer beforehand; the workers only read it */
+    void boundingBox(XmlBytes& xml, const Feature* F, int depth)
+    {
+        const CoordBox& bb = F->boundingBox(false);
+        xml.start("BoundingBox", depth);
+        xml.start("topright", depth+1);
+        xml.coordinate("lon", bb.topRight().x());
+        xml.coordinate("lat", bb.topRight().y());
+        xml.end("topright", depth+1);
+        xml.start("bottomleft", depth+1);
+        xml.coordinate("lon", bb.bottomLeft().x());
+        xml.coordinate("lat", bb.bottomLeft().y());
+        xml.end("bottomleft", depth+1);
+        xml.end("BoundingBox", depth);
+    }
+
+    const OsmWriter& theWriter;
+    const QList<Feature*>& theFeatures;
+    const QList<OsmWriter::ChangeAction>* theActions;
+};
+
+OsmWriter::OsmWriter(QIODevice* aDevice)
+    : theDevice(aDevice)
+    , theStrict(false)
+    , theIndent(false)
+    , theCompressed(false)
+    , theBytesWritten(0)
+{
+}
+
+void OsmWriter::setSelection(const QList<Feature*>& aSelection)
+{
+    theSelection.clear();
+    foreach (Feature* F, aSelection)
+        theSelection.insert(F);
+}
+
+bool OsmWriter::put(QByteArray bytes)
+{
+    theBytesWritten += bytes.size();
+    if (theCompressed)
+        bytes = gzip(bytes);
+    return theDevice->write(bytes) == bytes.size();
+}
+
+bool OsmWriter::writeChunks(const QList<Feature*>& aFeatures, const QList<ChangeAction>* someActions, QProgressDialog* progress)
+{
+    int perBatch = qMax(1, QThread::idealThreadCount()) * OSM_WRITE_BATCH;
+    int i = 0;
+    while (i < aFeatures.size()) {
+        QVector<Chunk> chunks;
+        for (; i<aFeatures.size() && chunks.size()<perBatch; i+=OSM_WRITE_CHUNK) {
+            Chunk C;
+            C.begin = i;
+            C.end = qMin(i + OSM_WRITE_CHUNK, aFeatures.size());
+            C.size = 0;
+            chunks << C;
+        }
+        QtConcurrent::blockingMap(chunks, FormatOsmChunk(*this, aFeatures, someActions));
+
+        foreach (const Chunk& C, chunks) {
+            theBytesWritten += C.size;
+            if (theDevice->write(C.bytes) != C.bytes.size())
+                return false;
+        }
+
+        if (progress) {
+            if (progress->wasCanceled())
+                return false;
+            progress->setValue(progress->value() + chunks.last().end - chunks.first().begin);
+        }
+    }
+    return true;
+}
+
+bool OsmWriter::writeOsm(const QList<Feature*>& aFeatures, QProgressDialog* progress)
+{
+    // Also brings the boxes up to date before the workers read them
+    CoordBox aCoordBox;
+    for (int i=0; i<aFeatures.size(); ++i) {
+        if (i)
+            aCoordBox.merge(aFeatures[i]->boundingBox(true));
+        else
+            aCoordBox = aFeatures[i]->boundingBox(true);
+    }
+
+    QByteArray head("<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+    XmlBytes xml(head, theIndent);
+    xml.start("osm", 0);
+    xml.attribute("version", "0.6");
+    xml.attribute("generator", QString("%1 %2").arg(QCoreApplication::applicationName()).arg(STRINGIFY(VERSION)));
+    xml.flush();
+    if (!put(head))
+        return false;
+
+    if (!writeChunks(aFeatures, NULL, progress))
+        return false;
+
+    QByteArray tail;
+    XmlBytes end(tail, theIndent);
+    end.start("bound", 1);
+    QString S = QString().number(aCoordBox.bottom(),'f',6) + ",";
+    S += QString().number(aCoordBox.left(),'f',6) + ",";
+    S += QString().number(aCoordBox.top(),'f',6) + ",";
+    S += QString().number(aCoordBox.right(),'f',6);
+    end.attribute("box", S);
+    end.attribute("origin", QString("http://www.openstreetmap.org/api/%1").arg(M_PREFS->apiVersion()));
+    end.end("bound", 1);
+    end.end("osm", 0);
+    if (theIndent)
+        tail += '\n';
+    return put(tail);
+}
+
+bool OsmWriter::writeOsmChange(const QList<QPair<ChangeAction, Feature*> >& someChanges)
+{
+    return writeOsmChange(someChanges, 0, someChanges.size());
+}
+
+bool OsmWriter::writeOsmChange(const QList<QPair<ChangeAction, Feature*> >& someChanges, int from, int to)
+{
+    QList<Feature*> theFeatures;
+    QList<ChangeAction> theActions;
+    for (int i=from; i<to; ++i) {
+        theActions << someChanges.at(i).first;
+        theFeatures << someChanges.at(i).second;
+        if (!theStrict)
+            someChanges.at(i).second->boundingBox(true);
+    }
+
+    QByteArray head("<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+    XmlBytes xml(head, theIndent);
+    // As QXmlStreamWriter used to write it, trailing space included
+    xml.start("osmChange ", 0);
+    xml.attribute("version", "0.3");
+    xml.attribute("generator", QString("Merkaartor %1").arg(STRINGIFY(VERSION)));
+    xml.flush();
+    if (!put(head))
+        return false;
+
+    if (!writeChunks(theFeatures, &theActions, NULL))
+        return false;
+
+    QByteArray tail;
+    XmlBytes end(tail, theIndent);
+    if (theActions.size())
+        end.end(actionName(theActions.last()), 1);
+    end.end("osmChange ", 0);
+    if (theIndent)
+        tail += '\n';
+    return put(tail);
+}
+
+QByteArray OsmWriter::element(const Feature* F, const QString& aChangesetId)
+{
+    QByteArray bytes;
+    XmlBytes xml(bytes, false);
+
+    const char* name;
+    if (CHECK_NODE(F)) {
+        if (static_cast<const Node*>(F)->isVirtual())
+            return bytes;
+        name = "node";
+    } else if (CHECK_WAY(F))
+        name = "way";
+    else if (CHECK_RELATION(F))
+        name = "relation";
+    else
+        return bytes;
+
+    xml.start(name, 0);
+    xml.attribute("id", F->id().numId);
+    if (CHECK_NODE(F)) {
+        const Node* N = static_cast<const Node*>(F);
+        xml.coordinate("lat", N->position().y(), 8);
+        xml.coordinate("lon", N->position().x(), 8);
+    }
+#ifndef FRISIUS_BUILD
+    xml.attribute("version", qint64(F->versionNumber()));
+#endif
+    if (!aChangesetId.isEmpty())
+        xml.attribute("changeset", aChangesetId);
+    xml.flush();
+
+    if (CHECK_WAY(F)) {
+        const Way* W = static_cast<const Way*>(F);
+        if (W->size()) {
+            xml.start("nd", 1);
+            xml.attribute("ref", W->get(0)->id().numId);
+            xml.end("nd", 1);
+            for (int i=1; i<W->size(); ++i)
+                if (!W->getNode(i)->isVirtual())
+                    if (W->get(i)->id().numId != W->get(i-1)->id().numId) {
+                        xml.start("nd", 1);
+                        xml.attribute("ref", W->get(i)->id().numId);
+                        xml.end("nd", 1);
+                    }
+        }
+    } else if (CHECK_RELATION(F)) {
+        const Relation* R = static_cast<const Relation*>(F);
+        for (int i=0; i<R->size(); ++i) {
+            const char* type = "node";
+            if (CHECK_WAY(R->get(i)))
+                type = "way";
+            else if (CHECK_RELATION(R->get(i)))
+                type = "relation";
+
+            xml.start("member", 1);
+            xml.attribute("type", type);
+            xml.attribute("ref", R->get(i)->id().numId);
+            xml.attribute("role", R->getRole(i));
+            xml.end("member", 1);
+        }
+    }
+
+    for (int i=0; i<F->tagSize(); ++i) {
+        const QString& k = F->tagKey(i);
+        if (k.startsWith('_') && k.endsWith('_'))
+            continue;
+
+        xml.start("tag", 1);
+        xml.attribute("k", k);
+        xml.attribute("v", F->tagValue(i));
+        xml.end("tag", 1);
+    }
+
+    xml.flush();
+    bytes += "</";
+    bytes += name;
+    bytes += '>';
+    return bytes;
+}
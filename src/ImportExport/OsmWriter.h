@@ -0,0 +1,68 @@
+#ifndef OSMWRITER_H
+#define OSMWRITER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QSet>
+#include <QString>
+
+class Feature;
+class QIODevice;
+class QProgressDialog;
+
+/* Writes OSM and osmChange XML straight into UTF-8 buffers. The features are formatted a chunk at
+   a time on the thread pool and the chunks are written to the device in order, so the output is
+   the same whatever the scheduling. The elements are those of Feature::toXML. */
+class OsmWriter
+{
+public:
+    enum ChangeAction { CreateAction, ModifyAction, DeleteAction };
+
+    OsmWriter(QIODevice* aDevice);
+
+    /* Leaves out Merkaartor's own attributes and tags, as the API wants */
+    void setStrict(bool b) { theStrict = b; }
+    void setChangesetId(const QString& anId) { theChangesetId = anId; }
+    /* The features marked selected="true" when not strict */
+    void setSelection(const QList<Feature*>& aSelection);
+    void setAutoFormatting(bool b) { theIndent = b; }
+    /* gzip the output; each chunk is its own gzip member, as the chunks are compressed in parallel */
+    void setCompressed(bool b) { theCompressed = b; }
+
+    /* An <osm> document with the features and their bounds.
+       Returns false if the device failed or the progress dialog was canceled. */
+    bool writeOsm(const QList<Feature*>& aFeatures, QProgressDialog* progress = NULL);
+    bool writeOsmChange(const QList<QPair<ChangeAction, Feature*> >& someChanges);
+    /* The changes from index from up to (not including) to */
+    bool writeOsmChange(const QList<QPair<ChangeAction, Feature*> >& someChanges, int from, int to);
+
+    /* Bytes of XML written, counted before compression */
+    qint64 bytesWritten() const { return theBytesWritten; }
+
+    /* One element as the requests sent a feature at a time want it: id, coordinates with 8
+       decimals, version and changeset, then the nodes or members and the tags */
+    static QByteArray element(const Feature* F, const QString& aChangesetId);
+
+private:
+    struct Chunk
+    {
+        int begin, end;
+        QByteArray bytes;
+        int size;       // of the XML, before compression
+    };
+    friend class FormatOsmChunk;
+
+    bool writeChunks(const QList<Feature*>& aFeatures, const QList<ChangeAction>* someActions, QProgressDialog* progress);
+    bool put(QByteArray bytes);
+
+    QIODevice* theDevice;
+    bool theStrict;
+    QString theChangesetId;
+    QSet<const Feature*> theSelection;
+    bool theIndent;
+    bool theCompressed;
+    qint64 theBytesWritten;
+};
+
+#endif // OSMWRITER_H
@@ -0,0 +1,850 @@
+#include "TrackParser.h"
+
+#include <QThread>
+#if QT_VERSION >= 0x050000
+#include <QtConcurrent>
+#else
+#include <QtConcurrentMap>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#define NMEA_CHUNK_MIN (256*1024) /* bytes; smaller logs are not worth cutting up */
+#define NMEA_MAX_FIELDS 32
+#define GPX_MAX_DEPTH 64
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static inline bool equals(const char* b, const char* e, const char* s)
+{
+    int n = strlen(s);
+    return e - b == n && !memcmp(b, s, n);
+}
+
+static const double Pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Reads the decimal number filling [b, e), with spaces around it; v is 0 when there is none,
+   as QString::toDouble() gives */
+static bool readNumber(const char* b, const char* e, double& v)
+{
+    v = 0;
+    while (b < e && isSpace(*b)) ++b;
+    while (e > b && isSpace(e[-1])) --e;
+
+    bool negative = false;
+    if (b < e && (*b == '-' || *b == '+'))
+        negative = *b++ == '-';
+
+    quint64 mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; b < e && isDigit(*b); ++b, any = true) {
+        if (digits < 18) {
+            mantissa = mantissa * 10 + (*b - '0');
+            if (mantissa)
+                ++digits;
+        } else
+            ++exponent;
+    }
+    if (b < e && *b == '.') {
+        for (++b; b < e && isDigit(*b); ++b, any = true) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (*b - '0');
+                if (mantissa)
+                    ++digits;
+                --exponent;
+            }
+        }
+    }
+    if (any && b < e && (*b == 'e' || *b == 'E')) {
+        ++b;
+        bool negativeExp = false;
+        if (b < e && (*b == '-' || *b == '+'))
+            negativeExp = *b++ == '-';
+        int exp = 0;
+        if (b == e || !isDigit(*b))
+            return false;
+        for (; b < e && isDigit(*b); ++b)
+            if (exp < 10000)
+                exp = exp * 10 + (*b - '0');
+        exponent += negativeExp ? -exp : exp;
+    }
+    if (!any || b != e)
+        return false;
+
+    double r = double(mantissa);
+    if (exponent < 0)
+        r = -exponent <= 22 ? r / Pow10[-exponent] : r / pow(10., -exponent);
+    else if (exponent > 0)
+        r = exponent <= 22 ? r * Pow10[exponent] : r * pow(10., exponent);
+    v = negative ? -r : r;
+    return true;
+}
+
+static bool readInteger(const char* b, const char* e, qint64& v)
+{
+    v = 0;
+    bool negative = b < e && *b == '-';
+    if (negative)
+        ++b;
+    if (b == e || e - b > 18)
+        return false;
+    for (; b < e; ++b) {
+        if (!isDigit(*b))
+            return false;
+        v = v * 10 + (*b - '0');
+    }
+    if (negative)
+        v = -v;
+    return true;
+}
+
+static bool readDigits(const char* s, int n, int& v)
+{
+    v = 0;
+    for (int i=0; i<n; ++i) {
+        if (!isDigit(s[i]))
+            return false;
+        v = v * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+/* Seconds since the epoch of a UTC date and time, checked */
+static bool toEpoch(int y, int m, int d, int h, int mi, int s, uint& t)
+{
+    static const int MonthDays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (m < 1 || m > 12 || d < 1 || d > MonthDays[m-1] || h > 23 || mi > 59 || s > 60)
+        return false;
+    if (m == 2 && d == 29 && !(y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)))
+        return false;
+    if (y < 1970)
+        return false;
+
+    // Days from 1970-01-01 of the proleptic Gregorian calendar, counting years from March
+    int yy = m <= 2 ? y - 1 : y;
+    int era = yy / 400;
+    int yoe = yy - era * 400;
+    int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    qint64 days = qint64(era) * 146097 + doe - 719468;
+
+    t = uint(days * 86400 + h * 3600 + mi * 60 + s);
+    return true;
+}
+
+/* NMEA */
+
+struct NmeaSentence
+{
+    char type;      // 'A' GSA, 'G' GGA, 'L' GLL, 'R' RMC
+    bool ok;        // the fix is good for GSA, GGA and GLL; the RMC gives a point
+    double lat, lon, speed, altitude;
+    uint time;
+};
+
+struct NmeaChunk
+{
+    const char* begin;
+    const char* end;
+    QVector<NmeaSentence> sentences;
+};
+
+static void readSentence(const char* b, const char* e, QVector<NmeaSentence>& out)
+{
+    if (e - b < 6 || b[1] != 'G' || b[2] != 'P')
+        return;
+
+    NmeaSentence S;
+    if (b[3] == 'G' && b[4] == 'S' && b[5] == 'A')
+        S.type = 'A';
+    else if (b[3] == 'G' && b[4] == 'G' && b[5] == 'A')
+        S.type = 'G';
+    else if (b[3] == 'G' && b[4] == 'L' && b[5] == 'L')
+        S.type = 'L';
+    else if (b[3] == 'R' && b[4] == 'M' && b[5] == 'C')
+        S.type = 'R';
+    else
+        return;
+    S.ok = false;
+    S.lat = S.lon = S.speed = S.altitude = 0;
+    S.time = 0;
+
+    const char* star = (const char*)memchr(b, '*', e - b);
+    if (star) {
+        if (e - star < 3)
+            return;
+        int hi = hexValue(star[1]), lo = hexValue(star[2]);
+        uchar sum = 0;
+        for (const char* p = b+1; p < star; ++p)
+            sum ^= uchar(*p);
+        if (hi < 0 || lo < 0 || sum != ((hi << 4) | lo))
+            return;
+    }
+
+    // Two sentences run together: the fix counts as lost
+    if (memchr(b+1, '$', e - b - 1)) {
+        out.append(S);
+        return;
+    }
+
+    const char* end = star ? star : e;
+    const char* start[NMEA_MAX_FIELDS];
+    const char* stop[NMEA_MAX_FIELDS];
+    int size = 0;
+    start[0] = b;
+    for (const char* p = b; ; ++p) {
+        if (p == end || *p == ',') {
+            stop[size++] = p;
+            if (p == end || size == NMEA_MAX_FIELDS)
+                break;
+            start[size] = p+1;
+        }
+    }
+
+    double v;
+    switch (S.type) {
+    case 'A':
+        if (size >= 3) {
+            readNumber(start[2], stop[2], v);
+            S.ok = int(v) != 1;
+        }
+        break;
+
+    case 'G':
+        if (size >= 10) {
+            readNumber(start[6], stop[6], v);
+            if (int(v) != 0) {
+                readNumber(start[9], stop[9], S.altitude);
+                S.ok = true;
+            }
+        }
+        break;
+
+    case 'L':
+        S.ok = size >= 7 && equals(start[6], stop[6], "A");
+        break;
+
+    case 'R': {
+        if (size < 10 || !equals(start[2], stop[2], "A"))
+            return;
+
+        // ddmm.mmmm and dddmm.mmmm
+        readNumber(start[3], stop[3], v);
+        double deg = floor(v / 100);
+        S.lat = deg + (v - deg * 100) / 60.0;
+        if (!equals(start[4], stop[4], "N"))
+            S.lat = -S.lat;
+        readNumber(start[5], stop[5], v);
+        deg = floor(v / 100);
+        S.lon = deg + (v - deg * 100) / 60.0;
+        if (!equals(start[6], stop[6], "E"))
+            S.lon = -S.lon;
+        readNumber(start[7], stop[7], v);
+        S.speed = v * 1.852;
+
+        // ddmmyy and hhmmss, with or without fractions
+        int dd, mm, yy, h, mi, s;
+        if (stop[9] - start[9] != 6 || stop[1] - start[1] < 6)
+            return;
+        if (stop[1] - start[1] > 6 && start[1][6] != '.')
+            return;
+        if (!readDigits(start[9], 2, dd) || !readDigits(start[9]+2, 2, mm) || !readDigits(start[9]+4, 2, yy)
+                || !readDigits(start[1], 2, h) || !readDigits(start[1]+2, 2, mi) || !readDigits(start[1]+4, 2, s))
+            return;
+        yy += 1900;
+        if (yy < 1970)
+            yy += 100;
+        if (!toEpoch(yy, mm, dd, h, mi, s, S.time))
+            return;
+        S.ok = true;
+        break;
+    }
+    }
+    out.append(S);
+}
+
+class ReadNmeaChunk
+{
+public:
+    typedef void result_type;
+
+    void operator()(NmeaChunk& c)
+    {
+        for (const char* p = c.begin; p < c.end; ) {
+            const char* nl = (const char*)memchr(p, '\n', c.end - p);
+            if (!nl)
+                nl = c.end;
+            const char* e = nl;
+            if (e > p && e[-1] == '\r')
+                --e;
+            if (*p == '$')
+                readSentence(p, e, c.sentences);
+            p = nl + 1;
+        }
+    }
+};
+
+NmeaParser::NmeaParser()
+{
+}
+
+void NmeaParser::parse(const char* data, qint64 size)
+{
+    theSegments.clear();
+
+    // Cut at line ends
+    QVector<NmeaChunk> chunks;
+    int count = int(qBound(qint64(1), size / NMEA_CHUNK_MIN, qint64(QThread::idealThreadCount() * 4)));
+    const char* end = data + size;
+    for (const char* p = data; p < end; ) {
+        const char* q = p + size / count;
+        if (q >= end)
+            q = end;
+        else {
+            q = (const char*)memchr(q, '\n', end - q);
+            q = q ? q + 1 : end;
+        }
+        NmeaChunk c;
+        c.begin = p;
+        c.end = q;
+        chunks.append(c);
+        p = q;
+    }
+    QtConcurrent::blockingMap(chunks, ReadNmeaChunk());
+
+    // Follow the fix, as it goes through the log
+    bool goodFix = false;
+    bool goodFix3D = true;
+    qreal altitude = 0.0;
+    QVector<TrackFix> current;
+    for (int i=0; i<chunks.size(); ++i) {
+        const QVector<NmeaSentence>& sentences = chunks.at(i).sentences;
+        for (int j=0; j<sentences.size(); ++j) {
+            const NmeaSentence& S = sentences.at(j);
+            bool lost = false;
+            switch (S.type) {
+            case 'A':
+                lost = goodFix3D && !S.ok;
+                goodFix3D = S.ok;
+                break;
+            case 'G':
+                lost = goodFix && !S.ok;
+                goodFix = S.ok;
+                if (S.ok)
+                    altitude = S.altitude;
+                break;
+            case 'L':
+                lost = goodFix && !S.ok;
+                goodFix = S.ok;
+                break;
+            case 'R':
+                if (S.ok && goodFix && goodFix3D) {
+                    TrackFix F;
+                    F.lat = S.lat;
+                    F.lon = S.lon;
+                    F.elevation = altitude;
+                    F.speed = S.speed;
+                    F.time = S.time;
+                    F.id = 0;
+                    F.text = -1;
+                    current.append(F);
+                }
+                break;
+            }
+            if (lost && !current.isEmpty()) {
+                theSegments.append(current);
+                current.clear();
+            }
+        }
+    }
+    if (!current.isEmpty())
+        theSegments.append(current);
+}
+
+int NmeaParser::fixCount() const
+{
+    int n = 0;
+    for (int i=0; i<theSegments.size(); ++i)
+        n += theSegments.at(i).size();
+    return n;
+}
+
+/* GPX */
+
+/* Decodes the text in [b, e) with its character references */
+static bool readText(const char* b, const char* e, QString& out)
+{
+    if (!memchr(b, '&', e - b)) {
+        out = QString::fromUtf8(b, e - b);
+        return true;
+    }
+
+    QByteArray bytes;
+    bytes.reserve(e - b);
+    while (b < e) {
+        if (*b != '&') {
+            bytes.append(*b++);
+            continue;
+        }
+        const char* semi = (const char*)memchr(b, ';', e - b);
+        if (!semi)
+            return false;
+        const char* name = b + 1;
+        if (equals(name, semi, "amp"))
+            bytes.append('&');
+        else if (equals(name, semi, "lt"))
+            bytes.append('<');
+        else if (equals(name, semi, "gt"))
+            bytes.append('>');
+        else if (equals(name, semi, "quot"))
+            bytes.append('"');
+        else if (equals(name, semi, "apos"))
+            bytes.append('\'');
+        else if (semi - name > 1 && *name == '#') {
+            uint code = 0;
+            bool hex = name[1] == 'x';
+            const char* p = name + (hex ? 2 : 1);
+            if (p == semi)
+                return false;
+            for (; p < semi; ++p) {
+                int d = hex ? hexValue(*p) : (isDigit(*p) ? *p - '0' : -1);
+                if (d < 0 || code > 0x10ffff)
+                    return false;
+                code = code * (hex ? 16 : 10) + d;
+            }
+            if (!code || code > 0x10ffff)
+                return false;
+            bytes.append(QString::fromUcs4(&code, 1).toUtf8());
+        } else
+            return false;
+        b = semi + 1;
+    }
+    out = QString::fromUtf8(bytes);
+    return true;
+}
+
+/* yyyy-MM-dd or yyyy-MM-ddThh:mm:ss, and whatever follows, taken as UTC */
+static bool readIsoTime(const char* b, const char* e, uint& t)
+{
+    while (b < e && isSpace(*b)) ++b;
+    int y, m, d, h = 0, mi = 0, s = 0;
+    if (e - b < 10 || b[4] != '-' || b[7] != '-')
+        return false;
+    if (!readDigits(b, 4, y) || !readDigits(b+5, 2, m) || !readDigits(b+8, 2, d))
+        return false;
+    if (e - b > 10 && !isSpace(b[10])) {
+        if (e - b < 19 || b[10] != 'T' || b[13] != ':' || b[16] != ':')
+            return false;
+        if (!readDigits(b+11, 2, h) || !readDigits(b+14, 2, mi) || !readDigits(b+17, 2, s))
+            return false;
+    }
+    return toEpoch(y, m, d, h, mi, s, t);
+}
+
+class GpxReader
+{
+public:
+    GpxReader(QList<GpxParser::Track>& aTracks, QVector<TrackFix>& aWaypoints, QVector<GpxParser::Text>& aTexts)
+        : theTracks(aTracks), theWaypoints(aWaypoints), theTexts(aTexts), depth(0), seenRoot(false)
+    {
+    }
+
+    bool read(const char* data, qint64 size);
+
+private:
+    enum Kind { Other, Root, Track, Route, Segment, Point, Extensions, Leaf };
+    enum LeafKind { NoLeaf, Name, Desc, Cmt, Time, Ele, Speed, Id };
+
+    struct Open
+    {
+        const char* name;
+        int length;
+        Kind kind;
+        LeafKind leaf;
+    };
+
+    const char* skipDeclaration(const char* p, const char* end);
+    const char* readStartTag(const char* p, const char* end);
+    const char* readEndTag(const char* p, const char* end);
+    bool open(const char* name, int length, const char* local, int localLength,
+              double lat, double lon, qint64 id);
+    bool close(const char* textEnd);
+
+    QList<GpxParser::Track>& theTracks;
+    QVector<TrackFix>& theWaypoints;
+    QVector<GpxParser::Text>& theTexts;
+
+    Open stack[GPX_MAX_DEPTH];
+    int depth;
+    bool seenRoot;
+    const char* textStart;
+
+    TrackFix fix;
+    GpxParser::Text text;
+    bool hasText;
+    bool waypoint;
+};
+
+/* Skips <?...?>, <!--...--> and <!DOCTYPE ...> from p; NULL for what is not read */
+const char* GpxReader::skipDeclaration(const char* p, const char* end)
+{
+    if (p[1] == '?') {
+        const char* q = p + 2;
+        for (; q + 1 < end && !(q[0] == '?' && q[1] == '>'); ++q) ;
+        if (q + 1 >= end)
+            return NULL;
+        if (end - p > 6 && !memcmp(p, "<?xml", 5) && isSpace(p[5])) {
+            // Only UTF-8, and ASCII with it
+            for (const char* r = p + 5; r + 8 < q; ++r) {
+                if (memcmp(r, "encoding", 8))
+                    continue;
+                r += 8;
+                while (r < q && (isSpace(*r) || *r == '=')) ++r;
+                if (r == q || (*r != '"' && *r != '\''))
+                    return NULL;
+                const char* v = ++r;
+                while (r < q && *r != v[-1]) ++r;
+                QByteArray enc = QByteArray(v, r - v).toLower();
+                if (enc != "utf-8" && enc != "utf8" && enc != "us-ascii")
+                    return NULL;
+                break;
+            }
+        }
+        return q + 2;
+    }
+    if (end - p >= 4 && !memcmp(p, "<!--", 4)) {
+        if (depth && stack[depth-1].kind == Leaf)
+            return NULL;
+        for (const char* q = p + 4; q + 2 < end; ++q)
+            if (q[0] == '-' && q[1] == '-' && q[2] == '>')
+                return q + 3;
+        return NULL;
+    }
+    // DOCTYPE; an internal subset could declare entities
+    for (const char* q = p + 2; q < end; ++q) {
+        if (*q == '[' || *q == '<')
+            return NULL;
+        if (*q == '>')
+            return depth ? NULL : q + 1;
+    }
+    return NULL;
+}
+
+const char* GpxReader::readStartTag(const char* p, const char* end)
+{
+    const char* name = p + 1;
+    const char* q = name;
+    while (q < end && !isSpace(*q) && *q != '>' && *q != '/') ++q;
+    if (q == name || q == end)
+        return NULL;
+    int length = q - name;
+    const char* local = name;
+    for (const char* c = name; c < q; ++c)
+        if (*c == ':')
+            local = c + 1;
+
+    double lat = 0, lon = 0;
+    qint64 id = 0;
+    bool selfClosing = false;
+    for (;;) {
+        while (q < end && isSpace(*q)) ++q;
+        if (q == end)
+            return NULL;
+        if (*q == '>') {
+            ++q;
+            break;
+        }
+        if (*q == '/') {
+            if (q + 1 == end || q[1] != '>')
+                return NULL;
+            selfClosing = true;
+            q += 2;
+            break;
+        }
+
+        const char* attr = q;
+        while (q < end && !isSpace(*q) && *q != '=' && *q != '>') ++q;
+        const char* attrEnd = q;
+        while (q < end && isSpace(*q)) ++q;
+        if (q == end || *q != '=' || attr == attrEnd)
+            return NULL;
+        ++q;
+        while (q < end && isSpace(*q)) ++q;
+        if (q == end || (*q != '"' && *q != '\''))
+            return NULL;
+        const char* value = q + 1;
+        const char* valueEnd = (const char*)memchr(value, *q, end - value);
+        if (!valueEnd)
+            return NULL;
+        q = valueEnd + 1;
+
+        if (equals(attr, attrEnd, "lat"))
+            readNumber(value, valueEnd, lat);
+        else if (equals(attr, attrEnd, "lon"))
+            readNumber(value, valueEnd, lon);
+        else if (equals(attr, attrEnd, "xml:id"))
+            readInteger(value, valueEnd, id);
+    }
+
+    if (!open(name, length, local, name + length - local, lat, lon, id))
+        return NULL;
+    textStart = q;
+    if (selfClosing && !close(q))
+        return NULL;
+    return q;
+}
+
+const char* GpxReader::readEndTag(const char* p, const char* end)
+{
+    const char* name = p + 2;
+    const char* q = name;
+    while (q < end && !isSpace(*q) && *q != '>') ++q;
+    if (!depth || q - name != stack[depth-1].length || memcmp(name, stack[depth-1].name, q - name))
+        return NULL;
+    const char* textEnd = p;
+    while (q < end && isSpace(*q)) ++q;
+    if (q == end || *q != '>')
+        return NULL;
+    if (!close(textEnd))
+        return NULL;
+    return q + 1;
+}
+
+bool GpxReader::open(const char* name, int length, const char* local, int localLength,
+                     double lat, double lon, qint64 id)
+{
+    if (depth == GPX_MAX_DEPTH)
+        return false;
+
+    Kind parent = depth ? stack[depth-1].kind : Other;
+    Open o;
+    o.name = name;
+    o.length = length;
+    o.kind = Other;
+    o.leaf = NoLeaf;
+    const char* e = local + localLength;
+
+    if (!depth) {
+        if (seenRoot || !equals(local, e, "gpx"))
+            return false;
+        seenRoot = true;
+        o.kind = Root;
+    } else if (parent == Leaf) {
+        // Markup inside a text
+        return false;
+    } else if (parent == Root) {
+        if (equals(local, e, "trk") || equals(local, e, "rte")) {
+            GpxParser::Track T;
+            T.route = equals(local, e, "rte");
+            o.kind = T.route ? Route : Track;
+            if (T.route) {
+                GpxParser::Segment S;
+                S.id = id;
+                T.segments.append(S);
+            }
+            theTracks.append(T);
+        } else if (equals(local, e, "wpt")) {
+            o.kind = Point;
+            waypoint = true;
+        }
+    } else if (parent == Track || parent == Route) {
+        if (parent == Track && equals(local, e, "trkseg")) {
+            GpxParser::Segment S;
+            S.id = id;
+            theTracks.last().segments.append(S);
+            o.kind = Segment;
+        } else if (parent == Route && equals(local, e, "rtept")) {
+            o.kind = Point;
+            waypoint = false;
+        } else if (equals(local, e, "name")) {
+            o.kind = Leaf;
+            o.leaf = Name;
+        } else if (equals(local, e, "desc")) {
+            o.kind = Leaf;
+            o.leaf = Desc;
+        }
+    } else if (parent == Segment) {
+        if (equals(local, e, "trkpt")) {
+            o.kind = Point;
+            waypoint = false;
+        }
+    } else if (parent == Point) {
+        o.kind = Leaf;
+        if (equals(local, e, "time"))
+            o.leaf = Time;
+        else if (equals(local, e, "ele"))
+            o.leaf = Ele;
+        else if (equals(local, e, "speed"))
+            o.leaf = Speed;
+        else if (equals(local, e, "name"))
+            o.leaf = Name;
+        else if (equals(local, e, "desc"))
+            o.leaf = Desc;
+        else if (equals(local, e, "cmt"))
+            o.leaf = Cmt;
+        else if (equals(local, e, "extensions"))
+            o.kind = Extensions;
+        else
+            o.kind = Other;
+    } else if (parent == Extensions) {
+        // The first <id> anywhere in there, for OpenStreetBugs
+        if (equals(local, e, "id") && !text.special) {
+            o.kind = Leaf;
+            o.leaf = Id;
+        } else
+            o.kind = Extensions;
+    }
+
+    if (o.kind == Point) {
+        fix.lat = lat;
+        fix.lon = lon;
+        fix.elevation = 0;
+        fix.speed = 0;
+        fix.time = 0;
+        fix.id = id;
+        fix.text = -1;
+        text = GpxParser::Text();
+        text.special = 0;
+        hasText = false;
+    }
+
+    stack[depth++] = o;
+    return true;
+}
+
+bool GpxReader::close(const char* textEnd)
+{
+    Open o = stack[--depth];
+    Kind parent = depth ? stack[depth-1].kind : Other;
+
+    if (o.kind == Leaf) {
+        double v;
+        switch (o.leaf) {
+        case Name:
+        case Desc: {
+            QString s;
+            if (!readText(textStart, textEnd, s))
+                return false;
+            if (parent == Point) {
+                (o.leaf == Name ? text.name : text.desc) = s;
+                hasText = true;
+            } else
+                (o.leaf == Name ? theTracks.last().name : theTracks.last().desc) = s;
+            break;
+        }
+        case Cmt:
+            if (!readText(textStart, textEnd, text.cmt))
+                return false;
+            hasText = true;
+            break;
+        case Time:
+            readIsoTime(textStart, textEnd, fix.time);
+            break;
+        case Ele:
+            readNumber(textStart, textEnd, v);
+            fix.elevation = v;
+            break;
+        case Speed:
+            readNumber(textStart, textEnd, v);
+            fix.speed = v;
+            break;
+        case Id: {
+            QString s;
+            if (!readText(textStart, textEnd, s))
+                return false;
+            text.special = s.toLongLong();
+            hasText = true;
+            break;
+        }
+        case NoLeaf:
+            break;
+        }
+    } else if (o.kind == Point) {
+        if (hasText) {
+            fix.text = theTexts.size();
+            theTexts.append(text);
+        }
+        if (waypoint)
+            theWaypoints.append(fix);
+        else
+            theTracks.last().segments.last().fixes.append(fix);
+    }
+    return true;
+}
+
+bool GpxReader::read(const char* data, qint64 size)
+{
+    const char* end = data + size;
+    const char* p = data;
+    if (size >= 3 && !memcmp(p, "\xef\xbb\xbf", 3))
+        p += 3;
+
+    while (p < end) {
+        p = (const char*)memchr(p, '<', end - p);
+        if (!p)
+            break;
+        if (p + 1 == end)
+            return false;
+        if (end - p >= 9 && !memcmp(p, "<![CDATA[", 9))
+            return false;
+        if (p[1] == '?' || p[1] == '!')
+            p = skipDeclaration(p, end);
+        else if (p[1] == '/')
+            p = readEndTag(p, end);
+        else
+            p = readStartTag(p, end);
+        if (!p)
+            return false;
+    }
+    return seenRoot && !depth;
+}
+
+GpxParser::GpxParser()
+{
+}
+
+bool GpxParser::parse(const char* data, qint64 size)
+{
+    theTracks.clear();
+    theWaypoints.clear();
+    theTexts.clear();
+
+    GpxReader reader(theTracks, theWaypoints, theTexts);
+    if (reader.read(data, size))
+        return true;
+
+    theTracks.clear();
+    theWaypoints.clear();
+    theTexts.clear();
+    return false;
+}
+
+int GpxParser::fixCount() const
+{
+    int n = theWaypoints.size();
+    for (int i=0; i<theTracks.size(); ++i)
+        for (int j=0; j<theTracks.at(i).segments.size(); ++j)
+            n += theTracks.at(i).segments.at(j).fixes.size();
+    return n;
+}
@@ -0,0 +1,74 @@
+#ifndef TRACKPARSER_H
+#define TRACKPARSER_H
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+/* One point of a track log as read, before it becomes a TrackNode */
+struct TrackFix
+{
+    double lat, lon;
+    double elevation, speed;
+    uint time;      // seconds since the epoch, UTC; 0 when the point has none
+    qint64 id;      // xml:id of a GPX point, 0 without
+    int text;       // into GpxParser::texts(), or -1
+};
+
+/* Reads NMEA logs straight from their bytes. The log is cut at line ends and the pieces are read
+   in parallel; the fix state (GGA, GLL, GSA) is then followed in order, so that the segments come
+   out as the line by line reader made them. Sentences failing their checksum are dropped. */
+class NmeaParser
+{
+public:
+    NmeaParser();
+
+    void parse(const char* data, qint64 size);
+
+    /* The fixes of each segment; a segment ends where the fix was lost */
+    const QList<QVector<TrackFix> >& segments() const { return theSegments; }
+    int fixCount() const;
+
+private:
+    QList<QVector<TrackFix> > theSegments;
+};
+
+/* Reads the tracks, routes and waypoints of a GPX file straight from its bytes.
+   It gives up on what it does not know (other encodings, CDATA, DTD entities, markup inside
+   texts); the DOM reader is left with those files. */
+class GpxParser
+{
+public:
+    struct Text
+    {
+        QString name, desc, cmt;
+        qint64 special;     // OpenStreetBugs id, 0 without
+    };
+    struct Segment
+    {
+        QVector<TrackFix> fixes;
+        qint64 id;
+    };
+    struct Track
+    {
+        bool route;
+        QString name, desc;
+        QList<Segment> segments;
+    };
+
+    GpxParser();
+
+    bool parse(const char* data, qint64 size);
+
+    const QList<Track>& tracks() const { return theTracks; }
+    const QVector<TrackFix>& waypoints() const { return theWaypoints; }
+    const QVector<Text>& texts() const { return theTexts; }
+    int fixCount() const;
+
+private:
+    QList<Track> theTracks;
+    QVector<TrackFix> theWaypoints;
+    QVector<Text> theTexts;
+};
+
+#endif // TRACKPARSER_H
@@ -269,7 +269,7 @@ void FeatureSnapInteraction::updateSnap(QMouseEvent* event)
                 if ((N = CAST_NODE(F))) {
                     if (NoSelectPoints)
                         continue;
-                    if (!N->isSelectable(theMain->view()->pixelPerM(), theMain->view()->renderOptions()))
+                    if (!N->isSelectable(theMain->view()->pixelPerM(), theMain->view()->renderOptions(), theMain->view()->renderSettings()))
                         continue;
                     if (HotZoneSnap.contains(N->boundingBox()))
                         SnapList.push_back(F);
@@ -345,18 +345,7 @@ void FeatureSnapInteraction::paintEvent(QPaintEvent* anEvent, QPainter& thePaint
     Interaction::paintEvent(anEvent, thePainter);
 
 #ifndef _MOBILE
-    for (int i=0; i<theMain->features()->highlightedSize(); ++i) {
-        theMain->features()->highlighted(i)->buildPath(view()->projection());
-        theMain->features()->highlighted(i)->drawHighlight(thePainter, view());
-    }
-    for (int i=0; i<theMain->properties()->selectionSize(); ++i) {
-        theMain->properties()->selection(i)->buildPath(view()->projection());
-        theMain->properties()->selection(i)->drawFocus(thePainter, view());
-    }
-    for (int i=0; i<theMain->properties()->highlightedSize(); ++i) {
-        theMain->properties()->highlighted(i)->buildPath(view()->projection());
-        theMain->properties()->highlighted(i)->drawHighlight(thePainter, view());
-    }
+    view()->drawSelection(thePainter);
 
     if (lastSnap()) {
         lastSnap()->drawHover(thePainter, view());
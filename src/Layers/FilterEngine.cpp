@@ -0,0 +1,141 @@
+#include "Global.h"
+
+#include "FilterEngine.h"
+
+#include "Document.h"
+#include "Feature.h"
+#include "Layer.h"
+#include "TagSelector.h"
+
+#include <QtConcurrentMap>
+
+#define FILTER_CHUNK 1024 /* features per parallel task */
+
+/* Tries one chunk of the features, writing whether each matches */
+class EvaluateFilter
+{
+public:
+    EvaluateFilter(const TagSelector* aSelector, const QVector<Feature*>& aFeatures, QVector<char>& aMatched)
+        : theSelector(aSelector), theFeatures(aFeatures), theMatched(aMatched) { }
+
+    typedef void result_type;
+
+    void operator()(const int& start)
+    {
+        int end = qMin(start + FILTER_CHUNK, theFeatures.size());
+        for (int i=start; i<end; ++i)
+            theMatched[i] = theSelector->matches(theFeatures.at(i), 0) != TagSelect_NoMatch;
+    }
+
+    const TagSelector* theSelector;
+    const QVector<Feature*>& theFeatures;
+    QVector<char>& theMatched;
+};
+
+FilterEngine::FilterEngine(Document* aDoc)
+    : theDocument(aDoc), theRevision(0)
+{
+}
+
+void FilterEngine::evaluate(FilterLayer* L)
+{
+    TagSelector* S = L->selector();
+    const TagIndex& index = g_backend.tagIndex();
+
+    Result after;
+    after.cached = !S || S->dependsOnTagsOnly();
+    after.bounded = !S || S->candidates(index, after.members);
+
+    if (S && after.cached) {
+        // Features without tags have no id; they are tried one by one as before
+        QVector<Feature*> theFeatures;
+        if (after.bounded) {
+            foreach (Feature* F, index.features(after.members))
+                if (F->layer() && F->layer()->getDocument() == theDocument)
+                    theFeatures << F;
+        } else {
+            // Deleted and not yet downloaded features too: they keep their tags when they come back
+            for (int i=0; i<theDocument->layerSize(); ++i) {
+                Layer* aLayer = theDocument->getLayer(i);
+                for (int j=0; j<aLayer->size(); ++j)
+                    if (TagIndex::idFor(aLayer->get(j)) >= 0)
+                        theFeatures << aLayer->get(j);
+            }
+        }
+
+        QVector<char> matched(theFeatures.size());
+        QVector<int> starts;
+        for (int i=0; i<theFeatures.size(); i+=FILTER_CHUNK)
+            starts << i;
+        QtConcurrent::blockingMap(starts, EvaluateFilter(S, theFeatures, matched));
+
+        after.members.clear();
+        for (int i=0; i<theFeatures.size(); ++i)
+            if (matched.at(i))
+                after.members.insert(TagIndex::idFor(theFeatures.at(i)));
+    }
+
+    Result before;
+    bool known;
+    {
+        QWriteLocker lock(&theLock);
+        known = theResults.contains(L);
+        if (known)
+            before = theResults.value(L);
+        theResults.insert(L, after);
+        ++theRevision;
+    }
+
+    refresh(known ? &before : NULL, after);
+}
+
+void FilterEngine::refresh(const Result* before, const Result& after)
+{
+    // Only the features either filter may match can have changed
+    if (before && before->bounded && after.bounded) {
+        FeatureIdSet ids = before->members;
+        ids |= after.members;
+        foreach (Feature* F, g_backend.tagIndex().features(ids))
+            if (F->layer() && F->layer()->getDocument() == theDocument)
+                F->updateFilters();
+        return;
+    }
+
+    for (FeatureIterator it(theDocument); !it.isEnd(); ++it)
+        it.get()->updateFilters();
+}
+
+void FilterEngine::forget(const Layer* L)
+{
+    QWriteLocker lock(&theLock);
+    if (theResults.remove(L))
+        ++theRevision;
+}
+
+bool FilterEngine::passes(FilterLayer* L, Feature* F, bool retest)
+{
+    TagSelector* S = L->selector();
+    if (!S)
+        return false;
+
+    int id = TagIndex::idFor(F);
+    if (id >= 0) {
+        QReadLocker lock(&theLock);
+        QHash<const Layer*, Result>::const_iterator it = theResults.constFind(L);
+        if (it != theResults.constEnd() && it.value().cached && !retest)
+            return it.value().members.contains(id);
+    }
+
+    bool match = S->matches(F, 0) != TagSelect_NoMatch;
+    if (id >= 0 && retest) {
+        QWriteLocker lock(&theLock);
+        QHash<const Layer*, Result>::iterator it = theResults.find(L);
+        if (it != theResults.end() && it.value().cached) {
+            if (match)
+                it.value().members.insert(id);
+            else
+                it.value().members.remove(id);
+        }
+    }
+    return match;
+}
@@ -0,0 +1,52 @@
+#ifndef FILTERENGINE_H
+#define FILTERENGINE_H
+
+#include "FeatureIdSet.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+
+class Document;
+class Layer;
+class FilterLayer;
+class Feature;
+
+/* The features of a document each filter layer matches, as a set of tag index ids.
+   A filter is run over all features at once, in parallel, when it is added or changed;
+   afterwards a feature is only tried again when its own tags change.
+   Filters that look at more than the tags (ids, users, parents, ...) are tried per feature
+   as before. */
+class FilterEngine
+{
+public:
+    FilterEngine(Document* aDoc);
+
+    /* Runs the filter of L over the document, then updates the features whose filters changed */
+    void evaluate(FilterLayer* L);
+    /* Drops what is known about L, once it leaves the document */
+    void forget(const Layer* L);
+
+    /* Whether F is in L; with retest, F is tried again first as its tags changed.
+       May be called from the render threads. */
+    bool passes(FilterLayer* L, Feature* F, bool retest);
+
+    /* Goes up each time a filter is evaluated */
+    int revision() const { return theRevision; }
+
+private:
+    struct Result
+    {
+        FeatureIdSet members;   // the matching features, or the candidates when not cached
+        bool cached;            // the selector only looks at tags, members are the matches
+        bool bounded;           // features outside members cannot match
+    };
+
+    void refresh(const Result* before, const Result& after);
+
+    Document* theDocument;
+    QHash<const Layer*, Result> theResults;
+    QReadWriteLock theLock;
+    int theRevision;
+};
+
+#endif // FILTERENGINE_H
@@ -11,6 +11,7 @@
 #include "IMapAdapterFactory.h"
 #include "IMapAdapter.h"
 #include "imagemanager.h"
+#include "tileseeder.h"
 #ifdef USE_WEBKIT
 #include "browserimagemanager.h"
 #endif
@@ -21,6 +22,7 @@
 #include <QLocale>
 #include <QPainter>
 #include <QMessageBox>
+#include <QStatusBar>
 
 #include "LayerWidget.h"
 #include "Features.h"
@@ -41,6 +43,7 @@ public:
     QString selServer;
 
     IImageManager* theImageManager;
+    TileSeeder* theSeeder;
 #ifdef USE_WEBKIT
     BrowserImageManager* theBrowserImageManager;
 #endif
@@ -58,6 +61,7 @@ public:
     {
         theMapAdapter = NULL;
         theImageManager = NULL;
+        theSeeder = NULL;
 #ifdef USE_WEBKIT
         theBrowserImageManager = NULL;
 #endif
@@ -65,6 +69,7 @@ public:
     }
     ~ImageMapLayerPrivate()
     {
+        delete theSeeder;
         delete theMapAdapter;
         delete theImageManager;
     }
@@ -162,6 +167,69 @@ IImageManager* ImageMapLayer::getImageManger()
     return p->theImageManager;
 }
 
+QRectF ImageMapLayer::lastViewport() const
+{
+    return p->Viewport;
+}
+
+TileSeeder* ImageMapLayer::getTileSeeder()
+{
+    if (!p->theMapAdapter || !p->theMapAdapter->isTiled() || p->theImageManager != p->theNetworkImageManager)
+        return NULL;
+
+    if (!p->theSeeder) {
+        IMapAdapter* anAdapter = newSeedAdapter();
+        if (!anAdapter)
+            return NULL;
+        p->theSeeder = new TileSeeder(anAdapter, this);
+        connect(p->theSeeder, SIGNAL(progress(qint64, qint64, qint64, int)),
+                this, SLOT(on_seedProgress(qint64, qint64, qint64, int)));
+        connect(p->theSeeder, SIGNAL(finished()), this, SLOT(on_seedFinished()));
+    }
+    return p->theSeeder;
+}
+
+/* A second adapter on the same server for the seeder, which moves it between zoom levels;
+   the view's own adapter stays at the zoom it is drawing */
+IMapAdapter* ImageMapLayer::newSeedAdapter()
+{
+    IMapAdapter* anAdapter = NULL;
+    if (p->bgType == WMS_ADAPTER_UUID) {
+        WmsServerList* wsl = M_PREFS->getWmsServers();
+        if (wsl->contains(p->selServer)) {
+            WmsServer theWmsServer(wsl->value(p->selServer));
+            anAdapter = new WMSMapAdapter(theWmsServer);
+        }
+    } else if (p->bgType == TMS_ADAPTER_UUID) {
+        TmsServerList* tsl = M_PREFS->getTmsServers();
+        if (tsl->contains(p->selServer)) {
+            TmsServer ts = tsl->value(p->selServer);
+            anAdapter = new TileMapAdapter(ts);
+        }
+    } else {
+        IMapAdapterFactory* fac = M_PREFS->getBackgroundPlugin(p->bgType);
+        if (fac)
+            anAdapter = fac->CreateInstance();
+        if (anAdapter) {
+            anAdapter->setSettings(M_PREFS->getQSettings());
+
+            // Plugins keep what they are set to, e.g. their server, in their XML
+            QByteArray xml;
+            QXmlStreamWriter out(&xml);
+            out.writeStartElement("Data");
+            p->theMapAdapter->toXML(out);
+            out.writeEndElement();
+            QXmlStreamReader in(xml);
+            in.readNextStartElement();
+            in.readNext();
+            anAdapter->fromXML(in);
+        }
+    }
+    if (anAdapter)
+        anAdapter->setImageManager(p->theImageManager);
+    return anAdapter;
+}
+
 IMapAdapter* ImageMapLayer::getMapAdapter()
 {
     return p->theMapAdapter;
@@ -179,6 +247,7 @@ void ImageMapLayer::setMapAdapter(const QUuid& theAdapterUid, const QString& ser
     WmsServerList* wsl;
     TmsServerList* tsl;
 
+    SAFE_DELETE(p->theSeeder);
     if (p->theImageManager)
         p->theImageManager->abortLoading();
     p->theImageManager = NULL;
@@ -504,6 +573,11 @@ void ImageMapLayer::drawImage(QPainter* P)
     P->drawPixmap(0, 0, p->curPix);
 }
 
+qint64 ImageMapLayer::imageKey() const
+{
+    return p->curPix.cacheKey();
+}
+
 void ImageMapLayer::zoom(qreal zoom, const QPoint& pos, const QRect& rect)
 {
     if (!p->theMapAdapter)
@@ -525,8 +599,7 @@ void ImageMapLayer::pan(QPoint delta)
 {
     if (!p->theMapAdapter)
         return;
-    if (p->theMapAdapter->getImageManager())
-        p->theMapAdapter->getImageManager()->abortLoading();
+    // No abort here: tiles still in view keep loading, the others are dropped on the next redraw
     if (p->curPix.isNull())
         return;
 
@@ -823,6 +896,7 @@ QRect ImageMapLayer::drawFull(MapView& theView, QRect& rect)
             QString url (p->theMapAdapter->getQuery(wgs84vp, vp, rect));
             if (!url.isEmpty()) {
                 //qDebug() << "ImageMapLayer::drawFull: getting: " << url;
+                p->theMapAdapter->getImageManager()->startRequestBatch();
                 QPixmap pm = QPixmap::fromImage(p->theMapAdapter->getImageManager()->getImage(p->theMapAdapter,url));
                 if (!pm.isNull()) {
                     p->curPix = QPixmap();
@@ -973,10 +1047,13 @@ QRect ImageMapLayer::drawTiled(MapView& theView, QRect& rect)
 
     qSort(tiles);
 
+    // Tiles queued for a previous viewport and not asked for again below are dropped
+    p->theMapAdapter->getImageManager()->startRequestBatch();
+
     int n=0; // Arbitrarily limit the number of tiles to 100
     for (QList<Tile>::const_iterator tile = tiles.begin(); tile != tiles.end() && n<100; ++tile)
     {
-        QImage pm = p->theMapAdapter->getImageManager()->getImage(p->theMapAdapter, p->theMapAdapter->getQuery(mapmiddle_tile_x+tile->i, mapmiddle_tile_y+tile->j, p->theMapAdapter->getZoom()));
+        QImage pm = p->theMapAdapter->getImageManager()->getImage(p->theMapAdapter, p->theMapAdapter->getQuery(mapmiddle_tile_x+tile->i, mapmiddle_tile_y+tile->j, p->theMapAdapter->getZoom()), tile->priority);
         int x = (tile->i*tilesizeW)+pmSize.width()/2 -cross_scr_x;
         int y = (tile->j*tilesizeH)+pmSize.height()/2-cross_scr_y;
         if (!pm.isNull())
@@ -1014,6 +1091,28 @@ void ImageMapLayer::on_loadingFinished()
     emit loadingFinished(this);
 }
 
+void ImageMapLayer::on_seedProgress(qint64 done, qint64 total, qint64 bytes, int eta)
+{
+#ifndef _MOBILE
+    if (!g_Merk_MainWindow)
+        return;
+    QString msg = tr("Seeding %1: %2 of %3 tiles, %4 KB").arg(name()).arg(done).arg(total).arg(bytes / 1024);
+    if (M_PREFS->getOfflineMode())
+        msg += tr(" (paused while offline)");
+    else if (eta >= 0)
+        msg += tr(", %1 min left").arg((eta + 59) / 60);
+    g_Merk_MainWindow->statusBar()->showMessage(msg);
+#endif
+}
+
+void ImageMapLayer::on_seedFinished()
+{
+#ifndef _MOBILE
+    if (g_Merk_MainWindow)
+        g_Merk_MainWindow->statusBar()->showMessage(tr("Seeding %1 finished, %2 tiles failed").arg(name()).arg(p->theSeeder->tilesFailed()), 15000);
+#endif
+}
+
 QString ImageMapLayer::toPropertiesHtml()
 {
     QString h;
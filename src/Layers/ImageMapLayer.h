@@ -11,6 +11,7 @@
 
 class MapView;
 class ImageMapLayerPrivate;
+class TileSeeder;
 class Projection;
 class IImageManager;
 
@@ -52,6 +53,8 @@ public:
     virtual const LayerGroups classGroups() const {return(Layer::Map);}
 
     virtual void drawImage(QPainter* P);
+    //! changes whenever the image drawImage draws does
+    qint64 imageKey() const;
     virtual void forceRedraw(MapView& theView, QTransform& aTransform, QRect rect);
     virtual void draw(MapView& theView, QRect& rect);
 
@@ -70,8 +73,14 @@ public:
     virtual void setEnabled(bool b);
     void resetAlign();
 
+    //! the WGS84 area drawn last
+    QRectF lastViewport() const;
+    //! the offline seeding job of the current adapter, or NULL if it cannot be seeded
+    TileSeeder* getTileSeeder();
+
 private:
     void setNoneAdapter();
+    IMapAdapter* newSeedAdapter();
     QRect drawTiled(MapView& theView, QRect& rect);
     QRect drawFull(MapView& theView, QRect& rect);
 
@@ -84,6 +93,8 @@ private slots:
     void on_imageRequested();
     void on_imageReceived();
     void on_loadingFinished();
+    void on_seedProgress(qint64 done, qint64 total, qint64 bytes, int eta);
+    void on_seedFinished();
 
 protected:
     ImageMapLayerPrivate* p;
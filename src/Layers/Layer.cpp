@@ -3,6 +3,7 @@
 #include "Features.h"
 
 #include "Document.h"
+#include "FilterEngine.h"
 #include "LayerWidget.h"
 
 #include "DocumentCommands.h"
@@ -51,6 +52,7 @@ Layer::Layer(const Layer&)
 Layer::~Layer()
 {
     clear();
+    g_backend.releaseLayer(this);
     delete p;
 }
 
@@ -184,6 +186,22 @@ void Layer::deleteFeature(Feature* aFeature)
     }
 }
 
+void Layer::deleteFeatures(const QSet<Feature*>& theFeatures)
+{
+    int j = 0;
+    for (int i=0; i<p->Features.size(); ++i) {
+        Feature* F = p->Features.at(i);
+        if (!theFeatures.contains(F)) {
+            p->Features[j++] = F;
+            continue;
+        }
+        g_backend.deallocFeature(this, F);
+        F->setLayer(0);
+        notifyIdUpdate(F->id(),0);
+    }
+    p->Features.erase(p->Features.begin() + j, p->Features.end());
+}
+
 void Layer::clear()
 {
     while (p->Features.count())
@@ -943,10 +961,8 @@ void FilterLayer::setFilter(const QString& aFilter)
     delete theSelector;
     theSelector = TagSelector::parse(theSelectorString);
 
-    FeatureIterator it(p->theDocument);
-    for(;!it.isEnd(); ++it) {
-        it.get()->updateFilters();
-    }
+    if (p->theDocument)
+        p->theDocument->filterEngine()->evaluate(this);
 }
 
 bool FilterLayer::toXML(QXmlStreamWriter& stream, bool asTemplate, QProgressDialog * progress)
@@ -971,6 +987,7 @@ FilterLayer* FilterLayer::fromXML(Document* d, QXmlStreamReader& stream, QProgre
     stream.readNext();
 
     d->add(l);
+    d->filterEngine()->evaluate(l);
     return l;
 }
 
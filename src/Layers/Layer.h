@@ -78,6 +78,8 @@ public:
     virtual void add(Feature* aFeature);
     virtual void remove(Feature* aFeature);
     virtual void deleteFeature(Feature* aFeature);
+    /* Same as deleteFeature() for each of them, in a single pass over the layer */
+    virtual void deleteFeatures(const QSet<Feature*>& theFeatures);
     virtual void clear();
     virtual void deleteAll();
     bool exists(Feature* aFeature) const;
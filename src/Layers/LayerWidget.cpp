@@ -10,6 +10,7 @@
 
 #include "IMapAdapterFactory.h"
 #include "IMapAdapter.h"
+#include "tileseeder.h"
 
 #include <QApplication>
 #include <QMouseEvent>
@@ -396,6 +397,54 @@ void ImageLayerWidget::resetAlign()
     emit (layerChanged(this, true));
 }
 
+void ImageLayerWidget::seedTiles()
+{
+    ImageMapLayer* il = (ImageMapLayer *)theLayer.data();
+    TileSeeder* seeder = il->getTileSeeder();
+    if (!seeder) {
+        QMessageBox::information(this, tr("Seed tiles"), tr("Only tiled network layers can be seeded."));
+        return;
+    }
+
+    if (seeder->isRunning()) {
+        if (QMessageBox::question(this, tr("Seed tiles"), tr("Stop seeding? It can be resumed later."),
+                                  QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
+            seeder->stop();
+        return;
+    }
+
+    if (seeder->canResume()) {
+        QMessageBox::StandardButton ret = QMessageBox::question(this, tr("Seed tiles"),
+                tr("An interrupted seeding job exists for this layer. Resume it?\n(No starts a new one for the current view)"),
+                QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel, QMessageBox::Yes);
+        if (ret == QMessageBox::Cancel)
+            return;
+        if (ret == QMessageBox::Yes) {
+            if (!seeder->resume())
+                QMessageBox::warning(this, tr("Seed tiles"), seeder->errorString());
+            return;
+        }
+    }
+
+    IMapAdapter* ma = il->getMapAdapter();
+    QRectF vp = il->lastViewport();
+    int cur = ma->getZoom();
+    int max = ma->getMaxZoom(vp);
+    bool ok;
+#ifdef QT5
+    int maxZoom = QInputDialog::getInt(this, tr("Seed tiles"), tr("Seed the current view from zoom level %1 up to:").arg(cur),
+                                       qMin(cur + 2, max), cur, max, 1, &ok);
+#else
+    int maxZoom = QInputDialog::getInteger(this, tr("Seed tiles"), tr("Seed the current view from zoom level %1 up to:").arg(cur),
+                                           qMin(cur + 2, max), cur, max, 1, &ok);
+#endif
+    if (!ok)
+        return;
+
+    if (!seeder->start(QPolygonF(vp), cur, maxZoom))
+        QMessageBox::warning(this, tr("Seed tiles"), seeder->errorString());
+}
+
 void ImageLayerWidget::initActions()
 {
     //if (actgrWms)
@@ -422,6 +471,11 @@ void ImageLayerWidget::initActions()
     ctxMenu->addAction(actResetAlign);
     associatedMenu->addAction(actResetAlign);
 
+    actSeed = new QAction(tr("Seed tiles for offline use..."), this);
+    connect(actSeed, SIGNAL(triggered()), this, SLOT(seedTiles()));
+    ctxMenu->addAction(actSeed);
+    associatedMenu->addAction(actSeed);
+
     closeAction = new QAction(tr("Close"), this);
     connect(closeAction, SIGNAL(triggered()), this, SLOT(close()));
     ctxMenu->addAction(closeAction);
@@ -138,6 +138,7 @@ class ImageLayerWidget : public LayerWidget
         QAction* actNone;
         QAction* actProjection;
         QAction* actResetAlign;
+        QAction* actSeed;
         QMenu* wmsMenu;
         QMenu* tmsMenu;
         QMenu* pluginsMenu;
@@ -150,6 +151,7 @@ class ImageLayerWidget : public LayerWidget
 
         void setProjection();
         void resetAlign();
+        void seedTiles();
 
     protected:
         virtual void showContextMenu(QContextMenuEvent* anEvent);
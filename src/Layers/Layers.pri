@@ -6,10 +6,12 @@ HEADERS += Layer.h \
     LayerIterator.h \
     LayerWidget.h \
     LayerPrivate.h \
+    FilterEngine.h \
     Layers/OsmRenderLayer.h
 SOURCES += Layer.cpp \
     ImageMapLayer.cpp \
     LayerWidget.cpp \
+    FilterEngine.cpp \
     Layers/OsmRenderLayer.cpp
 FORMS += LayerWidget.ui \
     FilterEditDialog.ui \
@@ -3,8 +3,8 @@
 #include "OsmRenderLayer.h"
 
 #include "Document.h"
+#include "Features.h"
 #include "MapRenderer.h"
-#include "MerkaartorPreferences.h"
 
 #if QT_VERSION >= 0x050000
 #include <QtConcurrent>
@@ -95,20 +95,17 @@ public:
 
         QMap<RenderPriority, QSet <Feature*> > theFeatures;
 
-        g_backend.delayDeletes();
-        for (int i=0; i<p->theDocument->layerSize(); ++i)
-            g_backend.getFeatureSet(p->theDocument->getLayer(i), theFeatures, invalidRect, p->theProjection);
+        g_backend.getFeatureSet(p->theSnapshot, theFeatures, invalidRect, p->theProjection, p->theSettings);
 
         QImage* img = new QImage(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32);
         img->fill(Qt::transparent);
 
         QPainter P(img);
-        if (M_PREFS->getUseAntiAlias())
+        if (p->theSettings.UseAntiAlias)
             P.setRenderHint(QPainter::Antialiasing);
         MapRenderer r;
-        r.render(&P, theFeatures, projR, /*QRect(0, 0, TILE_SIZE, TILE_SIZE)*/QRect(-((TILE_SIZE*TILE_SURROUND)-TILE_SIZE)/2, -((TILE_SIZE*TILE_SURROUND)-TILE_SIZE)/2, TILE_SIZE*TILE_SURROUND, TILE_SIZE*TILE_SURROUND), p->PixelPerM, p->ROptions);
+        r.render(&P, theFeatures, projR, /*QRect(0, 0, TILE_SIZE, TILE_SIZE)*/QRect(-((TILE_SIZE*TILE_SURROUND)-TILE_SIZE)/2, -((TILE_SIZE*TILE_SURROUND)-TILE_SIZE)/2, TILE_SIZE*TILE_SURROUND, TILE_SIZE*TILE_SURROUND), p->PixelPerM, p->ROptions, p->theSettings);
         P.end();
-        g_backend.resumeDeletes();
         p->theDocument->unlockPainters();
         renderLock.unlock();
         tileLock.lockForWrite();
@@ -122,14 +119,151 @@ public:
     OsmRenderLayer* p;
 };
 
+/* Resolves the painter and builds the projected path of one feature, so that
+   the tile workers do not contend on the same features afterwards. */
+class PrepareFeature
+{
+public:
+    PrepareFeature(OsmRenderLayer* orl)
+        : p(orl) { }
+
+    typedef void result_type;
+
+    void operator()(Feature* F)
+    {
+        if (!p->theDocument)
+            return;
+
+        if (!renderLock.tryLockForRead()) return;
+        p->theDocument->lockPainters();
+
+        if (F->isVisible()) {
+            F->getPainter(p->PixelPerM);
+            if (CHECK_WAY(F))
+                STATIC_CAST_WAY(F)->buildPath(p->theProjection);
+            else if (CHECK_RELATION(F))
+                STATIC_CAST_RELATION(F)->buildPath(p->theProjection);
+            else if (CHECK_NODE(F))
+                STATIC_CAST_NODE(F)->buildPath(p->theProjection);
+        }
+
+        p->theDocument->unlockPainters();
+        renderLock.unlock();
+    }
+
+    OsmRenderLayer* p;
+};
+
 /**************************/
 
 OsmRenderLayer::OsmRenderLayer(QObject *parent)
     : QObject(parent)
     , theDocument(0)
+    , preparePending(false)
+    , deletesDelayed(false)
+    , thePrepareTime(0)
+    , theDrawTime(0)
 {
     tileCache = new TileCache(this);
-    connect(&(renderGatheringWatcher), SIGNAL(finished()), SIGNAL(renderingDone()));
+    connect(&(preparingWatcher), SIGNAL(finished()), SLOT(on_preparingDone()));
+    connect(&(renderGatheringWatcher), SIGNAL(finished()), SLOT(on_renderingDone()));
+}
+
+void OsmRenderLayer::cancelRendering()
+{
+    if (preparing.isRunning()) {
+        preparing.cancel();
+        preparing.waitForFinished();
+    }
+    preparePending = false;
+    preparedFeatures.clear();
+    if (renderGathering.isRunning()) {
+        renderGathering.cancel();
+        renderGathering.waitForFinished();
+    }
+    releaseSnapshot();
+}
+
+void OsmRenderLayer::releaseSnapshot()
+{
+    theSnapshot = IndexSnapshot();
+    if (deletesDelayed) {
+        deletesDelayed = false;
+        g_backend.resumeDeletes();
+    }
+}
+
+void OsmRenderLayer::startRendering()
+{
+    if (!tiles.size())
+        return;
+
+    int minX = TILE_X(tiles[0]), maxX = minX;
+    int minY = TILE_Y(tiles[0]), maxY = minY;
+    foreach (const TILE_TYPE& t, tiles) {
+        minX = qMin(minX, TILE_X(t));
+        maxX = qMax(maxX, TILE_X(t));
+        minY = qMin(minY, TILE_Y(t));
+        maxY = qMax(maxY, TILE_Y(t));
+    }
+    /* One extra tile around, as the tiles themselves are rendered with a surround */
+    QPointF projTL(((minX-1)*tileSizeCoordW)+tileOriginCoord.x(), ((minY-1)*tileSizeCoordH)+tileOriginCoord.y());
+    QPointF projBR(((maxX+2)*tileSizeCoordW)+tileOriginCoord.x(), ((maxY+2)*tileSizeCoordH)+tileOriginCoord.y());
+    CoordBox bbox(theProjection.inverse2Coord(projTL), theProjection.inverse2Coord(projBR));
+
+    frameTimer.start();
+    theSettings = RenderSettings::current();
+
+    /* Released in on_renderingDone() or cancelRendering() */
+    g_backend.delayDeletes();
+    deletesDelayed = true;
+
+    QList<ILayer*> layers;
+    preparedFeatures.clear();
+    for (int i=0; i<theDocument->layerSize(); ++i) {
+        layers << theDocument->getLayer(i);
+        preparedFeatures << g_backend.indexFind(theDocument->getLayer(i), bbox);
+    }
+    theSnapshot = g_backend.indexSnapshot(layers);
+    preparePending = true;
+
+    preparing = QtConcurrent::map(preparedFeatures, PrepareFeature(this));
+    preparingWatcher.setFuture(preparing);
+}
+
+void OsmRenderLayer::on_preparingDone()
+{
+    if (!preparePending || !preparing.isFinished())
+        return;
+
+    preparePending = false;
+    preparedFeatures.clear();
+    if (preparing.isCanceled())
+        return;
+
+    thePrepareTime = frameTimer.restart();
+
+    renderGathering = QtConcurrent::map(tiles, RenderTile(this));
+    renderGatheringWatcher.setFuture(renderGathering);
+}
+
+void OsmRenderLayer::on_renderingDone()
+{
+    if (!preparePending && renderGathering.isFinished())
+        releaseSnapshot();
+    if (!renderGathering.isCanceled())
+        theDrawTime = frameTimer.elapsed();
+    emit renderingDone();
+}
+
+qint64 OsmRenderLayer::prepareTime() const
+{
+    return thePrepareTime;
+}
+
+qint64 OsmRenderLayer::drawTime() const
+{
+    return theDrawTime;
 }
 
 void OsmRenderLayer::setDocument(Document *aDocument)
@@ -150,10 +284,7 @@ void OsmRenderLayer::setProjection(const Projection& aProjection)
 
 void OsmRenderLayer::forceRedraw(const Projection& aProjection, const QTransform &aTransform, const QRect& rect, qreal ppm, const RendererOptions& roptions)
 {
-    if (renderGathering.isRunning()) {
-        renderGathering.cancel();
-        renderGathering.waitForFinished();
-    }
+    cancelRendering();
 
     if (!theDocument)
         return;
@@ -192,20 +323,14 @@ void OsmRenderLayer::forceRedraw(const Projection& aProjection, const QTransform
         }
     tileLock.unlock();
 
-    if (tiles.size()) {
-        renderGathering = QtConcurrent::map(tiles, RenderTile(this));
-        renderGatheringWatcher.setFuture(renderGathering);
-    }
+    startRendering();
 
     renderLock.unlock();
 }
 
 void OsmRenderLayer::pan(QPoint delta)
 {
-    if (renderGathering.isRunning()) {
-        renderGathering.cancel();
-        renderGathering.waitForFinished();
-    }
+    cancelRendering();
 
     theTransform.translate((qreal)(delta.x())/theTransform.m11(), (qreal)(delta.y())/theTransform.m22());
     theInvertedTransform = theTransform.inverted();
@@ -227,10 +352,8 @@ void OsmRenderLayer::pan(QPoint delta)
         }
     tileLock.unlock();
 
-    if (tiles.size()) {
-        renderGathering = QtConcurrent::map(tiles, RenderTile(this));
-        renderGatheringWatcher.setFuture(renderGathering);
-    }
+    if (theDocument)
+        startRendering();
 }
 
 void OsmRenderLayer::drawImage(QPainter *P)
@@ -250,7 +373,16 @@ void OsmRenderLayer::drawImage(QPainter *P)
 
 bool OsmRenderLayer::isRenderingDone()
 {
-    return renderGathering.isFinished();
+    return !preparePending && renderGathering.isFinished();
+}
+
+void OsmRenderLayer::waitForRendering()
+{
+    if (preparePending) {
+        preparing.waitForFinished();
+        on_preparingDone();
+    }
+    renderGathering.waitForFinished();
 }
 
 void OsmRenderLayer::stopRendering() {
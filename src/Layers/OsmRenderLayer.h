@@ -7,18 +7,22 @@
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QTransform>
+#include <QElapsedTimer>
 
 #include "IRenderer.h"
 #include "Projection.h"
+#include "MemoryBackend.h"
 
 class Document;
 class Projection;
+class Feature;
 
 class OsmRenderLayer : public QObject
 {
     Q_OBJECT
 
     friend class RenderTile;
+    friend class PrepareFeature;
 
 public:
     OsmRenderLayer(QObject*parent=0);
@@ -31,14 +35,27 @@ public:
     void drawImage(QPainter* P);
 
     bool isRenderingDone();
+    void waitForRendering();
 
     void stopRendering();
     void resumeRendering();
 
+    /* Duration of the last preparation and tile drawing stages, in ms */
+    qint64 prepareTime() const;
+    qint64 drawTime() const;
+
 signals:
     void renderingDone();
 
+private slots:
+    void on_preparingDone();
+    void on_renderingDone();
+
 protected:
+    void cancelRendering();
+    void startRendering();
+    void releaseSnapshot();
+
     Document* theDocument;
 
     QRectF projRect;
@@ -50,12 +67,29 @@ protected:
     QFuture<void> renderGathering;
     QFutureWatcher<void> renderGatheringWatcher;
 
+    /* Features of the pending tiles, painters and paths resolved before drawing */
+    QList<Feature*> preparedFeatures;
+    QFuture<void> preparing;
+    QFutureWatcher<void> preparingWatcher;
+    bool preparePending;
+
+    /* The index as it was when the rendering started; the tiles query it instead of the live
+       index, which the GUI thread keeps editing. Deletes stay delayed while it is held. */
+    IndexSnapshot theSnapshot;
+    bool deletesDelayed;
+
+    QElapsedTimer frameTimer;
+    qint64 thePrepareTime;
+    qint64 theDrawTime;
+
     QTransform theTransform;
     QTransform theInvertedTransform;
     Projection theProjection;
 
     qreal PixelPerM;
     RendererOptions ROptions;
+    /* Taken when the rendering starts, for the tile threads */
+    RenderSettings theSettings;
 };
 
 #endif // OSMRENDERLAYER_H
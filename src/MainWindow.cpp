@@ -13,6 +13,7 @@
 #include "FeatureCommands.h"
 #include "RelationCommands.h"
 #include "ImportExportOSC.h"
+#include "BinaryClipboard.h"
 #include "ExportGPX.h"
 #include "ImportExportKML.h"
 #ifdef USE_PROTOBUF
@@ -49,6 +50,8 @@
 #include "Utils/Utils.h"
 #include "DirtyList.h"
 #include "DirtyListExecutorOSC.h"
+#include "OsmStore.h"
+#include "StorePager.h"
 
 #include <ui_MainWindow.h>
 #include <ui_AboutDialog.h>
@@ -179,7 +182,7 @@ MainWindow::MainWindow(QWidget *parent)
 
     p = new MainWindowPrivate;
 
-    QString supported_import_formats("*.gpx *.osm *.osc *.ngt *.nmea *.nma *.kml *.csv");
+    QString supported_import_formats("*.gpx *.osm *.mks *.osc *.ngt *.nmea *.nma *.kml *.csv");
 #ifdef GEOIMAGE
     supported_import_formats += " *.jpg";
 #endif
@@ -190,6 +193,7 @@ MainWindow::MainWindow(QWidget *parent)
     QString supported_import_formats_desc =
             tr("GPS Exchange format (*.gpx)\n") \
             +tr("OpenStreetMap format (*.osm)\n") \
+            +tr("Merkaartor extract store (*.mks)\n") \
             +tr("OpenStreetMap change format (*.osc)\n") \
             +tr("Noni GPSPlot format (*.ngt)\n") \
             +tr("NMEA GPS log format (*.nmea *.nma)\n") \
@@ -1258,6 +1262,7 @@ void MainWindow::on_editCutAction_triggered()
     theDocument->exportOSM(this, &osmBuf, exportedFeatures);
     md->setText(QString(osmBuf.data()));
     md->setData(MIME_OPENSTREETMAP_XML, osmBuf.data());
+    md->setData(BinaryClipboard::MimeType, BinaryClipboard::encode(exportedFeatures));
 
     ImportExportKML kmlexp(theDocument);
     QBuffer kmlBuf;
@@ -1327,6 +1332,7 @@ void MainWindow::on_editCopyAction_triggered()
     theDocument->exportOSM(this, &osmBuf, exportedFeatures);
     md->setText(QString(osmBuf.data()));
     md->setData(MIME_OPENSTREETMAP_XML, osmBuf.data());
+    md->setData(BinaryClipboard::MimeType, BinaryClipboard::encode(exportedFeatures));
 
     ImportExportKML kmlexp(theDocument);
     QBuffer kmlBuf;
@@ -1391,22 +1397,32 @@ void MainWindow::on_editPasteFeatureAction_triggered()
         }
     }
 
-    if (!(doc = Document::getDocumentFromClipboard())) {
-        dieClipboardInvalid();
-        return;
-    }
-
     CommandList* theList = new CommandList();
     theList->setDescription("Paste Features");
-    QList<Feature*> theFeats = theDocument->mergeDocument(doc, theDocument->getDirtyOrOriginLayer(), theList);
+    QList<Feature*> theFeats;
+    QByteArray features = clipboard->mimeData()->data(BinaryClipboard::MimeType);
+    if (BinaryClipboard::isValid(features)) {
+        if (!BinaryClipboard::paste(features, theDocument, l, theList, theFeats)) {
+            theList->undo();
+            delete theList;
+            dieClipboardInvalid();
+            return;
+        }
+    } else {
+        if (!(doc = Document::getDocumentFromClipboard())) {
+            delete theList;
+            dieClipboardInvalid();
+            return;
+        }
+        theFeats = theDocument->mergeDocument(doc, l, theList);
+        delete doc;
+    }
 
     if (theList->size())
         document()->addHistory(theList);
     else
         delete theList;
 
-    delete doc;
-
     p->theProperties->setSelection(theFeats);
     view()->invalidate(true, true, false);
 }
@@ -1491,21 +1507,20 @@ void MainWindow::clipboardChanged()
 
     QClipboard *clipboard = QApplication::clipboard();
     //qDebug() << "Clipboard mime: " << clipboard->mimeData()->formats();
-    QDomDocument theXmlDoc;
-    bool ok = false;
-    if (clipboard->mimeData()->hasFormat(MIME_OPENSTREETMAP_XML))
-        ok = theXmlDoc.setContent(clipboard->mimeData()->data(MIME_OPENSTREETMAP_XML));
-    else if (clipboard->mimeData()->hasText())
-        ok = theXmlDoc.setContent(clipboard->text());
-
-    if (!ok) {
-        return;
-    }
-
-    QDomElement c = theXmlDoc.documentElement();
+    if (!BinaryClipboard::isValid(clipboard->mimeData()->data(BinaryClipboard::MimeType))) {
+        QXmlStreamReader stream;
+        if (clipboard->mimeData()->hasFormat(MIME_OPENSTREETMAP_XML))
+            stream.addData(clipboard->mimeData()->data(MIME_OPENSTREETMAP_XML));
+        else if (clipboard->mimeData()->hasText())
+            stream.addData(clipboard->text());
+        else
+            return;
 
-    if (c.tagName() != "osm" && c.tagName() != "kml") {
-        return;
+        // Only the root element matters here; the content is parsed on paste
+        if (!stream.readNextStartElement())
+            return;
+        if (stream.name() != "osm" && stream.name() != "kml")
+            return;
     }
 
     ui->editPasteFeatureAction->setEnabled(true);
@@ -1677,11 +1692,39 @@ MainWindow::ImportStatus MainWindow::importFile(Document * mapDocument, const QS
         }
 	    result = importOK ? IMPORT_OK : IMPORT_ERROR;
     }
+    else if (fileName.toLower().endsWith(".osm")
+             && QFileInfo(fileName).size() > (qint64)M_PREFS->getStoreImportThreshold() * 1024 * 1024) {
+        // Too large to load at once: page it in from a store built next to it
+        QString storeName = fileName.left(fileName.length() - 4) + ".mks";
+        QFileInfo storeInfo(storeName);
+        bool ok = storeInfo.exists() && storeInfo.lastModified() >= QFileInfo(fileName).lastModified();
+        if (!ok) {
+            QFile osm(fileName);
+            QString error;
+            QProgressDialog* dlg = getProgressDialog();
+            if (dlg)
+                dlg->setLabelText(tr("Building the store of %1...").arg(baseFileName));
+            ok = osm.open(QIODevice::ReadOnly) && OsmStore::build(osm, storeName, error, dlg);
+            if (!ok && !error.isEmpty())
+                QMessageBox::warning(this, tr("Store error"), tr("%1 could not be indexed: %2").arg(baseFileName).arg(error));
+        }
+        if (ok) {
+            newLayer = new DrawingLayer( baseFileName );
+            mapDocument->add(newLayer);
+            result = importStore(mapDocument, storeName, newLayer) ? IMPORT_OK : IMPORT_ERROR;
+        } else
+            result = IMPORT_ERROR;
+    }
     else if (fileName.toLower().endsWith(".osm")) {
         newLayer = new DrawingLayer( baseFileName );
         mapDocument->add(newLayer);
         result = importOSM(this, fileName, mapDocument, newLayer) ? IMPORT_OK : IMPORT_ERROR;
     }
+    else if (fileName.toLower().endsWith(".mks")) {
+        newLayer = new DrawingLayer( baseFileName );
+        mapDocument->add(newLayer);
+        result = importStore(mapDocument, fileName, newLayer) ? IMPORT_OK : IMPORT_ERROR;
+    }
 #ifndef FRISIUS_BUILD
     else if (fileName.toLower().endsWith(".osc")) {
         if (g_Merk_Frisius) {
@@ -1767,6 +1810,23 @@ MainWindow::ImportStatus MainWindow::importFile(Document * mapDocument, const QS
     return result;
 }
 
+bool MainWindow::importStore(Document* mapDocument, const QString& fileName, Layer* newLayer)
+{
+    OsmStore* theStore = new OsmStore;
+    if (!theStore->open(fileName)) {
+        QMessageBox::warning(this, tr("Store error"), tr("%1 could not be opened: %2").arg(fileName).arg(theStore->errorString()));
+        delete theStore;
+        return false;
+    }
+
+    // The pager belongs to the layer and goes away with it
+    StorePager* thePager = new StorePager(mapDocument, newLayer, theStore, theView);
+    if (!theView->viewport().intersects(theStore->boundingBox()))
+        theView->setViewport(theStore->boundingBox(), theView->rect());
+    thePager->page();
+    return true;
+}
+
 MainWindow::ImportStatus MainWindow::importFileUsingGDAL( Document* mapDocument, const QString& fileName, Layer*& newLayer ) {
     MainWindow::ImportStatus result;
 
@@ -2960,13 +3020,23 @@ void MainWindow::on_mapStyleLoadAction_triggered()
     }
 
     QString f = QFileDialog::getOpenFileName(this, tr("Load map style"), QString(),
-                                             tr("Supported formats")+" (*.mas *.css)\n" \
+                                             tr("Supported formats")+" (*.mas *.css *.mapcss)\n" \
                                              + tr("Merkaartor map style (*.mas)\n")
-                                             + tr("MapCSS stylesheet (*.css)"));
+                                             + tr("MapCSS stylesheet (*.css *.mapcss)"));
     if (!f.isNull()) {
-        if (f.endsWith("css"))
-            MapCSSPaintstyle::instance()->loadPainters(f);
-        else {
+        if (f.endsWith("css")) {
+            MapCSSPaintstyle* theSheet = new MapCSSPaintstyle;
+            theSheet->loadPainters(f);
+            if (!theSheet->ruleSize()) {
+                delete theSheet;
+                QMessageBox::critical(this, tr("Cannot load map style"), tr("No MapCSS rule could be read from \"%1\".").arg(f));
+                return;
+            }
+            if (theSheet->getGlobalPainter().getDrawBackground())
+                M_STYLE->setGlobalPainter(theSheet->getGlobalPainter());
+            document()->setStyleSheet(theSheet);
+            invalidateView();
+        } else {
             M_STYLE->loadPainters(f);
             document()->setPainters(M_STYLE->getPainters());
             invalidateView();
@@ -3335,13 +3405,21 @@ void MainWindow::on_exportOSMAction_triggered()
         return;
 
     QString path;
-    if (getPathToSave(tr("Export OSM"), "osm", tr("OSM Files (*.osm)") + "\n" + tr("All Files (*)"), &path)) {
+    if (getPathToSave(tr("Export OSM"), "osm", tr("OSM Files (*.osm)") + "\n" + tr("Compressed OSM Files (*.osm.gz)") + "\n" + tr("All Files (*)"), &path)) {
+        bool compressed = path.endsWith(".gz", Qt::CaseInsensitive);
         QFile file(path);
-        if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        if (!file.open(compressed ? QIODevice::WriteOnly : QIODevice::WriteOnly | QIODevice::Text))
             return;
 
-        theDocument->exportOSM(this, &file, theFeatures);
+        QElapsedTimer timer;
+        timer.start();
+        theDocument->exportOSM(this, &file, theFeatures, compressed);
         file.close();
+
+        qint64 elapsed = qMax(qint64(1), timer.elapsed());
+        statusBar()->showMessage(tr("Exported %1 features, %2 MB in %3 ms, %4 MB/s")
+                                 .arg(theFeatures.size()).arg(file.size() / 1048576., 0, 'f', 1).arg(elapsed)
+                                 .arg((file.size() / 1048576.) / (elapsed / 1000.), 0, 'f', 1), 15000);
     }
     deleteProgressDialog();
 }
@@ -3445,49 +3523,24 @@ bool MainWindow::selectExportedFeatures(QList<Feature*>& theFeatures)
                 theFeatures.append(i.get());
             }
             M_PREFS->setExportType(Export_All);
-            return true;
         }
         else if (dlgExport.rbViewport->isChecked()) {
             CoordBox aCoordBox = view()->viewport();
 
+            // What the features need from outside the viewport is added by exportCoreOSM
             theFeatures.clear();
             for (VisibleFeatureIterator i(document()); !i.isEnd(); ++i) {
-                if (i.get()->notEverythingDownloaded())
+                Feature* F = i.get();
+                if (F->notEverythingDownloaded())
                     continue;
 
-                if (Node* P = dynamic_cast<Node*>(i.get())) {
-                    if (aCoordBox.contains(P->position())) {
-                        theFeatures.append(P);
-                    }
-                } else
-                    if (Way* G = dynamic_cast<Way*>(i.get())) {
-                        if (aCoordBox.intersects(G->boundingBox())) {
-                            for (int j=0; j < G->size(); j++) {
-                                if (Node* P = dynamic_cast<Node*>(G->get(j)))
-                                    if (!aCoordBox.contains(P->position()))
-                                        theFeatures.append(P);
-                            }
-                            theFeatures.append(G);
-                        }
-                    } else
-                        //FIXME Not working for relation (not made of point?)
-                        if (Relation* G = dynamic_cast<Relation*>(i.get())) {
-                            if (aCoordBox.intersects(G->boundingBox())) {
-                                for (int j=0; j < G->size(); j++) {
-                                    if (Way* R = dynamic_cast<Way*>(G->get(j))) {
-                                        if (!aCoordBox.contains(R->boundingBox())) {
-                                            for (int k=0; k < R->size(); k++) {
-                                                if (Node* P = dynamic_cast<Node*>(R->get(k)))
-                                                    if (!aCoordBox.contains(P->position()))
-                                                        theFeatures.append(P);
-                                            }
-                                            theFeatures.append(R);
-                                        }
-                                    }
-                                }
-                                theFeatures.append(G);
-                            }
-                        }
+                if (CHECK_NODE(F)) {
+                    if (aCoordBox.contains(STATIC_CAST_NODE(F)->position()))
+                        theFeatures.append(F);
+                } else if (CHECK_WAY(F) || CHECK_RELATION(F)) {
+                    if (aCoordBox.intersects(F->boundingBox()))
+                        theFeatures.append(F);
+                }
             }
             M_PREFS->setExportType(Export_Viewport);
         }
@@ -3552,15 +3605,7 @@ void MainWindow::on_editSelectAction_triggered()
 
         int selMaxResult = Sel->sbMaxResult->value();
 
-        QList <Feature *> selection;
-        int added = 0;
-        for (VisibleFeatureIterator i(theDocument); !i.isEnd() && (!selMaxResult || added < selMaxResult); ++i) {
-            Feature* F = i.get();
-            if (tsel->matches(F, theView->pixelPerM())) {
-                selection.push_back(F);
-                ++added;
-            }
-        }
+        QList <Feature *> selection = theDocument->findFeatures(tsel, theView->pixelPerM(), selMaxResult);
         p->theProperties->setMultiSelection(selection);
         p->theProperties->checkMenuStatus();
     }
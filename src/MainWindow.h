@@ -312,6 +312,7 @@ private:
     void importAction( bool useGdal = false );
     ImportStatus importFile(Document* mapDocument, const QString& fileName, Layer*& newLayer);
     ImportStatus importFileUsingGDAL(Document* mapDocument, const QString& fileName, Layer*& newLayer);
+    bool importStore(Document* mapDocument, const QString& fileName, Layer* newLayer);
     void updateMenu();
     void updateRecentOpenMenu();
     void updateRecentImportMenu();
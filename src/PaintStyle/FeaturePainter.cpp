@@ -224,8 +224,8 @@ void FeaturePainter::drawBackground(Way* R, QPainter* thePainter, MapRenderer* t
     if (!DrawBackground && !ForegroundFill && !ForegroundFillUseIcon) return;
 
     thePainter->setPen(Qt::NoPen);
-    if (M_PREFS->getAreaOpacity() != 100 && ForegroundFill) {
-        thePainter->setOpacity(qreal(M_PREFS->getAreaOpacity()) / 100);
+    if (theRenderer->theSettings.AreaOpacity != 100 && ForegroundFill) {
+        thePainter->setOpacity(qreal(theRenderer->theSettings.AreaOpacity) / 100);
     }
     if (DrawBackground)
     {
@@ -238,7 +238,7 @@ void FeaturePainter::drawBackground(Way* R, QPainter* thePainter, MapRenderer* t
                 thePen.setJoinStyle(Qt::BevelJoin);
                 thePainter->setPen(thePen);
 
-                QPainterPath thePath = theRenderer->theTransform.map(R->getPath());
+                QPainterPath thePath = theRenderer->theTransform.map(theRenderer->lodPath(R));
                 QPainterPath aPath;
 
                 for (int j=1; j < thePath.elementCount(); j++) {
@@ -295,7 +295,7 @@ void FeaturePainter::drawBackground(Way* R, QPainter* thePainter, MapRenderer* t
         }
     }
 
-    thePainter->drawPath(theRenderer->theTransform.map(R->getPath()));
+    thePainter->drawPath(theRenderer->theTransform.map(theRenderer->lodPath(R)));
 }
 
 void FeaturePainter::drawBackground(Relation* R, QPainter* thePainter, MapRenderer* theRenderer) const
@@ -303,8 +303,8 @@ void FeaturePainter::drawBackground(Relation* R, QPainter* thePainter, MapRender
     if (!DrawBackground && !ForegroundFill && !ForegroundFillUseIcon) return;
 
     thePainter->setPen(Qt::NoPen);
-    if (M_PREFS->getAreaOpacity() != 100 && ForegroundFill) {
-        thePainter->setOpacity(qreal(M_PREFS->getAreaOpacity()) / 100);
+    if (theRenderer->theSettings.AreaOpacity != 100 && ForegroundFill) {
+        thePainter->setOpacity(qreal(theRenderer->theSettings.AreaOpacity) / 100);
     }
     if (DrawBackground)
     {
@@ -417,7 +417,7 @@ void FeaturePainter::drawForeground(Way* R, QPainter* thePainter, MapRenderer* t
 
     thePainter->setBrush(Qt::NoBrush);
 
-    thePainter->drawPath(theRenderer->theTransform.map(R->getPath()));
+    thePainter->drawPath(theRenderer->theTransform.map(theRenderer->lodPath(R)));
 }
 
 void FeaturePainter::drawForeground(Relation* R, QPainter* thePainter, MapRenderer* theRenderer) const
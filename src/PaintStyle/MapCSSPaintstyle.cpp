@@ -1,17 +1,23 @@
 #include "MapCSSPaintstyle.h"
-#include "TagSelector.h"
+#include "FeaturePainter.h"
+#include "Features.h"
 
 #include <QtCore/QFile>
 #include <QtCore/QTextStream>
 #include <QtGui/QPainter>
 #include <QtGui/QPainterPath>
-#include <QtXml/QDomDocument>
-#include <QtXml/QDomNode>
 
 #include <QHash>
-#include <QDebug>
+#include <QSet>
+#include <QBitArray>
+#include <QReadWriteLock>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFileInfo>
 
 #include <math.h>
+#include <limits.h>
 #include <utility>
 
 //#define GLOBALZOOM		0.002
@@ -20,51 +26,903 @@ MapCSSPaintstyle* MapCSSPaintstyle::m_MapCSSInstance = 0;
 
 #define ALWAYS 10e6
 
-/* Zoom boundaries : expressed in Pixel per Meter
+#define MAPCSS_MAX_ZOOM 22 /* the zoom levels past this one are styled as this one */
+#define MAPCSS_METER_PER_PIXEL_Z0 156543.03 /* at the equator, on 256 pixel tiles */
 
-   eg 0.01->ALWAYS means show a feature from a zoom level of 0.01 Pixel Per M,
-   or 100 Meter per Pixel. For a screen of 1000px wide this is when viewing
-   100km or less across.
-
-   eg 0.2->ALWAYS means show a feature from a zoom level 0.2 Px/M or 5M/Px which
-   is viewing 5km or less across a screen of 1000Px. */
+/* Zoom boundaries : MapCSS selectors are bounded by OSM zoom levels |zN-M. The view gives
+   Pixel per Meter; zoom level z shows 156543.03/2^z Meter per Pixel at the equator, so
+   z = log2(156543.03 * PixelPerM). Latitude is not accounted for, as with the tile servers. */
 
 /* EDITPAINTSTYLE */
 
-MapCSSPaintstyle::MapCSSPaintstyle()
+/* COMPILED RULES */
+
+/* What the selectors can see of a feature. It is all the cascade reads, so two features with
+   the same subject are styled alike and share a style class. */
+class MapCSSSubject
+{
+public:
+    MapCSSSubject()
+        : type('o'), closed(false), tagged(false) {}
+
+    char type;      // 'n'ode, 'w'ay, 'r'elation or 'o'ther
+    bool closed;    // a closed way or a multipolygon
+    bool tagged;
+    QHash<QString, QString> tags;   // the tested keys only; the value only if tested
+    QList<MapCSSSubject> parents;
+};
+
+class MapCSSCondition
+{
+public:
+    typedef enum {
+        Exists, Equals, Matches, Less, LessEqual, Greater, GreaterEqual, Truthy,
+        NotExists, NotEquals, NotMatches, Falsy,
+        HasClass, NotClass, Closed, NotClosed, Tagged, Untagged, Never
+    } Operator;
+
+    MapCSSCondition(Operator anOp = Never, const QString& aKey = QString())
+        : op(anOp), key(aKey), number(0) {}
+
+    /* Whether the condition only holds on features with the key; those rules are indexed by it */
+    bool needsKey() const { return op <= Truthy; }
+    bool testsValue() const { return op != Exists && op != NotExists && op < HasClass; }
+
+    bool matches(const MapCSSSubject& S, const QSet<QString>& classes, const QHash<QString, QString>& setTags) const
+    {
+        switch (op) {
+        case HasClass: return classes.contains(key);
+        case NotClass: return !classes.contains(key);
+        case Closed: return S.closed;
+        case NotClosed: return !S.closed;
+        case Tagged: return S.tagged || !setTags.isEmpty();
+        case Untagged: return !S.tagged && setTags.isEmpty();
+        case Never: return false;
+        default: break;
+        }
+
+        QHash<QString, QString>::const_iterator it = setTags.constFind(key);
+        bool has = (it != setTags.constEnd());
+        if (!has) {
+            it = S.tags.constFind(key);
+            has = (it != S.tags.constEnd());
+        }
+        QString v = has ? it.value() : QString();
+
+        switch (op) {
+        case Exists: return has;
+        case NotExists: return !has;
+        case Equals: return has && v == value;
+        case NotEquals: return !has || v != value;
+        case Matches: return has && rx.indexIn(v) != -1;
+        case NotMatches: return !has || rx.indexIn(v) == -1;
+        case Truthy: return has && (v == "yes" || v == "true" || v == "1");
+        case Falsy: return !has || v == "no" || v == "false" || v == "0";
+        default: break;
+        }
+
+        bool ok;
+        qreal n = v.toDouble(&ok);
+        if (!ok)
+            return false;
+        switch (op) {
+        case Less: return n < number;
+        case LessEqual: return n <= number;
+        case Greater: return n > number;
+        case GreaterEqual: return n >= number;
+        default: return false;
+        }
+    }
+
+    Operator op;
+    QString key;
+    QString value;
+    QRegExp rx;
+    qreal number;
+};
+
+class MapCSSSelector
+{
+public:
+    typedef enum { AnyType, NodeType, WayType, LineType, AreaType, RelationType, CanvasType, OtherType } Type;
+
+    MapCSSSelector()
+        : type(AnyType), zoomMin(0), zoomMax(INT_MAX) {}
+
+    bool matchesZoom(int z) const { return zoomMin <= z && z <= zoomMax; }
+    bool matches(const MapCSSSubject& S, const QSet<QString>& classes, const QHash<QString, QString>& setTags) const
+    {
+        switch (type) {
+        case AnyType: break;
+        case NodeType: if (S.type != 'n') return false; break;
+        case WayType:
+        case LineType: if (S.type != 'w') return false; break;
+        case AreaType: if (!S.closed) return false; break;
+        case RelationType: if (S.type != 'r') return false; break;
+        default: return false;
+        }
+        for (int i=0; i<conditions.size(); ++i)
+            if (!conditions[i].matches(S, classes, setTags))
+                return false;
+        return true;
+    }
+
+    Type type;
+    int zoomMin, zoomMax;
+    QList<MapCSSCondition> conditions;
+    QString subpart;
+};
+
+class MapCSSDeclaration
+{
+public:
+    QString property;   // or "set" with a key or a .class, or "exit"
+    QString key;
+    QString value;
+};
+
+class MapCSSRule
+{
+public:
+    QList<MapCSSSelector> chain;    // the subject last, preceded by the parents it must have
+    QList<MapCSSDeclaration> declarations;
+};
+
+/* PARSER */
+
+/* A recursive descent over the stylesheet text, reading its tokens as it goes as their meaning
+   depends on where they are (':' starts a pseudo-class but belongs to keys like name:en).
+   A rule that does not parse is skipped up to its closing brace, as CSS recovers. */
+class MapCSSParser
+{
+public:
+    MapCSSParser(const QString& aText)
+        : errors(0), s(aText), pos(0) {}
+
+    void parse(QList<MapCSSRule>& rules, QList<MapCSSDeclaration>& canvas)
+    {
+        while (skipSpace()) {
+            if (s[pos] == '@') {
+                skipBlock();
+                continue;
+            }
+            int start = pos;
+            QList<QList<MapCSSSelector> > chains;
+            QList<MapCSSDeclaration> declarations;
+            if (!selectors(chains) || !block(declarations)) {
+                ++errors;
+                pos = start;
+                skipBlock();
+                continue;
+            }
+            for (int i=0; i<chains.size(); ++i) {
+                if (chains[i].last().type == MapCSSSelector::CanvasType) {
+                    canvas << declarations;
+                    continue;
+                }
+                MapCSSRule R;
+                R.chain = chains[i];
+                R.declarations = declarations;
+                rules << R;
+            }
+        }
+    }
+
+    int errors;
+
+private:
+    bool atEnd() const { return pos >= s.size(); }
+
+    /* Skips blanks and comments; false at the end of the text */
+    bool skipSpace()
+    {
+        while (pos < s.size()) {
+            if (s[pos].isSpace())
+                ++pos;
+            else if (s.midRef(pos, 2) == QLatin1String("/*")) {
+                int end = s.indexOf("*/", pos+2);
+                pos = (end == -1) ? s.size() : end+2;
+            } else if (s.midRef(pos, 2) == QLatin1String("//")) {
+                int end = s.indexOf('\n', pos+2);
+                pos = (end == -1) ? s.size() : end+1;
+            } else
+                break;
+        }
+        return pos < s.size();
+    }
+
+    bool accept(QChar c)
+    {
+        skipSpace();
+        if (!atEnd() && s[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    /* Past the next ';' or the next balanced {} block, whichever comes first */
+    void skipBlock()
+    {
+        int depth = 0;
+        while (!atEnd()) {
+            QChar c = s[pos];
+            if (c == '"' || c == '\'') {
+                quoted();
+                continue;
+            }
+            ++pos;
+            if (c == '{')
+                ++depth;
+            else if (c == '}') {
+                if (--depth <= 0)
+                    return;
+            } else if (c == ';' && depth == 0)
+                return;
+        }
+    }
+
+    static bool isNameChar(QChar c) { return c.isLetterOrNumber() || c == '_' || c == '-'; }
+    static bool isKeyChar(QChar c) { return isNameChar(c) || c == ':' || c == '.'; }
+
+    QString name()
+    {
+        int start = pos;
+        while (!atEnd() && isNameChar(s[pos]))
+            ++pos;
+        return s.mid(start, pos-start);
+    }
+
+    QString quoted()
+    {
+        QChar q = s[pos++];
+        QString out;
+        while (!atEnd() && s[pos] != q) {
+            if (s[pos] == '\\' && pos+1 < s.size())
+                ++pos;
+            out += s[pos++];
+        }
+        ++pos;
+        return out;
+    }
+
+    QString key()
+    {
+        skipSpace();
+        if (atEnd())
+            return QString();
+        if (s[pos] == '"' || s[pos] == '\'')
+            return quoted();
+        int start = pos;
+        while (!atEnd() && isKeyChar(s[pos]))
+            ++pos;
+        return s.mid(start, pos-start);
+    }
+
+    int number()
+    {
+        int start = pos;
+        while (!atEnd() && s[pos].isDigit())
+            ++pos;
+        return s.mid(start, pos-start).toInt();
+    }
+
+    bool selectors(QList<QList<MapCSSSelector> >& chains)
+    {
+        do {
+            QList<MapCSSSelector> chain;
+            do {
+                skipSpace();
+                MapCSSSelector S;
+                if (!selector(S))
+                    return false;
+                chain << S;
+                accept('>');
+                skipSpace();
+            } while (!atEnd() && s[pos] != ',' && s[pos] != '{');
+            chains << chain;
+        } while (accept(','));
+        return !chains.isEmpty();
+    }
+
+    bool selector(MapCSSSelector& S)
+    {
+        if (atEnd())
+            return false;
+        if (s[pos] == '*') {
+            ++pos;
+            S.type = MapCSSSelector::AnyType;
+        } else {
+            QString t = name();
+            if (t.isEmpty())
+                return false;
+            if (t == "node") S.type = MapCSSSelector::NodeType;
+            else if (t == "way") S.type = MapCSSSelector::WayType;
+            else if (t == "line") S.type = MapCSSSelector::LineType;
+            else if (t == "area") S.type = MapCSSSelector::AreaType;
+            else if (t == "relation") S.type = MapCSSSelector::RelationType;
+            else if (t == "canvas") S.type = MapCSSSelector::CanvasType;
+            else S.type = MapCSSSelector::OtherType;
+        }
+
+        // No blanks within a selector: a blank ends it
+        while (!atEnd()) {
+            QChar c = s[pos];
+            if (c == '|') {
+                ++pos;
+                if (atEnd() || s[pos++] != 'z')
+                    return false;
+                if (!atEnd() && s[pos].isDigit())
+                    S.zoomMin = number();
+                if (!atEnd() && s[pos] == '-') {
+                    ++pos;
+                    if (!atEnd() && s[pos].isDigit())
+                        S.zoomMax = number();
+                } else
+                    S.zoomMax = S.zoomMin;
+            } else if (c == '[') {
+                ++pos;
+                MapCSSCondition C;
+                if (!condition(C))
+                    return false;
+                S.conditions << C;
+            } else if (c == '.' || (c == '!' && s.midRef(pos, 2) == QLatin1String("!."))) {
+                pos += (c == '!') ? 2 : 1;
+                MapCSSCondition C(c == '!' ? MapCSSCondition::NotClass : MapCSSCondition::HasClass, name());
+                if (C.key.isEmpty())
+                    return false;
+                S.conditions << C;
+            } else if (c == ':' && s.midRef(pos, 2) == QLatin1String("::")) {
+                pos += 2;
+                if (!atEnd() && s[pos] == '*') {
+                    ++pos;
+                    S.subpart = "*";
+                } else
+                    S.subpart = name();
+            } else if (c == ':') {
+                ++pos;
+                QString pseudo = name();
+                if (pseudo == "closed") S.conditions << MapCSSCondition(MapCSSCondition::Closed);
+                else if (pseudo == "unclosed") S.conditions << MapCSSCondition(MapCSSCondition::NotClosed);
+                else if (pseudo == "tagged") S.conditions << MapCSSCondition(MapCSSCondition::Tagged);
+                else if (pseudo == "untagged") S.conditions << MapCSSCondition(MapCSSCondition::Untagged);
+                else S.conditions << MapCSSCondition(MapCSSCondition::Never);  // :hover, :selected...
+            } else
+                break;
+        }
+        return true;
+    }
+
+    bool condition(MapCSSCondition& C)
+    {
+        bool negated = accept('!');
+        C.key = key();
+        if (C.key.isEmpty())
+            return false;
+
+        if (accept(']')) {
+            C.op = negated ? MapCSSCondition::NotExists : MapCSSCondition::Exists;
+            return true;
+        }
+        if (accept('?')) {
+            C.op = negated ? MapCSSCondition::Falsy : MapCSSCondition::Truthy;
+            return accept(']');
+        }
+        if (negated)
+            return false;
+
+        skipSpace();
+        static const char* const Ops[] = { "=~", "!~", "!=", "<=", ">=", "=", "<", ">" };
+        static const MapCSSCondition::Operator OpCodes[] = {
+            MapCSSCondition::Matches, MapCSSCondition::NotMatches, MapCSSCondition::NotEquals,
+            MapCSSCondition::LessEqual, MapCSSCondition::GreaterEqual, MapCSSCondition::Equals,
+            MapCSSCondition::Less, MapCSSCondition::Greater };
+        int o = 0;
+        for (; o<8; ++o)
+            if (s.midRef(pos, qstrlen(Ops[o])) == QLatin1String(Ops[o]))
+                break;
+        if (o == 8)
+            return false;
+        pos += qstrlen(Ops[o]);
+        C.op = OpCodes[o];
+
+        skipSpace();
+        if (atEnd())
+            return false;
+        if (C.op == MapCSSCondition::Matches || C.op == MapCSSCondition::NotMatches) {
+            if (s[pos] != '/')
+                return false;
+            ++pos;
+            QString pattern;
+            while (!atEnd() && s[pos] != '/') {
+                if (s[pos] == '\\' && pos+1 < s.size() && s[pos+1] == '/')
+                    ++pos;
+                pattern += s[pos++];
+            }
+            if (atEnd())
+                return false;
+            ++pos;
+            Qt::CaseSensitivity cs = Qt::CaseSensitive;
+            if (!atEnd() && s[pos] == 'i') {
+                ++pos;
+                cs = Qt::CaseInsensitive;
+            }
+            C.rx = QRegExp(pattern, cs, QRegExp::RegExp2);
+            if (!C.rx.isValid())
+                return false;
+        } else if (s[pos] == '"' || s[pos] == '\'')
+            C.value = quoted();
+        else {
+            int start = pos;
+            while (!atEnd() && s[pos] != ']')
+                ++pos;
+            C.value = s.mid(start, pos-start).trimmed();
+        }
+        if (C.op >= MapCSSCondition::Less && C.op <= MapCSSCondition::GreaterEqual) {
+            bool ok;
+            C.number = C.value.toDouble(&ok);
+            if (!ok)
+                return false;
+        }
+        return accept(']');
+    }
+
+    /* A declaration value: up to the ';' or '}' outside quotes and parentheses */
+    QString value()
+    {
+        skipSpace();
+        QString out;
+        int depth = 0;
+        bool onlyQuoted = true;
+        while (!atEnd()) {
+            QChar c = s[pos];
+            if (depth == 0 && (c == ';' || c == '}'))
+                break;
+            if (c == '"' || c == '\'') {
+                QString q = quoted();
+                out += onlyQuoted && out.isEmpty() ? q : QString(c) + q + c;
+                continue;
+            }
+            if (!c.isSpace())
+                onlyQuoted = false;
+            if (c == '(')
+                ++depth;
+            else if (c == ')')
+                --depth;
+            out += c;
+            ++pos;
+        }
+        return out.trimmed();
+    }
+
+    bool block(QList<MapCSSDeclaration>& declarations)
+    {
+        if (!accept('{'))
+            return false;
+        while (skipSpace()) {
+            if (accept('}'))
+                return true;
+            if (accept(';'))
+                continue;
+
+            int start = pos;
+            MapCSSDeclaration D;
+            D.property = name();
+            if (D.property == "exit") {
+                declarations << D;
+                continue;
+            }
+            if (D.property == "set") {
+                skipSpace();
+                if (!atEnd() && s[pos] == '.') {
+                    ++pos;
+                    D.key = "." + name();
+                } else {
+                    D.key = key();
+                    if (accept('='))
+                        D.value = value();
+                }
+                if (D.key.isEmpty() || D.key == ".")
+                    return false;
+                declarations << D;
+                continue;
+            }
+            if (D.property.isEmpty() || !accept(':')) {
+                // Not a declaration; drop it and carry on with the next one
+                ++errors;
+                pos = start;
+                while (!atEnd() && s[pos] != ';' && s[pos] != '}')
+                    ++pos;
+                continue;
+            }
+            D.value = value();
+            declarations << D;
+        }
+        return false;
+    }
+
+    const QString& s;
+    int pos;
+};
+
+/* STYLE CLASSES */
+
+/* The zoom levels are split into bands over which no candidate rule starts or stops matching,
+   so the class is cascaded once per band, and only when a zoom of the band is asked for */
+class MapCSSStyleClass
+{
+public:
+    MapCSSStyleClass()
+        : bandOf(MAPCSS_MAX_ZOOM+1, 0), drawn(-1) {}
+    ~MapCSSStyleClass()
+    {
+        qDeleteAll(painters);
+    }
+
+    MapCSSSubject subject;
+    QVector<int> candidates;    // the rules that may match, in cascade order
+    QVector<int> bandOf;        // zoom -> band
+    QVector<FeaturePainter*> painters;  // per band
+    QBitArray cascaded;         // per band
+    int drawn;                  // whether a painter is drawn at some zoom; -1 if not known yet
+};
+
+class MapCSSPaintstylePrivate
+{
+public:
+    MapCSSPaintstylePrivate()
+        : parentDepth(0), lookups(0), cascades(0), cascadeTime(0) {}
+    ~MapCSSPaintstylePrivate()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        rules.clear();
+        rulesByKey.clear();
+        genericRules.clear();
+        testedKeys.clear();
+        parentDepth = 0;
+        classIds.clear();
+        qDeleteAll(classes);
+        classes.clear();
+    }
+
+    void compile();
+    MapCSSSubject subjectOf(const Feature* F, int depth) const;
+    QString keyOf(const MapCSSSubject& S) const;
+    bool matches(const MapCSSRule& R, int k, const MapCSSSubject& S, int z,
+                 const QSet<QString>& classes, const QHash<QString, QString>& setTags) const;
+    void splitZooms(MapCSSStyleClass* C) const;
+    FeaturePainter* painterAt(MapCSSStyleClass* C, int z);
+    FeaturePainter* cascade(const MapCSSStyleClass& C, int z) const;
+    FeaturePainter* painterOf(const QHash<QString, QString>& props, const MapCSSSubject& S) const;
+
+    QVector<MapCSSRule> rules;
+    QHash<QString, QVector<int> > rulesByKey;
+    QVector<int> genericRules;
+    QHash<QString, bool> testedKeys;    // key -> whether some condition reads its value
+    int parentDepth;
+
+    QHash<QString, int> classIds;
+    QVector<MapCSSStyleClass*> classes;
+
+    QString basePath;
+    /* Lookups of cascaded painters only read; classes and cascades are added with the write lock */
+    QReadWriteLock lock;
+
+    QAtomicInt lookups;         // counted under the read lock
+    int cascades;
+    qint64 cascadeTime;
+};
+
+void MapCSSPaintstylePrivate::compile()
 {
+    QSet<QString> setKeys;
+    for (int i=0; i<rules.size(); ++i)
+        foreach (const MapCSSDeclaration& D, rules[i].declarations)
+            if (D.property == "set" && !D.key.startsWith('.'))
+                setKeys.insert(D.key);
+
+    for (int i=0; i<rules.size(); ++i) {
+        const MapCSSRule& R = rules[i];
+        parentDepth = qMax(parentDepth, R.chain.size()-1);
+        foreach (const MapCSSSelector& S, R.chain)
+            foreach (const MapCSSCondition& C, S.conditions)
+                if (C.op < MapCSSCondition::HasClass)
+                    testedKeys[C.key] = testedKeys.value(C.key) || C.testsValue();
+
+        // Indexed by the first key the subject must have, unless a rule may set it
+        QString indexKey;
+        foreach (const MapCSSCondition& C, R.chain.last().conditions)
+            if (C.needsKey() && !setKeys.contains(C.key)) {
+                indexKey = C.key;
+                break;
+            }
+        if (indexKey.isNull())
+            genericRules << i;
+        else
+            rulesByKey[indexKey] << i;
+    }
 }
 
-MapCSSPaintstyle::~MapCSSPaintstyle(void)
+MapCSSSubject MapCSSPaintstylePrivate::subjectOf(const Feature* F, int depth) const
 {
+    MapCSSSubject S;
+    if (CHECK_NODE(F))
+        S.type = 'n';
+    else if (CHECK_WAY(F)) {
+        S.type = 'w';
+        S.closed = static_cast<const Way*>(F)->isClosed();
+    } else if (CHECK_RELATION(F)) {
+        S.type = 'r';
+        S.closed = (F->tagValue("type", QString()) == "multipolygon");
+    }
+    S.tagged = F->tagSize() > 0;
+    for (int i=0; i<F->tagSize(); ++i) {
+        QString k = F->tagKey(i);
+        QHash<QString, bool>::const_iterator it = testedKeys.constFind(k);
+        if (it != testedKeys.constEnd())
+            S.tags.insert(k, it.value() ? F->tagValue(i) : QString());
+    }
+    if (depth > 0) {
+        QSet<QString> seen;
+        for (int i=0; i<F->sizeParents(); ++i) {
+            const Feature* P = static_cast<const Feature*>(F->getParent(i));
+            if (P->isDeleted())
+                continue;
+            MapCSSSubject PS = subjectOf(P, depth-1);
+            QString k = keyOf(PS);
+            if (!seen.contains(k)) {
+                seen.insert(k);
+                S.parents << PS;
+            }
+        }
+    }
+    return S;
 }
 
-void MapCSSPaintstyle::savePainters(const QString& /*filename*/)
+QString MapCSSPaintstylePrivate::keyOf(const MapCSSSubject& S) const
 {
+    QString k;
+    k += S.type;
+    k += S.closed ? 'c' : '-';
+    k += S.tagged ? 't' : '-';
+    QStringList keys = S.tags.keys();
+    keys.sort();
+    foreach (const QString& t, keys)
+        k += '\x1f' + t + '=' + S.tags.value(t);
+    QStringList parents;
+    foreach (const MapCSSSubject& P, S.parents)
+        parents << keyOf(P);
+    parents.sort();
+    foreach (const QString& p, parents)
+        k += '\x1e' + p + '\x1d';
+    return k;
 }
 
-QString parseSelector(QString in)
+bool MapCSSPaintstylePrivate::matches(const MapCSSRule& R, int k, const MapCSSSubject& S, int z,
+                                      const QSet<QString>& classes, const QHash<QString, QString>& setTags) const
 {
-    QString out = in;
-//    int idx = 0;
+    const MapCSSSelector& Sel = R.chain[k];
+    if (!Sel.matchesZoom(z) || !Sel.matches(S, classes, setTags))
+        return false;
+    if (k == 0)
+        return true;
+    // The classes and set tags are those of the subject, not of its parents
+    static const QSet<QString> NoClasses;
+    static const QHash<QString, QString> NoTags;
+    for (int i=0; i<S.parents.size(); ++i)
+        if (matches(R, k-1, S.parents[i], z, NoClasses, NoTags))
+            return true;
+    return false;
+}
 
-//    QList<TagSelector*> terms;
-//    while (idx < in.length()) {
-//        TagSelector* t = TagSelector::parse(in, idx);
-//        if (!t) break;
-//        terms.append(t);
-//    }
+void MapCSSPaintstylePrivate::splitZooms(MapCSSStyleClass* C) const
+{
+    QBitArray starts(MAPCSS_MAX_ZOOM+1);
+    starts.setBit(0);
+    foreach (int i, C->candidates)
+        foreach (const MapCSSSelector& S, rules[i].chain) {
+            if (S.zoomMin > 0 && S.zoomMin <= MAPCSS_MAX_ZOOM)
+                starts.setBit(S.zoomMin);
+            if (S.zoomMax >= 0 && S.zoomMax < MAPCSS_MAX_ZOOM)
+                starts.setBit(S.zoomMax+1);
+        }
+    int band = -1;
+    for (int z=0; z<=MAPCSS_MAX_ZOOM; ++z) {
+        if (starts.testBit(z))
+            ++band;
+        C->bandOf[z] = band;
+    }
+    C->painters.fill(0, band+1);
+    C->cascaded.resize(band+1);
+}
 
-//    if (terms.length()) {
-//        out += terms[terms.length()-1]->asExpression(true);
-//        for (int i=terms.length()-2; i>=0; --i) {
-//            out += " and parent(";
-//            out += terms[i]->asExpression(true);
-//            out += ") ";
-//        }
-//    }
+/* The painter of the class at zoom level z, cascaded the first time; the write lock is held */
+FeaturePainter* MapCSSPaintstylePrivate::painterAt(MapCSSStyleClass* C, int z)
+{
+    int b = C->bandOf[z];
+    if (!C->cascaded.testBit(b)) {
+        QElapsedTimer timer;
+        timer.start();
+        C->painters[b] = cascade(*C, z);
+        C->cascaded.setBit(b);
+        ++cascades;
+        cascadeTime += timer.nsecsElapsed() / 1000;
+    }
+    return C->painters[b];
+}
+
+FeaturePainter* MapCSSPaintstylePrivate::cascade(const MapCSSStyleClass& C, int z) const
+{
+    QHash<QString, QString> props;
+    QSet<QString> classes;
+    QHash<QString, QString> setTags;
+    foreach (int i, C.candidates) {
+        const MapCSSRule& R = rules[i];
+        if (!matches(R, R.chain.size()-1, C.subject, z, classes, setTags))
+            continue;
+        foreach (const MapCSSDeclaration& D, R.declarations) {
+            if (D.property == "exit")
+                return painterOf(props, C.subject);
+            if (D.property == "set") {
+                if (D.key.startsWith('.'))
+                    classes.insert(D.key.mid(1));
+                else
+                    setTags.insert(D.key, D.value.isNull() ? QString("yes") : D.value);
+            } else
+                props.insert(D.property, D.value);
+        }
+    }
+    return painterOf(props, C.subject);
+}
 
-    return out;
+static bool toColor(const QString& v, QColor& c)
+{
+    if (v.startsWith("rgb", Qt::CaseInsensitive)) {
+        int open = v.indexOf('(');
+        int close = v.lastIndexOf(')');
+        if (open == -1 || close < open)
+            return false;
+        QStringList parts = v.mid(open+1, close-open-1).split(',');
+        if (parts.size() < 3)
+            return false;
+        qreal n[4] = { 0, 0, 0, 1 };
+        bool fractions = true;
+        for (int i=0; i<parts.size() && i<4; ++i) {
+            bool ok;
+            n[i] = parts[i].trimmed().toDouble(&ok);
+            if (!ok)
+                return false;
+            if (i < 3 && n[i] > 1)
+                fractions = false;
+        }
+        qreal scale = fractions ? 255 : 1;
+        c = QColor(qBound(0, int(n[0]*scale), 255), qBound(0, int(n[1]*scale), 255),
+                   qBound(0, int(n[2]*scale), 255), qBound(0, int(n[3]*255), 255));
+        return true;
+    }
+    c = QColor(v);
+    return c.isValid();
+}
+
+static bool toNumber(const QString& v, qreal& n)
+{
+    bool ok;
+    n = v.toDouble(&ok);
+    return ok;
+}
+
+FeaturePainter* MapCSSPaintstylePrivate::painterOf(const QHash<QString, QString>& props, const MapCSSSubject& S) const
+{
+    if (props.isEmpty())
+        return NULL;
+
+    FeaturePainter* FP = new FeaturePainter;
+    bool draws = false;
+    QColor c;
+    qreal n;
+
+    if (S.type == 'n') {
+        qreal size = 0;
+        if (toNumber(props.value("symbol-size"), n))
+            size = n;
+        else if (props.contains("symbol-shape"))
+            size = 6;
+        if (size > 0) {
+            if (!toColor(props.value("symbol-fill-color"), c) && !toColor(props.value("symbol-stroke-color"), c))
+                c = Qt::gray;
+            FP->backgroundActive(true).background(c, 0, size);
+            draws = true;
+        }
+    } else {
+        qreal width = -1;
+        if (toNumber(props.value("width"), n))
+            width = n;
+        if (toColor(props.value("color"), c) || width > 0) {
+            if (!c.isValid())
+                c = Qt::black;
+            if (toNumber(props.value("opacity"), n))
+                c.setAlphaF(qBound(qreal(0), n, qreal(1)));
+            if (width < 0)
+                width = 1;
+            FP->foregroundActive(true).foreground(c, 0, width);
+            QStringList dashes = props.value("dashes").split(',', QString::SkipEmptyParts);
+            qreal on, off;
+            if (dashes.size() >= 2 && toNumber(dashes[0].trimmed(), on) && toNumber(dashes[1].trimmed(), off))
+                FP->foregroundDash(on, off);
+
+            if (toNumber(props.value("casing-width"), n) && n > 0) {
+                QColor casing;
+                if (!toColor(props.value("casing-color"), casing))
+                    casing = c.darker();
+                FP->backgroundActive(true).background(casing, 0, width + 2*n);
+            }
+            draws = true;
+        }
+        if (S.closed && toColor(props.value("fill-color"), c)) {
+            if (toNumber(props.value("fill-opacity"), n))
+                c.setAlphaF(qBound(qreal(0), n, qreal(1)));
+            FP->foregroundFill(c);
+            draws = true;
+        }
+        if (S.closed && props.contains("fill-image")) {
+            FP->IconName = QDir(basePath).filePath(props.value("fill-image"));
+            FP->ForegroundFillUseIcon = true;
+            draws = true;
+        }
+    }
+
+    if (props.contains("icon-image")) {
+        qreal size = 0;
+        toNumber(props.value("icon-width"), size);
+        FP->iconActive(true).setIcon(QDir(basePath).filePath(props.value("icon-image")), 0, size);
+        draws = true;
+    }
+
+    QString text = props.value("text");
+    if (!text.isEmpty()) {
+        FP->labelActive(true).labelTag(text == "auto" ? QString("name") : text);
+        if (!toColor(props.value("text-color"), c))
+            c = Qt::black;
+        if (!toNumber(props.value("font-size"), n))
+            n = 12;
+        FP->label(c, 0, n);
+        QFont font;
+        if (props.contains("font-family"))
+            font.setFamily(props.value("font-family"));
+        font.setBold(props.value("font-weight") == "bold");
+        font.setItalic(props.value("font-style") == "italic");
+        FP->LabelFont = font;
+        FP->labelHalo(toNumber(props.value("text-halo-radius"), n) && n > 0);
+        QString position = props.value("text-position");
+        FP->labelArea(position == "center" || (S.closed && position != "line" && props.contains("fill-color")));
+        draws = true;
+    }
+
+    if (!draws) {
+        delete FP;
+        return NULL;
+    }
+    return FP;
+}
+
+/* MAPCSSPAINTSTYLE */
+
+MapCSSPaintstyle::MapCSSPaintstyle()
+    : p(new MapCSSPaintstylePrivate)
+{
+}
+
+MapCSSPaintstyle::~MapCSSPaintstyle(void)
+{
+    delete p;
+}
+
+void MapCSSPaintstyle::savePainters(const QString& /*filename*/)
+{
 }
 
 void MapCSSPaintstyle::loadPainters(const QString& filename)
@@ -72,33 +930,150 @@ void MapCSSPaintstyle::loadPainters(const QString& filename)
     QFile file(filename);
     if (!file.open(QIODevice::ReadOnly))
         return;
-    QByteArray css = file.readAll();
-    QString cssS(css);
+    QString css = QString::fromUtf8(file.readAll());
     file.close();
 
-    /* Remove comments */
-    QRegExp cssComments("/\\*.*\\*/");
-    cssComments.setMinimal(true);
-    cssS.replace(cssComments, "");
+    parse(css, QFileInfo(filename).absolutePath());
+}
+
+void MapCSSPaintstyle::parse(const QString& css, const QString& aBasePath)
+{
+    QWriteLocker lock(&p->lock);
+    p->clear();
+    p->basePath = aBasePath;
+
+    QList<MapCSSRule> rules;
+    QList<MapCSSDeclaration> canvas;
+    MapCSSParser parser(css);
+    parser.parse(rules, canvas);
+
+    // Only the default layer is drawn: Merkaartor has one painter per feature
+    foreach (const MapCSSRule& R, rules) {
+        const QString& subpart = R.chain.last().subpart;
+        if (subpart.isEmpty() || subpart == "default" || subpart == "*")
+            p->rules << R;
+    }
+    p->compile();
+
+    globalPainter = GlobalPainter();
+    foreach (const MapCSSDeclaration& D, canvas) {
+        QColor c;
+        if ((D.property == "fill-color" || D.property == "background-color") && toColor(D.value, c))
+            globalPainter.backgroundActive(true).background(c);
+    }
+}
+
+int MapCSSPaintstyle::ruleSize() const
+{
+    return p->rules.size();
+}
+
+int MapCSSPaintstyle::parentDepth() const
+{
+    QReadLocker lock(&p->lock);
+    return p->parentDepth;
+}
+
+int MapCSSPaintstyle::styleClass(const Feature* F)
+{
+    QReadLocker readLock(&p->lock);
+    MapCSSSubject S = p->subjectOf(F, p->parentDepth);
+    QString key = p->keyOf(S);
+    QHash<QString, int>::const_iterator it = p->classIds.constFind(key);
+    if (it != p->classIds.constEnd())
+        return it.value();
+    readLock.unlock();
+
+    QWriteLocker lock(&p->lock);
+    // Another thread may have added it in between
+    it = p->classIds.constFind(key);
+    if (it != p->classIds.constEnd())
+        return it.value();
+
+    MapCSSStyleClass* C = new MapCSSStyleClass;
+    C->subject = S;
+    C->candidates = p->genericRules;
+    QHash<QString, QString>::const_iterator t = S.tags.constBegin();
+    for (; t != S.tags.constEnd(); ++t)
+        C->candidates += p->rulesByKey.value(t.key());
+    qSort(C->candidates);
+    p->splitZooms(C);
 
-    /* Styles */
-    QRegExp cssStyle("\\s*(.*)\\s*\\{(.*)\\}");
-    cssStyle.setMinimal(true);
+    p->classes << C;
+    p->classIds.insert(key, p->classes.size()-1);
+    return p->classes.size()-1;
+}
 
-    QRegExp blanks("\\s*");
-    QRegExp attSep("\\s*;\\s*");
-    QHash <QString, QStringList> styles;
-    int pos=0;
-    while (cssStyle.indexIn(cssS, pos) != -1) {
-        QString selector = parseSelector(cssStyle.capturedTexts().at(1).trimmed());
-        QString attributes = cssStyle.capturedTexts().at(2).trimmed();
-        styles[selector] = attributes.split(attSep);
+bool MapCSSPaintstyle::hasPainter(int aClass)
+{
+    QReadLocker readLock(&p->lock);
+    if (aClass < 0 || aClass >= p->classes.size())
+        return false;
+    MapCSSStyleClass* C = p->classes[aClass];
+    if (C->drawn != -1)
+        return C->drawn;
+    readLock.unlock();
 
-        pos += cssStyle.matchedLength();
+    // One cascade per band, stopping at the first that draws
+    QWriteLocker lock(&p->lock);
+    if (aClass >= p->classes.size())
+        return false;
+    C = p->classes[aClass];
+    if (C->drawn == -1) {
+        C->drawn = 0;
+        for (int z=0; z<=MAPCSS_MAX_ZOOM && !C->drawn; ++z)
+            if (z == 0 || C->bandOf[z] != C->bandOf[z-1])
+                C->drawn = (p->painterAt(C, z) != NULL);
     }
-    qDebug() << styles;
+    return C->drawn;
+}
+
+const FeaturePainter* MapCSSPaintstyle::painterFor(int aClass, qreal PixelPerM)
+{
+    int z = 0;
+    if (PixelPerM > 0)
+        z = qBound(0, int(floor(log(PixelPerM * MAPCSS_METER_PER_PIXEL_Z0) / log(2.0))), MAPCSS_MAX_ZOOM);
 
+    p->lookups.fetchAndAddRelaxed(1);
 
+    QReadLocker readLock(&p->lock);
+    if (aClass < 0 || aClass >= p->classes.size())
+        return NULL;
+    MapCSSStyleClass* C = p->classes[aClass];
+    int b = C->bandOf[z];
+    if (C->cascaded.testBit(b))
+        return C->painters[b];
+    readLock.unlock();
+
+    QWriteLocker lock(&p->lock);
+    if (aClass >= p->classes.size())
+        return NULL;
+    return p->painterAt(p->classes[aClass], z);
+}
+
+MapCSSStatistics MapCSSPaintstyle::statistics() const
+{
+    QReadLocker lock(&p->lock);
+    MapCSSStatistics S;
+    S.Classes = p->classes.size();
+    S.Bands = 0;
+    S.Cascaded = 0;
+    foreach (const MapCSSStyleClass* C, p->classes) {
+        S.Bands += C->cascaded.size();
+        S.Cascaded += C->cascaded.count(true);
+    }
+    S.Lookups = p->lookups.fetchAndAddRelaxed(0);
+    S.Cascades = p->cascades;
+    S.CascadeTime = p->cascadeTime;
+    return S;
+}
+
+void MapCSSPaintstyle::resetStatistics()
+{
+    QWriteLocker lock(&p->lock);
+    p->lookups.fetchAndStoreRelaxed(0);
+    p->cascades = 0;
+    p->cascadeTime = 0;
 }
 
 int MapCSSPaintstyle::painterSize()
@@ -130,5 +1105,3 @@ void MapCSSPaintstyle::setPainters(QList<Painter> aPainters)
 {
     Painters = aPainters;
 }
-
-
@@ -4,10 +4,28 @@
 #include "Painter.h"
 
 class MapView;
-class PaintStylePrivate;
+class Feature;
+class FeaturePainter;
+class MapCSSPaintstylePrivate;
 
 #include <QList>
 
+/* How much the style classes save; the counts since the last reset are those of painterFor */
+struct MapCSSStatistics
+{
+    int Classes;
+    int Bands;              // zoom bands of all the classes
+    int Cascaded;           // bands cascaded so far
+    int Lookups;            // since the last reset
+    int Cascades;           // since the last reset
+    qint64 CascadeTime;     // in microseconds, since the last reset
+};
+
+/* A MapCSS 0.2 stylesheet. The rules are compiled once when loaded; a feature is then styled
+   through its style class, which holds only what the selectors can see of it (its type, the
+   tags they test, its parents), so that features alike share their cascaded painters.
+   The painter of a class is cascaded the first time a zoom level asks for it, once for all the
+   levels no rule tells apart, and kept until the sheet goes. */
 class MapCSSPaintstyle
 {
     public:
@@ -32,10 +50,27 @@ class MapCSSPaintstyle
 
         void savePainters(const QString& filename);
         void loadPainters(const QString& filename);
+        /* Replaces the rules with those of the stylesheet; rules that do not parse are skipped */
+        void parse(const QString& css, const QString& aBasePath = QString());
+        int ruleSize() const;
+        /* How many levels of parents the selectors look at; 0 if none does */
+        int parentDepth() const;
+
+        /* The style class of F; two features of the same class are styled alike */
+        int styleClass(const Feature* F);
+        /* Whether some rule matches the class, at any zoom */
+        bool hasPainter(int aClass);
+        /* The cascaded painter of the class at that zoom, or NULL if nothing is drawn.
+           The painter belongs to the stylesheet. */
+        const FeaturePainter* painterFor(int aClass, qreal PixelPerM);
+
+        MapCSSStatistics statistics() const;
+        void resetStatistics();
 
     private:
         QList<Painter> Painters;
         GlobalPainter globalPainter;
+        MapCSSPaintstylePrivate* p;
 
         static MapCSSPaintstyle* m_MapCSSInstance;
 };
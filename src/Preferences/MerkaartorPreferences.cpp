@@ -998,6 +998,7 @@ void MerkaartorPreferences::setOsmWebsite(const QString & theValue)
 M_PARAM_IMPLEMENT_STRING(XapiUrl, osm, "http://www.overpass-api.de/api/xapi_meta?")
 M_PARAM_IMPLEMENT_STRING(NominatimUrl, osm, "http://nominatim.openstreetmap.org/search")
 M_PARAM_IMPLEMENT_BOOL(AutoHistoryCleanup, data, true);
+M_PARAM_IMPLEMENT_INT(HistoryMemoryLimit, data, 256);    /* MB; 0 for no limit */
 
 QString MerkaartorPreferences::getOsmUser() const
 {
@@ -1190,6 +1191,8 @@ M_PARAM_IMPLEMENT_STRING(CustomStyle, style, QString())
 M_PARAM_IMPLEMENT_BOOL(DisableStyleForTracks, style, true)
 M_PARAM_IMPLEMENT_STRINGLIST(TechnicalTags, style, TECHNICAL_TAGS)
 M_PARAM_IMPLEMENT_INT(EditRendering, style, 0)
+M_PARAM_IMPLEMENT_BOOL(UseLevelOfDetail, style, true)
+M_PARAM_IMPLEMENT_BOOL(LodPoiAggregation, style, false)
 
 /* Zoom */
 M_PARAM_IMPLEMENT_INT(ZoomIn, zoom, 133)
@@ -1260,6 +1263,8 @@ M_PARAM_IMPLEMENT_STRING(MapdustUrl, data, "http://www.mapdust.com/feed?lang=en&
 M_PARAM_IMPLEMENT_BOOL(GdalConfirmProjection, data, true)
 M_PARAM_IMPLEMENT_BOOL(HasAutoLoadDocument, data, false)
 M_PARAM_IMPLEMENT_STRING(AutoLoadDocumentFilename, data, QString())
+M_PARAM_IMPLEMENT_INT(StoreFeatureBudget, data, 300000)
+M_PARAM_IMPLEMENT_INT(StoreImportThreshold, data, 256)
 
 /* Mouse bevaviour */
 #ifdef _MOBILE
@@ -1281,6 +1286,8 @@ M_PARAM_IMPLEMENT_STRING(MerkaartorStyleString, visual, "skulpture")
 M_PARAM_IMPLEMENT_BOOL(OfflineMode, Network, false)
 M_PARAM_IMPLEMENT_BOOL(LocalServer, Network, false)
 M_PARAM_IMPLEMENT_INT(NetworkTimeout, Network, 10000)
+M_PARAM_IMPLEMENT_BOOL(CacheStaleWhileRevalidate, Network, true)
+M_PARAM_IMPLEMENT_INT(TileSeedRate, Network, 2)
 
 /* Proxy */
 
@@ -247,6 +247,7 @@ public:
     M_PARAM_DECLARE_STRING(XapiUrl)
     M_PARAM_DECLARE_STRING(NominatimUrl)
     M_PARAM_DECLARE_BOOL(AutoHistoryCleanup)
+    M_PARAM_DECLARE_INT(HistoryMemoryLimit)
 
     void setOsmUser(const QString & theValue);
     QString getOsmUser() const;
@@ -296,6 +297,8 @@ public:
     M_PARAM_DECLARE_BOOL(DisableStyleForTracks)
     M_PARAM_DECLARE_STRINGList(TechnicalTags)
     M_PARAM_DECLARE_INT(EditRendering)
+    M_PARAM_DECLARE_BOOL(UseLevelOfDetail)
+    M_PARAM_DECLARE_BOOL(LodPoiAggregation)
 
     /* Visual */
     M_PARAM_DECLARE_INT(ZoomIn)
@@ -370,6 +373,8 @@ public:
     M_PARAM_DECLARE_BOOL(OfflineMode)
     M_PARAM_DECLARE_BOOL(LocalServer)
     M_PARAM_DECLARE_INT(NetworkTimeout)
+    M_PARAM_DECLARE_BOOL(CacheStaleWhileRevalidate)
+    M_PARAM_DECLARE_INT(TileSeedRate)
 
     /* Proxy */
     QNetworkProxy getProxy(const QUrl & requestUrl);
@@ -389,6 +394,8 @@ public:
     M_PARAM_DECLARE_BOOL(GdalConfirmProjection)
     M_PARAM_DECLARE_BOOL(HasAutoLoadDocument)
     M_PARAM_DECLARE_STRING(AutoLoadDocumentFilename)
+    M_PARAM_DECLARE_INT(StoreFeatureBudget)
+    M_PARAM_DECLARE_INT(StoreImportThreshold)
 
     /* FeaturesDock */
     M_PARAM_DECLARE_BOOL(FeaturesWithin)
@@ -428,7 +428,7 @@ void PreferencesDialog::savePrefs()
     bool PainterToInvalidate = false;
     if (cbDisableStyleForTracks->isChecked() != M_PREFS->getDisableStyleForTracks()) {
         M_PREFS->setDisableStyleForTracks(cbDisableStyleForTracks->isChecked());
-        PainterToInvalidate = true;
+        ((MainWindow*)parent())->document()->setDisableStyleForTracks(cbDisableStyleForTracks->isChecked());
     }
     if (cbSimpleGpxTrack->isChecked() != M_PREFS->getSimpleGpxTrack()) {
         M_PREFS->setSimpleGpxTrack(cbSimpleGpxTrack->isChecked());
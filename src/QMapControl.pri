@@ -8,7 +8,8 @@ HEADERS += \
            mapnetwork.h \
            wmsmapadapter.h \
            WmscMapAdapter.h \
-           tilemapadapter.h
+           tilemapadapter.h \
+           tileseeder.h
 
 SOURCES += \
            IImageManager.cpp \
@@ -17,7 +18,8 @@ SOURCES += \
            mapnetwork.cpp \
            wmsmapadapter.cpp \
            WmscMapAdapter.cpp \
-           tilemapadapter.cpp
+           tilemapadapter.cpp \
+           tileseeder.cpp
 
 QT += network
 
@@ -185,11 +185,11 @@ QImage BrowserImageManager::getImage(IMapAdapter* anAdapter, const QString &url)
     }
 
     // disk cache?
-    if (anAdapter->isTiled() && useDiskCache(hash + ".png")) {
-        if (pm.load(cacheDir.absolutePath() + "/" + hash + ".png")) {
-            QPixmapCache::insert(hash, pm);
-            return pm.toImage();
-        }
+    QImage img;
+    if (anAdapter->isTiled() && useDiskCache(hash + ".png", img)) {
+        pm = QPixmap::fromImage(img);
+        QPixmapCache::insert(hash, pm);
+        return img;
     }
     if (M_PREFS->getOfflineMode())
         return pm.toImage();
@@ -23,9 +23,23 @@
 
 #include <QDateTime>
 #include <QCryptographicHash>
+#include <QFile>
+
+#define SEED_PRIORITY 1e6 /* seeded tiles queue behind anything asked for by the view */
 
 ImageManager* ImageManager::m_ImageManagerInstance = 0;
 
+/* The validators of a stale tile, to ask the server whether it is still good */
+static void conditionalHeaders(const QImage& img, QHash<QByteArray, QByteArray>& validators)
+{
+    QString etag = IImageManager::tileHeader(img, "ETag");
+    if (!etag.isEmpty())
+        validators["If-None-Match"] = etag.toLatin1();
+    QString lastModified = IImageManager::tileHeader(img, "Last-Modified");
+    if (!lastModified.isEmpty())
+        validators["If-Modified-Since"] = lastModified.toLatin1();
+}
+
 ImageManager::ImageManager(QObject* parent)
     :QObject(parent), emptyPixmap(QPixmap(1,1)), net(new MapNetwork(this))
 {
@@ -44,9 +58,8 @@ ImageManager::~ImageManager()
     delete net;
 }
 
-QByteArray ImageManager::getData(IMapAdapter* anAdapter, const QString &url)
+QString ImageManager::tileHash(IMapAdapter* anAdapter, const QString &url)
 {
-    QString host = anAdapter->getHost();
     QString strHash = anAdapter->getName() + url;
     QString hash = QString(strHash.toLatin1().toBase64());
     if (hash.size() > 255) {
@@ -54,6 +67,13 @@ QByteArray ImageManager::getData(IMapAdapter* anAdapter, const QString &url)
         crypt.addData(hash.toLatin1());
         hash = QString(crypt.result().toHex());
     }
+    return hash;
+}
+
+QByteArray ImageManager::getData(IMapAdapter* anAdapter, const QString &url)
+{
+    QString host = anAdapter->getHost();
+    QString hash = tileHash(anAdapter, url);
 
     QByteArray ba;
     if (m_dataCache.contains(hash)) {
@@ -73,60 +93,109 @@ QByteArray ImageManager::getData(IMapAdapter* anAdapter, const QString &url)
 }
 
 QImage ImageManager::getImage(IMapAdapter* anAdapter, const QString &url)
+{
+    return getImage(anAdapter, url, 0.);
+}
+
+QImage ImageManager::getImage(IMapAdapter* anAdapter, const QString &url, qreal priority)
 {
 // 	qDebug() << "ImageManager::getImage";
 
-    QString host = anAdapter->getHost();
-    QString strHash = anAdapter->getName() + url;
-    QString hash = QString(strHash.toLatin1().toBase64());
-    if (hash.size() > 255) {
-        QCryptographicHash crypt(QCryptographicHash::Md5);
-        crypt.addData(hash.toLatin1());
-        hash = QString(crypt.result().toHex());
-    }
+    QString hash = tileHash(anAdapter, url);
 
     /*	QPixmap pm(anAdapter->getTileSize(), anAdapter->getTileSize());
         pm.fill(Qt::black);*/
     //	QPixmap pm(emptyPixmap);
     QImage pm;
+    QHash<QByteArray, QByteArray> validators;
+    if (cachedImage(anAdapter, hash, pm, validators))
+        return pm;
+
+    if (M_PREFS->getOfflineMode())
+        return pm;
 
+    // currently loading? Then only refresh its priority
+    bool wasLoading = net->isLoading(hash);
+    net->load(hash, anAdapter->getHost(), url, priority, validators);
+    if (!wasLoading)
+        emit(dataRequested());
+    return pm;
+}
+
+/* Looks the tile up in the memory and disk caches.
+   Returns true if pm can be used as is; otherwise pm may still hold a stale copy to show while
+   it is revalidated with the returned validators. */
+bool ImageManager::cachedImage(IMapAdapter* anAdapter, const QString& hash, QImage& pm, QHash<QByteArray, QByteArray>& validators)
+{
     // is image in picture cache
     if (m_dataCache.contains(hash)) {
         pm.loadFromData(m_dataCache.object(hash)->data());
-        return pm;
+        if (!staleTiles.contains(hash))
+            return true;
+        // Shown while revalidated; ask again if the last request was dropped
+        conditionalHeaders(pm, validators);
+        return false;
     }
 
     // disk cache?
-    if (anAdapter->isTiled() && useDiskCache(hash + ".png")) {
-        if (pm.load(cacheDir.absolutePath() + "/" + hash + ".png")) {
-            return pm;
-        }
+    if (!anAdapter->isTiled())
+        return false;
+    if (useDiskCache(hash + ".png", pm)) {
+        keepInMemory(hash, false);
+        return true;
     }
+    if (pm.isNull())
+        return false;
 
-    if (M_PREFS->getOfflineMode())
-        return pm;
+    // Stale: ask the server whether our copy is still good
+    conditionalHeaders(pm, validators);
+    if (M_PREFS->getCacheStaleWhileRevalidate())
+        keepInMemory(hash, true);
+    else
+        pm = QImage();
+    return false;
+}
 
-    // currently loading?
-    if (!net->isLoading(hash))
-    {
-        // load from net, add empty image
-        net->load(hash, host, url);
-        emit(dataRequested());
-        return pm;
-    }
-    return pm;
+/* Keeps the disk copy of a tile in memory as well, so that it is not read again on every paint */
+void ImageManager::keepInMemory(const QString& hash, bool stale)
+{
+    QFile f(cacheDir.absolutePath() + "/" + hash + ".png");
+    if (!f.open(QIODevice::ReadOnly))
+        return;
+    QBuffer* buf = new QBuffer();
+    buf->setData(f.readAll());
+    m_dataCache.insert(hash, buf, buf->data().size());
+    if (stale)
+        staleTiles.insert(hash);
 }
 
 //QPixmap ImageManager::prefetchImage(const QString& host, const QString& url)
 QImage ImageManager::prefetchImage(IMapAdapter* anAdapter, int x, int y, int z)
 {
-    QString host = anAdapter->getHost();
     QString url = anAdapter->getQuery(x, y, z);
-    QString strHash = QString("%1%2").arg(anAdapter->getName()).arg(url);
-    QString hash = QString(strHash.toLatin1().toBase64());
 
-    prefetch.append(hash);
-    return getImage(anAdapter, anAdapter->getQuery(x, y, z));
+    prefetch.append(tileHash(anAdapter, url));
+    return getImage(anAdapter, url);
+}
+
+bool ImageManager::seedImage(IMapAdapter* anAdapter, const QString &url, QString& hash)
+{
+    hash = tileHash(anAdapter, url);
+
+    QImage pm;
+    QHash<QByteArray, QByteArray> validators;
+    if (cachedImage(anAdapter, hash, pm, validators))
+        return false;
+    if (M_PREFS->getOfflineMode())
+        return false;
+
+    net->load(hash, anAdapter->getHost(), url, SEED_PRIORITY, validators, true);
+    return true;
+}
+
+bool ImageManager::isLoading(const QString& hash)
+{
+    return net->isLoading(hash);
 }
 
 void ImageManager::receivedData(const QByteArray& ba, const QHash<QString, QString>& headers, const QString& hash)
@@ -137,25 +206,58 @@ void ImageManager::receivedData(const QByteArray& ba, const QHash<QString, QStri
     foreach (QString k, headers.keys()) {
         img.setText(k, headers[k]);
     }
+    storeImage(img, hash);
+
+    prefetch.removeOne(hash);
+    emit(dataReceived());
+    emit(imageReceived(hash, ba.size()));
+}
+
+void ImageManager::notModified(const QHash<QString, QString>& headers, const QString& hash)
+{
+    QImage img;
+    if (!img.load(cacheDir.absolutePath() + "/" + hash + ".png"))
+        return;
+
+    // A 304 only carries the headers that changed, e.g. new Date/Expires/Cache-Control
+    foreach (QString k, headers.keys()) {
+        QString key = k;
+        foreach (QString old, img.textKeys())
+            if (old.compare(k, Qt::CaseInsensitive) == 0)
+                key = old;
+        img.setText(key, headers[k]);
+    }
+    storeImage(img, hash);
+
+    prefetch.removeOne(hash);
+    emit(dataReceived());
+    emit(imageReceived(hash, 0));
+}
+
+void ImageManager::storeImage(const QImage& img, const QString& hash)
+{
     QBuffer* buf = new QBuffer();
     buf->open(QIODevice::WriteOnly);
     img.save(buf, "PNG");
     buf->close();
     m_dataCache.insert(hash, buf, buf->data().size());
+    staleTiles.remove(hash);
     if (cacheMaxSize || cachePermanent) {
 
         if (!img.isNull()) {
-            img.save(cacheDir.absolutePath() + "/" + hash + ".png");
-            QFileInfo info(cacheDir.absolutePath() + "/" + hash + ".png");
-            cacheInfo.append(info);
+            QString fn = cacheDir.absolutePath() + "/" + hash + ".png";
+            bool existed = cacheDir.exists(hash + ".png");
+            if (existed)
+                cacheSize -= QFileInfo(fn).size();
+            img.save(fn);
+            QFileInfo info(fn);
+            if (!existed)
+                cacheInfo.append(info);
             cacheSize += info.size();
 
             adaptCache();
         }
     }
-
-    prefetch.removeOne(hash);
-    emit(dataReceived());
 }
 
 void ImageManager::loadingQueueEmpty()
@@ -172,6 +274,11 @@ void ImageManager::abortLoading()
     loadingQueueEmpty();
 }
 
+void ImageManager::startRequestBatch()
+{
+    net->startRequestBatch();
+}
+
 void ImageManager::setCacheDir(const QDir& path)
 {
     cacheDir = path;
@@ -53,12 +53,23 @@ class ImageManager : public QObject, public IImageManager
          * @return the pixmap of the asked image
          */
         QImage getImage(IMapAdapter* anAdapter, const QString &url);
+        QImage getImage(IMapAdapter* anAdapter, const QString &url, qreal priority);
         QByteArray getData(IMapAdapter* anAdapter, const QString &url);
 
         //QPixmap prefetchImage(const QString& host, const QString& path);
         QImage prefetchImage(IMapAdapter* anAdapter, int x, int y, int z);
 
+        //! queues a tile for the disk cache, behind the view's own requests
+        /*!
+         * @param hash set to the cache key of the tile
+         * @return false if the cached copy is still fresh or we are offline
+         */
+        bool seedImage(IMapAdapter* anAdapter, const QString &url, QString& hash);
+        bool isLoading(const QString& hash);
+        static QString tileHash(IMapAdapter* anAdapter, const QString &url);
+
         void receivedData(const QByteArray& ba, const QHash<QString, QString>& headers, const QString& url);
+        void notModified(const QHash<QString, QString>& headers, const QString& hash);
 
         /*!
          * This method is called by MapNetwork, after all images in its queue were loaded.
@@ -73,12 +84,18 @@ class ImageManager : public QObject, public IImageManager
          * This is useful when changing the zoom-factor, though newly needed images loads faster
          */
         void abortLoading();
+        void startRequestBatch();
 
         void setCacheDir(const QDir& path);
         QDir getCacheDir();
         void setCacheMaxSize(int max);
+        bool hasDiskCache() const { return cacheMaxSize || cachePermanent; }
 
     private:
+        bool cachedImage(IMapAdapter* anAdapter, const QString& hash, QImage& pm, QHash<QByteArray, QByteArray>& validators);
+        void storeImage(const QImage& img, const QString& hash);
+        void keepInMemory(const QString& hash, bool stale);
+
         QPixmap emptyPixmap;
         MapNetwork* net;
         QStringList prefetch;
@@ -86,10 +103,13 @@ class ImageManager : public QObject, public IImageManager
         static ImageManager* m_ImageManagerInstance;
 
         QCache<QString, QBuffer> m_dataCache;
+        //! tiles in m_dataCache shown while they are revalidated
+        QSet<QString> staleTiles;
 
     signals:
         void dataRequested();
         void dataReceived();
+        void imageReceived(const QString& hash, int bytes);
         void loadingFinished();
 };
 
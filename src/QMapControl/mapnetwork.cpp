@@ -23,53 +23,108 @@
 
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QTimer>
 
-#define MAX_REQ 8
+#define MAX_REQ 8 /* requests on the network at any time */
+#define MAX_REQ_PER_HOST 4 /* requests to a single host; keep-alive connections are reused */
+#define TIMEOUT_TICK 250 /* ms between timeout wheel ticks */
+#define TIMEOUT_WHEEL_SIZE 256 /* slots in the timeout wheel; longer timeouts are clamped */
+#define MAX_TIMEOUTS 3 /* times a request is sent before it is given up, so a dead server is not retried forever */
 
 MapNetwork::MapNetwork(IImageManager* parent)
-        : parent(parent)
+        : parent(parent), generation(0), timeoutWheel(TIMEOUT_WHEEL_SIZE), wheelPos(0)
 {
     m_networkManager = parent->getNetworkManager();
     m_networkManager->setProxy(M_PREFS->getProxy(QUrl("http://merkaartor.be")));
     connect(m_networkManager, SIGNAL(finished(QNetworkReply*)),
             this, SLOT(requestFinished(QNetworkReply*)));
+
+    wheelTimer = new QTimer(this);
+    wheelTimer->setInterval(TIMEOUT_TICK);
+    connect(wheelTimer, SIGNAL(timeout()), this, SLOT(timeout()));
 }
 
 MapNetwork::~MapNetwork()
 {
+    // abortLoading() leaves persistent requests alone
+    disconnect(m_networkManager, 0, this, 0);
+    QList<QNetworkReply*> replies = loadingMap.keys();
+    foreach (QNetworkReply* rply, replies) {
+        delete loadingMap.value(rply);
+        rply->abort();
+        rply->deleteLater();
+    }
+    qDeleteAll(loadingRequests);
 }
 
 
-void MapNetwork::load(const QString& hash, const QString& host, const QString& url)
+void MapNetwork::load(const QString& hash, const QString& host, const QString& url, qreal priority,
+                      const QHash<QByteArray, QByteArray>& headers, bool persistent)
 {
-    qDebug() << "requesting: " << QString(host).append(url);
-// 	http->setHost(host);
-// 	int getId = http->get(url);
+    if (LoadingRequest* R = queuedRequests.value(hash)) {
+        // Still wanted: move it to its new place in the queue
+        loadingRequests.remove(R->priority, R);
+        if (!R->persistent || priority < R->priority)
+            R->priority = priority;
+        R->generation = generation;
+        R->persistent |= persistent;
+        loadingRequests.insert(R->priority, R);
+    } else if (loadingHashes.contains(hash)) {
+        return;
+    } else {
+        qDebug() << "requesting: " << QString(host).append(url);
+        LoadingRequest* R = new LoadingRequest(hash, host, url, priority);
+        R->headers = headers;
+        R->persistent = persistent;
+        enqueue(R);
+    }
 
-    loadingRequests.enqueue(new LoadingRequest(hash, host, url));
+    launchRequest();
+}
 
-    if (loadingMap.size() < MAX_REQ)
-        launchRequest();
-    else
-        qDebug() << "queue full";
+void MapNetwork::enqueue(LoadingRequest* R)
+{
+    R->generation = generation;
+    R->timeoutSlot = -1;
+    loadingRequests.insert(R->priority, R);
+    queuedRequests.insert(R->hash, R);
 }
 
-void MapNetwork::launchRequest()
+void MapNetwork::startRequestBatch()
 {
-    if (loadingRequests.isEmpty())
-        return;
-    LoadingRequest* R = loadingRequests.dequeue();
+    ++generation;
+}
 
-    QUrl theUrl;
-    if (R->host.contains("://")) {
-        theUrl.setUrl(QString(R->host).append(R->url));
-    } else {
-        theUrl.setUrl("http://" + QString(R->host).append(R->url));
-    }
+void MapNetwork::launchRequest()
+{
+    QMultiMap<qreal, LoadingRequest*>::iterator it = loadingRequests.begin();
+    while (it != loadingRequests.end() && loadingMap.size() < MAX_REQ) {
+        LoadingRequest* R = it.value();
+        if (!R->persistent && R->generation != generation) {
+            // Out of view since it was queued
+            queuedRequests.remove(R->hash);
+            it = loadingRequests.erase(it);
+            delete R;
+            continue;
+        }
+        if (hostLoad.value(R->host) >= MAX_REQ_PER_HOST) {
+            ++it;
+            continue;
+        }
+        queuedRequests.remove(R->hash);
+        it = loadingRequests.erase(it);
+
+        QUrl theUrl;
+        if (R->host.contains("://")) {
+            theUrl.setUrl(QString(R->host).append(R->url));
+        } else {
+            theUrl.setUrl("http://" + QString(R->host).append(R->url));
+        }
 
-    qDebug() << "getting: " << theUrl.toString();
+        qDebug() << "getting: " << theUrl.toString();
 
-    launchRequest(theUrl, R);
+        launchRequest(theUrl, R);
+    }
 }
 
 void MapNetwork::launchRequest(QUrl url, LoadingRequest* R)
@@ -79,17 +134,37 @@ void MapNetwork::launchRequest(QUrl url, LoadingRequest* R)
     req.setRawHeader("Host", url.host().toLatin1());
     req.setRawHeader("Accept", "image/*");
     req.setRawHeader("User-Agent", USER_AGENT.toLatin1());
+    req.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
+    QHashIterator<QByteArray, QByteArray> h(R->headers);
+    while (h.hasNext()) {
+        h.next();
+        req.setRawHeader(h.key(), h.value());
+    }
 
     QNetworkReply* reply = m_networkManager->get(req);
     loadingMap[reply] = R;
+    loadingHashes.insert(R->hash);
+    hostLoad[R->host]++;
+
+    int ticks = qBound(1, (M_PREFS->getNetworkTimeout() + TIMEOUT_TICK - 1) / TIMEOUT_TICK, TIMEOUT_WHEEL_SIZE - 1);
+    R->timeoutSlot = (wheelPos + ticks) % TIMEOUT_WHEEL_SIZE;
+    timeoutWheel[R->timeoutSlot].append(reply);
+    if (!wheelTimer->isActive())
+        wheelTimer->start();
+}
 
-    QTimer* timeoutTimer = new QTimer();
-    connect(timeoutTimer, SIGNAL(timeout()), this, SLOT(timeout()));
-    timeoutTimer->setInterval(M_PREFS->getNetworkTimeout());
-    timeoutTimer->setSingleShot(true);
-
-    timeoutMap[timeoutTimer] = reply;
-    timeoutTimer->start();
+void MapNetwork::releaseRequest(QNetworkReply* reply, LoadingRequest* R)
+{
+    loadingMap.remove(reply);
+    loadingHashes.remove(R->hash);
+    if (--hostLoad[R->host] <= 0)
+        hostLoad.remove(R->host);
+    if (R->timeoutSlot >= 0)
+        timeoutWheel[R->timeoutSlot].removeOne(reply);
+    R->timeoutSlot = -1;
+
+    if (loadingMap.isEmpty())
+        wheelTimer->stop();
 }
 
 void MapNetwork::requestFinished(QNetworkReply* reply)
@@ -98,14 +173,9 @@ void MapNetwork::requestFinished(QNetworkReply* reply)
         // Don't react on setProxy and setHost requestFinished...
         return;
     }
-    QTimer* t = timeoutMap.key(reply);
-    Q_ASSERT(t);
-    t->stop();
-    timeoutMap.remove(t);
-    delete t;
-
     LoadingRequest* R = loadingMap[reply];
-    loadingMap.remove(reply);
+    releaseRequest(reply, R);
+    reply->deleteLater();
 
     int statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
@@ -118,8 +188,17 @@ void MapNetwork::requestFinished(QNetworkReply* reply)
             case 302:
             case 307:
                 qDebug() << "redirected: " << R->host << R->url;
-                launchRequest(reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl(), new LoadingRequest(R->hash, R->host, R->url));
+                launchRequest(reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl(), R);
                 return;
+            case 304: {
+                // Cached copy is still valid; the reply carries refreshed freshness headers
+                QHash<QString, QString> headers;
+                foreach (QByteArray k, reply->rawHeaderList()) {
+                    headers[QString(k)] = QString(reply->rawHeader(k));
+                }
+                parent->notModified(headers, R->hash);
+                break;
+            }
             case 404:
                 qDebug() << "404 error: " << R->host << R->url;
                 break;
@@ -156,47 +235,62 @@ void MapNetwork::requestFinished(QNetworkReply* reply)
 
 void MapNetwork::abortLoading()
 {
-    foreach (QNetworkReply* rply, loadingMap.keys())
+    QList<QNetworkReply*> replies = loadingMap.keys();
+    foreach (QNetworkReply* rply, replies) {
+        LoadingRequest* R = loadingMap.value(rply);
+        if (R->persistent)
+            continue;
+        releaseRequest(rply, R);
+        delete R;
         rply->abort();
-    loadingMap.clear();
-    while (!loadingRequests.isEmpty())
-        delete loadingRequests.dequeue();
-    //loadingRequests.clear();
+        rply->deleteLater();
+    }
+    QMultiMap<qreal, LoadingRequest*>::iterator it = loadingRequests.begin();
+    while (it != loadingRequests.end()) {
+        LoadingRequest* R = it.value();
+        if (R->persistent) {
+            ++it;
+            continue;
+        }
+        queuedRequests.remove(R->hash);
+        it = loadingRequests.erase(it);
+        delete R;
+    }
 }
 
 bool MapNetwork::isLoading(QString hash)
 {
-    QListIterator<LoadingRequest*> i(loadingRequests);
-    while (i.hasNext())
-        if (i.next()->hash == hash)
-            return true;
-
-    QMapIterator<QNetworkReply*, LoadingRequest*> j(loadingMap);
-    while (j.hasNext())
-        if (j.next().value()->hash == hash)
-            return true;
-
-    return false;
+    return queuedRequests.contains(hash) || loadingHashes.contains(hash);
 }
 
 void MapNetwork::timeout()
 {
-    QTimer* t = qobject_cast<QTimer*>(sender());
-    Q_ASSERT(t);
-
-    QNetworkReply* rply = timeoutMap[t];
-    if (!loadingMap.contains(rply))
+    wheelPos = (wheelPos + 1) % TIMEOUT_WHEEL_SIZE;
+    if (timeoutWheel[wheelPos].isEmpty())
         return;
 
-    LoadingRequest* R = loadingMap[rply];
-    qDebug() << "MapNetwork::timeout: " << R->host << R->url;
-    loadingMap.remove(rply);
-    loadingRequests.enqueue(R);
+    QList<QNetworkReply*> expired = timeoutWheel[wheelPos];
+    foreach (QNetworkReply* rply, expired) {
+        LoadingRequest* R = loadingMap.value(rply);
+        if (!R)
+            continue;
 
-    rply->abort();
-    timeoutMap.remove(t);
-    delete t;
+        qDebug() << "MapNetwork::timeout: " << R->host << R->url;
+        releaseRequest(rply, R);
+        rply->abort();
+        rply->deleteLater();
+
+        // Retry, unless it was asked for again in the meantime or has timed out too often
+        if (queuedRequests.contains(R->hash))
+            delete R;
+        else if (++R->timeouts >= MAX_TIMEOUTS) {
+            qDebug() << "MapNetwork::timeout: giving up on " << R->host << R->url;
+            delete R;
+        } else
+            enqueue(R);
+    }
 
-    if (loadingMap.size() < MAX_REQ)
-        launchRequest();
+    launchRequest();
+    if (loadingMap.isEmpty() && loadingRequests.isEmpty())
+        parent->loadingQueueEmpty();
 }
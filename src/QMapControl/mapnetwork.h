@@ -23,7 +23,10 @@
 #include <QObject>
 #include <QDebug>
 #include <QList>
-#include <QQueue>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QVector>
 #include <QPixmap>
 #include <QMutex>
 #include <QUrl>
@@ -40,7 +43,14 @@ class MapNetwork : QObject
         MapNetwork(IImageManager* parent);
         ~MapNetwork();
 
-        void load(const QString& hash, const QString& host, const QString& url);
+        /*!
+         * queues the given url, or updates its priority if it is already queued
+         * @param priority lower values are fetched first
+         * @param persistent the request is neither dropped by a new batch nor by abortLoading()
+         */
+        void load(const QString& hash, const QString& host, const QString& url, qreal priority = 0.,
+                  const QHash<QByteArray, QByteArray>& headers = QHash<QByteArray, QByteArray>(),
+                  bool persistent = false);
 
         /*!
          * checks if the given url is already loading
@@ -50,22 +60,36 @@ class MapNetwork : QObject
         bool isLoading(QString hash);
 
         /*!
-         * Aborts all current loading threads.
+         * Aborts all current loading threads, except persistent ones.
          * This is useful when changing the zoom-factor, though newly needed images loads faster
         */
         void abortLoading();
 
+        /*!
+         * Starts a new request batch; queued requests not asked for again are dropped.
+        */
+        void startRequestBatch();
+
     private:
         IImageManager* parent;
         QNetworkAccessManager* m_networkManager;
-        QMap<QNetworkReply*, LoadingRequest*> loadingMap;
-        QMap<QTimer*, QNetworkReply*> timeoutMap;
-        QQueue<LoadingRequest*> loadingRequests;
+        QHash<QNetworkReply*, LoadingRequest*> loadingMap;
+        QSet<QString> loadingHashes;
+        QHash<QString, int> hostLoad;
+        QMultiMap<qreal, LoadingRequest*> loadingRequests;
+        QHash<QString, LoadingRequest*> queuedRequests;
+        int generation;
+
+        QVector<QList<QNetworkReply*> > timeoutWheel;
+        int wheelPos;
+        QTimer* wheelTimer;
 
         MapNetwork& operator=(const MapNetwork& rhs);
         MapNetwork(const MapNetwork& old);
         void launchRequest();
         void launchRequest(QUrl url, LoadingRequest* R);
+        void enqueue(LoadingRequest* R);
+        void releaseRequest(QNetworkReply* reply, LoadingRequest* R);
 
 
     private slots:
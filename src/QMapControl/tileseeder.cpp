@@ -0,0 +1,318 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "tileseeder.h"
+#include "imagemanager.h"
+#include "IMapAdapter.h"
+#include "MerkaartorPreferences.h"
+
+#include <QApplication>
+#include <QSettings>
+
+#include <math.h>
+
+#define SEED_MAX_OUTSTANDING 2 /* tiles on the network at once; leaves the other host slots to the view */
+#define SEED_SCAN_LIMIT 1000 /* tiles looked at per tick while skipping cached or out of area ones */
+#define SEED_MAX_ZOOM_STEPS 64 /* guard against adapters whose zoom never reaches the asked level */
+#define SEED_MAX_LATITUDE 85.0511 /* beyond this mercator coordinates go to infinity */
+#define SEED_SAVE_INTERVAL 100 /* tiles between two saves of the position in the job */
+
+TileSeeder::TileSeeder(IMapAdapter* anAdapter, QObject* parent)
+    : QObject(parent), theAdapter(anAdapter), theManager(NULL)
+    , theMinZoom(0), theMaxZoom(0), curRange(0), curIndex(0)
+    , thePosition(0), theTotal(0), theFailed(0), theBytes(0), theStartPosition(0), theSavedPosition(0)
+{
+    connect(&theTimer, SIGNAL(timeout()), this, SLOT(on_timeout()));
+}
+
+TileSeeder::~TileSeeder()
+{
+    if (isRunning())
+        stop();
+    delete theAdapter;
+}
+
+bool TileSeeder::isRunning() const
+{
+    return theTimer.isActive();
+}
+
+QString TileSeeder::settingsGroup() const
+{
+    return QString("TileSeed/%1").arg(qHash(theAdapter->getName() + theAdapter->getHost()));
+}
+
+bool TileSeeder::canResume() const
+{
+    QSettings* Sets = M_PREFS->getQSettings();
+    return Sets->contains(settingsGroup() + "/Area");
+}
+
+bool TileSeeder::setAdapterZoom(int z)
+{
+    int guard = 0;
+    while (theAdapter->getAdaptedZoom() && guard++ < SEED_MAX_ZOOM_STEPS)
+        theAdapter->zoom_out();
+    guard = 0;
+    while (theAdapter->getZoom() != z && guard++ < SEED_MAX_ZOOM_STEPS)
+        theAdapter->zoom_in();
+    return theAdapter->getZoom() == z;
+}
+
+bool TileSeeder::init(const QPolygonF& wgs84Area, int minZoom, int maxZoom)
+{
+    theError.clear();
+    if (isRunning())
+        stop();
+
+    theManager = dynamic_cast<ImageManager*>(theAdapter->getImageManager());
+    if (!theAdapter->isTiled() || !theManager) {
+        theError = QApplication::translate("TileSeeder", "Only tiled network layers can be seeded.");
+        return false;
+    }
+    if (!theManager->hasDiskCache()) {
+        theError = QApplication::translate("TileSeeder", "The tile disk cache is disabled.");
+        return false;
+    }
+
+    theWgs84Area = wgs84Area;
+    theMinZoom = qMin(minZoom, maxZoom);
+    theMaxZoom = qMax(minZoom, maxZoom);
+
+    theProjection.setProjectionType(theAdapter->projection());
+    theArea.clear();
+    foreach (QPointF pt, wgs84Area) {
+        pt.setY(qBound<qreal>(-SEED_MAX_LATITUDE, pt.y(), SEED_MAX_LATITUDE));
+        theArea << theProjection.project(pt);
+    }
+    if (!theArea.isClosed() && !theArea.isEmpty())
+        theArea << theArea.first();
+    QRectF areaBox = theArea.boundingRect();
+
+    theRanges.clear();
+    theTotal = 0;
+    for (int z = theMinZoom; z <= theMaxZoom; ++z) {
+        if (!setAdapterZoom(z))
+            continue;
+
+        ZoomRange r;
+        r.zoom = z;
+        r.box = theAdapter->getBoundingbox().normalized();
+        int tilesWE = theAdapter->getTilesWE(z);
+        int tilesNS = theAdapter->getTilesNS(z);
+        if (tilesWE <= 0 || tilesNS <= 0)
+            continue;
+        r.tileWidth = r.box.width() / tilesWE;
+        r.tileHeight = r.box.height() / tilesNS;
+
+        QRectF bb = areaBox & r.box;
+        if (bb.isEmpty())
+            continue;
+        // Tile rows are counted from the north edge of the bounding box, see ImageMapLayer::drawTiled
+        r.i0 = qBound(0, int(floor((bb.left() - r.box.left()) / r.tileWidth)), tilesWE-1);
+        int i1 = qBound(0, int(floor((bb.right() - r.box.left()) / r.tileWidth)), tilesWE-1);
+        r.j0 = qBound(0, int(floor((r.box.bottom() - bb.bottom()) / r.tileHeight)), tilesNS-1);
+        int j1 = qBound(0, int(floor((r.box.bottom() - bb.top()) / r.tileHeight)), tilesNS-1);
+        r.cols = i1 - r.i0 + 1;
+        r.rows = j1 - r.j0 + 1;
+
+        theRanges << r;
+        theTotal += r.count();
+    }
+
+    if (!theTotal) {
+        theError = QApplication::translate("TileSeeder", "The area is outside of the layer.");
+        return false;
+    }
+
+    curRange = 0;
+    curIndex = 0;
+    thePosition = 0;
+    theFailed = 0;
+    theBytes = 0;
+    theOutstanding.clear();
+    theReceived.clear();
+    return true;
+}
+
+void TileSeeder::run()
+{
+    connect(theManager, SIGNAL(imageReceived(QString, int)), this, SLOT(on_imageReceived(QString, int)), Qt::UniqueConnection);
+
+    theStartPosition = thePosition;
+    theClock.start();
+    theTimer.start(qMax(1, 1000 / qMax(1, M_PREFS->getTileSeedRate())));
+    saveState();
+}
+
+bool TileSeeder::start(const QPolygonF& wgs84Area, int minZoom, int maxZoom)
+{
+    if (!init(wgs84Area, minZoom, maxZoom))
+        return false;
+
+    run();
+    return true;
+}
+
+bool TileSeeder::resume()
+{
+    QSettings* Sets = M_PREFS->getQSettings();
+    Sets->beginGroup(settingsGroup());
+    QPolygonF area = Sets->value("Area").value<QPolygonF>();
+    int minZoom = Sets->value("MinZoom").toInt();
+    int maxZoom = Sets->value("MaxZoom").toInt();
+    qint64 position = Sets->value("Position").toLongLong();
+    qint64 failed = Sets->value("Failed").toLongLong();
+    qint64 bytes = Sets->value("Bytes").toLongLong();
+    Sets->endGroup();
+
+    if (area.isEmpty()) {
+        theError = QApplication::translate("TileSeeder", "There is no seeding job to resume.");
+        return false;
+    }
+    if (!init(area, minZoom, maxZoom))
+        return false;
+
+    thePosition = qBound((qint64)0, position, theTotal);
+    qint64 index = thePosition;
+    while (curRange < theRanges.size() && index >= theRanges[curRange].count()) {
+        index -= theRanges[curRange].count();
+        ++curRange;
+    }
+    curIndex = index;
+    theFailed = failed;
+    theBytes = bytes;
+
+    run();
+    return true;
+}
+
+void TileSeeder::stop()
+{
+    theTimer.stop();
+    saveState();
+
+    // Whatever is still on the network completes into the cache; a resume looks at it again
+    theOutstanding.clear();
+    theReceived.clear();
+}
+
+void TileSeeder::saveState()
+{
+    // Resume from the oldest tile not known to be done
+    qint64 position = thePosition;
+    foreach (qint64 pos, theOutstanding)
+        position = qMin(position, pos);
+
+    QSettings* Sets = M_PREFS->getQSettings();
+    Sets->beginGroup(settingsGroup());
+    Sets->setValue("Area", QVariant::fromValue(theWgs84Area));
+    Sets->setValue("MinZoom", theMinZoom);
+    Sets->setValue("MaxZoom", theMaxZoom);
+    Sets->setValue("Position", position);
+    Sets->setValue("Failed", theFailed);
+    Sets->setValue("Bytes", theBytes);
+    Sets->endGroup();
+    theSavedPosition = thePosition;
+}
+
+void TileSeeder::clearState()
+{
+    M_PREFS->getQSettings()->remove(settingsGroup());
+}
+
+int TileSeeder::secondsRemaining() const
+{
+    qint64 processed = tilesDone() - theStartPosition;
+    if (processed <= 0 || !theClock.isValid())
+        return -1;
+    return int((theTotal - tilesDone()) * theClock.elapsed() / processed / 1000);
+}
+
+bool TileSeeder::requestNext()
+{
+    int scanned = 0;
+    while (curRange < theRanges.size() && scanned < SEED_SCAN_LIMIT) {
+        const ZoomRange& r = theRanges[curRange];
+        if (curIndex >= r.count()) {
+            ++curRange;
+            curIndex = 0;
+            continue;
+        }
+        int i = r.i0 + int(curIndex % r.cols);
+        int j = r.j0 + int(curIndex / r.cols);
+        ++curIndex;
+        ++thePosition;
+        ++scanned;
+
+        QRectF tile(r.box.left() + i*r.tileWidth, r.box.bottom() - (j+1)*r.tileHeight, r.tileWidth, r.tileHeight);
+        if (theArea.intersected(QPolygonF(tile)).isEmpty())
+            continue;
+        if (!theAdapter->isValid(i, j, r.zoom))
+            continue;
+
+        // Some adapters compute the query from their current zoom
+        if (theAdapter->getZoom() != r.zoom)
+            setAdapterZoom(r.zoom);
+        QString url = theAdapter->getQuery(i, j, r.zoom);
+
+        QString hash;
+        if (theManager->seedImage(theAdapter, url, hash)) {
+            theOutstanding.insert(hash, thePosition-1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TileSeeder::on_timeout()
+{
+    if (M_PREFS->getOfflineMode())
+        return;
+
+    QMutableHashIterator<QString, qint64> it(theOutstanding);
+    while (it.hasNext()) {
+        it.next();
+        if (theManager->isLoading(it.key()))
+            continue;
+        if (!theReceived.remove(it.key()))
+            ++theFailed;
+        it.remove();
+    }
+
+    if (theOutstanding.size() < SEED_MAX_OUTSTANDING)
+        requestNext();
+
+    if (curRange >= theRanges.size() && theOutstanding.isEmpty()) {
+        theTimer.stop();
+        clearState();
+        emit progress(tilesDone(), theTotal, theBytes, 0);
+        emit finished();
+        return;
+    }
+
+    if (thePosition - theSavedPosition >= SEED_SAVE_INTERVAL)
+        saveState();
+    emit progress(tilesDone(), theTotal, theBytes, secondsRemaining());
+}
+
+void TileSeeder::on_imageReceived(const QString& hash, int bytes)
+{
+    if (!theOutstanding.contains(hash))
+        return;
+    theBytes += bytes;
+    theReceived.insert(hash);
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef TILESEEDER_H
+#define TILESEEDER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QPolygonF>
+
+#include "Projection.h"
+
+class IMapAdapter;
+class ImageManager;
+
+//! Fills the disk cache with the tiles of an area, e.g. before going offline
+/*!
+ * Tiles are requested through the adapter's ImageManager at a low priority and at most
+ * TileSeedRate per second, so the view's own requests are served first.
+ * Tiles whose cached copy is still fresh are skipped.
+ * The position in the job is kept in the settings, so an interrupted job can be resumed.
+ * Nothing is requested while offline mode is on.
+ * The seeder owns its adapter and moves it between zoom levels, so it must not be the one the
+ * view draws with.
+ */
+class TileSeeder : public QObject
+{
+    Q_OBJECT
+    public:
+        TileSeeder(IMapAdapter* anAdapter, QObject* parent = 0);
+        ~TileSeeder();
+
+        //! starts seeding the given area (in WGS84) for the zoom levels minZoom to maxZoom
+        bool start(const QPolygonF& wgs84Area, int minZoom, int maxZoom);
+        //! resumes the interrupted job of this adapter, if any
+        bool resume();
+        //! stops seeding; the job can be resumed later
+        void stop();
+        bool isRunning() const;
+        //! true if an interrupted job of this adapter can be resumed
+        bool canResume() const;
+
+        QString errorString() const { return theError; }
+        qint64 tilesTotal() const { return theTotal; }
+        qint64 tilesDone() const { return thePosition - theOutstanding.size(); }
+        qint64 tilesFailed() const { return theFailed; }
+        qint64 bytesReceived() const { return theBytes; }
+        //! estimated seconds to completion, or -1 if not known yet
+        int secondsRemaining() const;
+
+    signals:
+        void progress(qint64 done, qint64 total, qint64 bytes, int eta);
+        void finished();
+
+    private slots:
+        void on_timeout();
+        void on_imageReceived(const QString& hash, int bytes);
+
+    private:
+        struct ZoomRange
+        {
+            int zoom;
+            QRectF box;         //!< the adapter's bounding box, in its projection
+            qreal tileWidth, tileHeight;
+            int i0, j0;
+            int cols, rows;
+            qint64 count() const { return (qint64)cols * rows; }
+        };
+
+        bool init(const QPolygonF& wgs84Area, int minZoom, int maxZoom);
+        void run();
+        bool setAdapterZoom(int z);
+        bool requestNext();
+        void saveState();
+        void clearState();
+        QString settingsGroup() const;
+
+        IMapAdapter* theAdapter;
+        ImageManager* theManager;
+        Projection theProjection;
+
+        QPolygonF theWgs84Area;
+        QPolygonF theArea;
+        int theMinZoom, theMaxZoom;
+        QList<ZoomRange> theRanges;
+
+        int curRange;
+        qint64 curIndex;
+        qint64 thePosition;
+        qint64 theTotal;
+        qint64 theFailed;
+        qint64 theBytes;
+
+        QHash<QString, qint64> theOutstanding; //!< tile hash -> position in the job
+        QSet<QString> theReceived;
+
+        QTimer theTimer;
+        QElapsedTimer theClock;
+        qint64 theStartPosition;
+        qint64 theSavedPosition;
+        QString theError;
+};
+
+#endif
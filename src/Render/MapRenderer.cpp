@@ -14,10 +14,20 @@
 #include "Document.h"
 #include "Features.h"
 #include "MapView.h"
-#include "MasPaintStyle.h"
 #include "ImageMapLayer.h"
 #include "LineF.h"
 
+#include <QtCore/qmath.h>
+
+/* Simplification tolerance of LOD level 1, in meters; each further level is 4 times coarser */
+#define LOD_BASE_TOLERANCE 2.0
+/* Maximum on-screen error allowed by a simplified path, in pixels */
+#define LOD_PIXEL_TOLERANCE 0.5
+/* Features smaller than this on screen are not drawn when zoomed out, in pixels */
+#define LOD_CULL_SIZE 1.0
+/* Cell size of the POI density raster, in pixels */
+#define LOD_DENSITY_CELL 4
+
 #define TEST_RFLAGS(x) theOptions.options.testFlag(x)
 #define TEST_RENDERER_RFLAGS(x) r->theOptions.options.testFlag(x)
 
@@ -32,21 +42,19 @@ void BackgroundStyleLayer::draw(Way* R)
         QPen thePen(QColor(0,0,0),1);
 
         r->thePainter->setBrush(Qt::NoBrush);
-        if (R->layer()->classType() == Layer::ImageLayerType && M_PREFS->getUseShapefileForBackground()) {
+        if (R->layer()->classType() == Layer::ImageLayerType && r->theSettings.UseShapefileForBackground) {
             thePen = QPen(QColor(0xc0,0xc0,0xc0),1);
-            if (M_PREFS->getBackgroundOverwriteStyle() || !M_STYLE->getGlobalPainter().getDrawBackground())
-                r->thePainter->setBrush(M_PREFS->getBgColor());
+            if (r->theSettings.BackgroundOverwriteStyle || !r->theGlobalPainter.getDrawBackground())
+                r->thePainter->setBrush(r->theSettings.BgColor);
             else
-                r->thePainter->setBrush(QBrush(M_STYLE->getGlobalPainter().getBackgroundColor()));
+                r->thePainter->setBrush(QBrush(r->theGlobalPainter.getBackgroundColor()));
         } else {
-            if (r->thePixelPerM < M_PREFS->getRegionalZoom())
+            if (r->thePixelPerM < r->theSettings.RegionalZoom)
                 thePen = QPen(QColor(0x77,0x77,0x77),1);
         }
 
         r->thePainter->setPen(thePen);
-        R->getLock();
-        r->thePainter->drawPath(r->theTransform.map(R->getPath()));
-        R->releaseLock();
+        r->thePainter->drawPath(r->theTransform.map(r->lodPath(R)));
     }
 }
 
@@ -60,7 +68,7 @@ void BackgroundStyleLayer::draw(Relation* R)
 
 void BackgroundStyleLayer::draw(Node* N)
 {
-    if ((N->isReadonly() || !N->isSelectable(r->thePixelPerM, r->theOptions)) && (!N->isPOI() && !N->isWaypoint()))
+    if ((N->isReadonly() || !N->isSelectable(r->thePixelPerM, r->theOptions, r->theSettings)) && (!N->isPOI() && !N->isWaypoint()))
         return;
 
     const FeaturePainter* paintsel = N->getPainter(r->thePixelPerM);
@@ -84,7 +92,7 @@ void ForegroundStyleLayer::draw(Relation* R)
 
 void ForegroundStyleLayer::draw(Node* N)
 {
-    if ((N->isReadonly() || !N->isSelectable(r->thePixelPerM, r->theOptions)) && (!N->isPOI() && !N->isWaypoint()))
+    if ((N->isReadonly() || !N->isSelectable(r->thePixelPerM, r->theOptions, r->theSettings)) && (!N->isPOI() && !N->isWaypoint()))
         return;
 
     const FeaturePainter* paintsel = N->getPainter(r->thePixelPerM);
@@ -160,7 +168,7 @@ void TouchupStyleLayer::draw(Node* Pt)
     if (paintsel)
         paintsel->drawTouchup(Pt,r->thePainter,r);
     else if (!TEST_RENDERER_RFLAGS(RendererOptions::UnstyledHidden)) {
-        if (! ((Pt->isReadonly() || !Pt->isSelectable(r->thePixelPerM, r->theOptions)) && (!Pt->isPOI() && !Pt->isWaypoint())))
+        if (! ((Pt->isReadonly() || !Pt->isSelectable(r->thePixelPerM, r->theOptions, r->theSettings)) && (!Pt->isPOI() && !Pt->isWaypoint())))
 //        if (!Pt->isReadonly() && Pt->isSelectable(r))
         {
             qreal WW = r->NodeWidth;
@@ -218,6 +226,92 @@ QPoint MapRenderer::toView(Node* aPt) const
     return theTransform.map(aPt->projected()).toPoint();
 }
 
+QPainterPath MapRenderer::lodPath(Way* R) const
+{
+    return R->getPath(theLod, theLodTolerance);
+}
+
+bool MapRenderer::isCulled(Feature* F) const
+{
+    if (!theLod)
+        return false;
+    if (!CHECK_WAY(F) && !CHECK_RELATION(F))
+        return false;
+
+    QRectF r = F->getPath().controlPointRect();
+    return (r.width()*fabs(theTransform.m11()) < LOD_CULL_SIZE
+            && r.height()*fabs(theTransform.m22()) < LOD_CULL_SIZE);
+}
+
+void MapRenderer::setupLod()
+{
+    theLod = 0;
+    theLodTolerance = 0.;
+    theLodAggregate = false;
+    if (!theSettings.UseLevelOfDetail || TEST_RFLAGS(RendererOptions::ForPrinting) || thePixelPerM <= 0.)
+        return;
+
+    qreal tol = LOD_BASE_TOLERANCE;
+    while (theLod+1 < LOD_LEVELS && tol*thePixelPerM <= LOD_PIXEL_TOLERANCE) {
+        ++theLod;
+        tol *= 4;
+    }
+    if (!theLod)
+        return;
+
+    /* Back to the tolerance of the selected level, converted from meters to projected units */
+    tol /= 4;
+    theLodTolerance = tol * thePixelPerM / fabs(theTransform.m11());
+    theLodAggregate = theSettings.LodPoiAggregation;
+}
+
+void MapRenderer::aggregatePois(const QMap<RenderPriority, QSet <Feature*> >& theFeatures)
+{
+    /* Tiles draw a surround around their own rect, so the screen does not start at (0,0) */
+    const QPoint origin = theScreen.topLeft();
+    int w = theScreen.width() / LOD_DENSITY_CELL + 1;
+    int h = theScreen.height() / LOD_DENSITY_CELL + 1;
+    QVector<int> density(w*h, 0);
+    int maxDensity = 0;
+
+    QMap<RenderPriority, QSet<Feature*> >::const_iterator itm;
+    QSet<Feature*>::const_iterator it;
+    for (itm = theFeatures.constBegin(); itm != theFeatures.constEnd(); ++itm) {
+        for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+            if (!CHECK_NODE(*it) || !STATIC_CAST_NODE(*it)->isPOI())
+                continue;
+            QPoint P = toView(STATIC_CAST_NODE(*it)) - origin;
+            int x = qFloor(qreal(P.x()) / LOD_DENSITY_CELL);
+            int y = qFloor(qreal(P.y()) / LOD_DENSITY_CELL);
+            if (x < 0 || x >= w || y < 0 || y >= h)
+                continue;
+            int d = ++density[y*w+x];
+            if (d > maxDensity)
+                maxDensity = d;
+        }
+    }
+    if (!maxDensity)
+        return;
+
+    QImage img(w, h, QImage::Format_ARGB32);
+    img.fill(Qt::transparent);
+    QColor theColor = theGlobalPainter.DrawNodes ? theGlobalPainter.NodesColor : QColor(0,0,0);
+    qreal logMax = log(1. + maxDensity);
+    for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x) {
+            int d = density[y*w+x];
+            if (!d)
+                continue;
+            int a = 64 + int(191 * log(1. + d) / logMax);
+            img.setPixel(x, y, qRgba(theColor.red(), theColor.green(), theColor.blue(), a));
+        }
+
+    thePainter->save();
+    thePainter->setRenderHint(QPainter::SmoothPixmapTransform, false);
+    thePainter->drawImage(QRectF(origin, QSizeF(w*LOD_DENSITY_CELL, h*LOD_DENSITY_CELL)), img);
+    thePainter->restore();
+}
+
 
 void MapRenderer::render(
         QPainter* P,
@@ -225,7 +319,8 @@ void MapRenderer::render(
         const QRectF& pViewport,
         const QRect& screen,
         const qreal pixelPerM,
-        const RendererOptions& options
+        const RendererOptions& options,
+        const RenderSettings& settings
 )
 {
     theViewport = pViewport;
@@ -251,14 +346,16 @@ void MapRenderer::render(
     theTransform.translate(-pViewport.topLeft().x(), -pViewport.topLeft().y());
 
     theOptions = options;
-    theGlobalPainter = M_STYLE->getGlobalPainter();
+    theSettings = settings;
+    theGlobalPainter = settings.theGlobalPainter;
     if (theGlobalPainter.DrawNodes) {
         NodeWidth = thePixelPerM*theGlobalPainter.NodesProportional+theGlobalPainter.NodesFixed;
     } else {
-        NodeWidth = thePixelPerM * M_PREFS->getNodeSize();
-        if (NodeWidth > M_PREFS->getNodeSize())
-            NodeWidth = M_PREFS->getNodeSize();
+        NodeWidth = thePixelPerM * theSettings.NodeSize;
+        if (NodeWidth > theSettings.NodeSize)
+            NodeWidth = theSettings.NodeSize;
     }
+    setupLod();
 
     bool bgLayerVisible = TEST_RFLAGS(RendererOptions::BackgroundVisible);
     bool fgLayerVisible = TEST_RFLAGS(RendererOptions::ForegroundVisible);
@@ -283,6 +380,8 @@ void MapRenderer::render(
             if (bgLayerVisible)
             {
                 for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                    if (isCulled(*it) || (theLodAggregate && CHECK_NODE(*it) && STATIC_CAST_NODE(*it)->isPOI()))
+                        continue;
                     qreal alpha = (*it)->getAlpha();
                     if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
                         alpha /= 2.0;
@@ -314,6 +413,8 @@ void MapRenderer::render(
             if (fgLayerVisible)
             {
                 for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                    if (isCulled(*it) || (theLodAggregate && CHECK_NODE(*it) && STATIC_CAST_NODE(*it)->isPOI()))
+                        continue;
                     qreal alpha = (*it)->getAlpha();
                     if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
                         alpha /= 2.0;
@@ -340,10 +441,15 @@ void MapRenderer::render(
             ++itm;
         }
     }
+    if (theLodAggregate)
+        aggregatePois(theFeatures);
+
     if (tchpLayerVisible)
     {
         for (itm = theFeatures.constBegin() ;itm != theFeatures.constEnd(); ++itm) {
             for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                if (isCulled(*it) || (theLodAggregate && CHECK_NODE(*it) && STATIC_CAST_NODE(*it)->isPOI()))
+                    continue;
                 qreal alpha = (*it)->getAlpha();
                 if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
                     alpha /= 2.0;
@@ -373,6 +479,8 @@ void MapRenderer::render(
     {
         for (itm = theFeatures.constBegin() ;itm != theFeatures.constEnd(); ++itm) {
             for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                if (isCulled(*it) || (theLodAggregate && CHECK_NODE(*it) && STATIC_CAST_NODE(*it)->isPOI()))
+                    continue;
                 P->save();
                 qreal alpha = (*it)->getAlpha();
                 if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
@@ -20,6 +20,7 @@
 
 #include "Feature.h"
 #include "IRenderer.h"
+#include "RenderSettings.h"
 
 class Document;
 class PaintStylePrivate;
@@ -93,7 +94,8 @@ public:
             const QRectF& pViewport,
             const QRect& screen,
             const qreal pixelPerM,
-            const RendererOptions& options
+            const RendererOptions& options,
+            const RenderSettings& settings
     );
 //    void print(
 //            QPainter* P,
@@ -110,11 +112,22 @@ public:
 
     QPainter* thePainter;
     RendererOptions theOptions;
+    RenderSettings theSettings;
     GlobalPainter theGlobalPainter;
 
+    /* Level of detail for the current frame; 0 draws full resolution paths */
+    int theLod;
+    qreal theLodTolerance;
+    bool theLodAggregate;
+
     QPoint toView(Node *aPt) const;
+    QPainterPath lodPath(Way* R) const;
+    bool isCulled(Feature* F) const;
 
 protected:
+    void setupLod();
+    void aggregatePois(const QMap<RenderPriority, QSet <Feature*> >& theFeatures);
+
     BackgroundStyleLayer bglayer;
     ForegroundStyleLayer fglayer;
     TouchupStyleLayer tchuplayer;
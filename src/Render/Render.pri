@@ -4,12 +4,14 @@ DEPENDPATH += $$MERKAARTOR_SRC_DIR/Render
 # Header files
 HEADERS += \
     FeaturePainter.h \
-    MapRenderer.h
+    MapRenderer.h \
+    RenderSettings.h
 
 # Source files
 SOURCES += \
     FeaturePainter.cpp \
-    MapRenderer.cpp
+    MapRenderer.cpp \
+    RenderSettings.cpp
 
 isEmpty(MOBILE) {
   QT += svg
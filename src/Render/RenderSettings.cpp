@@ -0,0 +1,36 @@
+#include "RenderSettings.h"
+
+#include "MerkaartorPreferences.h"
+#include "MasPaintStyle.h"
+
+RenderSettings::RenderSettings()
+    : TrackPointsVisible(true), VirtualNodesVisible(true), UseAntiAlias(true)
+    , SimpleGpxTrack(false), GpxTrackWidth(3), GpxTrackColor(50, 220, 220)
+    , NodeSize(8), AreaOpacity(100), RegionalZoom(0.01), UseLevelOfDetail(true), LodPoiAggregation(false)
+    , UseShapefileForBackground(false), BackgroundOverwriteStyle(false), BgColor(Qt::white)
+{
+}
+
+RenderSettings RenderSettings::current()
+{
+    RenderSettings S;
+    S.TrackPointsVisible = M_PREFS->getTrackPointsVisible();
+    S.VirtualNodesVisible = M_PREFS->getVirtualNodesVisible();
+    S.UseAntiAlias = M_PREFS->getUseAntiAlias();
+
+    S.SimpleGpxTrack = M_PREFS->getSimpleGpxTrack();
+    S.GpxTrackWidth = M_PREFS->getGpxTrackWidth();
+    S.GpxTrackColor = M_PREFS->getGpxTrackColor();
+
+    S.NodeSize = M_PREFS->getNodeSize();
+    S.AreaOpacity = M_PREFS->getAreaOpacity();
+    S.RegionalZoom = M_PREFS->getRegionalZoom();
+    S.UseLevelOfDetail = M_PREFS->getUseLevelOfDetail();
+    S.LodPoiAggregation = M_PREFS->getLodPoiAggregation();
+
+    S.UseShapefileForBackground = M_PREFS->getUseShapefileForBackground();
+    S.BackgroundOverwriteStyle = M_PREFS->getBackgroundOverwriteStyle();
+    S.BgColor = M_PREFS->getBgColor();
+    S.theGlobalPainter = M_STYLE->getGlobalPainter();
+    return S;
+}
@@ -0,0 +1,39 @@
+#ifndef RENDERSETTINGS_H
+#define RENDERSETTINGS_H
+
+#include "Painter.h"
+
+#include <QColor>
+
+/* The preferences the renderers and the spatial index read for each feature, taken together once
+   per frame. The preferences are read lazily from QSettings and may only be read on the GUI thread;
+   a snapshot is not changed once taken, so the tile threads can share it. */
+class RenderSettings
+{
+public:
+    RenderSettings();
+
+    /* The current preferences; on the GUI thread only */
+    static RenderSettings current();
+
+    bool TrackPointsVisible;
+    bool VirtualNodesVisible;
+    bool UseAntiAlias;
+
+    bool SimpleGpxTrack;
+    int GpxTrackWidth;
+    QColor GpxTrackColor;
+
+    int NodeSize;
+    int AreaOpacity;
+    qreal RegionalZoom;
+    bool UseLevelOfDetail;
+    bool LodPoiAggregation;
+
+    bool UseShapefileForBackground;
+    bool BackgroundOverwriteStyle;
+    QColor BgColor;
+    GlobalPainter theGlobalPainter;
+};
+
+#endif // RENDERSETTINGS_H
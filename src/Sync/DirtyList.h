@@ -19,6 +19,8 @@ class QWidget;
 
 #include <utility>
 #include <QList>
+#include <QHash>
+#include <QSet>
 
 class DirtyList
 {
@@ -50,9 +52,9 @@ class DirtyListBuild : public DirtyList
         virtual void resetUpdates();
 
     protected:
-        QList<Feature*> Added, Deleted;
-        QList<Feature*> Updated;
-        mutable QList<QPair<int, int> > UpdateCounter;
+        QSet<Feature*> Added, Deleted;
+        /* per feature: (number of updates in history, number visited so far) */
+        mutable QHash<Feature*, QPair<int, int> > UpdateCounter;
 };
 
 class DirtyListVisit : public DirtyList
@@ -84,8 +86,8 @@ class DirtyListVisit : public DirtyList
         const DirtyListBuild& Future;
         bool EraseFromHistory;
         QList<Feature*> Updated;
-        QList<Feature*> AlreadyAdded;
-        QList<bool> EraseResponse;
+        /* features already visited by add(), with the response given */
+        QHash<Feature*, bool> AlreadyAdded;
         bool DeletePass;
         QMap<Node*, bool> TrackPointsToDelete;
         QMap<Way*, bool> RoadsToDelete;
@@ -28,15 +28,31 @@
 extern int glbAdded, glbUpdated, glbDeleted;
 extern QString glbChangeSetComment;
 
+/* Reports the commands whose features all went up with the chunks sent as done */
+class DirtyListUploaded : public DirtyList
+{
+public:
+    DirtyListUploaded(const QSet<Feature*>& someFeatures) : theFeatures(someFeatures) {}
+
+    virtual bool add(Feature* F) { return theFeatures.contains(F); }
+    virtual bool update(Feature* F) { return theFeatures.contains(F); }
+    virtual bool erase(Feature* F) { return theFeatures.contains(F); }
+    virtual bool noop(Feature* F) { return theFeatures.contains(F); }
+
+private:
+    QSet<Feature*> theFeatures;
+};
+
 DirtyListExecutorOSC::DirtyListExecutorOSC(Document* aDoc, const DirtyListBuild& aFuture)
     : DirtyListVisit(aDoc, aFuture, false)
+    , Uploaded(0)
     , Done(0)
     , theDownloader(0)
 {
 }
 
 DirtyListExecutorOSC::DirtyListExecutorOSC(Document* aDoc, const DirtyListBuild& aFuture, const QString& aWeb, const QString& aUser, const QString& aPwd, int aTasks)
-: DirtyListVisit(aDoc, aFuture, false), Tasks(aTasks), Done(0), Web(aWeb), User(aUser), Pwd(aPwd), theDownloader(0)
+: DirtyListVisit(aDoc, aFuture, false), Uploaded(0), Tasks(aTasks), Done(0), Web(aWeb), User(aUser), Pwd(aPwd), theDownloader(0)
 {
     theDownloader = new Downloader(User, Pwd);
 }
@@ -96,6 +112,14 @@ int DirtyListExecutorOSC::sendRequest(const QString& Method, const QString& URL,
     return rCode;
 }
 
+void DirtyListExecutorOSC::writeChanges(QIODevice* aDevice, int from, int to)
+{
+    OsmWriter writer(aDevice);
+    writer.setStrict(true);
+    writer.setChangesetId(ChangeSetId);
+    writer.writeOsmChange(Changes, from, to);
+}
+
 QByteArray DirtyListExecutorOSC::getChanges()
 {
     Progress = new QProgressDialog(0);
@@ -107,21 +131,14 @@ QByteArray DirtyListExecutorOSC::getChanges()
     Progress->setMaximum(Tasks+2);
     Progress->show();
 
-    OscBuffer.buffer().clear();
-    OscBuffer.open(QIODevice::WriteOnly);
-
-    OscStream.setDevice(&OscBuffer);
-    OscStream.writeStartDocument();
-
-    OscStream.writeStartElement("osmChange ");
-    OscStream.writeAttribute("version", "0.3");
-    OscStream.writeAttribute("generator", QString("Merkaartor %1").arg(STRINGIFY(VERSION)));
-
+    Changes.clear();
     runVisit();
 
     SAFE_DELETE(Progress)
 
-    OscStream.writeEndDocument();
+    OscBuffer.buffer().clear();
+    OscBuffer.open(QIODevice::WriteOnly);
+    writeChanges(&OscBuffer, 0, Changes.size());
     OscBuffer.close();
 
     return OscBuffer.buffer();
@@ -154,18 +171,11 @@ bool DirtyListExecutorOSC::executeChanges(QWidget* aParent)
 
     if ((ok = start()))
     {
-        OscBuffer.buffer().clear();
-        OscBuffer.open(QIODevice::WriteOnly);
-        OscStream.setDevice(&OscBuffer);
-        OscStream.writeStartDocument();
-
-        OscStream.writeStartElement("osmChange ");
-        OscStream.writeAttribute("version", "0.3");
-        OscStream.writeAttribute("generator", QString("Merkaartor %1").arg(STRINGIFY(VERSION)));
+        Changes.clear();
+        Uploaded = 0;
 
         Lbl->setText(QApplication::translate("Downloader","Preparing changes"));
         if ((ok = runVisit())) {
-            Lbl->setText(QApplication::translate("Downloader","Waiting for server response"));
             ok = stop();
         }
     }
@@ -204,150 +214,145 @@ bool DirtyListExecutorOSC::start()
 
 bool DirtyListExecutorOSC::stop()
 {
-    QString DataIn, DataOut;
-    QString errFeat;
+    bool ok = uploadChanges();
+
+    if (ok)
+        theDocument->history().cleanup();
+    else if (Uploaded) {
+        // Only the commands behind what was sent go; the rest is uploaded next time
+        QSet<Feature*> Sent;
+        for (int i=0; i<Uploaded; ++i)
+            Sent.insert(Changes.at(i).second);
+        DirtyListUploaded theUploaded(Sent);
+        theDocument->history().cleanupUploaded(theUploaded);
+    }
+    closeChangeSet();
 
-    OscStream.writeEndDocument();
-    OscBuffer.close();
-    qDebug() << OscBuffer.buffer();
-    QString URL = theDownloader->getURLToUploadDiff(ChangeSetId);
-    switch (sendRequest("POST", URL, QString::fromUtf8(OscBuffer.buffer().data()), DataOut)) {
-    case 200: {
-        QDomDocument resDoc;
-        if (resDoc.setContent(DataOut)) {
-
-            QDomNodeList nl = resDoc.elementsByTagName("diffResult");
-            if (nl.size()) {
-                QDomElement resRoot = nl.at(0).toElement();
-                QDomElement c = resRoot.firstChildElement();
-                while (!c.isNull()) {
-                    IFeature::FeatureType aType = IFeature::FeatureType::Uninitialized;
-                    if (c.tagName() == "node")
-                        aType = IFeature::Point;
-                    else if (c.tagName() == "way")
-                        aType = IFeature::LineString;
-                    else if (c.tagName() == "relation")
-                        aType = IFeature::OsmRelation;
-                    else {
-                        qDebug() << "Unknown element found in response.";
-                    }
+    if (!ok && Uploaded) {
+        QMessageBox::warning(Progress, tr("Upload incomplete"),
+                             tr("%1 of %2 changes have been uploaded.\n"
+                                "The remaining changes are still in your document; upload again to resume.")
+                             .arg(Uploaded).arg(Changes.size()));
+    }
 
-                    Feature* F = theDocument->getFeature(IFeature::FId(aType, c.attribute("old_id").toLongLong()));
-                    if (F) {
-                        F->setId(IFeature::FId(aType, c.attribute("new_id").toLongLong()));
-                        F->setVersionNumber(c.attribute("new_version").toInt());
-                        F->setLastUpdated(Feature::OSMServer);
-                        F->setUser("me");
-                        F->setTime(QDateTime::currentDateTime());
-
-                        if (!g_Merk_Frisius) {
-                            F->layer()->remove(F);
-                            document()->getUploadedLayer()->add(F);
-                        }
-                        F->setUploaded(true);
-                        F->setDirtyLevel(0);
-
-                    } else
-                        qDebug() << "Feature not found in diff upload result: " << c.attribute("old_id");
-
-                    c = c.nextSiblingElement();
-                }
-                theDocument->history().cleanup();
-            }
-        }
-        break;
+    // The document has changed as soon as one chunk went through
+    return ok || Uploaded > 0;
+}
+
+bool DirtyListExecutorOSC::uploadChanges()
+{
+    int ChangeSetSize = 0;
+    if (Progress) {
+        Progress->setMaximum(Changes.size());
+        Progress->setValue(0);
     }
 
-    case 409: {    // Confilct
-//            QRegExp rx(".*node.*(\\d+)", Qt::CaseInsensitive);
-//            if (rx.indexIn(DataOut) > -1) {
-//                errFeat = "node_" + rx.cap(1);
-//            } else {
-//                QRegExp rx(".*way.*(\\d+)", Qt::CaseInsensitive);
-//                if (rx.indexIn(DataOut) > -1) {
-//                    errFeat = "way_" + rx.cap(1);
-//                } else {
-//                    QRegExp rx(".*relation.*(\\d+)", Qt::CaseInsensitive);
-//                    if (rx.indexIn(DataOut) > -1) {
-//                        errFeat = "rel_" + rx.cap(1);
-//                    }
-//                }
-//            }
-//            qDebug() << errFeat;
-            break;
-        }
-    case 410: {    // Gone
-//            QRegExp rx(".*node.*(\\d+)", Qt::CaseInsensitive);
-//            if (rx.indexIn(DataOut) > -1) {
-//                errFeat = "node_" + rx.cap(1);
-//            } else {
-//                QRegExp rx(".*way.*(\\d+)", Qt::CaseInsensitive);
-//                if (rx.indexIn(DataOut) > -1) {
-//                    errFeat = "way_" + rx.cap(1);
-//                } else {
-//                    QRegExp rx(".*relation.*(\\d+)", Qt::CaseInsensitive);
-//                    if (rx.indexIn(DataOut) > -1) {
-//                        errFeat = "rel_" + rx.cap(1);
-//                    }
-//                }
-//            }
-//            qDebug() << errFeat;
-            break;
+    while (Uploaded < Changes.size()) {
+        int to = qMin(Uploaded + OSC_CHUNK_SIZE, Changes.size());
+
+        if (ChangeSetSize && ChangeSetSize + (to - Uploaded) > MAX_CHANGESET_ELEMENTS) {
+            closeChangeSet();
+            if (!start())
+                return false;
+            ChangeSetSize = 0;
         }
 
-    default:
-        break;
+        qDebug() << QString("UPLOAD changes %1-%2 of %3").arg(Uploaded+1).arg(to).arg(Changes.size());
+        Progress->setLabelText(tr("Uploading changes %1-%2 of %3").arg(Uploaded+1).arg(to).arg(Changes.size()));
+        QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
+
+        QBuffer ChunkBuffer;
+        ChunkBuffer.open(QIODevice::WriteOnly);
+        writeChanges(&ChunkBuffer, Uploaded, to);
+        ChunkBuffer.close();
+
+        QString DataOut;
+        QString URL = theDownloader->getURLToUploadDiff(ChangeSetId);
+        if (sendRequest("POST", URL, QString::fromUtf8(ChunkBuffer.buffer().data()), DataOut) != 200)
+            return false;
+
+        processDiffResult(DataOut);
+        ChangeSetSize += to - Uploaded;
+        Uploaded = to;
+        Progress->setValue(Uploaded);
+    }
+    return true;
+}
+
+void DirtyListExecutorOSC::processDiffResult(const QString& DataOut)
+{
+    QDomDocument resDoc;
+    if (resDoc.setContent(DataOut)) {
+
+        QDomNodeList nl = resDoc.elementsByTagName("diffResult");
+        if (nl.size()) {
+            QDomElement resRoot = nl.at(0).toElement();
+            QDomElement c = resRoot.firstChildElement();
+            while (!c.isNull()) {
+                IFeature::FeatureType aType = IFeature::FeatureType::Uninitialized;
+                if (c.tagName() == "node")
+                    aType = IFeature::Point;
+                else if (c.tagName() == "way")
+                    aType = IFeature::LineString;
+                else if (c.tagName() == "relation")
+                    aType = IFeature::OsmRelation;
+                else {
+                    qDebug() << "Unknown element found in response.";
+                }
+
+                Feature* F = theDocument->getFeature(IFeature::FId(aType, c.attribute("old_id").toLongLong()));
+                if (F) {
+                    F->setId(IFeature::FId(aType, c.attribute("new_id").toLongLong()));
+                    F->setVersionNumber(c.attribute("new_version").toInt());
+                    F->setLastUpdated(Feature::OSMServer);
+                    F->setUser("me");
+                    F->setTime(QDateTime::currentDateTime());
+
+                    if (!g_Merk_Frisius) {
+                        F->layer()->remove(F);
+                        document()->getUploadedLayer()->add(F);
+                    }
+                    F->setUploaded(true);
+                    F->setDirtyLevel(0);
+
+                } else
+                    qDebug() << "Feature not found in diff upload result: " << c.attribute("old_id");
+
+                c = c.nextSiblingElement();
+            }
+        }
     }
+}
+
+void DirtyListExecutorOSC::closeChangeSet()
+{
+    QString DataIn;
 
     qDebug() << QString("CLOSE changeset");
 
     Progress->setLabelText(tr("CLOSE changeset"));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    URL = theDownloader->getURLToCloseChangeSet(ChangeSetId);
+    QString URL = theDownloader->getURLToCloseChangeSet(ChangeSetId);
     QUrl theUrl(Web+URL);
-    theDownloader->setAnimator(NULL, NULL, NULL, false);
     if (!theDownloader->request("PUT",theUrl,DataIn)) {
         QMessageBox::warning(NULL, tr("Changeset could not be closed."), tr("An unknown error has occurred. It might already be closed, or will be closed automatically. If you want to be sure, please, check manually on the osm.org website."));
     }
-
-    return true;
 }
 
 void DirtyListExecutorOSC::OscCreate(Feature* F)
 {
-    if (LastAction != "create") {
-        if (!LastAction.isEmpty())
-            OscStream.writeEndElement();
-        OscStream.writeStartElement("create");
-        LastAction = "create";
-    }
-
-    F->toXML(OscStream, Progress, true, ChangeSetId);
+    Changes << qMakePair(OsmWriter::CreateAction, F);
 }
 
 void DirtyListExecutorOSC::OscModify(Feature* F)
 {
-    if (LastAction != "modify") {
-        if (!LastAction.isEmpty())
-            OscStream.writeEndElement();
-        OscStream.writeStartElement("modify");
-        LastAction = "modify";
-    }
-
-    F->toXML(OscStream, Progress, true, ChangeSetId);
+    Changes << qMakePair(OsmWriter::ModifyAction, F);
 }
 
 void DirtyListExecutorOSC::OscDelete(Feature* F)
 {
-    if (LastAction != "delete") {
-        if (!LastAction.isEmpty())
-            OscStream.writeEndElement();
-        OscStream.writeStartElement("delete");
-        LastAction = "modify";
-    }
-
-    F->toXML(OscStream, Progress, true, ChangeSetId);
+    Changes << qMakePair(OsmWriter::DeleteAction, F);
 }
 
 
@@ -14,12 +14,16 @@
 #define DirtyListExecutorOSC_H
 
 #include "DirtyList.h"
+#include "OsmWriter.h"
 
 #include <QXmlStreamWriter>
 #include <QBuffer>
 
 class Downloader;
 
+#define OSC_CHUNK_SIZE 1000 /* elements per diff upload */
+#define MAX_CHANGESET_ELEMENTS 10000 /* API limit on the number of elements in a changeset */
+
 class DirtyListExecutorOSC : public QObject, public DirtyListVisit
 {
     Q_OBJECT
@@ -50,8 +54,15 @@ public:
 
 private:
     int sendRequest(const QString& Method, const QString& URL, const QString& Out, QString& Rcv);
+    void writeChanges(QIODevice* aDevice, int from, int to);
+    bool uploadChanges();
+    void processDiffResult(const QString& DataOut);
+    void closeChangeSet();
 
-    QXmlStreamWriter OscStream;
+    /* The visit only records the actions; they are serialized a chunk at a time, once the
+       ids created by the previous chunk are known */
+    QList<QPair<OsmWriter::ChangeAction, Feature*> > Changes;
+    int Uploaded;
     QBuffer OscBuffer;
 
     Ui::SyncListDialog Ui;
@@ -60,7 +71,6 @@ private:
     QString Web,User,Pwd;
     Downloader* theDownloader;
     QString ChangeSetId;
-    QString LastAction;
 };
 
 
@@ -27,6 +27,10 @@
 #include <QProgressDialog>
 #include <QStatusBar>
 #include <QInputDialog>
+#include <QNetworkReply>
+
+#define MAX_PARALLEL_DOWNLOADS 4 /* concurrent tile requests for one download */
+#define DOWNLOAD_TILE_SIZE 0.5 /* degrees; keeps each tile within the API's 0.25 square degree limit */
 
 /* DOWNLOADER */
 
@@ -192,6 +196,16 @@ const QString &Downloader::locationText()
     return LocationText;
 }
 
+const QString &Downloader::user() const
+{
+    return User;
+}
+
+const QString &Downloader::password() const
+{
+    return Password;
+}
+
 QString Downloader::getURLToOpenChangeSet()
 {
     return QString("/changeset/create");
@@ -272,73 +286,352 @@ QString Downloader::getURLToTrackPoints()
     return URL;
 }
 
-bool downloadOSM(QWidget* aParent, const QUrl& theUrl, const QString& aUser, const QString& aPassword, Document* theDocument, Layer* theLayer)
+/* STREAMINGDOWNLOADER */
+
+StreamingDownloader::StreamingDownloader(const QString& aUser, const QString& aPwd, Document* aDoc, Layer* aLayer, Layer* aConflictLayer)
+: User(aUser), Password(aPwd), theDocument(aDoc), theLayer(aLayer), conflictLayer(aConflictLayer),
+  Requests(0), Finished(0), FinishedFeatures(0), FinishedBytes(0), Result(0),
+  Error(false), Canceled(false), AnimatorLabel(0), AnimatorBar(0)
 {
-    Downloader Rcv(aUser, aPassword);
+    connect(&netManager,SIGNAL(finished(QNetworkReply*)),this,SLOT(on_requestFinished(QNetworkReply*)));
+    connect(&netManager,SIGNAL(authenticationRequired(QNetworkReply*,QAuthenticator*)), this,SLOT(on_authenticationRequired(QNetworkReply*,QAuthenticator*)));
+}
+
+StreamingDownloader::~StreamingDownloader()
+{
+    abortAll();
+}
+
+void StreamingDownloader::setAnimator(QProgressDialog *anAnimator, QLabel* anAnimatorLabel, QProgressBar* anAnimatorBar)
+{
+    AnimatorLabel = anAnimatorLabel;
+    AnimatorBar = anAnimatorBar;
+    if (anAnimator)
+        connect(anAnimator,SIGNAL(canceled()),this,SLOT(on_Cancel_clicked()));
+}
+
+bool StreamingDownloader::go(const QList<QUrl>& urls)
+{
+    if (Error || urls.isEmpty())
+        return false;
+
+    Queued = urls;
+    Requests = urls.size();
+    while (!Queued.isEmpty() && Pending.size() < MAX_PARALLEL_DOWNLOADS)
+        start(Queued.takeFirst());
+    updateProgress();
+
+    if (Loop.exec() == QDialog::Rejected)
+        return false;
+    return !Error;
+}
+
+void StreamingDownloader::start(const QUrl& url)
+{
+    qDebug() << "StreamingDownloader::start: " << url;
+
+    netManager.setProxy(M_PREFS->getProxy(url));
+    QNetworkRequest req(url);
+    /* Accept-Encoding is deliberately left unset: Qt then requests gzip itself
+     * and inflates the body before it reaches readyRead(). */
+    req.setRawHeader(QByteArray("User-Agent"), USER_AGENT.toLatin1());
+
+    QNetworkReply* reply = netManager.get(req);
+    Pending[reply] = new OSMStreamParser(theDocument, theLayer, conflictLayer);
+    Progress[reply] = qMakePair(qint64(0), qint64(0));
+    connect(reply,SIGNAL(readyRead()),this,SLOT(on_readyRead()));
+    connect(reply,SIGNAL(downloadProgress(qint64, qint64)), this,SLOT(on_downloadProgress(qint64, qint64)));
+}
+
+void StreamingDownloader::abortAll()
+{
+    QList<QNetworkReply*> replies = Pending.keys();
+    foreach (QNetworkReply* reply, replies) {
+        discard(Pending.take(reply));
+        Progress.remove(reply);
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+    Queued.clear();
+}
+
+/* Whatever a parser already read is in the layer: keep track of it so that the import can be finished */
+void StreamingDownloader::discard(OSMStreamParser* theParser)
+{
+    theParser->abort();
+    TouchedWays.unite(theParser->handler().touchedWays);
+    TouchedRelations.unite(theParser->handler().touchedRelations);
+    FinishedFeatures += theParser->featureCount();
+    delete theParser;
+}
+
+void StreamingDownloader::fail(OSMStreamParser* theParser)
+{
+    discard(theParser);
+    Error = true;
+    abortAll();
+    if (Loop.isRunning())
+        Loop.exit(QDialog::Accepted);
+}
+
+void StreamingDownloader::on_readyRead()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !Pending.contains(reply))
+        return;
+
+    /* Redirections and errors are handled once the reply is finished */
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200)
+        return;
+
+    if (!Pending[reply]->feed(reply->readAll())) {
+        OSMStreamParser* theParser = Pending.take(reply);
+        Result = 200;
+        ResultText = tr("The server sent invalid XML");
+        FinishedBytes += Progress.take(reply).first;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+        fail(theParser);
+        return;
+    }
+    updateProgress();
+}
+
+void StreamingDownloader::on_downloadProgress(qint64 done, qint64 total)
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !Progress.contains(reply))
+        return;
+
+    Progress[reply] = qMakePair(done, total);
+    updateProgress();
+}
+
+void StreamingDownloader::on_requestFinished(QNetworkReply *reply)
+{
+    if (!Pending.contains(reply))
+        return;
+
+    OSMStreamParser* theParser = Pending.take(reply);
+    FinishedBytes += Progress.take(reply).first;
+    reply->deleteLater();
+
+    int x = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    /* Test for redirections */
+    QVariant redir = reply->attribute(QNetworkRequest::RedirectionTargetAttribute);
+    if (redir.isValid() && !redir.toUrl().isEmpty()) {
+        delete theParser;
+        start(reply->url().resolved(redir.toUrl()));
+        return;
+    }
+
+    if (reply->error() || x != 200) {
+        Result = x;
+        ResultText = reply->errorString();
+        ErrorText = reply->rawHeader("Error");
+        fail(theParser);
+        return;
+    }
+
+    if (!theParser->feed(reply->readAll())) {
+        Result = x;
+        ResultText = tr("The server sent invalid XML");
+        fail(theParser);
+        return;
+    }
+    TouchedWays.unite(theParser->handler().touchedWays);
+    TouchedRelations.unite(theParser->handler().touchedRelations);
+    FinishedFeatures += theParser->featureCount();
+    delete theParser;
+
+    Result = x;
+    ++Finished;
+    if (!Queued.isEmpty())
+        start(Queued.takeFirst());
+    updateProgress();
+
+    if (Pending.isEmpty() && Loop.isRunning())
+        Loop.exit(QDialog::Accepted);
+}
+
+void StreamingDownloader::on_authenticationRequired( QNetworkReply *reply, QAuthenticator *auth)
+{
+    static QNetworkReply *lastReply = NULL;
 
+    /* Only provide authentication the first time we see this reply, to avoid
+     * infinite loop providing the same credentials. */
+    if (lastReply != reply) {
+        lastReply = reply;
+        auth->setUser(User);
+        auth->setPassword(Password);
+    }
+}
+
+void StreamingDownloader::on_Cancel_clicked()
+{
+    Canceled = true;
+    Error = true;
+    abortAll();
+    if (Loop.isRunning())
+        Loop.exit(QDialog::Rejected);
+}
+
+void StreamingDownloader::updateProgress()
+{
+    if (!AnimatorLabel || !AnimatorBar)
+        return;
+
+    qint64 done = bytesReceived();
+    if (done < 10240)
+        AnimatorLabel->setText(tr("Downloading from OSM (%n bytes, %1 features)", "", done).arg(featureCount()));
+    else
+        AnimatorLabel->setText(tr("Downloading from OSM (%n kBytes, %1 features)", "", (done/1024)).arg(featureCount()));
+
+    if (Requests > 1) {
+        AnimatorBar->setMaximum(Requests);
+        AnimatorBar->setValue(Finished);
+    } else if (Progress.size() == 1 && Progress.begin().value().second > 0) {
+        AnimatorBar->setMaximum(Progress.begin().value().second);
+        AnimatorBar->setValue(Progress.begin().value().first);
+    } else {
+        /* Unknown size: busy indicator */
+        AnimatorBar->setMaximum(0);
+    }
+}
+
+bool StreamingDownloader::wasCanceled() const
+{
+    return Canceled;
+}
+
+int StreamingDownloader::resultCode()
+{
+    return Result;
+}
+
+const QString &StreamingDownloader::resultText()
+{
+    return ResultText;
+}
+
+const QString &StreamingDownloader::errorText()
+{
+    return ErrorText;
+}
+
+const QSet<Way*>& StreamingDownloader::touchedWays() const
+{
+    return TouchedWays;
+}
+
+const QSet<Relation*>& StreamingDownloader::touchedRelations() const
+{
+    return TouchedRelations;
+}
+
+int StreamingDownloader::featureCount() const
+{
+    int count = FinishedFeatures;
+    foreach (OSMStreamParser* theParser, Pending)
+        count += theParser->featureCount();
+    return count;
+}
+
+qint64 StreamingDownloader::bytesReceived() const
+{
+    qint64 bytes = FinishedBytes;
+    QHashIterator<QNetworkReply*, QPair<qint64, qint64> > it(Progress);
+    while (it.hasNext()) {
+        it.next();
+        bytes += it.value().first;
+    }
+    return bytes;
+}
+
+/* Split a download area into tiles the API will accept, so that they can be fetched in parallel */
+static QList<CoordBox> splitDownloadBox(const CoordBox& aBox)
+{
+    QList<CoordBox> theTiles;
+    int nx = qMax(1, int(ceil(aBox.lonDiff() / DOWNLOAD_TILE_SIZE)));
+    int ny = qMax(1, int(ceil(aBox.latDiff() / DOWNLOAD_TILE_SIZE)));
+    qreal dx = aBox.lonDiff() / nx;
+    qreal dy = aBox.latDiff() / ny;
+    for (int j=0; j<ny; ++j) {
+        for (int i=0; i<nx; ++i) {
+            Coord bl(aBox.bottomLeft().x() + i*dx, aBox.bottomLeft().y() + j*dy);
+            Coord tr((i == nx-1) ? aBox.topRight().x() : bl.x() + dx, (j == ny-1) ? aBox.topRight().y() : bl.y() + dy);
+            theTiles << CoordBox(bl, tr);
+        }
+    }
+    return theTiles;
+}
+
+static bool downloadOSM(QWidget* aParent, const QList<QUrl>& theUrls, const QString& aUser, const QString& aPassword, Document* theDocument, Layer* theLayer)
+{
+    QProgressDialog* dlg = NULL;
+    QProgressBar* Bar = NULL;
+    QLabel* Lbl = NULL;
     IProgressWindow* aProgressWindow = dynamic_cast<IProgressWindow*>(aParent);
     if (aProgressWindow) {
 
-        QProgressDialog* dlg = aProgressWindow->getProgressDialog();
+        dlg = aProgressWindow->getProgressDialog();
         if (dlg) {
             dlg->setWindowTitle(QApplication::translate("Downloader","Downloading..."));
             dlg->setWindowFlags(dlg->windowFlags() & ~Qt::WindowContextHelpButtonHint);
             dlg->setWindowFlags(dlg->windowFlags() | Qt::MSWindowsFixedSizeDialogHint);
         }
 
-        QProgressBar* Bar = aProgressWindow->getProgressBar();
+        Bar = aProgressWindow->getProgressBar();
         Bar->setTextVisible(false);
-        Bar->setMaximum(11);
+        Bar->setMaximum(0);
 
-        QLabel* Lbl = aProgressWindow->getProgressLabel();
+        Lbl = aProgressWindow->getProgressLabel();
         Lbl->setText(QApplication::translate("Downloader","Downloading from OSM (connecting)"));
 
         if (dlg)
             dlg->show();
-
-        Rcv.setAnimator(dlg, Lbl, Bar, true);
     }
-    if (!Rcv.go(theUrl))
+
+    Layer* conflictLayer = new DrawingLayer(QApplication::translate("Downloader","Conflicts from %1").arg(theLayer->name()));
+    theDocument->add(conflictLayer);
+
+    StreamingDownloader Rcv(aUser, aPassword, theDocument, theLayer, conflictLayer);
+    Rcv.setAnimator(dlg, Lbl, Bar);
+    Downloader Down(aUser, aPassword);
+    Down.setAnimator(dlg, Lbl, Bar, false);
+    if (!Rcv.go(theUrls))
     {
+        /* Features streamed in before the failure are already in the layer; finish the
+         * import as a cancelled one, which keeps any conflicts they raised */
+        finishImportOSM(aParent, theDocument, theLayer, conflictLayer, Rcv.touchedWays(), Rcv.touchedRelations(), &Down, true);
 #ifndef _MOBILE
         aParent->setCursor(QCursor(Qt::ArrowCursor));
 #endif
-        return false;
-    }
-    int x = Rcv.resultCode();
-    switch (x)
-    {
-    case 200:
-        break;
-    case 301:
-    case 302:
-    case 307: {
-        QString aWeb = Rcv.locationText();
-        if (!aWeb.isEmpty()) {
-            QUrl aURL(aWeb);
-            return downloadOSM(aParent, aURL, aUser, aPassword, theDocument, theLayer);
+        if (Rcv.wasCanceled())
+            return false;
+
+        int x = Rcv.resultCode();
+        if (x == 401) {
+            QMessageBox::warning(aParent,QApplication::translate("Downloader","Download failed"),QApplication::translate("Downloader","Username/password invalid"));
+        } else if (x == 200) {
+            QMessageBox::warning(aParent,QApplication::translate("Downloader","Download failed"), Rcv.resultText());
         } else {
             QString msg = QApplication::translate("Downloader","Unexpected http status code (%1)\nServer message is '%2'").arg(x).arg(Rcv.resultText());
             if (!Rcv.errorText().isEmpty())
                 msg += QApplication::translate("Downloader", "\nAPI message is '%1'").arg(Rcv.errorText());
             QMessageBox::warning(aParent,QApplication::translate("Downloader","Download failed"), msg);
-            return false;
         }
-        break;
-    }
-    case 401:
-        QMessageBox::warning(aParent,QApplication::translate("Downloader","Download failed"),QApplication::translate("Downloader","Username/password invalid"));
-        return false;
-    default:
-        QString msg = QApplication::translate("Downloader","Unexpected http status code (%1)\nServer message is '%2'").arg(x).arg(Rcv.resultText());
-        if (!Rcv.errorText().isEmpty())
-            msg += QApplication::translate("Downloader", "\nAPI message is '%1'").arg(Rcv.errorText());
-        QMessageBox::warning(aParent,QApplication::translate("Downloader","Download failed"), msg);
         return false;
     }
-    Downloader Down(aUser, aPassword);
-    bool OK = importOSM(aParent, Rcv.content(), theDocument, theLayer, &Down);
-    return OK;
+    return finishImportOSM(aParent, theDocument, theLayer, conflictLayer, Rcv.touchedWays(), Rcv.touchedRelations(), &Down, false);
+}
+
+bool downloadOSM(QWidget* aParent, const QUrl& theUrl, const QString& aUser, const QString& aPassword, Document* theDocument, Layer* theLayer)
+{
+    return downloadOSM(aParent, QList<QUrl>() << theUrl, aUser, aPassword, theDocument, theLayer);
 }
 
 bool downloadOSM(QWidget* aParent, const QString& aWeb, const QString& aUser, const QString& aPassword, const CoordBox& aBox , Document* theDocument, Layer* theLayer)
@@ -370,9 +663,12 @@ bool downloadOSM(QWidget* aParent, const QString& aWeb, const QString& aUser, co
 
     } else {
         /* Normal code path */
-        URL = URL.arg(aBox.bottomLeft().x(), 0, 'f').arg(aBox.bottomLeft().y(), 0, 'f').arg(aBox.topRight().x(), 0, 'f').arg(aBox.topRight().y(), 0, 'f');
-        QUrl theUrl(aWeb+URL);
-        return downloadOSM(aParent, theUrl, aUser, aPassword, theDocument, theLayer);
+        QList<QUrl> theUrls;
+        foreach (const CoordBox& aTile, splitDownloadBox(aBox)) {
+            QString tileURL = URL.arg(aTile.bottomLeft().x(), 0, 'f').arg(aTile.bottomLeft().y(), 0, 'f').arg(aTile.topRight().x(), 0, 'f').arg(aTile.topRight().y(), 0, 'f');
+            theUrls << QUrl(aWeb+tileURL);
+        }
+        return downloadOSM(aParent, theUrls, aUser, aPassword, theDocument, theLayer);
     }
 }
 
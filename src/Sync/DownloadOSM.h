@@ -14,10 +14,15 @@ class CoordBox;
 class Feature;
 class Layer;
 class SpecialLayer;
+class Way;
+class Relation;
+class OSMStreamParser;
 
 #include <QtCore/QByteArray>
 #include <QtCore/QEventLoop>
 #include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
 #include <QNetworkAccessManager>
 #include <QUrl>
 
@@ -37,6 +42,8 @@ class Downloader : public QObject
         const QString & resultText();
         const QString & errorText();
         const QString & locationText();
+        const QString & user() const;
+        const QString & password() const;
         QString getURLToMap();
         QString getURLToTrackPoints();
         QString getURLToFetchFull(IFeature::FId id);
@@ -75,6 +82,64 @@ class Downloader : public QObject
         QTimer *AnimationTimer;
 };
 
+/// Downloads one or more OSM extracts concurrently, parsing each reply while it is being received
+class StreamingDownloader : public QObject
+{
+    Q_OBJECT
+
+    public:
+        StreamingDownloader(const QString& aUser, const QString& aPwd, Document* aDoc, Layer* aLayer, Layer* aConflictLayer);
+        ~StreamingDownloader();
+
+        bool go(const QList<QUrl>& urls);
+        bool wasCanceled() const;
+        int resultCode();
+        const QString & resultText();
+        const QString & errorText();
+        const QSet<Way*>& touchedWays() const;
+        const QSet<Relation*>& touchedRelations() const;
+        int featureCount() const;
+        qint64 bytesReceived() const;
+        void setAnimator(QProgressDialog *anAnimator, QLabel* AnimatorLabel, QProgressBar* AnimatorBar);
+
+    public slots:
+        void on_readyRead();
+        void on_downloadProgress( qint64 done, qint64 total );
+        void on_requestFinished( QNetworkReply *reply);
+        void on_authenticationRequired( QNetworkReply *reply, QAuthenticator *auth);
+        void on_Cancel_clicked();
+
+    private:
+        void start(const QUrl& url);
+        void abortAll();
+        void discard(OSMStreamParser* theParser);
+        void fail(OSMStreamParser* theParser);
+        void updateProgress();
+
+        QNetworkAccessManager netManager;
+        QString User, Password;
+        Document* theDocument;
+        Layer* theLayer;
+        Layer* conflictLayer;
+        QList<QUrl> Queued;
+        QHash<QNetworkReply*, OSMStreamParser*> Pending;
+        QHash<QNetworkReply*, QPair<qint64, qint64> > Progress;
+        QSet<Way*> TouchedWays;
+        QSet<Relation*> TouchedRelations;
+        int Requests;
+        int Finished;
+        int FinishedFeatures;
+        qint64 FinishedBytes;
+        int Result;
+        QString ResultText;
+        QString ErrorText;
+        bool Error;
+        bool Canceled;
+        QEventLoop Loop;
+        QLabel* AnimatorLabel;
+        QProgressBar* AnimatorBar;
+};
+
 bool downloadOSM(MainWindow* Main, const CoordBox& aBox , Document* theDocument);
 bool downloadMoreOSM(MainWindow* Main, const CoordBox& aBox , Document* theDocument);
 bool downloadFeatures(MainWindow* Main, const QList<Feature*>& aDownloadList , Document* theDocument);
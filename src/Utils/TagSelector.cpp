@@ -1,6 +1,9 @@
 #include "TagSelector.h"
+#include "TagSelectorProgram.h"
 
+#include "Global.h"
 #include "IFeature.h"
+#include "TagIndex.h"
 
 void skipWhite(const QString& Expression, int& idx)
 {
@@ -339,10 +342,52 @@ TagSelector* TagSelector::parse(const QString& Expression, int& idx)
     return parseTagSelector(Expression,idx);
 }
 
+TagSelector::TagSelector()
+    : theProgram(0)
+{
+}
+
 TagSelector::~TagSelector()
 {
+    delete program();
+}
+
+const TagSelectorProgram* TagSelector::program() const
+{
+#ifdef QT5
+    return theProgram.loadAcquire();
+#else
+    return theProgram;
+#endif
 }
 
+TagSelectorMatchResult TagSelector::matches(const IFeature* F, qreal PixelPerM) const
+{
+    const TagSelectorProgram* P = program();
+    if (!P) {
+        // Compiling only reads the selector, so threads racing here build the same program
+        TagSelectorProgram* Compiled = new TagSelectorProgram;
+        compile(*Compiled);
+        if (theProgram.testAndSetOrdered(0, Compiled))
+            P = Compiled;
+        else {
+            delete Compiled;
+            P = program();
+        }
+    }
+    return P->run(F, PixelPerM);
+}
+
+bool TagSelector::candidates(const TagIndex&, FeatureIdSet&) const
+{
+    return false;
+}
+
+
+bool TagSelector::dependsOnTagsOnly() const
+{
+    return false;
+}
 
 /* TAGSELECTOROPERATOR */
 
@@ -373,6 +418,15 @@ TagSelectorOperator::TagSelectorOperator(const QString& key, const QString& oper
     else if (key.toLower() == ":uploaded")
         specialKey = TagSelectKey_Uploaded;
 
+    // Interned here rather than in compile(), which may run on a rendering thread
+    KeyId = ValueId = 0;
+    if (specialKey == TagSelectKey_None) {
+        TagSelectorAtoms::get();
+        if (key != "*")
+            KeyId = g_internTagKey(key);
+        ValueId = g_internTagValue(value);
+    }
+
     boolVal = false;
     if (value.toUpper() == "_NULL_") {
         specialValue = TagSelectValue_Empty;
@@ -418,362 +472,56 @@ TagSelector* TagSelectorOperator::copy() const
 
 static const QString emptyString("__EMPTY__");
 
-TagSelectorMatchResult TagSelectorOperator::evaluateVal(const QString& val) const
+void TagSelectorOperator::compile(TagSelectorProgram& aProgram) const
 {
-    if (val == emptyString && specialValue != TagSelectValue_Empty)
-        return TagSelect_NoMatch;
-    if (specialValue == TagSelectValue_Empty) {
-        if (theOp == EQ) {
-            if (val.toUpper() == emptyString) return TagSelect_Match;
-        } else {
-            if (val.toUpper() != emptyString) return TagSelect_Match;
-        }
-    } else if (UseSimpleRegExp) {
-        QRegExp lrx(rx);
-        if (lrx.exactMatch(val))  {
-            if (theOp == EQ)
-                return TagSelect_Match;
-        } else {
-            if (theOp != EQ)
-                return TagSelect_Match;
-        }
-
-    } else if (UseFullRegExp) {
-        QRegExp lrx(rx);
-        if (lrx.indexIn(val) != -1)  {
-            if (theOp == EQ)
-                return TagSelect_Match;
-        } else {
-            if (theOp != EQ)
-                return TagSelect_Match;
-        }
-
-    } else {
-        bool okkey;
-        qreal keyN = val.toDouble(&okkey);
-        if (boolVal)
-            switch (theOp) {
-            case EQ:
-                if (valB) {
-                    if (val.toLower() == "true" || val.toLower() == "yes" || val == "1")
-                        return TagSelect_Match;
-                } else {
-                    if (val.toLower() == "false" || val.toLower() == "no" || val == "0")
-                        return TagSelect_Match;
-                }
-                break;
-
-            case NE:
-                if (valB) {
-                    if (val.toLower() == "false" || val.toLower() == "no" || val == "0")
-                        return TagSelect_Match;
-                } else {
-                    if (val.toLower() == "true" || val.toLower() == "yes" || val == "1")
-                        return TagSelect_Match;
-                }
-                break;
-
-            default:
-                break;
-            }
-        else if (okkey && okval)
-            switch (theOp) {
-            case EQ:
-                if (keyN == valN) return TagSelect_Match;
-                break;
-            case NE:
-                if (keyN != valN) return TagSelect_Match;
-                break;
-            case GT:
-                if (keyN > valN) return TagSelect_Match;
-                break;
-            case LT:
-                if (keyN < valN) return TagSelect_Match;
-                break;
-            case GE:
-                if (keyN >= valN) return TagSelect_Match;
-                break;
-            case LE:
-                if (keyN <= valN) return TagSelect_Match;
-                break;
-            }
-        else
-            switch (theOp) {
-            case EQ:
-                if ((QString::compare(val, Value, Qt::CaseInsensitive)) == 0) return TagSelect_Match;
-                break;
-            case NE:
-                if ((QString::compare(val, Value, Qt::CaseInsensitive)) != 0 ) return TagSelect_Match;
-                break;
-            case GT:
-                if ((QString::compare(val, Value, Qt::CaseInsensitive)) > 0) return TagSelect_Match;
-                break;
-            case LT:
-                if ((QString::compare(val, Value, Qt::CaseInsensitive)) < 0) return TagSelect_Match;
-                break;
-            case GE:
-                if ((QString::compare(val, Value, Qt::CaseInsensitive)) >= 0) return TagSelect_Match;
-                break;
-            case LE:
-                if ((QString::compare(val, Value, Qt::CaseInsensitive)) <= 0) return TagSelect_Match;
-                break;
-            }
+    TagSelectorProgram::Test T;
+    T.op = TagSelectorProgram::Comparison(theOp);
+    T.specialKey = specialKey;
+    T.text = Value;
+    if (specialKey == TagSelectKey_None) {
+        T.value = ValueId;
+        T.fold = g_getTagValueFold(ValueId);
     }
-    return TagSelect_NoMatch;
+    T.isEmpty = specialValue == TagSelectValue_Empty;
+    T.isBool = boolVal;
+    T.boolValue = valB;
+    T.isNumber = okval;
+    T.number = (specialKey == TagSelectKey_Version) ? numValue : valN;
+    T.useSimpleRegExp = UseSimpleRegExp;
+    T.useFullRegExp = UseFullRegExp;
+    T.rx = rx;
+    T.time = dtValue;
+
+    if (specialKey != TagSelectKey_None)
+        aProgram.add(TagSelectorProgram::SpecialTest, 0, aProgram.addTest(T));
+    else if (Key == "*")
+        aProgram.add(TagSelectorProgram::AnyTag, 0, aProgram.addTest(T));
+    else
+        aProgram.add(TagSelectorProgram::Tag, KeyId, aProgram.addTest(T));
 }
 
-TagSelectorMatchResult TagSelectorOperator::matches(const IFeature* F, qreal PixelPerM) const
+QString TagSelectorOperator::asExpression(bool) const
 {
-    if (specialKey != TagSelectKey_None) {
-        switch (specialKey) {
-        case TagSelectKey_Id:
-            switch (theOp) {
-            case EQ:
-                return (F->xmlId() == Value ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case NE:
-                return (F->xmlId() != Value ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GT:
-                return (F->xmlId() > Value ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LT:
-                return (F->xmlId() < Value ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GE:
-                return (F->xmlId() >= Value ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LE:
-                return (F->xmlId() <= Value ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            }
-            break;
-
-#ifndef FRISIUS_BUILD
-        case TagSelectKey_User:
-            switch (theOp) {
-            case EQ:
-                return (QString::compare(F->user(), Value, Qt::CaseInsensitive) == 0 ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case NE:
-                return (QString::compare(F->user(), Value, Qt::CaseInsensitive) != 0 ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GT:
-                return (QString::compare(F->user(), Value, Qt::CaseInsensitive) > 0 ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LT:
-                return (QString::compare(F->user(), Value, Qt::CaseInsensitive) < 0 ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GE:
-                return (QString::compare(F->user(), Value, Qt::CaseInsensitive) >= 0 ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LE:
-                return (QString::compare(F->user(), Value, Qt::CaseInsensitive) <= 0 ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            }
-            break;
-
-        case TagSelectKey_Time: {
-                if (!dtValue.isValid())
-                    return TagSelect_NoMatch;
-                if (dtValue.time() == QTime(0, 0, 0))
-                    switch (theOp) {
-                    case EQ:
-                        return (F->time().date() == dtValue.date() ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case NE:
-                        return (F->time().date() != dtValue.date() ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case GT:
-                        return (F->time().date() > dtValue.date() ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case LT:
-                        return (F->time().date() < dtValue.date() ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case GE:
-                        return (F->time().date() >= dtValue.date() ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case LE:
-                        return (F->time().date() <= dtValue.date() ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    }
-                else
-                    switch (theOp) {
-                    case EQ:
-                        return (F->time() == dtValue ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case NE:
-                        return (F->time() != dtValue ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case GT:
-                        return (F->time() > dtValue ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case LT:
-                        return (F->time() < dtValue ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case GE:
-                        return (F->time() >= dtValue ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    case LE:
-                        return (F->time() <= dtValue ? TagSelect_Match : TagSelect_NoMatch);
-                        break;
-                    }
-
-                break;
-        }
-
-        case TagSelectKey_Version:
-            switch (theOp) {
-            case EQ:
-                return (F->versionNumber() == numValue ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case NE:
-                return (F->versionNumber() != numValue ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GT:
-                return (F->versionNumber() > numValue ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LT:
-                return (F->versionNumber() < numValue ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GE:
-                return (F->versionNumber() >= numValue ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LE:
-                return (F->versionNumber() <= numValue ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            }
-
-            break;
-#endif
-
-        case TagSelectKey_PixelPerM: {
-            if (!PixelPerM)
-                return TagSelect_Match;
-            bool okval;
-            qreal valN = Value.toDouble(&okval);
-            if (!okval)
-                return TagSelect_NoMatch;
-            switch (theOp) {
-            case EQ:
-                return (PixelPerM == valN ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case NE:
-                return (PixelPerM != valN ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GT:
-                return (PixelPerM > valN ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LT:
-                return (PixelPerM < valN ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case GE:
-                return (PixelPerM >= valN ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            case LE:
-                return (PixelPerM <= valN ? TagSelect_Match : TagSelect_NoMatch);
-                break;
-            }
-            break;
-        }
-
-        case TagSelectKey_Dirty: {
-            if (!boolVal)
-                return TagSelect_NoMatch;
-
-            switch (theOp) {
-            case EQ:
-                if (valB) {
-                    if (F->isDirty())
-                        return TagSelect_Match;
-                    else
-                        return TagSelect_NoMatch;
-                } else {
-                    if (!F->isDirty())
-                        return TagSelect_Match;
-                    else
-                        return TagSelect_NoMatch;
-                }
-                break;
-
-            case NE:
-                if (valB) {
-                    if (F->isDirty())
-                        return TagSelect_NoMatch;
-                    else
-                        return TagSelect_Match;
-                } else {
-                    if (!F->isDirty())
-                        return TagSelect_NoMatch;
-                    else
-                        return TagSelect_Match;
-                }
-                break;
-
-            default:
-                return TagSelect_NoMatch;
-            }
-            break;
-        }
+    return "[" + Key + "]" + Oper + Value;
+}
 
-        case TagSelectKey_Uploaded: {
-            if (!boolVal)
-                return TagSelect_NoMatch;
-
-            switch (theOp) {
-            case EQ:
-                if (valB) {
-                    if (F->isUploaded())
-                        return TagSelect_Match;
-                    else
-                        return TagSelect_NoMatch;
-                } else {
-                    if (!F->isUploaded())
-                        return TagSelect_Match;
-                    else
-                        return TagSelect_NoMatch;
-                }
-                break;
-
-            case NE:
-                if (valB) {
-                    if (F->isUploaded())
-                        return TagSelect_NoMatch;
-                    else
-                        return TagSelect_Match;
-                } else {
-                    if (!F->isUploaded())
-                        return TagSelect_NoMatch;
-                    else
-                        return TagSelect_Match;
-                }
-                break;
-
-            default:
-                return TagSelect_NoMatch;
-            }
-            break;
-        }
+bool TagSelectorOperator::candidates(const TagIndex& index, FeatureIdSet& ids) const
+{
+    // Only _NULL_ can match a feature without the key
+    if (specialKey != TagSelectKey_None || specialValue == TagSelectValue_Empty || Key == "*")
+        return false;
 
-        default:
-            return TagSelect_NoMatch;
-            break;
-        }
-    } else {
-        if (Key != "*")
-            return evaluateVal(F->tagValue(Key, emptyString));
-        else {
-            for (int i=0; i<F->tagSize(); ++i)
-                if (evaluateVal(F->tagValue(i)) == TagSelect_Match)
-                    return TagSelect_Match;
-        }
-    }
-    return TagSelect_NoMatch;
+    // Numbers and booleans compare by value, patterns need the value at hand: look at the whole key
+    if (theOp == EQ && !UseSimpleRegExp && !UseFullRegExp && !boolVal && !okval)
+        ids = index.withValue(Key, Value);
+    else
+        ids = index.withKey(Key);
+    return true;
 }
 
-QString TagSelectorOperator::asExpression(bool) const
+bool TagSelectorOperator::dependsOnTagsOnly() const
 {
-    return "[" + Key + "]" + Oper + Value;
+    return specialKey == TagSelectKey_None;
 }
 
 /* TAGSELECTORISONEOF */
@@ -804,6 +552,14 @@ TagSelectorIsOneOf::TagSelectorIsOneOf(const QString& key, const QStringList& va
             exactMatchv.append(values[i]);
         }
     }
+
+    KeyId = 0;
+    if (specialKey == TagSelectKey_None) {
+        TagSelectorAtoms::get();
+        KeyId = g_internTagKey(key);
+        foreach (QString Value, exactMatchv)
+            exactMatchIds.append(g_internTagValue(Value));
+    }
 }
 
 TagSelector* TagSelectorIsOneOf::copy() const
@@ -811,60 +567,28 @@ TagSelector* TagSelectorIsOneOf::copy() const
     return new TagSelectorIsOneOf(Key,Values);
 }
 
-TagSelectorMatchResult TagSelectorIsOneOf::matches(const IFeature* F, qreal /*PixelPerM*/) const
+void TagSelectorIsOneOf::compile(TagSelectorProgram& aProgram) const
 {
+    TagSelectorProgram::Set S;
+    S.specialKey = specialKey;
     if (specialKey != TagSelectKey_None) {
         foreach (QString Value, exactMatchv) {
-            switch (specialKey) {
-            case TagSelectKey_Id:
-                if (F->xmlId() == Value)
-                    return TagSelect_Match;
-                break;
-
-#ifndef FRISIUS_BUILD
-            case TagSelectKey_User:
-                if (QString::compare(F->user(), Value, Qt::CaseInsensitive) == 0)
-                    return TagSelect_Match;
-                break;
-
-            case TagSelectKey_Time: {
+            if (specialKey == TagSelectKey_Time) {
                 QDateTime dtValue = QDateTime::fromString(Value, Qt::ISODate);
-                if (!dtValue.isValid())
-                    break;
-                if (dtValue.time() == QTime(0, 0, 0)) {
-                    if (F->time().date() == dtValue.date())
-                        return TagSelect_Match;
-                } else {
-                    if (F->time() == dtValue)
-                        return TagSelect_Match;
-                }
-
-                break;
-            }
-
-            case TagSelectKey_Version:
-                if (F->versionNumber() == Value.toInt())
-                    return TagSelect_Match;
-                break;
-#endif
-
-            default:
-                break;
-            }
+                if (dtValue.isValid())
+                    S.times.append(dtValue);
+            } else if (specialKey == TagSelectKey_Version)
+                S.numbers.append(Value.toInt());
+            else
+                S.texts.append(Value);
         }
+        aProgram.add(TagSelectorProgram::SpecialIsOneOf, 0, aProgram.addSet(S));
     } else {
-        QString V = F->tagValue(Key, emptyString);
-        if (specialValue == TagSelectValue_Empty && V.isEmpty()) {
-            return TagSelect_Match;
-        }
-        foreach (QString pattern, exactMatchv) {
-            if (QString::compare(V, pattern) == 0) return TagSelect_Match;
-        }
-        foreach (QRegExp pattern, rxv) {
-            if (pattern.exactMatch(V)) return TagSelect_Match;
-        }
+        S.hasEmpty = specialValue == TagSelectValue_Empty;
+        S.values = exactMatchIds;
+        S.patterns = rxv;
+        aProgram.add(TagSelectorProgram::TagIsOneOf, KeyId, aProgram.addSet(S));
     }
-    return TagSelect_NoMatch;
 }
 
 QString TagSelectorIsOneOf::asExpression(bool) const
@@ -872,6 +596,26 @@ QString TagSelectorIsOneOf::asExpression(bool) const
     return "[" + Key + "] isoneof (" + Values.join(" , ") + ")";
 }
 
+bool TagSelectorIsOneOf::candidates(const TagIndex& index, FeatureIdSet& ids) const
+{
+    if (specialKey != TagSelectKey_None || specialValue == TagSelectValue_Empty || exactMatchv.contains(emptyString))
+        return false;
+
+    if (!rxv.isEmpty()) {
+        ids = index.withKey(Key);
+        return true;
+    }
+    ids.clear();
+    foreach (QString Value, exactMatchv)
+        ids |= index.withValue(Key, Value);
+    return true;
+}
+
+bool TagSelectorIsOneOf::dependsOnTagsOnly() const
+{
+    return specialKey == TagSelectKey_None;
+}
+
 /* TAGSELECTORTYPEIS */
 
 TagSelectorTypeIs::TagSelectorTypeIs(const QString& type)
@@ -884,21 +628,21 @@ TagSelector* TagSelectorTypeIs::copy() const
     return new TagSelectorTypeIs(Type);
 }
 
-TagSelectorMatchResult TagSelectorTypeIs::matches(const IFeature* F, qreal /*PixelPerM*/) const
+void TagSelectorTypeIs::compile(TagSelectorProgram& aProgram) const
 {
     QString t = Type.toLower();
     if (t == "node")
-        return (F->getType() & IFeature::Point) ? TagSelect_Match : TagSelect_NoMatch;
+        aProgram.add(TagSelectorProgram::TypeIs, IFeature::Point);
     else if (t == "way")
-        return (F->getType() & IFeature::LineString && !(F->getType() & IFeature::Polygon)) ? TagSelect_Match : TagSelect_NoMatch;
+        aProgram.add(TagSelectorProgram::TypeIs, IFeature::LineString, IFeature::Polygon);
     else if (t == "area")
-        return (F->getType() & IFeature::Polygon) ? TagSelect_Match : TagSelect_NoMatch;
+        aProgram.add(TagSelectorProgram::TypeIs, IFeature::Polygon);
     else if (t == "relation")
-        return (F->getType() & IFeature::OsmRelation) ? TagSelect_Match : TagSelect_NoMatch;
+        aProgram.add(TagSelectorProgram::TypeIs, IFeature::OsmRelation);
     else if (t == "tracksegment")
-        return (F->getType() & IFeature::GpxSegment) ? TagSelect_Match : TagSelect_NoMatch;
-
-    return TagSelect_NoMatch;
+        aProgram.add(TagSelectorProgram::TypeIs, IFeature::GpxSegment);
+    else
+        aProgram.add(TagSelectorProgram::SetResult, TagSelect_NoMatch);
 }
 
 QString TagSelectorTypeIs::asExpression(bool) const
@@ -906,11 +650,20 @@ QString TagSelectorTypeIs::asExpression(bool) const
     return "Type is " + Type;
 }
 
+bool TagSelectorTypeIs::dependsOnTagsOnly() const
+{
+    // A way turns into an area as it gets closed
+    QString t = Type.toLower();
+    return t != "way" && t != "area";
+}
+
 /* TAGSELECTORHASTAGS */
 
 TagSelectorHasTags::TagSelectorHasTags()
 {
     TechnicalTags = QString(TECHNICAL_TAGS).split("#");
+    foreach (QString Key, TechnicalTags)
+        TechnicalTagIds.append(g_internTagKey(Key));
 }
 
 TagSelector* TagSelectorHasTags::copy() const
@@ -918,14 +671,11 @@ TagSelector* TagSelectorHasTags::copy() const
     return new TagSelectorHasTags();
 }
 
-TagSelectorMatchResult TagSelectorHasTags::matches(const IFeature* F, qreal /*PixelPerM*/) const
+void TagSelectorHasTags::compile(TagSelectorProgram& aProgram) const
 {
-    for (int i=0; i<F->tagSize(); ++i) {
-        if (!TechnicalTags.contains(F->tagKey(i))) {
-            return TagSelect_Match;
-        }
-    }
-    return TagSelect_NoMatch;
+    TagSelectorProgram::Set S;
+    S.values = TechnicalTagIds;
+    aProgram.add(TagSelectorProgram::HasTags, 0, aProgram.addSet(S));
 }
 
 QString TagSelectorHasTags::asExpression(bool) const
@@ -933,6 +683,17 @@ QString TagSelectorHasTags::asExpression(bool) const
     return "HasTags";
 }
 
+bool TagSelectorHasTags::candidates(const TagIndex& index, FeatureIdSet& ids) const
+{
+    ids = index.withAnyKeyBut(TechnicalTags);
+    return true;
+}
+
+bool TagSelectorHasTags::dependsOnTagsOnly() const
+{
+    return true;
+}
+
 /* TAGSELECTOROR */
 
 TagSelectorOr::TagSelectorOr(const QList<TagSelector*> terms)
@@ -953,12 +714,16 @@ TagSelector* TagSelectorOr::copy() const
     return new TagSelectorOr(Copied);
 }
 
-TagSelectorMatchResult TagSelectorOr::matches(const IFeature* F, qreal PixelPerM) const
+void TagSelectorOr::compile(TagSelectorProgram& aProgram) const
 {
-    for (int i=0; i<Terms.size(); ++i)
-        if (Terms[i]->matches(F,PixelPerM) == TagSelect_Match)
-            return TagSelect_Match;
-    return TagSelect_NoMatch;
+    QList<int> Jumps;
+    for (int i=0; i<Terms.size(); ++i) {
+        Terms[i]->compile(aProgram);
+        Jumps << aProgram.add(TagSelectorProgram::JumpIfMatch);
+    }
+    aProgram.add(TagSelectorProgram::SetResult, TagSelect_NoMatch);
+    foreach (int Jump, Jumps)
+        aProgram.land(Jump);
 }
 
 QString TagSelectorOr::asExpression(bool Precedence) const
@@ -977,6 +742,26 @@ QString TagSelectorOr::asExpression(bool Precedence) const
     return R;
 }
 
+bool TagSelectorOr::candidates(const TagIndex& index, FeatureIdSet& ids) const
+{
+    ids.clear();
+    for (int i=0; i<Terms.size(); ++i) {
+        FeatureIdSet termIds;
+        if (!Terms[i]->candidates(index, termIds))
+            return false;
+        ids |= termIds;
+    }
+    return true;
+}
+
+
+bool TagSelectorOr::dependsOnTagsOnly() const
+{
+    for (int i=0; i<Terms.size(); ++i)
+        if (!Terms[i]->dependsOnTagsOnly())
+            return false;
+    return true;
+}
 
 /* TAGSELECTORAND */
 
@@ -998,12 +783,16 @@ TagSelector* TagSelectorAnd::copy() const
     return new TagSelectorAnd(Copied);
 }
 
-TagSelectorMatchResult TagSelectorAnd::matches(const IFeature* F, qreal PixelPerM) const
+void TagSelectorAnd::compile(TagSelectorProgram& aProgram) const
 {
-    for (int i=0; i<Terms.size(); ++i)
-        if (Terms[i]->matches(F,PixelPerM) == TagSelect_NoMatch)
-            return TagSelect_NoMatch;
-    return TagSelect_Match;
+    QList<int> Jumps;
+    for (int i=0; i<Terms.size(); ++i) {
+        Terms[i]->compile(aProgram);
+        Jumps << aProgram.add(TagSelectorProgram::JumpIfNoMatch);
+    }
+    aProgram.add(TagSelectorProgram::SetResult, TagSelect_Match);
+    foreach (int Jump, Jumps)
+        aProgram.land(Jump);
 }
 
 QString TagSelectorAnd::asExpression(bool /* Precedence */) const
@@ -1018,6 +807,33 @@ QString TagSelectorAnd::asExpression(bool /* Precedence */) const
     return R;
 }
 
+bool TagSelectorAnd::candidates(const TagIndex& index, FeatureIdSet& ids) const
+{
+    // The terms the index knows nothing about are left for matches()
+    bool narrowed = false;
+    for (int i=0; i<Terms.size(); ++i) {
+        FeatureIdSet termIds;
+        if (!Terms[i]->candidates(index, termIds))
+            continue;
+        if (narrowed)
+            ids &= termIds;
+        else
+            ids = termIds;
+        narrowed = true;
+        if (ids.isEmpty())
+            break;
+    }
+    return narrowed;
+}
+
+bool TagSelectorAnd::dependsOnTagsOnly() const
+{
+    for (int i=0; i<Terms.size(); ++i)
+        if (!Terms[i]->dependsOnTagsOnly())
+            return false;
+    return true;
+}
+
 /* TAGSELECTORNOT */
 
 TagSelectorNot::TagSelectorNot(TagSelector* term)
@@ -1037,11 +853,14 @@ TagSelector* TagSelectorNot::copy() const
     return new TagSelectorNot(Term->copy());
 }
 
-TagSelectorMatchResult TagSelectorNot::matches(const IFeature* F, qreal PixelPerM) const
+void TagSelectorNot::compile(TagSelectorProgram& aProgram) const
 {
-    if (!Term)
-        return TagSelect_NoMatch;
-    return (Term->matches(F,PixelPerM) == TagSelect_Match) ? TagSelect_NoMatch : TagSelect_Match;
+    if (!Term) {
+        aProgram.add(TagSelectorProgram::SetResult, TagSelect_NoMatch);
+        return;
+    }
+    Term->compile(aProgram);
+    aProgram.add(TagSelectorProgram::Negate);
 }
 
 QString TagSelectorNot::asExpression(bool /* Precedence */) const
@@ -1051,6 +870,11 @@ QString TagSelectorNot::asExpression(bool /* Precedence */) const
     return "not(" + Term->asExpression(true) + ")";
 }
 
+bool TagSelectorNot::dependsOnTagsOnly() const
+{
+    return !Term || Term->dependsOnTagsOnly();
+}
+
 /* TAGSELECTORPARENT */
 
 TagSelectorParent::TagSelectorParent(TagSelector* term)
@@ -1070,19 +894,15 @@ TagSelector* TagSelectorParent::copy() const
     return new TagSelectorParent(Term->copy());
 }
 
-TagSelectorMatchResult TagSelectorParent::matches(const IFeature* F, qreal PixelPerM) const
+void TagSelectorParent::compile(TagSelectorProgram& aProgram) const
 {
-    if (!Term)
-        return TagSelect_NoMatch;
-
-    TagSelectorMatchResult ret = TagSelect_NoMatch;
-    for (int i=0; i<F->sizeParents(); ++i) {
-        if (Term->matches(F->getParent(i),PixelPerM) == TagSelect_Match) {
-            ret = TagSelect_Match;
-            break;
-        }
+    if (!Term) {
+        aProgram.add(TagSelectorProgram::SetResult, TagSelect_NoMatch);
+        return;
     }
-    return ret;
+    int Start = aProgram.add(TagSelectorProgram::Parent);
+    Term->compile(aProgram);
+    aProgram.land(Start);
 }
 
 QString TagSelectorParent::asExpression(bool /* Precedence */) const
@@ -1103,9 +923,9 @@ TagSelector* TagSelectorFalse::copy() const
     return new TagSelectorFalse();
 }
 
-TagSelectorMatchResult TagSelectorFalse::matches(const IFeature* /* F */, qreal /*PixelPerM*/) const
+void TagSelectorFalse::compile(TagSelectorProgram& aProgram) const
 {
-    return TagSelect_NoMatch;
+    aProgram.add(TagSelectorProgram::SetResult, TagSelect_NoMatch);
 }
 
 QString TagSelectorFalse::asExpression(bool /* Precedence */) const
@@ -1113,6 +933,17 @@ QString TagSelectorFalse::asExpression(bool /* Precedence */) const
     return " false ";
 }
 
+bool TagSelectorFalse::candidates(const TagIndex&, FeatureIdSet& ids) const
+{
+    ids.clear();
+    return true;
+}
+
+bool TagSelectorFalse::dependsOnTagsOnly() const
+{
+    return true;
+}
+
 /* TAGSELECTORTRUE */
 
 TagSelectorTrue::TagSelectorTrue()
@@ -1124,9 +955,9 @@ TagSelector* TagSelectorTrue::copy() const
     return new TagSelectorFalse();
 }
 
-TagSelectorMatchResult TagSelectorTrue::matches(const IFeature* /* F */, qreal /*PixelPerM*/) const
+void TagSelectorTrue::compile(TagSelectorProgram& aProgram) const
 {
-    return TagSelect_Match;
+    aProgram.add(TagSelectorProgram::SetResult, TagSelect_Match);
 }
 
 QString TagSelectorTrue::asExpression(bool /* Precedence */) const
@@ -1134,6 +965,11 @@ QString TagSelectorTrue::asExpression(bool /* Precedence */) const
     return " true ";
 }
 
+bool TagSelectorTrue::dependsOnTagsOnly() const
+{
+    return true;
+}
+
 /* TAGSELECTORDEFAULT */
 
 TagSelectorDefault::TagSelectorDefault(TagSelector* term)
@@ -1151,13 +987,10 @@ TagSelector* TagSelectorDefault::copy() const
     return new TagSelectorDefault(Term->copy());
 }
 
-TagSelectorMatchResult TagSelectorDefault::matches(const IFeature* F, qreal PixelPerM) const
+void TagSelectorDefault::compile(TagSelectorProgram& aProgram) const
 {
-    //return (Term->matches(F) == TagSelect_Match) ? TagSelect_DefaultMatch : TagSelect_NoMatch;
-    if (Term->matches(F,PixelPerM) == TagSelect_Match)
-        return TagSelect_DefaultMatch;
-    else
-        return TagSelect_NoMatch;
+    Term->compile(aProgram);
+    aProgram.add(TagSelectorProgram::MakeDefault);
 }
 
 QString TagSelectorDefault::asExpression(bool /* Precedence */) const
@@ -1165,3 +998,7 @@ QString TagSelectorDefault::asExpression(bool /* Precedence */) const
     return " [Default] " + Term->asExpression(true);
 }
 
+bool TagSelectorDefault::dependsOnTagsOnly() const
+{
+    return Term->dependsOnTagsOnly();
+}
@@ -2,11 +2,16 @@
 #define MERKAARTOR_STYLE_TAGSELECTOR_H_
 
 class IFeature;
+class TagIndex;
+class FeatureIdSet;
+class TagSelectorProgram;
 
 #include <QtCore/QString>
 #include <QRegExp>
 #include <QList>
+#include <QVector>
 #include <QStringList>
+#include <QAtomicPointer>
 
 #include <QDateTime>
 
@@ -36,14 +41,30 @@ enum TagSelectorSpecialValue {
 class TagSelector
 {
     public:
+        TagSelector();
         virtual ~TagSelector() = 0;
 
         virtual TagSelector* copy() const = 0;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const = 0;
         virtual QString asExpression(bool Precedence) const = 0;
 
+        /* Runs the selector compiled into a TagSelectorProgram, compiling it on first use */
+        TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        /* Appends the instructions leaving the result of the selector in the register */
+        virtual void compile(TagSelectorProgram& aProgram) const = 0;
+
+        /* Sets ids to the indexed features that may match and returns true; returns false
+           when the index cannot narrow the selector down and every feature must be tried */
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        /* Whether the result only changes with the tags of the feature, so that it can be kept */
+        virtual bool dependsOnTagsOnly() const;
+
         static TagSelector* parse(const QString& Expression);
         static TagSelector* parse(const QString& Expression, int& idx);
+
+    private:
+        const TagSelectorProgram* program() const;
+
+        mutable QAtomicPointer<TagSelectorProgram> theProgram;
 };
 
 class TagSelectorOperator : public TagSelector
@@ -60,14 +81,15 @@ class TagSelectorOperator : public TagSelector
         TagSelectorOperator(const QString& key, const QString& oper, const QString& value);
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
-        TagSelectorMatchResult evaluateVal(const QString& val) const;
-
         QRegExp rx;
         QString Key, Oper, Value;
+        quint32 KeyId, ValueId;
         Ops theOp;
         qreal numValue;
         QDateTime dtValue;
@@ -86,13 +108,17 @@ class TagSelectorIsOneOf : public TagSelector
         TagSelectorIsOneOf(const QString& key, const QStringList& values);
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         QList<QRegExp> rxv;
         QStringList exactMatchv;
+        QVector<quint32> exactMatchIds;
         QString Key;
+        quint32 KeyId;
         QStringList Values;
         TagSelectorSpecialKey specialKey;
         TagSelectorSpecialValue specialValue;
@@ -104,8 +130,9 @@ class TagSelectorTypeIs : public TagSelector
         TagSelectorTypeIs(const QString& type);
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         QString Type;
@@ -117,11 +144,14 @@ class TagSelectorHasTags : public TagSelector
         TagSelectorHasTags();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         QStringList TechnicalTags;
+        QVector<quint32> TechnicalTagIds;
 };
 
 class TagSelectorOr : public TagSelector
@@ -131,8 +161,10 @@ class TagSelectorOr : public TagSelector
         virtual ~TagSelectorOr();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         QList<TagSelector*> Terms;
@@ -145,8 +177,10 @@ class TagSelectorAnd : public TagSelector
         virtual ~TagSelectorAnd();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         QList<TagSelector*> Terms;
@@ -159,8 +193,9 @@ class TagSelectorNot : public TagSelector
         virtual ~TagSelectorNot();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         TagSelector* Term;
@@ -173,7 +208,7 @@ class TagSelectorParent : public TagSelector
         virtual ~TagSelectorParent();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
 
     private:
@@ -186,8 +221,10 @@ class TagSelectorFalse : public TagSelector
         TagSelectorFalse();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool candidates(const TagIndex& index, FeatureIdSet& ids) const;
+        virtual bool dependsOnTagsOnly() const;
 };
 
 class TagSelectorTrue : public TagSelector
@@ -196,8 +233,9 @@ class TagSelectorTrue : public TagSelector
         TagSelectorTrue();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool dependsOnTagsOnly() const;
 };
 
 class TagSelectorDefault : public TagSelector
@@ -207,8 +245,9 @@ class TagSelectorDefault : public TagSelector
         virtual ~TagSelectorDefault();
 
         virtual TagSelector* copy() const;
-        virtual TagSelectorMatchResult matches(const IFeature* F, qreal PixelPerM) const;
+        virtual void compile(TagSelectorProgram& aProgram) const;
         virtual QString asExpression(bool Precedence) const;
+        virtual bool dependsOnTagsOnly() const;
 
     private:
         TagSelector* Term;
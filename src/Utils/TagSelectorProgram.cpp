@@ -0,0 +1,331 @@
+#include "TagSelectorProgram.h"
+
+#include "Global.h"
+#include "IFeature.h"
+
+TagSelectorAtoms::TagSelectorAtoms()
+{
+    missing = g_internTagValue("__EMPTY__");
+    missingFold = g_getTagValueFold(missing);
+    blank = g_internTagValue(QString(""));
+    trueFolds[0] = g_getTagValueFold(g_internTagValue("true"));
+    trueFolds[1] = g_getTagValueFold(g_internTagValue("yes"));
+    trueFolds[2] = g_getTagValueFold(g_internTagValue("1"));
+    falseFolds[0] = g_getTagValueFold(g_internTagValue("false"));
+    falseFolds[1] = g_getTagValueFold(g_internTagValue("no"));
+    falseFolds[2] = g_getTagValueFold(g_internTagValue("0"));
+}
+
+const TagSelectorAtoms& TagSelectorAtoms::get()
+{
+    static TagSelectorAtoms theAtoms;
+    return theAtoms;
+}
+
+TagSelectorProgram::Test::Test()
+    : op(EQ), specialKey(TagSelectKey_None), value(0), fold(0), isEmpty(false)
+    , isBool(false), boolValue(false), isNumber(false), number(0.)
+    , useSimpleRegExp(false), useFullRegExp(false)
+{
+}
+
+TagSelectorProgram::Set::Set()
+    : specialKey(TagSelectKey_None), hasEmpty(false)
+{
+}
+
+TagSelectorProgram::TagSelectorProgram()
+{
+}
+
+int TagSelectorProgram::add(Opcode code, quint32 a, quint32 b)
+{
+    Instruction I;
+    I.code = code;
+    I.a = a;
+    I.b = b;
+    theCode.append(I);
+    return theCode.size()-1;
+}
+
+void TagSelectorProgram::land(int at)
+{
+    theCode[at].a = theCode.size();
+}
+
+quint32 TagSelectorProgram::addTest(const Test& aTest)
+{
+    theTests.append(aTest);
+    return theTests.size()-1;
+}
+
+quint32 TagSelectorProgram::addSet(const Set& aSet)
+{
+    theSets.append(aSet);
+    return theSets.size()-1;
+}
+
+TagSelectorMatchResult TagSelectorProgram::run(const IFeature* F, qreal PixelPerM) const
+{
+    return run(F, PixelPerM, 0, theCode.size());
+}
+
+TagSelectorMatchResult TagSelectorProgram::run(const IFeature* F, qreal PixelPerM, int from, int to) const
+{
+    TagSelectorMatchResult R = TagSelect_NoMatch;
+    const Instruction* code = theCode.constData();
+    int pc = from;
+    while (pc < to) {
+        const Instruction& I = code[pc++];
+        switch (I.code) {
+        case SetResult:
+            R = TagSelectorMatchResult(I.a);
+            break;
+
+        case JumpIfMatch:
+            if (R == TagSelect_Match)
+                pc = I.a;
+            break;
+
+        case JumpIfNoMatch:
+            if (R == TagSelect_NoMatch)
+                pc = I.a;
+            break;
+
+        case Negate:
+            R = (R == TagSelect_Match) ? TagSelect_NoMatch : TagSelect_Match;
+            break;
+
+        case MakeDefault:
+            R = (R == TagSelect_Match) ? TagSelect_DefaultMatch : TagSelect_NoMatch;
+            break;
+
+        case Parent:
+            R = TagSelect_NoMatch;
+            for (int i=0; i<F->sizeParents(); ++i)
+                if (run(F->getParent(i), PixelPerM, pc, I.a) == TagSelect_Match) {
+                    R = TagSelect_Match;
+                    break;
+                }
+            pc = I.a;
+            break;
+
+        case Tag: {
+            const QList<QPair<quint32, quint32> >& tags = F->tagIds();
+            quint32 value = TagSelectorAtoms::get().missing;
+            for (int i=0; i<tags.size(); ++i)
+                if (tags.at(i).first == I.a) {
+                    value = tags.at(i).second;
+                    break;
+                }
+            R = testValue(value, theTests.at(I.b));
+            break;
+        }
+
+        case AnyTag: {
+            const QList<QPair<quint32, quint32> >& tags = F->tagIds();
+            R = TagSelect_NoMatch;
+            for (int i=0; i<tags.size(); ++i)
+                if (testValue(tags.at(i).second, theTests.at(I.b)) == TagSelect_Match) {
+                    R = TagSelect_Match;
+                    break;
+                }
+            break;
+        }
+
+        case TagIsOneOf: {
+            const QList<QPair<quint32, quint32> >& tags = F->tagIds();
+            quint32 value = TagSelectorAtoms::get().missing;
+            for (int i=0; i<tags.size(); ++i)
+                if (tags.at(i).first == I.a) {
+                    value = tags.at(i).second;
+                    break;
+                }
+            R = testSet(value, theSets.at(I.b));
+            break;
+        }
+
+        case SpecialTest:
+            R = testSpecial(F, PixelPerM, theTests.at(I.b));
+            break;
+
+        case SpecialIsOneOf:
+            R = testSpecialSet(F, theSets.at(I.b));
+            break;
+
+        case HasTags: {
+            const QList<QPair<quint32, quint32> >& tags = F->tagIds();
+            const QVector<quint32>& technical = theSets.at(I.b).values;
+            R = TagSelect_NoMatch;
+            for (int i=0; i<tags.size(); ++i)
+                if (!technical.contains(tags.at(i).first)) {
+                    R = TagSelect_Match;
+                    break;
+                }
+            break;
+        }
+
+        case TypeIs:
+            R = ((F->getType() & I.a) && !(F->getType() & I.b)) ? TagSelect_Match : TagSelect_NoMatch;
+            break;
+        }
+    }
+    return R;
+}
+
+template<typename T>
+static inline TagSelectorMatchResult testOrder(TagSelectorProgram::Comparison op, const T& a, const T& b)
+{
+    bool res = false;
+    switch (op) {
+    case TagSelectorProgram::EQ:
+        res = a == b;
+        break;
+    case TagSelectorProgram::NE:
+        res = a != b;
+        break;
+    case TagSelectorProgram::GT:
+        res = a > b;
+        break;
+    case TagSelectorProgram::LT:
+        res = a < b;
+        break;
+    case TagSelectorProgram::GE:
+        res = a >= b;
+        break;
+    case TagSelectorProgram::LE:
+        res = a <= b;
+        break;
+    }
+    return res ? TagSelect_Match : TagSelect_NoMatch;
+}
+
+TagSelectorMatchResult TagSelectorProgram::testValue(quint32 value, const Test& T) const
+{
+    const TagSelectorAtoms& atoms = TagSelectorAtoms::get();
+    if (T.isEmpty) {
+        bool empty = g_getTagValueFold(value) == atoms.missingFold;
+        return (empty == (T.op == EQ)) ? TagSelect_Match : TagSelect_NoMatch;
+    }
+    if (value == atoms.missing)
+        return TagSelect_NoMatch;
+
+    if (T.useSimpleRegExp || T.useFullRegExp) {
+        // A QRegExp keeps the state of its last match: work on a copy
+        QRegExp lrx(T.rx);
+        bool found = T.useSimpleRegExp ? lrx.exactMatch(g_getTagValue(value)) : lrx.indexIn(g_getTagValue(value)) != -1;
+        return (found == (T.op == EQ)) ? TagSelect_Match : TagSelect_NoMatch;
+    }
+
+    quint32 fold = g_getTagValueFold(value);
+    if (T.isBool) {
+        const quint32* expected = T.boolValue ? atoms.trueFolds : atoms.falseFolds;
+        const quint32* other = T.boolValue ? atoms.falseFolds : atoms.trueFolds;
+        if (T.op == EQ)
+            return (fold == expected[0] || fold == expected[1] || fold == expected[2]) ? TagSelect_Match : TagSelect_NoMatch;
+        if (T.op == NE)
+            return (fold == other[0] || fold == other[1] || fold == other[2]) ? TagSelect_Match : TagSelect_NoMatch;
+        return TagSelect_NoMatch;
+    }
+
+    qreal number;
+    if (T.isNumber && g_getTagValueNumber(value, number))
+        return testOrder(T.op, number, T.number);
+
+    // Folds are equal exactly when the strings compare equal ignoring case
+    if (T.op == EQ)
+        return (fold == T.fold) ? TagSelect_Match : TagSelect_NoMatch;
+    if (T.op == NE)
+        return (fold != T.fold) ? TagSelect_Match : TagSelect_NoMatch;
+    return testOrder(T.op, QString::compare(g_getTagValue(value), T.text, Qt::CaseInsensitive), 0);
+}
+
+TagSelectorMatchResult TagSelectorProgram::testSpecial(const IFeature* F, qreal PixelPerM, const Test& T) const
+{
+    switch (T.specialKey) {
+    case TagSelectKey_Id:
+        return testOrder(T.op, F->xmlId(), T.text);
+
+#ifndef FRISIUS_BUILD
+    case TagSelectKey_User:
+        return testOrder(T.op, QString::compare(F->user(), T.text, Qt::CaseInsensitive), 0);
+
+    case TagSelectKey_Time:
+        if (!T.time.isValid())
+            return TagSelect_NoMatch;
+        if (T.time.time() == QTime(0, 0, 0))
+            return testOrder(T.op, F->time().date(), T.time.date());
+        return testOrder(T.op, F->time(), T.time);
+
+    case TagSelectKey_Version:
+        return testOrder(T.op, qreal(F->versionNumber()), T.number);
+#endif
+
+    case TagSelectKey_PixelPerM:
+        if (!PixelPerM)
+            return TagSelect_Match;
+        if (!T.isNumber)
+            return TagSelect_NoMatch;
+        return testOrder(T.op, PixelPerM, T.number);
+
+    case TagSelectKey_Dirty:
+    case TagSelectKey_Uploaded: {
+        if (!T.isBool || (T.op != EQ && T.op != NE))
+            return TagSelect_NoMatch;
+        bool flag = (T.specialKey == TagSelectKey_Dirty) ? F->isDirty() : F->isUploaded();
+        return ((flag == T.boolValue) == (T.op == EQ)) ? TagSelect_Match : TagSelect_NoMatch;
+    }
+
+    default:
+        return TagSelect_NoMatch;
+    }
+}
+
+TagSelectorMatchResult TagSelectorProgram::testSet(quint32 value, const Set& S) const
+{
+    if (S.hasEmpty && value == TagSelectorAtoms::get().blank)
+        return TagSelect_Match;
+    if (S.values.contains(value))
+        return TagSelect_Match;
+    if (!S.patterns.isEmpty()) {
+        QString V = g_getTagValue(value);
+        foreach (QRegExp pattern, S.patterns)
+            if (pattern.exactMatch(V))
+                return TagSelect_Match;
+    }
+    return TagSelect_NoMatch;
+}
+
+TagSelectorMatchResult TagSelectorProgram::testSpecialSet(const IFeature* F, const Set& S) const
+{
+    switch (S.specialKey) {
+    case TagSelectKey_Id: {
+        QString id = F->xmlId();
+        if (S.texts.contains(id))
+            return TagSelect_Match;
+        break;
+    }
+
+#ifndef FRISIUS_BUILD
+    case TagSelectKey_User:
+        if (S.texts.contains(F->user(), Qt::CaseInsensitive))
+            return TagSelect_Match;
+        break;
+
+    case TagSelectKey_Time:
+        foreach (const QDateTime& dt, S.times)
+            if (dt.time() == QTime(0, 0, 0) ? F->time().date() == dt.date() : F->time() == dt)
+                return TagSelect_Match;
+        break;
+
+    case TagSelectKey_Version:
+        if (S.numbers.contains(F->versionNumber()))
+            return TagSelect_Match;
+        break;
+#endif
+
+    default:
+        break;
+    }
+    return TagSelect_NoMatch;
+}
@@ -0,0 +1,113 @@
+#ifndef MERKAARTOR_STYLE_TAGSELECTORPROGRAM_H_
+#define MERKAARTOR_STYLE_TAGSELECTORPROGRAM_H_
+
+#include "TagSelector.h"
+
+#include <QVector>
+
+/* A TagSelector flattened into a list of instructions, as TagSelector::matches runs it.
+   Keys and values are the indexes features keep their tags by, interned when the selector is
+   parsed, so that finding a tag and testing it for equality are integer compares; numbers, dates
+   and patterns are taken from the parsed selector.
+   Each instruction leaves its result in a single register; "and" and "or" jump past the terms
+   they do not need, "parent" runs the instructions up to its end on each parent in turn. */
+class TagSelectorProgram
+{
+public:
+    enum Opcode {
+        SetResult,      // a: the result
+        JumpIfMatch,    // a: the target
+        JumpIfNoMatch,  // a: the target
+        Negate,
+        MakeDefault,
+        Parent,         // a: the end of the instructions run on the parents
+        Tag,            // a: the key, b: the test
+        AnyTag,         // b: the test
+        TagIsOneOf,     // a: the key, b: the set
+        SpecialTest,    // b: the test
+        SpecialIsOneOf, // b: the set
+        HasTags,        // b: the set of keys not counted
+        TypeIs          // a: the types, b: the types excluded
+    };
+
+    /* In the order of the operators of TagSelectorOperator */
+    enum Comparison { EQ, NE, GT, LT, LE, GE };
+
+    /* One comparison of a value with a constant */
+    struct Test
+    {
+        Test();
+
+        Comparison op;
+        TagSelectorSpecialKey specialKey;
+        QString text;
+        quint32 value;
+        quint32 fold;
+        bool isEmpty;
+        bool isBool, boolValue;
+        bool isNumber;
+        qreal number;
+        bool useSimpleRegExp, useFullRegExp;
+        QRegExp rx;
+        QDateTime time;
+    };
+
+    /* The constants of "isoneof", and the keys HasTags leaves out */
+    struct Set
+    {
+        Set();
+
+        TagSelectorSpecialKey specialKey;
+        bool hasEmpty;
+        QVector<quint32> values;
+        QStringList texts;
+        QList<QRegExp> patterns;
+        QList<QDateTime> times;
+        QVector<int> numbers;
+    };
+
+    TagSelectorProgram();
+
+    TagSelectorMatchResult run(const IFeature* F, qreal PixelPerM) const;
+
+    /* Building, by TagSelector::compile */
+    int size() const { return theCode.size(); }
+    int add(Opcode code, quint32 a = 0, quint32 b = 0);
+    /* Points the jump at "at" to the next instruction */
+    void land(int at);
+    quint32 addTest(const Test& aTest);
+    quint32 addSet(const Set& aSet);
+
+private:
+    struct Instruction
+    {
+        quint8 code;
+        quint32 a;
+        quint32 b;
+    };
+
+    TagSelectorMatchResult run(const IFeature* F, qreal PixelPerM, int from, int to) const;
+    TagSelectorMatchResult testValue(quint32 value, const Test& T) const;
+    TagSelectorMatchResult testSpecial(const IFeature* F, qreal PixelPerM, const Test& T) const;
+    TagSelectorMatchResult testSet(quint32 value, const Set& S) const;
+    TagSelectorMatchResult testSpecialSet(const IFeature* F, const Set& S) const;
+
+    QVector<Instruction> theCode;
+    QVector<Test> theTests;
+    QVector<Set> theSets;
+};
+
+/* The values a missing tag and the booleans are compared as, interned on first use */
+struct TagSelectorAtoms
+{
+    quint32 missing, blank;
+    quint32 missingFold;
+    quint32 trueFolds[3], falseFolds[3];
+
+    static const TagSelectorAtoms& get();
+
+private:
+    TagSelectorAtoms();
+};
+
+#endif
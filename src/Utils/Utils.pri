@@ -14,6 +14,7 @@ HEADERS += \
     OsmLink.h \
     Utils.h \
     TagSelector.h \
+    TagSelectorProgram.h \
     TagSelectorWidget.h \
     CheckBoxList.h
 
@@ -29,6 +30,7 @@ SOURCES += \
     OsmLink.cpp \
     Utils.cpp \
     TagSelector.cpp \
+    TagSelectorProgram.cpp \
     TagSelectorWidget.cpp \
     CheckBoxList.cpp
 
@@ -0,0 +1,56 @@
+#include "Global.h"
+#include "MainWindow.h"
+
+#include "BulkGeometry.h"
+
+#include <QFutureWatcher>
+#include <QApplication>
+#include <QProgressDialog>
+#include <QStatusBar>
+
+static QString theComputed;     // the rate of the last jobs, shown again with that of their commands
+
+bool BulkGeometry::wait(const QString& aLabel, QFuture<void> aFuture)
+{
+    QProgressDialog dlg(aLabel, QApplication::tr("Cancel"), 0, 0, g_Merk_MainWindow);
+    dlg.setWindowModality(Qt::ApplicationModal);
+
+    QFutureWatcher<void> watcher;
+    QObject::connect(&watcher, SIGNAL(finished()), &dlg, SLOT(reset()));
+    QObject::connect(&dlg, SIGNAL(canceled()), &watcher, SLOT(cancel()));
+    QObject::connect(&watcher, SIGNAL(progressRangeChanged(int,int)), &dlg, SLOT(setRange(int,int)));
+    QObject::connect(&watcher, SIGNAL(progressValueChanged(int)), &dlg, SLOT(setValue(int)));
+    watcher.setFuture(aFuture);
+
+    // The finished signal is queued to this thread, so it closes the dialog even if sent already
+    dlg.exec();
+    watcher.waitForFinished();
+    return !watcher.isCanceled();
+}
+
+static QString rate(int count, qint64 nsecs)
+{
+    return QString::number(nsecs ? qint64(count * 1e9 / nsecs) : 0);
+}
+
+void BulkGeometry::computed(const QString& aLabel, int jobs, const QElapsedTimer& timer, bool done)
+{
+    qint64 elapsed = timer.nsecsElapsed();
+    QString label = aLabel;
+    if (label.endsWith("..."))
+        label.chop(3);
+    theComputed = QApplication::tr("%1: %2 jobs in %3 ms, %4 jobs/s")
+            .arg(label).arg(jobs).arg(elapsed / 1000000).arg(rate(jobs, elapsed));
+    if (!done)
+        theComputed += QApplication::tr(" (cancelled)");
+    if (g_Merk_MainWindow)
+        g_Merk_MainWindow->statusBar()->showMessage(theComputed, 15000);
+}
+
+void BulkGeometry::applied(int commands, const QElapsedTimer& timer)
+{
+    qint64 elapsed = timer.nsecsElapsed();
+    if (g_Merk_MainWindow)
+        g_Merk_MainWindow->statusBar()->showMessage(theComputed + QApplication::tr("; %1 commands in %2 ms, %3 commands/s")
+                                                    .arg(commands).arg(elapsed / 1000000).arg(rate(commands, elapsed)), 15000);
+}
@@ -0,0 +1,46 @@
+#ifndef MERKAARTOR_BULKGEOMETRY_H_
+#define MERKAARTOR_BULKGEOMETRY_H_
+
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QString>
+#include <QVector>
+#include <QtConcurrentMap>
+
+#define BULK_GEOMETRY_THRESHOLD 256 /* jobs below which they are computed in place, without threads or dialog */
+
+/* The computing half of a geometry operation over a large selection. The GUI thread copies what
+   the operation reads into jobs, computes the jobs here, then applies their results into one
+   CommandList. Jobs only see their own copy, so they run on the thread pool while the user
+   watches a progress dialog that can cancel them. */
+class BulkGeometry
+{
+public:
+    /* Calls compute() on every job; returns false if the user cancelled, leaving results partial */
+    template<typename Job>
+    static bool compute(const QString& aLabel, QVector<Job>& someJobs)
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        bool done = true;
+        if (someJobs.size() < BULK_GEOMETRY_THRESHOLD) {
+            for (int i=0; i<someJobs.size(); ++i)
+                someJobs[i].compute();
+        } else
+            done = wait(aLabel, QtConcurrent::map(someJobs, &Job::compute));
+
+        computed(aLabel, someJobs.size(), timer, done);
+        return done;
+    }
+
+    /* Shows in the status bar how fast the last jobs were computed and their results applied,
+       from the number of commands added since the timer started */
+    static void applied(int commands, const QElapsedTimer& timer);
+
+private:
+    static bool wait(const QString& aLabel, QFuture<void> aFuture);
+    static void computed(const QString& aLabel, int jobs, const QElapsedTimer& timer, bool done);
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "Command.h"
 
 #include "Feature.h"
+#include "FeatureClosure.h"
 #include "Document.h"
 #include "ImageMapLayer.h"
 
@@ -11,6 +12,7 @@
 #include "ImportExportCSV.h"
 #include "ImportExportOSC.h"
 #include "ImportExportGdal.h"
+#include "OsmWriter.h"
 #ifdef USE_PROTOBUF
 #include "ImportExportPBF.h"
 #endif
@@ -18,12 +20,15 @@
 #include "MainWindow.h"
 #include "MerkaartorPreferences.h"
 #include "LayerWidget.h"
+#include "PropertiesDock.h"
 
 #include "TagSelector.h"
 #include "IPaintStyle.h"
 #include "FeaturePainter.h"
+#include "MapCSSPaintstyle.h"
 
 #include "LayerIterator.h"
+#include "FilterEngine.h"
 #include "IMapAdapter.h"
 
 
@@ -37,33 +42,42 @@
 #include <QMenu>
 #include <QSet>
 #include <QReadWriteLock>
+#include <QElapsedTimer>
+#include <QStatusBar>
 
 /* MAPDOCUMENT */
 
 class MapDocumentPrivate
 {
 public:
-    MapDocumentPrivate()
-        : History(new CommandHistory())
+    MapDocumentPrivate(Document* aDocument)
+        : History(new CommandHistory(aDocument))
         , dirtyLayer(0)
         , uploadedLayer(0)
         /*, trashLayer(0)*/
         , theDock(0)
         , lastDownloadLayer(0)
-        , tagFilter(0), FilterRevision(0)
+        , tagFilter(0), FilterRevision(0), theFilterEngine(0)
         , layerNum(0)
         , theFeaturePaintersLock( QReadWriteLock::Recursive )
+        , theStyleSheet(0)
+        , DisableStyleForTracks(M_PREFS->getDisableStyleForTracks())
     {
     };
     ~MapDocumentPrivate()
     {
         History->cleanup();
         delete History;
+        // Nothing outside the document refers to its features any more
+        for (int i=0; i<Layers.size(); ++i)
+            Layers[i]->deleteAll();
         for (int i=0; i<Layers.size(); ++i) {
             if (theDock)
                 theDock->deleteLayer(Layers[i]);
             delete Layers[i];
         }
+        delete theFilterEngine;
+        delete theStyleSheet;
     }
     CommandHistory*	History;
     QList<Layer*> Layers;
@@ -76,17 +90,21 @@ public:
 
     TagSelector* tagFilter;
     int FilterRevision;
+    FilterEngine* theFilterEngine;
     QString title;
     int layerNum;
     mutable QString Id;
 
     QList<FeaturePainter> theFeaturePainters;
     QReadWriteLock theFeaturePaintersLock;
+    MapCSSPaintstyle* theStyleSheet;
+    bool DisableStyleForTracks;
 };
 
 Document::Document()
-    : p(new MapDocumentPrivate)
+    : p(new MapDocumentPrivate(this))
 {
+    p->theFilterEngine = new FilterEngine(this);
     setFilterType(M_PREFS->getCurrentFilter());
     p->title = tr("untitled");
 
@@ -96,9 +114,10 @@ Document::Document()
 }
 
 Document::Document(LayerDock* aDock)
-    : p(new MapDocumentPrivate)
+    : p(new MapDocumentPrivate(this))
 {
     p->theDock = aDock;
+    p->theFilterEngine = new FilterEngine(this);
     setFilterType(M_PREFS->getCurrentFilter());
     p->title = tr("untitled");
 
@@ -133,6 +152,8 @@ void Document::setPainters(QList<Painter> aPainters)
         FeaturePainter fp(aPainters[i]);
         p->theFeaturePainters.append(fp);
     }
+    delete p->theStyleSheet;
+    p->theStyleSheet = 0;
     for (FeatureIterator it(this); !it.isEnd(); ++it)
     {
         it.get()->invalidatePainter();
@@ -140,6 +161,40 @@ void Document::setPainters(QList<Painter> aPainters)
     unlockPainters();
 }
 
+void Document::setStyleSheet(MapCSSPaintstyle* aSheet)
+{
+    lockPaintersForWrite();
+    if (aSheet != p->theStyleSheet)
+        delete p->theStyleSheet;
+    p->theStyleSheet = aSheet;
+    for (FeatureIterator it(this); !it.isEnd(); ++it)
+    {
+        it.get()->invalidatePainter();
+    }
+    unlockPainters();
+}
+
+MapCSSPaintstyle* Document::getStyleSheet() const
+{
+    return p->theStyleSheet;
+}
+
+void Document::setDisableStyleForTracks(bool b)
+{
+    lockPaintersForWrite();
+    p->DisableStyleForTracks = b;
+    for (FeatureIterator it(this); !it.isEnd(); ++it)
+    {
+        it.get()->invalidatePainter();
+    }
+    unlockPainters();
+}
+
+bool Document::getDisableStyleForTracks() const
+{
+    return p->DisableStyleForTracks;
+}
+
 int Document::getPaintersSize()
 {
     return p->theFeaturePainters.size();
@@ -314,7 +369,7 @@ LayerDock* Document::getLayerDock(void)
 void Document::clear()
 {
     delete p;
-    p = new MapDocumentPrivate;
+    p = new MapDocumentPrivate(this);
     addDefaultLayers();
 }
 
@@ -398,11 +453,7 @@ FilterLayer* Document::addFilterLayer(FilterLayer *aLayer)
     if (!theLayer)
         theLayer = new FilterLayer(QUuid::createUuid().toString(), tr("Filter layer #%1").arg(++p->layerNum), "false");
     add(theLayer);
-
-    FeatureIterator it(this);
-    for(;!it.isEnd(); ++it) {
-        it.get()->updateFilters();
-    }
+    filterEngine()->evaluate(theLayer);
 
     return theLayer;
 }
@@ -415,6 +466,7 @@ void Document::remove(Layer* aLayer)
     }
     if (aLayer == p->lastDownloadLayer)
         p->lastDownloadLayer = NULL;
+    p->theFilterEngine->forget(aLayer);
     if (p->theDock)
         p->theDock->deleteLayer(aLayer);
 }
@@ -579,7 +631,7 @@ UploadedLayer* Document::getUploadedLayer() const
     return p->uploadedLayer;
 }
 
-void Document::exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeatures)
+void Document::exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeatures, bool compressed)
 {
     if (aFeatures.isEmpty())
         return;
@@ -605,91 +657,24 @@ void Document::exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeat
     if (dlg)
         dlg->show();
 
-    QXmlStreamWriter stream(device);
-    stream.setAutoFormatting(true);
-    stream.setAutoFormattingIndent(2);
-    stream.writeStartDocument();
-
-    stream.writeStartElement("osm");
-    stream.writeAttribute("version", "0.6");
-    stream.writeAttribute("generator", QString("%1 %2").arg(qApp->applicationName()).arg(STRINGIFY(VERSION)));
-
-    CoordBox aCoordBox = aFeatures[0]->boundingBox(true);
-    aFeatures[0]->toXML(stream, dlg);
-    for (int i=1; i < aFeatures.size(); i++) {
-        aCoordBox.merge(aFeatures[i]->boundingBox(true));
-        aFeatures[i]->toXML(stream, dlg);
-    }
-
-    stream.writeStartElement("bound");
-    QString S = QString().number(aCoordBox.bottom(),'f',6) + ",";
-    S += QString().number(aCoordBox.left(),'f',6) + ",";
-    S += QString().number(aCoordBox.top(),'f',6) + ",";
-    S += QString().number(aCoordBox.right(),'f',6);
-    stream.writeAttribute("box", S);
-    stream.writeAttribute("origin", QString("http://www.openstreetmap.org/api/%1").arg(M_PREFS->apiVersion()));
-    stream.writeEndElement();
-
-    stream.writeEndElement();
-    stream.writeEndDocument();
+    OsmWriter writer(device);
+    writer.setAutoFormatting(true);
+    writer.setCompressed(compressed);
+#ifndef _MOBILE
+    if (g_Merk_MainWindow)
+        writer.setSelection(g_Merk_MainWindow->properties()->selection());
+#endif
+    writer.writeOsm(aFeatures, dlg);
 }
 
 QList<Feature*> Document::exportCoreOSM(QList<Feature*> aFeatures, bool forCopyPaste, QProgressDialog * progress)
 {
-    QList<Feature*> exportedFeatures;
-    QList<Feature*>::Iterator i;
-
-    for (i = aFeatures.begin(); i != aFeatures.end(); ++i) {
-        if (/*Node* n = */dynamic_cast<Node*>(*i)) {
-            if (!exportedFeatures.contains(*i))
-                exportedFeatures.append(*i);
-        } else {
-            if (Way* G = dynamic_cast<Way*>(*i)) {
-                for (int j=0; j < G->size(); j++) {
-                    if (Node* P = dynamic_cast<Node*>(G->get(j))) {
-                        if (!exportedFeatures.contains(P))
-                            exportedFeatures.append(P);
-                    }
-                    if (!exportedFeatures.contains(G))
-                        exportedFeatures.append(G);
-                }
-            } else {
-                //FIXME Not working for relation (not made of point?)
-                if (Relation* G = dynamic_cast<Relation*>(*i)) {
-                    if (!forCopyPaste) {
-                        for (int j=0; j < G->size(); j++) {
-                            if (Way* R = CAST_WAY(G->get(j))) {
-                                for (int k=0; k < R->size(); k++) {
-                                    if (Node* P = dynamic_cast<Node*>(R->get(k))) {
-                                        if (!exportedFeatures.contains(P))
-                                            exportedFeatures.append(P);
-                                    }
-                                }
-                                if (!exportedFeatures.contains(R))
-                                    exportedFeatures.append(R);
-                            } else
-                            if (Node* P = CAST_NODE(G->get(j))) {
-                                if (!exportedFeatures.contains(P))
-                                    exportedFeatures.append(P);
-                            }
-
-                        }
-                    }
-                    if (!exportedFeatures.contains(G))
-                        exportedFeatures.append(G);
-                }
-            }
-        }
-        if (progress) {
-            if (progress->wasCanceled()) {
-                exportedFeatures.clear();
-                return exportedFeatures;
-            }
-            progress->setValue(progress->value()+1);
-        }
-    }
+    // A pasted relation refers to its members without carrying them
+    FeatureClosure closure(forCopyPaste ? FeatureClosure::Options() : FeatureClosure::RelationMembers);
+    if (!closure.add(aFeatures, progress))
+        return QList<Feature*>();
 
-    return exportedFeatures;
+    return closure.features();
 }
 
 bool Document::importNMEA(const QString& filename, TrackLayer* NewLayer)
@@ -875,11 +860,54 @@ TagSelector* Document::getTagFilter()
     return p->tagFilter;
 }
 
+QList<Feature*> Document::findFeatures(const TagSelector* theSelector, qreal PixelPerM, int maxResults)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<Feature*> result;
+    int tried = 0;
+    FeatureIdSet ids;
+    if (!theSelector->candidates(g_backend.tagIndex(), ids)) {
+        for (VisibleFeatureIterator i(this); !i.isEnd() && (!maxResults || result.size() < maxResults); ++i, ++tried)
+            if (theSelector->matches(i.get(), PixelPerM) != TagSelect_NoMatch)
+                result << i.get();
+    } else {
+        // Same features as VisibleFeatureIterator, out of the ones that may match
+        foreach (Feature* F, g_backend.tagIndex().features(ids)) {
+            if (maxResults && result.size() >= maxResults)
+                break;
+            if (!exists(F->layer()))
+                continue;
+            if (F->lastUpdated() == Feature::NotYetDownloaded || F->isDeleted() || F->isVirtual() || F->isHidden())
+                continue;
+            ++tried;
+            if (theSelector->matches(F, PixelPerM) != TagSelect_NoMatch)
+                result << F;
+        }
+    }
+
+#ifndef _MOBILE
+    if (g_Merk_MainWindow) {
+        qint64 elapsed = qMax(qint64(1), timer.nsecsElapsed() / 1000);
+        g_Merk_MainWindow->statusBar()->showMessage(tr("Found %1 of %2 features tried in %3 ms, %4 features/s")
+                .arg(result.size()).arg(tried).arg(elapsed / 1000., 0, 'f', 1)
+                .arg(qint64(tried) * 1000000 / elapsed), 15000);
+    }
+#endif
+    return result;
+}
+
 int Document::filterRevision() const
 {
     return p->FilterRevision;
 }
 
+FilterEngine* Document::filterEngine() const
+{
+    return p->theFilterEngine;
+}
+
 QString Document::title() const
 {
     return p->title;
@@ -1169,7 +1197,7 @@ bool VisibleFeatureIterator::check()
 void Document::rebuildHistory()
 {
     delete p->History;
-    p->History = new CommandHistory();
+    p->History = new CommandHistory(this);
     CommandHistory* h = p->History;
 
     // Identify changes
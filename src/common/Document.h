@@ -26,6 +26,8 @@ class DirtyLayer;
 class UploadedLayer;
 class DeletedLayer;
 class FeaturePainter;
+class MapCSSPaintstyle;
+class FilterEngine;
 
 class Document : public QObject, public IDocument
 {
@@ -83,7 +85,7 @@ public:
     void setUploadedLayer(UploadedLayer* aLayer);
     UploadedLayer* getUploadedLayer() const;
 
-    void exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeatures);
+    void exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeatures, bool compressed=false);
     QList<Feature*> exportCoreOSM(QList<Feature*> aFeatures, bool forCopyPaste=false, QProgressDialog * progress=NULL);
     bool toXML(QXmlStreamWriter& stream, bool asTemplate, QProgressDialog * progress);
     static Document* fromXML(QString title, QXmlStreamReader& stream, qreal version, LayerDock* aDock, QProgressDialog * progress);
@@ -113,7 +115,10 @@ public:
 
     bool setFilterType(FilterType aFilter);
     TagSelector* getTagFilter();
+    /* The visible features the selector matches, no more than maxResults of them unless it is 0 */
+    QList<Feature*> findFeatures(const TagSelector* theSelector, qreal PixelPerM, int maxResults = 0);
     int filterRevision() const;
+    FilterEngine* filterEngine() const;
 
     QString title() const;
     void setTitle(const QString aTitle);
@@ -126,6 +131,14 @@ public:
     void lockPaintersForWrite();
     void unlockPainters();
     virtual const Painter* getPainter(int i);
+    /* Styles the features with a MapCSS stylesheet instead of the painters; the document owns it.
+       Setting the painters drops it. */
+    void setStyleSheet(MapCSSPaintstyle* aSheet);
+    MapCSSPaintstyle* getStyleSheet() const;
+    /* Whether the features of track layers go unstyled. A copy of the preference, as the painters
+       are resolved on the rendering threads; setting it invalidates the painters. */
+    void setDisableStyleForTracks(bool b);
+    bool getDisableStyleForTracks() const;
 
     QStringList getCurrentSourceTags();
 
@@ -12,11 +12,13 @@
 #include "PropertiesDock.h"
 #include "Projection.h"
 #include "ImportExportOSC.h"
+#include "BulkGeometry.h"
 
 #include "Utils.h"
 #include "LineF.h"
 
 #include <QtCore/QString>
+#include <QApplication>
 #include <QMessageBox>
 
 #include <algorithm>
@@ -149,39 +151,63 @@ static qreal distanceFrom(QLineF ab, const Coord& c)
     return dc.distanceFrom(c);
 }
 
-void simplifyWay(Document *doc, Layer *layer, CommandList *theList, Way *w, int start, int end, qreal threshold)
+/* Douglas-Peucker reduction of the uninteresting points of a way, on a copy of its positions.
+   Each run between two points that must stay (ends, junctions, tagged nodes) is reduced
+   on its own. */
+struct SimplifyJob
 {
-    // Douglas-Peucker reduction of uninteresting points in way, subject to maximum error in metres
+    Way* theWay;
+    QVector<Coord> positions;
+    QVector<bool> fixed;
+    qreal threshold;
+    QVector<int> removed;   // indexes, in decreasing order
 
-    // TODO Performance: Use path-hull algorithm described at http://www.cs.ubc.ca/cgi-bin/tr/1992/TR-92-07.ps
-    if (end - start <= 1)
-        // no removable nodes
-        return;
-
-    QLineF segment(w->getNode(start)->position(), w->getNode(end)->position());
-    qreal maxdist = -1;
-    int maxpos = 0;
-    for (int i = start+1;  i < end;  i++) {
-        qreal d = distanceFrom(segment, w->getNode(i)->position());
-        if (d > maxdist) {
-            maxdist = d;
-            maxpos = i;
-        }
+    void compute()
+    {
+        int end = positions.size() - 1;
+        for (int i = end;  i >= 0;  i--)
+            if (fixed.at(i)) {
+                simplify(i, end);
+                end = i;
+            }
     }
-    // maxdist is in kilometres
-    if (maxpos && maxdist * 1000 > threshold) {
-        simplifyWay(doc, layer, theList, w, maxpos, end, threshold);
-        simplifyWay(doc, layer, theList, w, start, maxpos, threshold);
-    } else {
-        for (int i = end - 1;  i > start;  i--) {
-            Feature *n = w->get(i);
-            if (!doc->isDownloadedSafe(n->boundingBox()) && n->hasOSMId())
+
+    void simplify(int first, int last)
+    {
+        // TODO Performance: Use path-hull algorithm described at http://www.cs.ubc.ca/cgi-bin/tr/1992/TR-92-07.ps
+        // The upper part of a run is reduced before the lower, so that removals come in decreasing order
+        QVector<QPair<int, int> > runs;
+        runs.append(qMakePair(first, last));
+        while (!runs.isEmpty()) {
+            int start = runs.last().first;
+            int end = runs.last().second;
+            runs.pop_back();
+            if (end - start <= 1)
+                // no removable nodes
                 continue;
-            theList->add(new WayRemoveNodeCommand(w, i, layer));
-            theList->add(new RemoveFeatureCommand(doc, n));
+
+            QLineF segment(positions.at(start), positions.at(end));
+            qreal maxdist = -1;
+            int maxpos = 0;
+            for (int i = start+1;  i < end;  i++) {
+                qreal d = distanceFrom(segment, positions.at(i));
+                if (d > maxdist) {
+                    maxdist = d;
+                    maxpos = i;
+                }
+            }
+            // maxdist is in kilometres
+            if (maxpos && maxdist * 1000 > threshold) {
+                runs.append(qMakePair(start, maxpos));
+                runs.append(qMakePair(maxpos, end));
+            } else {
+                for (int i = end - 1;  i > start;  i--)
+                    removed.append(i);
+            }
         }
     }
-}
+};
+
 QSet<QString> uninterestingKeys;
 bool isNodeInteresting(Node *n)
 {
@@ -196,18 +222,39 @@ void simplifyRoads(Document* theDocument, CommandList* theList, PropertiesDock*
     if (uninterestingKeys.isEmpty())
         uninterestingKeys << "source";
 
+    QVector<SimplifyJob> jobs;
     for (int i = 0;  i < theDock->selectionSize();  ++i)
         if (Way* w = CAST_WAY(theDock->selection(i))) {
-            Layer *layer = theDocument->getDirtyOrOriginLayer(w->layer());
-            int end = w->size() - 1;
-            for (int i = end;  i >= 0;  i--) {
-                Node *n = w->getNode(i);
-                if (i == 0 || n->sizeParents() > 1 || isNodeInteresting(n)) {
-                    simplifyWay(theDocument, layer, theList, w, i, end, threshold);
-                    end = i;
-                }
+            SimplifyJob job;
+            job.theWay = w;
+            job.threshold = threshold;
+            job.positions.resize(w->size());
+            job.fixed.resize(w->size());
+            for (int j = 0;  j < w->size();  ++j) {
+                Node *n = w->getNode(j);
+                job.positions[j] = n->position();
+                job.fixed[j] = (j == 0 || n->sizeParents() > 1 || isNodeInteresting(n));
             }
+            jobs.append(job);
         }
+    if (!BulkGeometry::compute(QApplication::tr("Simplifying roads..."), jobs))
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    int before = theList->size();
+    foreach (const SimplifyJob& job, jobs) {
+        Way* w = job.theWay;
+        Layer *layer = theDocument->getDirtyOrOriginLayer(w->layer());
+        foreach (int i, job.removed) {
+            Feature *n = w->get(i);
+            if (!theDocument->isDownloadedSafe(n->boundingBox()) && n->hasOSMId())
+                continue;
+            theList->add(new WayRemoveNodeCommand(w, i, layer));
+            theList->add(new RemoveFeatureCommand(theDocument, n));
+        }
+    }
+    BulkGeometry::applied(theList->size() - before, timer);
 }
 
 static void appendPoints(Document* theDocument, CommandList* L, Way* Dest, Way* Src, bool prepend, bool reverse)
@@ -732,6 +779,24 @@ void addStreetNumbers(Document* theDocument, CommandList* theList, PropertiesDoc
         theList->setFeature(Roads.at(0));
 }
 
+/* Projects a node onto the line through p1 with the given slope */
+struct AlignJob
+{
+    Node* theNode;
+    Coord position;
+    Coord p1;
+    qreal slope;
+
+    void compute()
+    {
+        Coord pos = position - p1;
+        rotate(pos,-slope);
+        pos.setY(0);
+        rotate(pos,slope);
+        position = pos + p1;
+    }
+};
+
 void alignNodes(Document* theDocument, CommandList* theList, PropertiesDock* theDock)
 {
     if (theDock->selectionSize() < 3) //thre must be at least 3 nodes to align something
@@ -750,18 +815,25 @@ void alignNodes(Document* theDocument, CommandList* theList, PropertiesDock* the
         return;
 
     //we do the alignement
-    Coord pos(0,0);
     const Coord p1(Nodes[0]->position());
     const Coord p2(Nodes[1]->position()-p1);
     const qreal slope = angle(p2);
+    QVector<AlignJob> jobs(Nodes.size()-2);
     for (int i=2; i<Nodes.size(); ++i) {
-        pos=Nodes[i]->position()-p1;
-        rotate(pos,-slope);
-        pos.setY(0);
-        rotate(pos,slope);
-        pos=pos+p1;
-        theList->add(new MoveNodeCommand( Nodes[i], pos, theDocument->getDirtyOrOriginLayer(Nodes[i]->layer()) ));
+        AlignJob& job = jobs[i-2];
+        job.theNode = Nodes[i];
+        job.position = Nodes[i]->position();
+        job.p1 = p1;
+        job.slope = slope;
     }
+    if (!BulkGeometry::compute(QApplication::tr("Aligning nodes..."), jobs))
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    foreach (const AlignJob& job, jobs)
+        theList->add(new MoveNodeCommand( job.theNode, job.position, theDocument->getDirtyOrOriginLayer(job.theNode->layer()) ));
+    BulkGeometry::applied(jobs.size(), timer);
 }
 
 void bingExtract(Document* theDocument, CommandList* theList, PropertiesDock* theDock, CoordBox vp)
@@ -841,6 +913,27 @@ void bingExtract(Document* theDocument, CommandList* theList, PropertiesDock* th
     delete newDoc;
 }
 
+/* The distance of a node along the line between the first two nodes, as a dot product */
+struct SpreadJob
+{
+    Node* theNode;
+    Coord position;
+    Coord p;
+    Coord delta;
+    qreal metric;
+
+    void compute()
+    {
+        Coord pos = position - p;
+        metric = pos.x()*delta.x() + pos.y()*delta.y();
+    }
+
+    bool operator<(const SpreadJob& other) const
+    {
+        return metric < other.metric;
+    }
+};
+
 void spreadNodes(Document* theDocument, CommandList* theList, PropertiesDock* theDock)
 {
     // There must be at least 3 nodes to align something
@@ -848,56 +941,43 @@ void spreadNodes(Document* theDocument, CommandList* theList, PropertiesDock* th
         return;
 
     // We build a list of selected nodes
-    // Sort by distance along the line between the first two nodes
-    QList<Node*> Nodes;
-    QList<float> Metrics;
-    Coord p;
-    Coord delta;
-    for (int i=0; i<theDock->selectionSize(); ++i) {
+    QVector<SpreadJob> jobs;
+    for (int i=0; i<theDock->selectionSize(); ++i)
         if (Node* N = CAST_NODE(theDock->selection(i))) {
-            Coord pos(N->position());
-            if (Nodes.size() == 0) {
-                p = pos;
-                Nodes.push_back(N);
-                Metrics.push_back(0.0f);
-            } else if (Nodes.size() == 1) {
-                delta = pos - p;
-                // First two nodes must form a line
-                if (delta.isNull())
-                    return;
-                Nodes.push_back(N);
-                Metrics.push_back(delta.x()*delta.x() + delta.y()*delta.y());
-            } else {
-                pos = pos - p;
-                qreal metric = pos.x()*delta.x() + pos.y()*delta.y();
-                // This could be done more efficiently with a binary search
-                for (int j = 0; j < Metrics.size(); ++j) {
-                    if (metric < Metrics[j]) {
-                        Nodes.insert(j, N);
-                        Metrics.insert(j, metric);
-                        goto inserted;
-                    }
-                }
-                Nodes.push_back(N);
-                Metrics.push_back(metric);
-inserted:
-                ;
-            }
+            SpreadJob job;
+            job.theNode = N;
+            job.position = N->position();
+            jobs.append(job);
         }
-    }
 
-    // We check that we have at least 3 nodes
-    if(Nodes.size() < 3)
+    // We check that we have at least 3 nodes, and that the first two form a line
+    if (jobs.size() < 3)
+        return;
+    Coord p = jobs[0].position;
+    Coord delta = jobs[1].position - p;
+    if (delta.isNull())
         return;
+    for (int i=0; i<jobs.size(); ++i) {
+        jobs[i].p = p;
+        jobs[i].delta = delta;
+    }
+    if (!BulkGeometry::compute(QApplication::tr("Spreading nodes..."), jobs))
+        return;
+
+    // Sort by distance along the line between the first two nodes; nodes as far keep their order
+    qStableSort(jobs.begin(), jobs.end());
 
     // Do the spreading between the extremes
-    p = Nodes[0]->position();
-    delta = (Nodes[Nodes.size()-1]->position() - p) / (Nodes.size()-1);
+    QElapsedTimer timer;
+    timer.start();
+    p = jobs[0].position;
+    delta = (jobs[jobs.size()-1].position - p) / (jobs.size()-1);
 
-    for (int i=1; i<Nodes.size()-1; ++i) {
+    for (int i=1; i<jobs.size()-1; ++i) {
         p = p + delta;
-        theList->add(new MoveNodeCommand( Nodes[i], p, theDocument->getDirtyOrOriginLayer(Nodes[i]->layer()) ));
+        theList->add(new MoveNodeCommand( jobs[i].theNode, p, theDocument->getDirtyOrOriginLayer(jobs[i].theNode->layer()) ));
     }
+    BulkGeometry::applied(jobs.size()-2, timer);
 }
 
 static void mergeNodes(Document* theDocument, CommandList* theList, Node *node1, Node *node2)
@@ -1634,55 +1714,111 @@ bool canAxisAlignRoads(PropertiesDock* theDock)
     return axisAlignGetWays(theDock, theWays);
 }
 
-// returns true on success
-static bool axisAlignPreprocess(/* in */ PropertiesDock *theDock, const Projection &proj, int axes,
-                                /* out */ QList<Way *> &theWays, QVector<int> &edge_angles, QVector<int> &edge_axis,
-                                          QVector<qreal> &edge_weight, qreal &total_weight, QVector<QPointF> &midpoints)
+/* A way as axis align reads it, projected on the GUI thread, with the index of its first edge */
+struct AxisAlignWay
 {
-    if (!axisAlignGetWays(theDock, theWays))
-        return false;
+    Way* theWay;
+    QVector<Node*> nodes;
+    QVector<Coord> positions;
+    QVector<QPointF> points;
+    bool closed;
+    int first;
+};
+
+/* The angle, weight and midpoint of the edges of one way, as they do not depend on the axes */
+struct AxisAlignEdgesJob
+{
+    const AxisAlignWay* way;
+    qreal* edge_degrees;
+    qreal* edge_weight;
+    QPointF* midpoints;
+    bool ok;
+
+    void compute()
+    {
+        ok = true;
+        for (int j = 0; j < way->points.size()-1; ++j) {
+            const QPointF& p1 = way->points.at(j);
+            const QPointF& p2 = way->points.at(j+1);
+            if (way->nodes.at(j) == way->nodes.at(j+1) || p1 == p2) {
+                qWarning() << "ERROR: duplicate nodes found during axis align in" << way->theWay->id().numId;
+                ok = false;
+                return;
+            }
+            midpoints[j] = (p1 + p2) * 0.5;
+            // weight towards longer edges rather than lots of smaller edges
+            edge_weight[j] = way->positions.at(j).distanceFrom(way->positions.at(j+1));
+            edge_weight[j] *= edge_weight[j];
+            // calculate angle of edge
+            edge_degrees[j] = QLineF(p1, p2).angle();
+        }
+    }
+};
+
+static AxisAlignResult axisAlignSnapshot(/* in */ PropertiesDock *theDock, const Projection &proj,
+                              /* out */ QVector<AxisAlignWay> &theWays, QVector<qreal> &edge_degrees,
+                                        QVector<qreal> &edge_weight, qreal &total_weight, QVector<QPointF> &midpoints)
+{
+    QList<Way *> ways;
+    if (!axisAlignGetWays(theDock, ways))
+        return AxisAlignFail;
 
-    // manipulate angles as fixed point values with a unit of the angle between axes
     int nedges = 0;
-    foreach (Way *theWay, theWays)
+    theWays.resize(ways.size());
+    for (int w = 0; w < ways.size(); ++w) {
+        Way *theWay = ways.at(w);
+        AxisAlignWay &way = theWays[w];
+        way.theWay = theWay;
+        way.closed = theWay->isClosed();
+        way.first = nedges;
+        way.nodes.resize(theWay->size());
+        way.positions.resize(theWay->size());
+        way.points.resize(theWay->size());
+        for (int j = 0; j < theWay->size(); ++j) {
+            Node *N = theWay->getNode(j);
+            way.nodes[j] = N;
+            way.positions[j] = N->position();
+            way.points[j] = proj.project(N);
+        }
         nedges += theWay->size()-1;
-    edge_angles.resize(nedges);
-    edge_axis.resize(nedges);
+    }
+    edge_degrees.resize(nedges);
     edge_weight.resize(nedges);
     midpoints.resize(nedges);
+
+    QVector<AxisAlignEdgesJob> jobs(theWays.size());
+    for (int w = 0; w < theWays.size(); ++w) {
+        jobs[w].way = &theWays.at(w);
+        jobs[w].edge_degrees = edge_degrees.data() + theWays.at(w).first;
+        jobs[w].edge_weight = edge_weight.data() + theWays.at(w).first;
+        jobs[w].midpoints = midpoints.data() + theWays.at(w).first;
+    }
+    if (!BulkGeometry::compute(QApplication::tr("Measuring edges..."), jobs))
+        return AxisAlignCancelled;
+
     total_weight = 0.0;
+    for (int w = 0; w < jobs.size(); ++w)
+        if (!jobs.at(w).ok)
+            return AxisAlignFail;
+    for (int i = 0; i < nedges; ++i)
+        total_weight += edge_weight.at(i);
+    return AxisAlignSuccess;
+}
 
-    // Look at nodes and find angles etc
-    int i = 0;
-    foreach (Way *theWay, theWays) {
-        Node *n1;
-        Node *n2 = theWay->getNode(0);
-        QPointF p1;
-        QPointF p2 = proj.project(n2);
-        for (int j = 0; j < theWay->size()-1; ++j, ++i) {
-            n1 = n2;
-            n2 = theWay->getNode(j + 1);
-            p1 = p2;
-            p2 = proj.project(n2);
-            if (n1 == n2 || p1 == p2) {
-                qWarning() << "ERROR: duplicate nodes found during axis align in" << theWay->id().numId;
-                return false;
-            }
-            midpoints[i] = (p1 + p2) * 0.5;
-            // weight towards longer edges rather than lots of smaller edges
-            edge_weight[i] = n1->position().distanceFrom(n2->position());
-            edge_weight[i] *= edge_weight[i];
-            total_weight += edge_weight[i];
-            // calculate angle of edge
-            qreal ang = QLineF(p1, p2).angle();
-            edge_angles[i] = ang * ((axes << angle_shift) / 360.0);
-            if (edge_angles[i] < 0) {
-                edge_angles[i] += axes<<angle_shift;
-            }
-            edge_axis[i] = -1;
+// manipulate angles as fixed point values with a unit of the angle between axes
+static void axisAlignAngles(/* in */ const QVector<qreal> &edge_degrees, int axes,
+                            /* out */ QVector<int> &edge_angles, QVector<int> &edge_axis)
+{
+    const int nedges = edge_degrees.size();
+    edge_angles.resize(nedges);
+    edge_axis.resize(nedges);
+    for (int i = 0; i < nedges; ++i) {
+        edge_angles[i] = edge_degrees[i] * ((axes << angle_shift) / 360.0);
+        if (edge_angles[i] < 0) {
+            edge_angles[i] += axes<<angle_shift;
         }
+        edge_axis[i] = -1;
     }
-    return true;
 }
 
 // QVectors must be same size
@@ -1757,7 +1893,8 @@ static qreal axisAlignCalcVariance(const QVector<int> &edge_angles, const QVecto
 // returns 0 on failure.
 unsigned int axisAlignGuessAxes(PropertiesDock* theDock, const Projection &proj, unsigned int max_axes)
 {
-    QList<Way *> theWays;
+    QVector<AxisAlignWay> theWays;
+    QVector<qreal> edge_degrees;
     QVector<int> edge_angles;
     QVector<int> edge_axis;
     QVector<qreal> edge_weight;
@@ -1765,10 +1902,11 @@ unsigned int axisAlignGuessAxes(PropertiesDock* theDock, const Projection &proj,
     qreal total_weight;
     qreal min_var;
     int min_var_axes = 0;
+    if (axisAlignSnapshot(theDock, proj,
+                          theWays, edge_degrees, edge_weight, total_weight, midpoints) != AxisAlignSuccess)
+        return 0;
     for (unsigned int axes = 3; axes <= max_axes; ++axes) {
-        if (!axisAlignPreprocess(theDock, proj, axes,
-                                 theWays, edge_angles, edge_axis, edge_weight, total_weight, midpoints))
-            return 0;
+        axisAlignAngles(edge_degrees, axes, edge_angles, edge_axis);
         int theta;
         axisAlignCluster(edge_angles, edge_weight, total_weight, axes, theta, edge_axis);
         qreal var = axisAlignCalcVariance(edge_angles, edge_axis, theta);
@@ -1789,6 +1927,120 @@ unsigned int axisAlignGuessAxes(PropertiesDock* theDock, const Projection &proj,
 // threshold of (node movement/distance from midpoint)^2
 #define AXIS_ALIGN_FAR_THRESHOLD    (1e-6)  // 1/1000th ^2
 
+/* Where a node goes given the edges before and after it (-1 at the ends of an open way): onto
+   the intersection of their axes through their midpoints or, where both edges are on the same
+   axis (and so there is no intersection), onto the axis through the mean midpoint.
+   mid is the midpoint the movement of the node is measured against.
+   Returns false where the axes do not intersect. */
+static bool axisAlignPlaceNode(const QVector<int> &edge_axis, const QVector<QPointF> &midpoints,
+                               const QVector<QPointF> &axis_vectors, int index0, int index1,
+                               const QPointF &old_pos, QPointF &new_pos, QPointF &mid)
+{
+    if (index0 >= 0 && index1 >= 0 && edge_axis[index0] != edge_axis[index1]) {
+        // axes different, so probably safe to intersect
+        QLineF l0(midpoints[index0], midpoints[index0] + axis_vectors[edge_axis[index0]]);
+        QLineF l1(midpoints[index1], midpoints[index1] + axis_vectors[edge_axis[index1]]);
+        if (l0.intersect(l1, &new_pos) == QLineF::NoIntersection)
+            return false;
+        mid = midpoints[index0];
+    } else {
+        // Axes are the same so there's no intersection point. Just
+        // project onto axis through average midpoint.
+        int index = ((index0 >= 0) ? index0 : index1);
+        QPointF midpoint = midpoints[index];
+        if (index != index1 && index1 >= 0)
+            midpoint = (midpoint + midpoints[index1]) / 2;
+        QPointF rel_pos = old_pos - midpoint;
+        QPointF dir = axis_vectors[edge_axis[index]];
+        qreal dot = dir.x()*rel_pos.x() + dir.y()*rel_pos.y();
+        new_pos = midpoint + dir*dot;
+        mid = midpoints[index];
+    }
+    return true;
+}
+
+/* The indexes of the edges before and after node j of a way, -1 where there is none */
+static void axisAlignNeighbours(const AxisAlignWay &way, int j, int &index0, int &index1)
+{
+    const int n = way.points.size()-1;
+    if (j == 0)
+        index0 = way.closed ? way.first+n-1 : -1;
+    else
+        index0 = way.first+j-1;
+    index1 = (j < n) ? way.first+j : -1;
+}
+
+/* Aligns the midpoints of the runs of edges of one way sharing an axis.
+   Works on a copy of the way's own midpoints, so that a run wrapping around the ends of a
+   closed way does not reach into the next way's. */
+struct AxisAlignMidpointsJob
+{
+    const AxisAlignWay* way;
+    const QVector<int>* edge_axis;
+    const QVector<qreal>* edge_weight;
+    const QVector<QPointF>* axis_vectors;
+    QVector<QPointF> midpoints;
+
+    void compute()
+    {
+        const int start = way->first;
+        const int n = way->points.size()-1;
+        QVector<qreal> weights = edge_weight->mid(start, n);
+        int last_axis = -1;
+        int first_in_seq = -1;
+        int excess = 0;
+        for (int i = 0; i < n; ++i) {
+            int axis = (*edge_axis)[start+i];
+            if (axis != last_axis) {
+                if (first_in_seq == -1) {
+                    // If edges sharing axis cross the join between ends, we'll
+                    // come back to it anyway.
+                    excess = i;
+                    if (i != 0 || !way->closed || (*edge_axis)[start+n-1] != axis)
+                        first_in_seq = i;
+                } else {
+                    if (i - first_in_seq > 1) {
+                        axisAlignAlignMidpoints(midpoints, weights, (*axis_vectors)[last_axis], first_in_seq, i);
+                    }
+                    first_in_seq = i;
+                }
+                last_axis = axis;
+            }
+        }
+        if (n + excess - first_in_seq > 1)
+            axisAlignAlignMidpoints(midpoints, weights, (*axis_vectors)[last_axis], first_in_seq, n+excess);
+    }
+};
+
+/* Places the nodes of one way sharing none with the others, in a single pass */
+struct AxisAlignNodesJob
+{
+    const AxisAlignWay* way;
+    const QVector<int>* edge_axis;
+    const QVector<QPointF>* midpoints;
+    const QVector<QPointF>* axis_vectors;
+    QVector<QPointF> positions;
+    bool ok;
+
+    void compute()
+    {
+        ok = true;
+        positions = way->points;
+        int max = way->closed ? way->points.size()-1 : way->points.size();
+        for (int j = 0; j < max; ++j) {
+            int index0, index1;
+            axisAlignNeighbours(*way, j, index0, index1);
+            QPointF mid;
+            if (!axisAlignPlaceNode(*edge_axis, *midpoints, *axis_vectors, index0, index1, way->points.at(j), positions[j], mid)) {
+                ok = false;
+                return;
+            }
+        }
+        if (way->closed)
+            positions.last() = positions.first();
+    }
+};
+
 // don't add theList to history if result isn't success
 AxisAlignResult axisAlignRoads(Document* theDocument, CommandList* theList, PropertiesDock* theDock, const Projection &proj, unsigned int axes)
 {
@@ -1796,19 +2048,22 @@ AxisAlignResult axisAlignRoads(Document* theDocument, CommandList* theList, Prop
     removeRepeatsInRoads(theDocument, theList, theDock);
 
     // manipulate angles as fixed point values with a unit of the angle between axes
-    QList<Way *> theWays;
+    QVector<AxisAlignWay> theWays;
+    QVector<qreal> edge_degrees;
     QVector<int> edge_angles;
     QVector<int> edge_axis;
     QVector<qreal> edge_weight;
     QVector<QPointF> midpoints;
     qreal total_weight;
-    if (!axisAlignPreprocess(theDock, proj, axes,
-                             theWays, edge_angles, edge_axis, edge_weight, total_weight, midpoints)) {
-        // should never happen, repeated nodes already removed
-        Q_ASSERT(0);
+    AxisAlignResult snapshot = axisAlignSnapshot(theDock, proj,
+                                                 theWays, edge_degrees, edge_weight, total_weight, midpoints);
+    if (snapshot != AxisAlignSuccess) {
+        // should never fail, repeated nodes already removed
+        Q_ASSERT(snapshot == AxisAlignCancelled);
         theList->undo();
-        return AxisAlignFail;
+        return snapshot;
     }
+    axisAlignAngles(edge_degrees, axes, edge_angles, edge_axis);
 
     int theta;
     axisAlignCluster(edge_angles, edge_weight, total_weight, axes, theta, edge_axis);
@@ -1826,164 +2081,156 @@ AxisAlignResult axisAlignRoads(Document* theDocument, CommandList* theList, Prop
     // axis so that we can just project the nodes onto the axis and make the
     // result axis aligned. Note that this does not handle adjacent edges which
     // have opposite axes and are therefore parallel (when axes is even).
-    int i = 0;
-    foreach (Way *theWay, theWays) {
-        int start = i;
-        int n = theWay->size()-1;
-        int last_axis = -1;
-        int first_in_seq = -1;
-        int excess = 0;
-        for (; i < start + n; ++i) {
-            int axis = edge_axis[i];
-            if (axis != last_axis) {
-                if (first_in_seq == -1) {
-                    // If edges sharing axis cross the join between ends, we'll
-                    // come back to it anyway.
-                    excess = i;
-                    if (i != 0 || !theWay->isClosed() || edge_axis[start+n-1] != axis)
-                        first_in_seq = i;
-                } else {
-                    if (i - first_in_seq > 1) {
-                        axisAlignAlignMidpoints(midpoints, edge_weight, axis_vectors[last_axis], first_in_seq, i);
-                    }
-                    first_in_seq = i;
-                }
-                last_axis = axis;
-            }
-        }
-        if (n + excess - first_in_seq > 1)
-            axisAlignAlignMidpoints(midpoints, edge_weight, axis_vectors[last_axis], first_in_seq, n+excess);
+    QVector<AxisAlignMidpointsJob> midpointJobs(theWays.size());
+    for (int w = 0; w < theWays.size(); ++w) {
+        AxisAlignMidpointsJob &job = midpointJobs[w];
+        job.way = &theWays.at(w);
+        job.edge_axis = &edge_axis;
+        job.edge_weight = &edge_weight;
+        job.axis_vectors = &axis_vectors;
+        job.midpoints = midpoints.mid(job.way->first, job.way->points.size()-1);
+    }
+    if (!BulkGeometry::compute(QApplication::tr("Aligning edges..."), midpointJobs)) {
+        theList->undo();
+        return AxisAlignCancelled;
+    }
+    for (int w = 0; w < midpointJobs.size(); ++w) {
+        const AxisAlignMidpointsJob &job = midpointJobs.at(w);
+        for (int i = 0; i < job.midpoints.size(); ++i)
+            midpoints[job.way->first + i] = job.midpoints.at(i);
     }
 
-    // Get the positions of each unique node
-    QHash<Node *, QPointF> node_pos;
+    // Are nodes shared between (or repeated within) the ways?
     bool dups = false;
-    foreach (Way *theWay, theWays) {
-        for (int i = 0; i < theWay->size(); ++i) {
-            Node *N = theWay->getNode(i);
-            if (!dups && node_pos.contains(N) && !(theWay->isClosed() && i == theWay->size()-1))
-                dups = true;
-            node_pos[N] = proj.project(N);
+    {
+        QSet<Node *> seen;
+        foreach (const AxisAlignWay &way, theWays) {
+            for (int i = 0; i < way.nodes.size() && !dups; ++i) {
+                Node *N = way.nodes.at(i);
+                if (seen.contains(N) && !(way.closed && i == way.nodes.size()-1))
+                    dups = true;
+                seen.insert(N);
+            }
         }
     }
 
-    // If nodes are repeated then they will be moved more than once, so we
-    // iterate and allow the nodes to converge to a point.
-    qreal last_movement = -1.0;
-    qreal movement = 0.0;
-    for (int it = 0; ; ++it) {
-        i = 0;
-        bool moved_far = false;
-        // Move nodes (only in node_pos) onto the intersection of the neighbouring
-        // edge's axes through their midpoints. Where neighbouring edges are on the
-        // same axis (and so there is no intersection), project directly onto the
-        // axis through the mean midpoint.
-        foreach (Way *theWay, theWays) {
-            int index0, index1, max;
-            int start = i;
-            int n = theWay->size()-1;
-            if (theWay->isClosed()) {
-                index1 = start+n-1;
-                max = n;
-            } else {
-                index1 = -1;
-                max = theWay->size();
+    QVector<QVector<QPointF> > positions(theWays.size());
+    if (!dups) {
+        // Every node is placed once, from the edges of its own way
+        QVector<AxisAlignNodesJob> nodeJobs(theWays.size());
+        for (int w = 0; w < theWays.size(); ++w) {
+            AxisAlignNodesJob &job = nodeJobs[w];
+            job.way = &theWays.at(w);
+            job.edge_axis = &edge_axis;
+            job.midpoints = &midpoints;
+            job.axis_vectors = &axis_vectors;
+        }
+        if (!BulkGeometry::compute(QApplication::tr("Aligning nodes..."), nodeJobs)) {
+            theList->undo();
+            return AxisAlignCancelled;
+        }
+        for (int w = 0; w < nodeJobs.size(); ++w) {
+            if (!nodeJobs.at(w).ok) {
+                theList->undo();
+                return AxisAlignSharpAngles;
             }
-            for (int j = 0; j < max; ++j) {
-                index0 = index1;
-                index1 = ((j < n) ? i++ : -1);
-                Node *N = theWay->getNode(j);
-                QPointF old_pos = node_pos[N];
-                QPointF new_pos;
-                QPointF mid;
-                if (index0 >= 0 && index1 >= 0 && edge_axis[index0] != edge_axis[index1]) {
-                    // axes different, so probably safe to intersect
-                    QLineF l0(midpoints[index0], midpoints[index0] + axis_vectors[edge_axis[index0]]);
-                    QLineF l1(midpoints[index1], midpoints[index1] + axis_vectors[edge_axis[index1]]);
-                    if (l0.intersect(l1, &new_pos) == QLineF::NoIntersection) {
+            positions[w] = nodeJobs.at(w).positions;
+        }
+    } else {
+        // Get the positions of each unique node
+        QHash<Node *, QPointF> node_pos;
+        foreach (const AxisAlignWay &way, theWays)
+            for (int i = 0; i < way.nodes.size(); ++i)
+                node_pos[way.nodes.at(i)] = way.points.at(i);
+
+        // If nodes are repeated then they will be moved more than once, so we
+        // iterate and allow the nodes to converge to a point.
+        qreal last_movement = -1.0;
+        qreal movement = 0.0;
+        for (int it = 0; ; ++it) {
+            bool moved_far = false;
+            // Move nodes (only in node_pos) onto the intersection of the neighbouring
+            // edge's axes through their midpoints.
+            foreach (const AxisAlignWay &way, theWays) {
+                int max = way.closed ? way.nodes.size()-1 : way.nodes.size();
+                for (int j = 0; j < max; ++j) {
+                    int index0, index1;
+                    axisAlignNeighbours(way, j, index0, index1);
+                    Node *N = way.nodes.at(j);
+                    QPointF old_pos = node_pos[N];
+                    QPointF new_pos;
+                    QPointF mid;
+                    if (!axisAlignPlaceNode(edge_axis, midpoints, axis_vectors, index0, index1, old_pos, new_pos, mid)) {
                         theList->undo();
                         return AxisAlignSharpAngles;
                     }
-
-                    if (dups && !moved_far)
-                        mid = midpoints[index0];
-                } else {
-                    // Axes are the same so there's no intersection point. Just
-                    // project onto axis through average midpoint.
-                    int index = ((index0 >= 0) ? index0 : index1);
-                    QPointF midpoint = midpoints[index];
-                    if (index != index1 && index1 >= 0)
-                        midpoint = (midpoint + midpoints[index1]) / 2;
-                    QPointF rel_pos = old_pos - midpoint;
-                    QPointF dir = axis_vectors[edge_axis[index]];
-                    qreal dot = dir.x()*rel_pos.x() + dir.y()*rel_pos.y();
-                    new_pos = midpoint + dir*dot;
-
-                    if (dups && !moved_far)
-                        mid = midpoints[index];
-                }
-                if (dups) {
-                    // If we're iterating, only move the node half the distance
-                    // towards the new position, so that different edges can
-                    // compete with one another to move the node.
-                    new_pos = (new_pos + old_pos) / 2;
-
-                    // find how far the node has moved (squared to avoid a sqrt)
-                    QPointF delta = new_pos - old_pos;
-                    qreal moved_sq = delta.x()*delta.x() + delta.y()*delta.y();
-                    movement += moved_sq;
-
-                    // has the node moved "far"?
-                    if (!moved_far) {
-                        delta = new_pos - mid;
-                        qreal size_sq = delta.x()*delta.x() + delta.y()*delta.y();
-                        if (moved_sq > size_sq * AXIS_ALIGN_FAR_THRESHOLD)
-                            moved_far = true;
+                    if (dups) {
+                        // If we're iterating, only move the node half the distance
+                        // towards the new position, so that different edges can
+                        // compete with one another to move the node.
+                        new_pos = (new_pos + old_pos) / 2;
+
+                        // find how far the node has moved (squared to avoid a sqrt)
+                        QPointF delta = new_pos - old_pos;
+                        qreal moved_sq = delta.x()*delta.x() + delta.y()*delta.y();
+                        movement += moved_sq;
+
+                        // has the node moved "far"?
+                        if (!moved_far) {
+                            delta = new_pos - mid;
+                            qreal size_sq = delta.x()*delta.x() + delta.y()*delta.y();
+                            if (moved_sq > size_sq * AXIS_ALIGN_FAR_THRESHOLD)
+                                moved_far = true;
+                        }
                     }
+                    node_pos[N] = new_pos;
                 }
-                node_pos[N] = new_pos;
             }
-        }
 
-        // We're done when no nodes have moved very far.
-        if (!moved_far)
-            dups = false;
-        if (!dups || it >= AXIS_ALIGN_MAX_ITS)
-            break;
-        // Every so often check that the movement has decreased since last
-        // time. If it hasn't then it's likely that the ways are impossible to
-        // align.
-        if ((it & 0xf) == 0xf) {
-            if (last_movement >= 0.0 && movement >= last_movement)
+            // We're done when no nodes have moved very far.
+            if (!moved_far)
+                dups = false;
+            if (!dups || it >= AXIS_ALIGN_MAX_ITS)
                 break;
-            last_movement = movement;
-            movement = 0.0;
-        }
+            // Every so often check that the movement has decreased since last
+            // time. If it hasn't then it's likely that the ways are impossible to
+            // align.
+            if ((it & 0xf) == 0xf) {
+                if (last_movement >= 0.0 && movement >= last_movement)
+                    break;
+                last_movement = movement;
+                movement = 0.0;
+            }
 
-        // tweak midpoints
-        i = 0;
-        foreach (Way *theWay, theWays) {
-            Node *n2 = theWay->getNode(0);
-            QPointF p1;
-            QPointF p2 = node_pos[n2];
-            for (int j = 0; j < theWay->size()-1; ++j, ++i) {
-                n2 = theWay->getNode(j + 1);
-                p1 = p2;
-                p2 = node_pos[n2];
-                midpoints[i] = (p1 + p2) * 0.5;
+            // tweak midpoints
+            foreach (const AxisAlignWay &way, theWays) {
+                QPointF p1;
+                QPointF p2 = node_pos[way.nodes.at(0)];
+                for (int j = 0; j < way.nodes.size()-1; ++j) {
+                    p1 = p2;
+                    p2 = node_pos[way.nodes.at(j + 1)];
+                    midpoints[way.first + j] = (p1 + p2) * 0.5;
+                }
             }
         }
+        // dups is set to false when converged
+        if (dups) {
+            theList->undo();
+            return AxisAlignFail;
+        }
+        for (int w = 0; w < theWays.size(); ++w) {
+            positions[w].resize(theWays.at(w).nodes.size());
+            for (int i = 0; i < theWays.at(w).nodes.size(); ++i)
+                positions[w][i] = node_pos[theWays.at(w).nodes.at(i)];
+        }
     }
-    // dups is set to false when converged
-    if (dups) {
-        theList->undo();
-        return AxisAlignFail;
-    }
+
     // Commit the changes
-    foreach (Way *theWay, theWays) {
-        for (int i = 0; i < theWay->size(); ++i) {
-            Node *N = theWay->getNode(i);
-            theList->add(new MoveNodeCommand(N, proj.inverse2Coord(node_pos[N]), theDocument->getDirtyOrOriginLayer(N->layer())));
+    for (int w = 0; w < theWays.size(); ++w) {
+        const AxisAlignWay &way = theWays.at(w);
+        for (int i = 0; i < way.nodes.size(); ++i) {
+            Node *N = way.nodes.at(i);
+            theList->add(new MoveNodeCommand(N, proj.inverse2Coord(positions.at(w).at(i)), theDocument->getDirtyOrOriginLayer(N->layer())));
         }
     }
     return AxisAlignSuccess;
@@ -45,7 +45,8 @@ enum AxisAlignResult {
     AxisAlignSuccess,
     // failures:
     AxisAlignSharpAngles,
-    AxisAlignFail       // no convergence
+    AxisAlignFail,      // no convergence
+    AxisAlignCancelled  // by the user, while in progress
 };
 bool canAxisAlignRoads(PropertiesDock* theDock);
 unsigned int axisAlignGuessAxes(PropertiesDock* theDock, const Projection &proj, unsigned int max_axes);
@@ -43,28 +43,61 @@ QHash< quint32, QList<quint32> > tagList;
 QStringList userList;
 QString noUser;
 
-QPair<quint32, quint32> g_addToTagList(QString k, QString v)
+/* What TagSelector compares a value by, worked out once as the value is interned */
+struct TagValueInfo
+{
+    quint32 fold;
+    bool isNumber;
+    qreal number;
+};
+QVector<TagValueInfo> tagValueInfos;
+QHash<QString, quint32> tagFoldsHash;
+
+quint32 g_internTagKey(const QString& k)
 {
-    qint32 ik, iv;
+    QHash<QString, quint32>::const_iterator it = tagKeysHash.constFind(k);
+    if (it != tagKeysHash.constEnd())
+        return it.value();
+
+    tagKeys.append(k);
+    quint32 ik = tagKeys.size()-1;
+    tagKeysHash[k] = ik;
+    return ik;
+}
 
-    if (!tagKeysHash.contains(k)) {
-        tagKeys.append(k);
-        ik = tagKeys.size()-1;
-        tagKeysHash[k] = ik;
-    } else
-        ik = tagKeysHash.value(k);
+quint32 g_internTagValue(const QString& v)
+{
+    QHash<QString, quint32>::const_iterator it = tagValuesHash.constFind(v);
+    if (it != tagValuesHash.constEnd())
+        return it.value();
+
+    tagValues.append(v);
+    quint32 iv = tagValues.size()-1;
+    tagValuesHash[v] = iv;
+
+    TagValueInfo info;
+    QString folded = v.toCaseFolded();
+    it = tagFoldsHash.constFind(folded);
+    if (it != tagFoldsHash.constEnd())
+        info.fold = it.value();
+    else {
+        info.fold = tagFoldsHash.size();
+        tagFoldsHash.insert(folded, info.fold);
+    }
+    info.number = v.toDouble(&info.isNumber);
+    tagValueInfos.append(info);
+    return iv;
+}
 
-    if (!tagValuesHash.contains(v)) {
-        tagValues.append(v);
-        iv = tagValues.size()-1;
-        tagValuesHash[v] = iv;
-    } else
-        iv = tagValuesHash.value(v);
+QPair<quint32, quint32> g_addToTagList(QString k, QString v)
+{
+    quint32 ik = g_internTagKey(k);
+    quint32 iv = g_internTagValue(v);
 
     if (!k.isEmpty() && !v.isEmpty())
         tagList[ik].append(iv);
 
-    return qMakePair((quint32)ik, (quint32)iv);
+    return qMakePair(ik, iv);
 }
 
 void g_removeFromTagList(quint32 k, quint32 v)
@@ -107,12 +140,16 @@ const QString& g_getTagKey(int idx)
 
 quint32 g_getTagKeyIndex(const QString& s)
 {
-    return tagKeys.indexOf(s);
+    return tagKeysHash.value(s, (quint32)-1);
 }
 
 QStringList g_getTagKeyList()
 {
-    return tagKeys.toSet().toList();
+    // Not tagKeys: the selectors intern keys no feature has
+    QStringList res;
+    foreach (quint32 k, tagList.keys())
+        res << tagKeys.at(k);
+    return res;
 }
 
 QString g_getTagValue(int idx)
@@ -122,7 +159,19 @@ QString g_getTagValue(int idx)
 
 quint32 g_getTagValueIndex(const QString& s)
 {
-    return tagValues.indexOf(s);
+    return tagValuesHash.value(s, (quint32)-1);
+}
+
+quint32 g_getTagValueFold(quint32 idx)
+{
+    return tagValueInfos.at(idx).fold;
+}
+
+bool g_getTagValueNumber(quint32 idx, qreal& n)
+{
+    const TagValueInfo& info = tagValueInfos.at(idx);
+    n = info.number;
+    return info.isNumber;
 }
 
 quint32 g_setUser(const QString& u)
@@ -48,6 +48,12 @@ extern QStringList g_getTagKeyList();
 extern QString g_getTagValue(int idx);
 extern quint32 g_getTagValueIndex(const QString& s);
 extern QStringList g_getTagValueList(QString k) ;
+/* The index of the key or value, adding it without counting it as a tag in use */
+extern quint32 g_internTagKey(const QString& k);
+extern quint32 g_internTagValue(const QString& v);
+/* Values equal ignoring case share a fold; a value may also read as a number */
+extern quint32 g_getTagValueFold(quint32 idx);
+extern bool g_getTagValueNumber(quint32 idx, qreal& n);
 
 extern quint32 g_setUser(const QString& u);
 extern const QString& g_getUser(quint32 idx);
@@ -5,6 +5,8 @@
 #include "MapView.h"
 #include "MainWindow.h"
 #include "PropertiesDock.h"
+#include "FeaturesDock.h"
+#include "Painting.h"
 #include "Document.h"
 #include "ILayer.h"
 #include "LayerIterator.h"
@@ -14,6 +16,7 @@
 #include "Feature.h"
 #include "Interaction.h"
 #include "IPaintStyle.h"
+#include "MapCSSPaintstyle.h"
 #include "Projection.h"
 #include "qgps.h"
 #include "qgpsdevice.h"
@@ -40,6 +43,7 @@
 #define EQUATORIALRADIUS 6378137.0
 #define LAT_ANG_PER_M 1.0 / EQUATORIALRADIUS
 #define TEST_RFLAGS(x) p->ROptions.options.testFlag(x)
+#define SELECTION_MARGIN 16 /* pixels around the view in which the focus of nodes still shows */
 
 class MapViewPrivate
 {
@@ -55,6 +59,7 @@ public:
     qreal theVectorRotation;
     QList<Node*> theVirtualNodes;
     RendererOptions ROptions;
+    RenderSettings theSettings;
 
     Projection theProjection;
     Document* theDocument;
@@ -67,11 +72,22 @@ public:
 
     OsmRenderLayer* osmLayer;
 
+    /* What the selection overlay was drawn for */
+    bool SelectionUpToDate;
+    QTransform SelectionTransform;
+    uint SelectionKey;
+
+    /* The background and the visible image layers flattened, and what they were when it was */
+    QImage BackgroundComposite;
+    QList<qint64> BackgroundCompositeKey;
+
     MapViewPrivate()
       : PixelPerM(0.0), Viewport(WORLD_COORDBOX), theVectorRotation(0.0)
       , BackgroundOnlyPanZoom(false)
       , theDocument(0)
       , theInteraction(0)
+      , SelectionUpToDate(false)
+      , SelectionKey(0)
     {}
 };
 
@@ -79,7 +95,7 @@ public:
 
 MapView::MapView(QWidget* parent) :
     QWidget(parent), Main(dynamic_cast<MainWindow*>(parent)), StaticBackground(0)
-  , StaticWireframe(0), StaticTouchup(0)
+  , StaticWireframe(0), StaticTouchup(0), StaticSelection(0)
   , SelectionLocked(false),lockIcon(0)
   , p(new MapViewPrivate)
 {
@@ -144,6 +160,7 @@ MapView::~MapView()
     delete StaticBackground;
     delete StaticWireframe;
     delete StaticTouchup;
+    delete StaticSelection;
     delete p;
 }
 
@@ -167,6 +184,8 @@ Document *MapView::document()
 
 void MapView::invalidate(bool updateWireframe, bool updateOsmMap, bool updateBgMap)
 {
+    if (updateWireframe || updateOsmMap)
+        p->SelectionUpToDate = false;
     if (updateOsmMap) {
         if (!M_PREFS->getWireframeView()) {
             if (!TEST_RFLAGS(RendererOptions::Interacting))
@@ -276,21 +295,19 @@ void MapView::paintEvent(QPaintEvent * anEvent)
     QTime Start(QTime::currentTime());
 #endif
 
+    p->theSettings = RenderSettings::current();
+
     QPainter P;
     P.begin(this);
 
     updateStaticBackground();
+    updateBackgroundComposite();
 
-    P.drawPixmap(p->theVectorPanDelta, *StaticBackground);
-    P.save();
+    P.drawImage(0, 0, p->BackgroundComposite);
     QTransform AlignTransform;
-    for (LayerIterator<ImageMapLayer*> ImgIt(p->theDocument); !ImgIt.isEnd(); ++ImgIt) {
-        if (ImgIt.get()->isVisible()) {
-            ImgIt.get()->drawImage(&P);
+    for (LayerIterator<ImageMapLayer*> ImgIt(p->theDocument); !ImgIt.isEnd(); ++ImgIt)
+        if (ImgIt.get()->isVisible())
             AlignTransform = ImgIt.get()->getCurrentAlignmentTransform();
-        }
-    }
-    P.restore();
 
     if (!p->invalidRects.isEmpty()) {
         updateWireframe();
@@ -348,7 +365,16 @@ void MapView::paintEvent(QPaintEvent * anEvent)
         }
 #ifndef NDEBUG
         QTime Stop(QTime::currentTime());
-        Main->PaintTimeLabel->setText(tr("%1ms").arg(Start.msecsTo(Stop)));
+        Main->PaintTimeLabel->setText(tr("%1ms (prepare %2ms, draw %3ms)").arg(Start.msecsTo(Stop)).arg(p->osmLayer->prepareTime()).arg(p->osmLayer->drawTime()));
+        if (MapCSSPaintstyle* theSheet = p->theDocument->getStyleSheet()) {
+            MapCSSStatistics stats = theSheet->statistics();
+            theSheet->resetStatistics();
+            Main->PaintTimeLabel->setToolTip(tr("MapCSS: %1 style classes, %2 of %3 zoom bands cascaded; "
+                                                "since the last update %4 lookups, %5 cascades in %6ms")
+                                             .arg(stats.Classes).arg(stats.Cascaded).arg(stats.Bands)
+                                             .arg(stats.Lookups).arg(stats.Cascades).arg(stats.CascadeTime / 1000));
+        } else
+            Main->PaintTimeLabel->setToolTip(QString());
 #endif
     }
 #endif
@@ -544,7 +570,7 @@ void MapView::drawLatLonGrid(QPainter & P)
 }
 
 void MapView::drawFeaturesSync(QPainter & P) {
-    while (!p->osmLayer->isRenderingDone());
+    p->osmLayer->waitForRendering();
     p->osmLayer->drawImage(&P);
 }
 
@@ -586,6 +612,151 @@ void MapView::drawDownloadAreas(QPainter & P)
     P.restore();
 }
 
+static uint selectionKey(uint h, const QList<Feature*>& theFeatures)
+{
+    h = 31 * h + theFeatures.size();
+    foreach (Feature* F, theFeatures)
+        h = 31 * h + qHash(F);
+    return h;
+}
+
+void MapView::drawSelection(QPainter & P)
+{
+#ifndef _MOBILE
+    if (!Main)
+        return;
+
+    // The focus then follows the segment under the mouse; it is drawn as it always was
+    if (g_Merk_Segment_Mode) {
+        for (int i=0; i<Main->features()->highlightedSize(); ++i) {
+            Main->features()->highlighted(i)->buildPath(p->theProjection);
+            Main->features()->highlighted(i)->drawHighlight(P, this);
+        }
+        for (int i=0; i<Main->properties()->selectionSize(); ++i) {
+            Main->properties()->selection(i)->buildPath(p->theProjection);
+            Main->properties()->selection(i)->drawFocus(P, this);
+        }
+        for (int i=0; i<Main->properties()->highlightedSize(); ++i) {
+            Main->properties()->highlighted(i)->buildPath(p->theProjection);
+            Main->properties()->highlighted(i)->drawHighlight(P, this);
+        }
+        return;
+    }
+
+    uint key = selectionKey(0, Main->features()->highlighted());
+    key = selectionKey(key, Main->properties()->selection());
+    key = selectionKey(key, Main->properties()->highlighted());
+
+    if (!StaticSelection || StaticSelection->size() != size() || !p->SelectionUpToDate
+            || p->SelectionTransform != p->theTransform || p->SelectionKey != key) {
+        updateSelection();
+        p->SelectionUpToDate = true;
+        p->SelectionTransform = p->theTransform;
+        p->SelectionKey = key;
+    }
+    P.drawPixmap(0, 0, *StaticSelection);
+#else
+    Q_UNUSED(P);
+#endif
+}
+
+#ifndef _MOBILE
+void MapView::updateSelection()
+{
+    if (!StaticSelection || StaticSelection->size() != size()) {
+        delete StaticSelection;
+        StaticSelection = new QPixmap(size());
+    }
+    StaticSelection->fill(Qt::transparent);
+
+    CoordBox Visible(fromView(QPoint(-SELECTION_MARGIN, -SELECTION_MARGIN)),
+                     fromView(QPoint(width() + SELECTION_MARGIN, height() + SELECTION_MARGIN)));
+
+    QPainter P(StaticSelection);
+    P.setRenderHint(QPainter::Antialiasing);
+    P.setBrush(Qt::NoBrush);
+    QPen Highlight(M_PREFS->getHighlightColor(), M_PREFS->getHighlightWidth(), Qt::SolidLine);
+    drawSelectionBatch(P, Main->features()->highlighted(), Highlight, Visible);
+    drawSelectionBatch(P, Main->properties()->selection(), QPen(M_PREFS->getFocusColor(), M_PREFS->getFocusWidth(), Qt::SolidLine), Visible);
+    drawSelectionBatch(P, Main->properties()->highlighted(), Highlight, Visible);
+}
+
+/* As Feature::drawFocus for each feature, but with the ways, the nodes and the way nodes each
+   stroked at once. Features outside the view are left out, with their parents. */
+void MapView::drawSelectionBatch(QPainter& P, const QList<Feature*>& theFeatures, const QPen& aPen, const CoordBox& Visible)
+{
+    QPainterPath Ways, Nodes, ParentWays;
+    QPolygonF WayNodes;
+    QList<Feature*> Others;
+    QSet<Feature*> Parents;
+    bool showParents = M_PREFS->getShowParents();
+
+    foreach (Feature* F, theFeatures) {
+        if (Visible.disjunctFrom(F->boundingBox()))
+            continue;
+
+        F->buildPath(p->theProjection);
+        if (CHECK_WAY(F)) {
+            Way* W = STATIC_CAST_WAY(F);
+            Ways.addPath(W->getPath());
+            QPolygonF Pl;
+            buildPolygonFromRoad(W, p->theProjection, Pl);
+            WayNodes += Pl;
+        } else if (CHECK_NODE(F)) {
+            QPoint me(toView(STATIC_CAST_NODE(F)));
+            QRect R(me-QPoint(3,3),QSize(6,6));
+            Nodes.addRect(R);
+            R.adjust(-7, -7, 7, 7);
+            Nodes.addEllipse(R);
+        } else
+            Others << F;
+
+        if (showParents)
+            for (int i=0; i<F->sizeParents(); ++i)
+                if (!F->getParent(i)->isDeleted())
+                    if (Feature* Parent = CAST_FEATURE(F->getParent(i)))
+                        Parents.insert(Parent);
+    }
+
+    P.setPen(aPen);
+    P.drawPath(p->theTransform.map(Ways));
+
+    QPen NodePen(aPen);
+    NodePen.setWidth(NodePen.width() / 2);
+    P.setPen(NodePen);
+    P.drawPath(Nodes);
+
+    QPen WayNodePen(aPen);
+    WayNodePen.setWidth(WayNodePen.width()*3);
+    WayNodePen.setCapStyle(Qt::RoundCap);
+    P.setPen(WayNodePen);
+    P.drawPoints(p->theTransform.map(WayNodes));
+
+    foreach (Feature* F, Others) {
+        QPen TP(aPen);
+        P.setPen(TP);
+        F->drawSpecial(P, TP, this);
+        F->drawChildrenSpecial(P, TP, this, 1);
+    }
+
+    if (Parents.isEmpty())
+        return;
+    QPen ParentPen(aPen);
+    ParentPen.setDashPattern(M_PREFS->getParentDashes());
+    foreach (Feature* F, Parents) {
+        if (CHECK_WAY(F)) {
+            F->buildPath(p->theProjection);
+            ParentWays.addPath(STATIC_CAST_WAY(F)->getPath());
+        } else {
+            P.setPen(ParentPen);
+            F->drawSpecial(P, ParentPen, this);
+        }
+    }
+    P.setPen(ParentPen);
+    P.drawPath(p->theTransform.map(ParentWays));
+}
+#endif
+
 void MapView::updateStaticBackground()
 {
     if (!StaticBackground || (StaticBackground->size() != size()))
@@ -604,6 +775,32 @@ void MapView::updateStaticBackground()
     }
 }
 
+/* Image layers change their image as tiles arrive and the view pans or zooms; a repaint for
+   anything else (the cursor, the selection) blits the composite as it is. */
+void MapView::updateBackgroundComposite()
+{
+    QList<qint64> key;
+    key << StaticBackground->cacheKey() << p->theVectorPanDelta.x() << p->theVectorPanDelta.y();
+    for (LayerIterator<ImageMapLayer*> ImgIt(p->theDocument); !ImgIt.isEnd(); ++ImgIt) {
+        if (ImgIt.get()->isVisible())
+            key << qint64(quintptr(ImgIt.get())) << ImgIt.get()->imageKey() << qRound(ImgIt.get()->getAlpha() * 255);
+    }
+    if (p->BackgroundComposite.size() == size() && p->BackgroundCompositeKey == key)
+        return;
+
+    if (p->BackgroundComposite.size() != size())
+        p->BackgroundComposite = QImage(size(), QImage::Format_ARGB32_Premultiplied);
+    p->BackgroundComposite.fill(Qt::transparent);
+    QPainter P(&p->BackgroundComposite);
+    P.drawPixmap(p->theVectorPanDelta, *StaticBackground);
+    for (LayerIterator<ImageMapLayer*> ImgIt(p->theDocument); !ImgIt.isEnd(); ++ImgIt) {
+        if (ImgIt.get()->isVisible())
+            ImgIt.get()->drawImage(&P);
+    }
+    P.end();
+    p->BackgroundCompositeKey = key;
+}
+
 void MapView::updateWireframe()
 {
     QMap<RenderPriority, QSet <Feature*> > theFeatures;
@@ -613,7 +810,7 @@ void MapView::updateWireframe()
     QPainter P;
 
     for (int i=0; i<p->theDocument->layerSize(); ++i)
-        g_backend.getFeatureSet(p->theDocument->getLayer(i), theFeatures, p->invalidRects, p->theProjection);
+        g_backend.getFeatureSet(p->theDocument->getLayer(i), theFeatures, p->invalidRects, p->theProjection, p->theSettings);
 
     if (!p->theVectorPanDelta.isNull()) {
         QRegion exposed;
@@ -631,7 +828,7 @@ void MapView::updateWireframe()
     }
 
     if (M_PREFS->getWireframeView() || !p->osmLayer->isRenderingDone() || M_PREFS->getEditRendering() == 1) {
-        if (M_PREFS->getWireframeView() && M_PREFS->getUseAntiAlias())
+        if (M_PREFS->getWireframeView() && p->theSettings.UseAntiAlias)
             P.setRenderHint(QPainter::Antialiasing);
         else if (M_PREFS->getEditRendering() == 1)
             P.setRenderHint(QPainter::Antialiasing);
@@ -1138,6 +1335,11 @@ RendererOptions MapView::renderOptions()
     return p->ROptions;
 }
 
+const RenderSettings& MapView::renderSettings() const
+{
+    return p->theSettings;
+}
+
 void MapView::setRenderOptions(const RendererOptions &opt)
 {
     p->ROptions = opt;
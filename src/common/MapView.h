@@ -3,6 +3,7 @@
 
 #include "Projection.h"
 #include "IRenderer.h"
+#include "RenderSettings.h"
 
 #include <QPixmap>
 #include <QWidget>
@@ -42,6 +43,9 @@ public:
     void drawLatLonGrid(QPainter & painter);
     void drawDownloadAreas(QPainter & painter);
     void drawScale(QPainter & painter);
+    /* The focus of the selection and the highlights, from a cached overlay rebuilt only when
+       they, the viewport or the map change */
+    void drawSelection(QPainter & painter);
 
     void panScreen(QPoint delta) ;
     void rotateScreen(QPoint center, qreal angle);
@@ -88,6 +92,8 @@ public:
 
     RendererOptions renderOptions();
     void setRenderOptions(const RendererOptions& opt);
+    /* The preferences as they were when the current frame started */
+    const RenderSettings& renderSettings() const;
 
     void stopRendering();
     void resumeRendering();
@@ -101,12 +107,16 @@ public:
 private:
     void drawGPS(QPainter & painter);
     void updateStaticBackground();
+    void updateBackgroundComposite();
     void updateWireframe();
+    void updateSelection();
+    void drawSelectionBatch(QPainter& P, const QList<Feature*>& theFeatures, const QPen& aPen, const CoordBox& Visible);
 
     MainWindow* Main;
     QPixmap* StaticBackground;
     QPixmap* StaticWireframe;
     QPixmap* StaticTouchup;
+    QPixmap* StaticSelection;
     bool StaticMapUpToDate;
     bool SelectionLocked;
     QLabel* lockIcon;
@@ -9,6 +9,7 @@ HEADERS += Global.h \
     Painting.h \
     Projection.h \
     FeatureManipulations.h \
+    BulkGeometry.h \
     MapView.h \
     TagModel.h \
     GotoDialog.h \
@@ -21,6 +22,7 @@ SOURCES += Global.cpp \
     Painting.cpp \
     Projection.cpp \
     FeatureManipulations.cpp \
+    BulkGeometry.cpp \
     MapView.cpp \
     TagModel.cpp \
     GotoDialog.cpp \